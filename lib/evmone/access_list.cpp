@@ -0,0 +1,649 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "access_list.hpp"
+#include "analysis.hpp"
+#include "opcodes_helpers.h"
+#include <evmc/instructions.h>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+namespace evmone
+{
+namespace
+{
+/// The limit of distinct states explored at the block entry before they are joined.
+constexpr size_t max_states_per_block = 8;
+
+/// The limit of the instructions interpreted by the exploration.
+constexpr size_t max_steps = 1 << 20;
+
+/// The limit of the memory offsets tracked by the exploration.
+constexpr uint64_t max_buffer_offset = std::numeric_limits<uint32_t>::max();
+
+/// The limit of the SHA3 input size computed by the exploration.
+constexpr uint64_t max_sha3_size = 1024;
+
+/// The value on the abstract stack: the constant or the value not known statically.
+struct abstract_value
+{
+    uint256 value;
+    bool known = false;
+};
+
+inline bool operator==(const abstract_value& a, const abstract_value& b) noexcept
+{
+    return a.known == b.known && (!a.known || a.value == b.value);
+}
+
+inline abstract_value known(const uint256& value) noexcept
+{
+    return {value, true};
+}
+
+/// The abstract execution state at the block entry.
+struct abstract_state
+{
+    std::vector<abstract_value> stack;
+
+    /// The known 32-byte memory words by the memory offset.
+    /// The memory not covered by the words is not known.
+    std::map<uint64_t, uint256> memory;
+
+    bool operator==(const abstract_state& other) const noexcept
+    {
+        return stack == other.stack && memory == other.memory;
+    }
+};
+
+/// Joins the b into the a, the values differing become unknown.
+/// The stack heights must be equal. Returns true if the a has changed.
+bool join(abstract_state& a, const abstract_state& b) noexcept
+{
+    bool changed = false;
+    for (size_t i = 0; i < a.stack.size(); ++i)
+    {
+        if (a.stack[i].known && !(a.stack[i] == b.stack[i]))
+        {
+            a.stack[i].known = false;
+            changed = true;
+        }
+    }
+    for (auto it = a.memory.begin(); it != a.memory.end();)
+    {
+        const auto other = b.memory.find(it->first);
+        if (other == b.memory.end() || other->second != it->second)
+        {
+            it = a.memory.erase(it);
+            changed = true;
+        }
+        else
+            ++it;
+    }
+    return changed;
+}
+
+/// The states seen at the block entry: the distinct ones first, then the joined ones,
+/// one per stack height.
+struct block_states
+{
+    std::vector<abstract_state> seen;
+    std::unordered_map<size_t, abstract_state> joined;
+};
+
+/// Sorts the values and removes the duplicates.
+template <typename T>
+void sort_unique(std::vector<T>& values) noexcept
+{
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+}
+
+/// The exploration of the code paths with the abstract interpretation of the instructions
+/// of the analysis (without the superinstructions and with the code offsets).
+class explorer
+{
+    const code_analysis& m_analysis;
+    const uint8_t* const m_code;
+    const size_t m_code_size;
+    const op_table& m_op_tbl;
+    const char* const* const m_names;
+    const evmc_message* const m_msg;
+    access_list& m_list;
+
+    std::vector<std::pair<size_t, abstract_state>> m_worklist;
+    std::unordered_map<size_t, block_states> m_blocks;
+    size_t m_steps = 0;
+
+public:
+    explorer(const code_analysis& analysis, evmc_revision rev, const uint8_t* code,
+        size_t code_size, const evmc_message* msg, access_list& list) noexcept
+      : m_analysis{analysis},
+        m_code{code},
+        m_code_size{code_size},
+        m_op_tbl{get_op_table(rev)},
+        m_names{evmc_get_instruction_names_table(rev)},
+        m_msg{msg},
+        m_list{list}
+    {}
+
+    void run()
+    {
+        enqueue(0, {});
+        while (!m_worklist.empty())
+        {
+            auto [index, state] = std::move(m_worklist.back());
+            m_worklist.pop_back();
+            execute_block(index, std::move(state));
+        }
+    }
+
+private:
+    /// Adds the state at the block entry to be explored, unless already seen.
+    void enqueue(size_t index, abstract_state state)
+    {
+        auto& block = m_blocks[index];
+        if (std::find(block.seen.begin(), block.seen.end(), state) != block.seen.end())
+            return;
+
+        if (block.seen.size() < max_states_per_block)
+        {
+            block.seen.push_back(state);
+            m_worklist.emplace_back(index, std::move(state));
+            return;
+        }
+
+        // Too many distinct states (e.g. the loop counter), explore the joined state.
+        const auto height = state.stack.size();
+        const auto [it, inserted] = block.joined.try_emplace(height, std::move(state));
+        auto& joined = it->second;
+        if (inserted)
+        {
+            for (const auto& s : block.seen)
+            {
+                if (s.stack.size() == height)
+                    join(joined, s);
+            }
+        }
+        else if (!join(joined, state))
+            return;
+        m_worklist.emplace_back(index, joined);
+    }
+
+    /// Continues at the jump destination, the instruction index of the JUMPDEST or -1.
+    void jump(int64_t target, abstract_state state)
+    {
+        if (target >= 0)
+            enqueue(static_cast<size_t>(target), std::move(state));
+    }
+
+    /// Continues at the jump destination being the code offset.
+    void jump(const abstract_value& dst, abstract_state state)
+    {
+        if (!dst.known)
+        {
+            m_list.complete = false;
+            return;
+        }
+        if (dst.value < m_code_size)
+            jump(find_jumpdest(m_analysis, static_cast<int>(dst.value)), std::move(state));
+    }
+
+    void record_storage(const abstract_value& key, bool write)
+    {
+        auto& keys = write ? m_list.storage_writes : m_list.storage_reads;
+        if (key.known)
+            keys.push_back(intx::be::store<evmc::bytes32>(key.value));
+        else
+            (write ? m_list.unknown_storage_writes : m_list.unknown_storage_reads) = true;
+    }
+
+    void record_address(const abstract_value& address, bool call)
+    {
+        auto& addresses = call ? m_list.calls : m_list.accounts;
+        if (address.known)
+            addresses.push_back(intx::be::trunc<evmc::address>(address.value));
+        else
+            (call ? m_list.unknown_calls : m_list.unknown_accounts) = true;
+    }
+
+    /// Forgets the memory words overlapping the memory range modified by an instruction.
+    static void clobber(abstract_state& state, const abstract_value& offset,
+        const abstract_value& size) noexcept
+    {
+        auto& memory = state.memory;
+        if (!offset.known || !size.known || offset.value > max_buffer_offset ||
+            size.value > max_buffer_offset)
+        {
+            memory.clear();
+            return;
+        }
+        const auto begin = static_cast<uint64_t>(offset.value);
+        const auto end = begin + static_cast<uint64_t>(size.value);
+        if (begin == end)
+            return;
+        memory.erase(memory.lower_bound(begin >= 31 ? begin - 31 : 0), memory.lower_bound(end));
+    }
+
+    abstract_value sha3(const abstract_state& state, const abstract_value& offset,
+        const abstract_value& size) const noexcept
+    {
+        if (!offset.known || !size.known || offset.value > max_buffer_offset ||
+            size.value > max_sha3_size || (size.value % 32) != 0)
+            return {};
+
+        const auto begin = static_cast<uint64_t>(offset.value);
+        const auto num_words = static_cast<size_t>(size.value / 32);
+        uint8_t data[max_sha3_size];
+        for (size_t i = 0; i < num_words; ++i)
+        {
+            const auto word = state.memory.find(begin + i * 32);
+            if (word == state.memory.end())
+                return {};
+            intx::be::unsafe::store(&data[i * 32], word->second);
+        }
+        return known(intx::be::unsafe::load<uint256>(keccak256(data, num_words * 32).data()));
+    }
+
+    abstract_value calldataload(const abstract_value& offset) const noexcept
+    {
+        if (m_msg == nullptr || !offset.known)
+            return {};
+        if (offset.value >= m_msg->input_size)
+            return known(0);
+
+        const auto begin = static_cast<size_t>(offset.value);
+        uint8_t data[32]{};
+        std::copy_n(&m_msg->input_data[begin], std::min(size_t{32}, m_msg->input_size - begin),
+            data);
+        return known(intx::be::load<uint256>(data));
+    }
+
+    /// Folds the result of the binary operation of the constants, the a is the stack top.
+    static abstract_value fold(uint8_t opcode, const abstract_value& a, const abstract_value& b)
+    {
+        if (!a.known || !b.known)
+            return {};
+
+        const auto& x = a.value;
+        const auto& y = b.value;
+        switch (opcode)
+        {
+        case OP_ADD:
+            return known(x + y);
+        case OP_SUB:
+            return known(x - y);
+        case OP_MUL:
+            return known(x * y);
+        case OP_DIV:
+            return known(y != 0 ? x / y : 0);
+        case OP_MOD:
+            return known(y != 0 ? x % y : 0);
+        case OP_AND:
+            return known(x & y);
+        case OP_OR:
+            return known(x | y);
+        case OP_XOR:
+            return known(x ^ y);
+        case OP_EQ:
+            return known(x == y);
+        case OP_LT:
+            return known(x < y);
+        case OP_GT:
+            return known(x > y);
+        case OP_SHL:
+            return known(x < 256 ? y << static_cast<unsigned>(x) : 0);
+        case OP_SHR:
+            return known(x < 256 ? y >> static_cast<unsigned>(x) : 0);
+        default:
+            return {};
+        }
+    }
+
+    /// Interprets the instructions of the block starting with the BEGINBLOCK at the index.
+    void execute_block(size_t index, abstract_state state)
+    {
+        const auto& instrs = m_analysis.instrs;
+        const auto& block = instrs[index].arg.block;
+        const auto height = state.stack.size();
+        if (height < static_cast<size_t>(block.stack_req) ||
+            height + static_cast<size_t>(block.stack_max_growth) > evm_stack::limit)
+            return;  // The execution fails at the block start.
+
+        auto& stack = state.stack;
+        const auto pop = [&stack]() noexcept {
+            const auto v = stack.back();
+            stack.pop_back();
+            return v;
+        };
+
+        const auto beginblock_fn = m_op_tbl[OPX_BEGINBLOCK].fn;
+        const auto static_jump_fn = m_op_tbl[OPX_STATIC_JUMP].fn;
+        const auto static_jumpi_fn = m_op_tbl[OPX_STATIC_JUMPI].fn;
+
+        for (auto i = index + 1; i < instrs.size(); ++i)
+        {
+            if (++m_steps > max_steps)
+            {
+                m_list.complete = false;
+                m_worklist.clear();
+                return;
+            }
+
+            const auto& instr = instrs[i];
+            if (instr.fn == beginblock_fn)
+                return enqueue(i, std::move(state));
+
+            if (instr.fn == static_jump_fn)
+                return jump(instr.arg.number, std::move(state));
+
+            if (instr.fn == static_jumpi_fn)
+            {
+                const auto cond = pop();
+                if (cond.known && cond.value != 0)
+                    return jump(instr.arg.number, std::move(state));
+                if (!cond.known)
+                    jump(instr.arg.number, state);
+                continue;
+            }
+
+            const auto pc = static_cast<size_t>(m_analysis.code_offsets[i]);
+            if (pc >= m_code_size)
+                return;  // The final STOP.
+
+            const auto opcode = m_code[pc];
+            if (m_names[opcode] == nullptr)
+                return;  // Undefined instruction.
+
+            if (opcode >= OP_DUP1 && opcode <= OP_DUP16)
+            {
+                stack.push_back(stack[stack.size() - 1 - static_cast<size_t>(opcode - OP_DUP1)]);
+                continue;
+            }
+            if (opcode >= OP_SWAP1 && opcode <= OP_SWAP16)
+            {
+                std::swap(stack.back(),
+                    stack[stack.size() - 2 - static_cast<size_t>(opcode - OP_SWAP1)]);
+                continue;
+            }
+
+            switch (opcode)
+            {
+            case OP_STOP:
+            case OP_RETURN:
+            case OP_REVERT:
+            case OP_INVALID:
+                return;
+
+            case OP_SELFDESTRUCT:
+                record_address(pop(), false);
+                return;
+
+            case OP_JUMP:
+            {
+                // The destination is popped before the state is moved.
+                const auto dst = pop();
+                return jump(dst, std::move(state));
+            }
+
+            case OP_JUMPI:
+            {
+                const auto dst = pop();
+                const auto cond = pop();
+                if (cond.known && cond.value != 0)
+                    return jump(dst, std::move(state));
+                if (!cond.known)
+                    jump(dst, state);
+                break;
+            }
+
+            case ANY_SMALL_PUSH:
+            case ANY_LARGE_PUSH:
+            {
+                const auto push_size = static_cast<size_t>(opcode - OP_PUSH1) + 1;
+                uint256 value = 0;
+                for (size_t p = pc + 1; p <= pc + push_size; ++p)
+                    value = (value << 8) | (p < m_code_size ? m_code[p] : 0);
+                stack.push_back(known(value));
+                break;
+            }
+
+            case OP_POP:
+                stack.pop_back();
+                break;
+
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_MOD:
+            case OP_AND:
+            case OP_OR:
+            case OP_XOR:
+            case OP_EQ:
+            case OP_LT:
+            case OP_GT:
+            case OP_SHL:
+            case OP_SHR:
+            {
+                const auto a = pop();
+                const auto b = pop();
+                stack.push_back(fold(opcode, a, b));
+                break;
+            }
+
+            case OP_ISZERO:
+                if (stack.back().known)
+                    stack.back().value = stack.back().value == 0;
+                break;
+
+            case OP_NOT:
+                if (stack.back().known)
+                    stack.back().value = ~stack.back().value;
+                break;
+
+            case OP_PC:
+                stack.push_back(known(pc));
+                break;
+
+            case OP_CODESIZE:
+                stack.push_back(known(m_code_size));
+                break;
+
+            case OP_ADDRESS:
+                stack.push_back(
+                    m_msg ? known(intx::be::load<uint256>(m_msg->destination)) : abstract_value{});
+                break;
+
+            case OP_CALLER:
+                stack.push_back(
+                    m_msg ? known(intx::be::load<uint256>(m_msg->sender)) : abstract_value{});
+                break;
+
+            case OP_CALLVALUE:
+                stack.push_back(
+                    m_msg ? known(intx::be::load<uint256>(m_msg->value)) : abstract_value{});
+                break;
+
+            case OP_CALLDATASIZE:
+                stack.push_back(m_msg ? known(m_msg->input_size) : abstract_value{});
+                break;
+
+            case OP_CALLDATALOAD:
+                stack.back() = calldataload(stack.back());
+                break;
+
+            case OP_MLOAD:
+            {
+                auto& v = stack.back();
+                const auto word = v.known && v.value <= max_buffer_offset ?
+                                      state.memory.find(static_cast<uint64_t>(v.value)) :
+                                      state.memory.end();
+                v = word != state.memory.end() ? known(word->second) : abstract_value{};
+                break;
+            }
+
+            case OP_MSTORE:
+            {
+                const auto offset = pop();
+                const auto value = pop();
+                clobber(state, offset, known(32));
+                if (offset.known && value.known && offset.value <= max_buffer_offset)
+                    state.memory[static_cast<uint64_t>(offset.value)] = value.value;
+                break;
+            }
+
+            case OP_MSTORE8:
+            {
+                const auto offset = pop();
+                pop();
+                clobber(state, offset, known(1));
+                break;
+            }
+
+            case OP_SHA3:
+            {
+                const auto offset = pop();
+                const auto size = pop();
+                stack.push_back(sha3(state, offset, size));
+                break;
+            }
+
+            case OP_SLOAD:
+                record_storage(stack.back(), false);
+                stack.back() = {};
+                break;
+
+            case OP_SSTORE:
+                record_storage(pop(), true);
+                pop();
+                break;
+
+            case OP_BALANCE:
+            case OP_EXTCODESIZE:
+            case OP_EXTCODEHASH:
+                record_address(stack.back(), false);
+                stack.back() = {};
+                break;
+
+            case OP_EXTCODECOPY:
+            {
+                record_address(pop(), false);
+                const auto offset = pop();
+                pop();
+                const auto size = pop();
+                clobber(state, offset, size);
+                break;
+            }
+
+            case OP_CALLDATACOPY:
+            case OP_CODECOPY:
+            case OP_RETURNDATACOPY:
+            {
+                const auto offset = pop();
+                pop();
+                const auto size = pop();
+                clobber(state, offset, size);
+                break;
+            }
+
+            case OP_CALL:
+            case OP_CALLCODE:
+            case OP_DELEGATECALL:
+            case OP_STATICCALL:
+            {
+                pop();  // The gas.
+                record_address(pop(), true);
+                if (opcode == OP_CALL || opcode == OP_CALLCODE)
+                    pop();  // The value.
+                pop();      // The input.
+                pop();
+                const auto output_offset = pop();
+                const auto output_size = pop();
+                clobber(state, output_offset, output_size);
+                stack.emplace_back();
+                break;
+            }
+
+            case OP_CREATE:
+            case OP_CREATE2:
+                m_list.creates = true;
+                [[fallthrough]];
+
+            default:
+            {
+                // The result of any other instruction is not known.
+                const auto& info = m_op_tbl[opcode];
+                const auto num_results = info.stack_req + info.stack_change;
+                stack.resize(stack.size() - static_cast<size_t>(info.stack_req));
+                stack.resize(stack.size() + static_cast<size_t>(num_results));
+                break;
+            }
+            }
+        }
+    }
+};
+
+/// Formats the bytes as the hex string with the 0x prefix.
+std::string to_hex(const uint8_t* data, size_t size)
+{
+    static constexpr auto digits = "0123456789abcdef";
+    std::string hex = "0x";
+    for (size_t i = 0; i < size; ++i)
+    {
+        hex += digits[data[i] >> 4];
+        hex += digits[data[i] & 0xf];
+    }
+    return hex;
+}
+
+template <typename T>
+std::string to_json_array(const std::vector<T>& values)
+{
+    std::string json = "[";
+    for (const auto& v : values)
+    {
+        if (json.size() > 1)
+            json += ",";
+        json += "\"" + to_hex(v.bytes, sizeof(v.bytes)) + "\"";
+    }
+    return json + "]";
+}
+
+const char* to_json(bool b) noexcept
+{
+    return b ? "true" : "false";
+}
+}  // namespace
+
+access_list extract_access_list(
+    evmc_revision rev, const uint8_t* code, size_t code_size, const evmc_message* msg)
+{
+    const auto analysis = analyze(rev, code, code_size, ANALYSIS_CODE_OFFSETS);
+
+    access_list list;
+    explorer{analysis, rev, code, code_size, msg, list}.run();
+    sort_unique(list.storage_reads);
+    sort_unique(list.storage_writes);
+    sort_unique(list.accounts);
+    sort_unique(list.calls);
+    return list;
+}
+
+std::string format_access_list_json(const access_list& list)
+{
+    return std::string{"{\"storageReads\":"} + to_json_array(list.storage_reads) +
+           ",\"storageWrites\":" + to_json_array(list.storage_writes) +
+           ",\"accounts\":" + to_json_array(list.accounts) +
+           ",\"calls\":" + to_json_array(list.calls) +
+           ",\"unknownStorageReads\":" + to_json(list.unknown_storage_reads) +
+           ",\"unknownStorageWrites\":" + to_json(list.unknown_storage_writes) +
+           ",\"unknownAccounts\":" + to_json(list.unknown_accounts) +
+           ",\"unknownCalls\":" + to_json(list.unknown_calls) +
+           ",\"creates\":" + to_json(list.creates) + ",\"complete\":" + to_json(list.complete) +
+           "}";
+}
+}  // namespace evmone
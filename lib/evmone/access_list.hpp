@@ -0,0 +1,68 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include <evmc/evmc.hpp>
+#include <evmc/utils.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace evmone
+{
+/// The speculative access list of the code: the state the execution may access.
+///
+/// The lists are sorted and contain only the statically known keys and addresses.
+/// The accesses with the keys or addresses not known statically are indicated by the flags.
+struct access_list
+{
+    /// The storage keys of the executed account loaded by SLOAD.
+    std::vector<evmc::bytes32> storage_reads;
+
+    /// The storage keys of the executed account modified by SSTORE.
+    std::vector<evmc::bytes32> storage_writes;
+
+    /// The accounts accessed by BALANCE, EXTCODESIZE, EXTCODECOPY, EXTCODEHASH
+    /// or being the SELFDESTRUCT beneficiary.
+    std::vector<evmc::address> accounts;
+
+    /// The destinations of CALL, CALLCODE, DELEGATECALL and STATICCALL.
+    std::vector<evmc::address> calls;
+
+    bool unknown_storage_reads = false;
+    bool unknown_storage_writes = false;
+    bool unknown_accounts = false;
+    bool unknown_calls = false;
+
+    /// Any CREATE or CREATE2 is reachable.
+    bool creates = false;
+
+    /// All the reachable code has been explored. This is false if the destination
+    /// of a reachable jump is not known statically or the exploration limit has been reached,
+    /// then the lists may miss the accesses of the paths not explored.
+    bool complete = true;
+};
+
+/// Extracts the speculative access list of the code.
+///
+/// The code is analyzed with analyze() and all the paths reachable from the code start
+/// are explored with the abstract stack and memory. The constants are propagated through
+/// PUSH, DUP, SWAP, the arithmetic and bitwise instructions, MSTORE/MLOAD and SHA3,
+/// so e.g. the mapping slots with the constant keys are computed.
+/// Only the paths with the condition not known statically are followed both ways.
+///
+/// With the msg the ADDRESS, CALLER, CALLVALUE and the call data are known as well,
+/// narrowing the list to the given transaction, e.g. following only the function
+/// selected by the call data. Without the msg these are unknown and the list covers
+/// all the entry paths of the contract.
+///
+/// The list is speculative: the execution may access less (e.g. runs out of gas)
+/// and, if not complete or any of the "unknown" flags is set, more.
+EVMC_EXPORT access_list extract_access_list(evmc_revision rev, const uint8_t* code,
+    size_t code_size, const evmc_message* msg = nullptr);
+
+/// Formats the access list as a JSON object.
+EVMC_EXPORT std::string format_access_list_json(const access_list& list);
+}  // namespace evmone
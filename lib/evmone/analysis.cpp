@@ -3,8 +3,14 @@
 // Licensed under the Apache License, Version 2.0.
 
 #include "analysis.hpp"
+#include "jit.hpp"
+#include "lazy_analysis.hpp"
 #include "opcodes_helpers.h"
+#include "threaded.hpp"
+#include <algorithm>
 #include <cassert>
+#include <memory>
+#include <utility>
 
 namespace evmone
 {
@@ -28,8 +34,32 @@ struct block_analysis
     /// This is the place where the analysis data is going to be dumped.
     size_t begin_block_index = 0;
 
+    /// The bounds of the stack height at the block start known from the preceding blocks.
+    int min_height = 0;
+    int max_height = evm_stack::limit;
+
     explicit block_analysis(size_t index) noexcept : begin_block_index{index} {}
 
+    block_analysis(size_t index, int min, int max) noexcept
+      : begin_block_index{index}, min_height{min}, max_height{max}
+    {}
+
+    /// Checks if the stack requirements are met for all the stack heights within the bounds.
+    [[nodiscard]] bool is_stack_proven() const noexcept
+    {
+        return stack_req <= min_height && max_height + stack_max_growth <= evm_stack::limit;
+    }
+
+    /// The bounds of the stack height at the block end, after the checks at the block start.
+    [[nodiscard]] std::pair<int, int> exit_heights() const noexcept
+    {
+        const auto min = std::max(min_height, stack_req);
+        const auto max = std::min(max_height, evm_stack::limit - stack_max_growth);
+        if (min > max)  // The block always fails, so nothing follows.
+            return {0, evm_stack::limit};
+        return {min + stack_change, max + stack_change};
+    }
+
     /// Close the current block by producing compressed information about the block.
     [[nodiscard]] block_info close() const noexcept
     {
@@ -39,31 +69,734 @@ struct block_analysis
     }
 };
 
-code_analysis analyze(evmc_revision rev, const uint8_t* code, size_t code_size) noexcept
+/// The block closed by the full analysis with its outgoing edges,
+/// kept to propagate the stack heights along all of them (see propagate_stack_heights()).
+struct block_edges
+{
+    block_analysis block;
+
+    /// The code offset of the static jump destination, or -1 if there is no such jump.
+    int64_t jump_dst = -1;
+
+    /// Whenever the execution can continue to the following block.
+    bool falls_through = false;
+
+    /// The number of times the stack height bounds have been extended, 0 if not reached.
+    int num_updates = 0;
+};
+
+namespace
+{
+/// Builds the constant-time lookup structure for jumpdests:
+/// the dense map for smaller code or the bitmap with ranks for bigger code.
+/// The storage for the structure is already allocated, the content is uninitialized.
+void build_jumpdest_map(code_analysis& analysis) noexcept
+{
+    const auto num_jumpdests = analysis.jumpdest_offsets.size();
+
+    if (!analysis.jumpdest_map.empty())
+    {
+        std::uninitialized_fill_n(analysis.jumpdest_map.data(), analysis.jumpdest_map.size(), -1);
+        for (size_t i = 0; i < num_jumpdests; ++i)
+        {
+            const auto offset = static_cast<size_t>(analysis.jumpdest_offsets[i]);
+            analysis.jumpdest_map[offset] = analysis.jumpdest_targets[i];
+        }
+        return;
+    }
+
+    const auto num_words = analysis.jumpdest_bitmap.size();
+    std::uninitialized_fill_n(analysis.jumpdest_bitmap.data(), num_words, uint64_t{0});
+    for (size_t i = 0; i < num_jumpdests; ++i)
+    {
+        const auto offset = static_cast<size_t>(analysis.jumpdest_offsets[i]);
+        analysis.jumpdest_bitmap[offset / 64] |= uint64_t{1} << (offset % 64);
+    }
+
+    int32_t rank = 0;
+    for (size_t w = 0; w < num_words; ++w)
+    {
+        new (&analysis.jumpdest_rank[w]) int32_t{rank};
+        rank += popcount(analysis.jumpdest_bitmap[w]);
+    }
+}
+
+/// The rule fusing two consecutive instructions of a basic block into a superinstruction.
+///
+/// The rule matches an instruction with the opcode in [first_begin, first_end] followed by
+/// an instruction with the opcode in [second_begin, second_end]. The opcodes may also be
+/// intrinsic opcodes, e.g. the one of the static jump replacing PUSH + JUMPI.
+/// The superinstruction takes the place of the first instruction.
+struct fusion_rule
+{
+    int first_begin;
+    int first_end;
+    int second_begin;
+    int second_end;
+
+    /// The intrinsic opcode of the superinstruction.
+    int fused;
+
+    /// The first revision having all the fused instructions defined.
+    evmc_revision since;
+
+    /// The optional additional condition for the first instruction's argument.
+    bool (*match)(const instruction_argument& first) noexcept;
+
+    /// Computes the superinstruction's argument.
+    instruction_argument (*combine)(const instruction_argument& first,
+        const instruction_argument& second, int first_opcode, int second_opcode) noexcept;
+};
+
+bool is_address_mask(const instruction_argument& first) noexcept
+{
+    return *first.push_value == (intx::uint256{1} << 160) - 1;
+}
+
+instruction_argument keep_first(
+    const instruction_argument& first, const instruction_argument&, int, int) noexcept
+{
+    return first;
+}
+
+instruction_argument keep_second(
+    const instruction_argument&, const instruction_argument& second, int, int) noexcept
+{
+    return second;
+}
+
+instruction_argument dup_swap_arg(const instruction_argument&, const instruction_argument&,
+    int first_opcode, int second_opcode) noexcept
+{
+    instruction_argument arg;
+    arg.number = (first_opcode - OP_DUP1 + 1) | ((second_opcode - OP_SWAP1 + 1) << 8);
+    return arg;
+}
+
+instruction_argument swap_pop_arg(
+    const instruction_argument&, const instruction_argument&, int first_opcode, int) noexcept
+{
+    instruction_argument arg;
+    arg.number = first_opcode - OP_SWAP1 + 1;
+    return arg;
+}
+
+/// The fusion rules. To add a fusion, add the rule and the superinstruction to the op tables.
+/// Use test/internal_benchmarks/opcode_ngrams.py to find frequent sequences.
+constexpr fusion_rule fusion_rules[] = {
+    {OP_PUSH1, OP_PUSH8, OP_ADD, OP_ADD, OPX_PUSH_ADD, EVMC_FRONTIER, nullptr, keep_first},
+    {OP_PUSH1, OP_PUSH8, OP_SUB, OP_SUB, OPX_PUSH_SUB, EVMC_FRONTIER, nullptr, keep_first},
+    {OP_PUSH1, OP_PUSH8, OP_MUL, OP_MUL, OPX_PUSH_MUL, EVMC_FRONTIER, nullptr, keep_first},
+    {OP_PUSH1, OP_PUSH8, OP_AND, OP_AND, OPX_PUSH_AND, EVMC_FRONTIER, nullptr, keep_first},
+    {OP_PUSH1, OP_PUSH8, OP_OR, OP_OR, OPX_PUSH_OR, EVMC_FRONTIER, nullptr, keep_first},
+    {OP_PUSH1, OP_PUSH8, OP_EQ, OP_EQ, OPX_PUSH_EQ, EVMC_FRONTIER, nullptr, keep_first},
+    {OP_PUSH1, OP_PUSH8, OP_LT, OP_LT, OPX_PUSH_LT, EVMC_FRONTIER, nullptr, keep_first},
+    {OP_PUSH1, OP_PUSH8, OP_GT, OP_GT, OPX_PUSH_GT, EVMC_FRONTIER, nullptr, keep_first},
+    {OP_PUSH1, OP_PUSH8, OP_SHL, OP_SHL, OPX_PUSH_SHL, EVMC_CONSTANTINOPLE, nullptr, keep_first},
+    {OP_PUSH1, OP_PUSH8, OP_SHR, OP_SHR, OPX_PUSH_SHR, EVMC_CONSTANTINOPLE, nullptr, keep_first},
+    {OP_PUSH1, OP_PUSH8, OP_MLOAD, OP_MLOAD, OPX_PUSH_MLOAD, EVMC_FRONTIER, nullptr, keep_first},
+    {OP_PUSH1, OP_PUSH8, OP_MSTORE, OP_MSTORE, OPX_PUSH_MSTORE, EVMC_FRONTIER, nullptr,
+        keep_first},
+    {OP_PUSH20, OP_PUSH32, OP_AND, OP_AND, OPX_PUSH_ADDRESS_MASK_AND, EVMC_FRONTIER,
+        is_address_mask, keep_first},
+    {OP_DUP1, OP_DUP16, OP_SWAP1, OP_SWAP16, OPX_DUP_SWAP, EVMC_FRONTIER, nullptr, dup_swap_arg},
+    {OP_SWAP1, OP_SWAP16, OP_POP, OP_POP, OPX_SWAP_POP, EVMC_FRONTIER, nullptr, swap_pop_arg},
+    {OP_ISZERO, OP_ISZERO, OPX_STATIC_JUMPI, OPX_STATIC_JUMPI, OPX_ISZERO_STATIC_JUMPI,
+        EVMC_FRONTIER, nullptr, keep_second},
+};
+
+/// The map of opcodes which may be the second instruction of any fusion rule.
+/// This allows skipping the rules lookup for most of the instructions.
+constexpr auto fusion_second_opcodes = [] {
+    std::array<bool, op_table_size> map{};
+    for (const auto& rule : fusion_rules)
+    {
+        for (auto op = rule.second_begin; op <= rule.second_end; ++op)
+            map[static_cast<size_t>(op)] = true;
+    }
+    return map;
+}();
+
+/// Applies the fusion rules to the last instructions as long as any of the rules matches.
+/// The opcodes are the opcodes of the instructions.
+void fuse_last(std::vector<instruction>& instrs, std::vector<int>& opcodes,
+    std::vector<size_t>& static_jumps, evmc_revision rev, const op_table& op_tbl) noexcept
+{
+    while (instrs.size() >= 2 && fusion_second_opcodes[static_cast<size_t>(opcodes.back())])
+    {
+        const auto first_index = instrs.size() - 2;
+        const auto first_opcode = opcodes[first_index];
+        const auto second_opcode = opcodes.back();
+        auto& first = instrs[first_index];
+        const auto& second = instrs.back();
+
+        const auto rule = std::find_if(
+            std::begin(fusion_rules), std::end(fusion_rules), [&](const fusion_rule& r) noexcept {
+                return first_opcode >= r.first_begin && first_opcode <= r.first_end &&
+                       second_opcode >= r.second_begin && second_opcode <= r.second_end &&
+                       rev >= r.since && (r.match == nullptr || r.match(first.arg));
+            });
+        if (rule == std::end(fusion_rules))
+            return;
+
+        first.arg = rule->combine(first.arg, second.arg, first_opcode, second_opcode);
+        first.fn = op_tbl[static_cast<size_t>(rule->fused)].fn;
+        opcodes[first_index] = rule->fused;
+
+        // The fused static jump is still to be resolved, but at the new index.
+        if (!static_jumps.empty() && static_jumps.back() == instrs.size() - 1)
+            static_jumps.back() = first_index;
+
+        instrs.pop_back();
+        opcodes.pop_back();
+    }
+}
+
+/// The code size up to which the scratch space is kept for following analyses.
+constexpr size_t max_retained_scratch_code_size = 64 * 1024;
+
+/// The reusable scratch space of the analysis in a thread.
+///
+/// The analysis produces the results here first, because the sizes are not known upfront.
+/// Reusing the space avoids allocating and page-faulting big buffers for every analysis.
+struct analysis_scratch
+{
+    std::vector<instruction> instrs;
+    std::vector<intx::uint256> push_values;
+    std::vector<int32_t> jumpdest_offsets;
+    std::vector<int32_t> jumpdest_targets;
+
+    /// The indexes of OPX_STATIC_JUMP/OPX_STATIC_JUMPI instructions to be resolved.
+    std::vector<size_t> static_jumps;
+
+    /// The blocks of the full analysis with ANALYSIS_ELIDE_CHECKS.
+    std::vector<block_edges> blocks;
+
+    /// The opcodes of the instructions, needed by the fusion pass and for building the labels.
+    std::vector<int> opcodes;
+
+    /// The code offsets of the instructions, only with ANALYSIS_CODE_OFFSETS.
+    std::vector<int32_t> code_offsets;
+
+    /// The prefetch hints, only with ANALYSIS_PREFETCH_HINTS.
+    std::vector<prefetch_hints> prefetch_blocks;
+    std::vector<evmc::bytes32> prefetch_keys;
+    std::vector<evmc::address> prefetch_addresses;
+
+    void clear() noexcept
+    {
+        instrs.clear();
+        push_values.clear();
+        jumpdest_offsets.clear();
+        jumpdest_targets.clear();
+        static_jumps.clear();
+        blocks.clear();
+        opcodes.clear();
+        code_offsets.clear();
+        prefetch_blocks.clear();
+        prefetch_keys.clear();
+        prefetch_addresses.clear();
+    }
+};
+
+thread_local analysis_scratch scratch;
+
+/// The number of times the stack height bounds of a block are extended exactly.
+/// Then the bounds growing further (e.g. in the loop pushing to the stack) are extended
+/// up to the limits at once, so the propagation finishes after a few passes.
+constexpr int max_exact_updates = 2;
+
+/// Propagates the stack heights of the full analysis along all the edges between the blocks.
+///
+/// Without the dynamic jumps in the code, the fall-through edges and the static jumps
+/// to the JUMPDESTs are all the ways to enter a block. The stack height bounds of each block
+/// are then the union of the bounds at the exits of the reached predecessors,
+/// iterated over the blocks until nothing changes.
+void propagate_stack_heights(std::vector<block_edges>& blocks) noexcept
+{
+    const auto& jumpdest_offsets = scratch.jumpdest_offsets;
+    const auto& jumpdest_targets = scratch.jumpdest_targets;
+
+    // Extends the bounds of the block with the given ones. Returns true if changed.
+    const auto join = [](block_edges& b, std::pair<int, int> heights) noexcept {
+        auto& block = b.block;
+        const auto [min_height, max_height] = heights;
+        if (b.num_updates == 0)
+        {
+            block.min_height = min_height;
+            block.max_height = max_height;
+        }
+        else
+        {
+            if (min_height >= block.min_height && max_height <= block.max_height)
+                return false;
+
+            const auto widen = b.num_updates >= max_exact_updates;
+            if (min_height < block.min_height)
+                block.min_height = widen ? 0 : min_height;
+            if (max_height > block.max_height)
+                block.max_height = widen ? evm_stack::limit : max_height;
+        }
+        ++b.num_updates;
+        return true;
+    };
+
+    // Finds the block starting with the JUMPDEST at the offset, nullptr if not a JUMPDEST.
+    const auto find_block = [&](int64_t offset) noexcept -> block_edges* {
+        const auto it = std::lower_bound(jumpdest_offsets.begin(), jumpdest_offsets.end(), offset);
+        if (it == jumpdest_offsets.end() || *it != offset)
+            return nullptr;
+
+        const auto jumpdest_index = static_cast<size_t>(it - jumpdest_offsets.begin());
+        const auto begin_block_index = static_cast<size_t>(jumpdest_targets[jumpdest_index]);
+        return &*std::lower_bound(blocks.begin(), blocks.end(), begin_block_index,
+            [](const block_edges& b, size_t index) noexcept {
+                return b.block.begin_block_index < index;
+            });
+    };
+
+    for (auto& b : blocks)
+        b.num_updates = 0;
+
+    // The stack is empty at the code start.
+    join(blocks.front(), {0, 0});
+
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            const auto& b = blocks[i];
+            if (b.num_updates == 0)
+                continue;
+
+            const auto heights = b.block.exit_heights();
+            if (b.falls_through && i + 1 < blocks.size())
+                changed |= join(blocks[i + 1], heights);
+            if (const auto target = b.jump_dst >= 0 ? find_block(b.jump_dst) : nullptr)
+                changed |= join(*target, heights);
+        }
+    }
+
+    // The unreachable blocks are never executed, but keep the checks there nonetheless.
+    for (auto& b : blocks)
+    {
+        if (b.num_updates == 0)
+        {
+            b.block.min_height = 0;
+            b.block.max_height = evm_stack::limit;
+        }
+    }
+}
+
+/// Collects the prefetch hints of the basic block (see ANALYSIS_PREFETCH_HINTS).
+///
+/// The storage key or the address is statically known if it is pushed by the instruction
+/// directly before the one using it. For the calls the address is the second stack item,
+/// so the PUSH must be followed by GAS and the call.
+class prefetch_collector
+{
+    size_t m_keys_begin = 0;
+    size_t m_addresses_begin = 0;
+
+    /// The value of the recent PUSH.
+    evmc::bytes32 m_push_value{};
+
+    /// The number of instructions after the recent PUSH: 1 directly after it,
+    /// 2 after the following GAS, 0 if not applicable.
+    int m_push_distance = 0;
+
+    template <typename T>
+    static void add_unique(std::vector<T>& values, size_t begin, const T& value) noexcept
+    {
+        if (std::find(values.begin() + static_cast<std::ptrdiff_t>(begin), values.end(), value) ==
+            values.end())
+            values.push_back(value);
+    }
+
+    void add_address() noexcept
+    {
+        evmc::address address;
+        std::copy_n(&m_push_value.bytes[12], sizeof(address), address.bytes);
+        add_unique(scratch.prefetch_addresses, m_addresses_begin, address);
+    }
+
+public:
+    /// Starts the new block.
+    void begin_block() noexcept
+    {
+        m_keys_begin = scratch.prefetch_keys.size();
+        m_addresses_begin = scratch.prefetch_addresses.size();
+        m_push_distance = 0;
+    }
+
+    /// Records the instruction, the immediate is the code following the opcode.
+    void add(uint8_t opcode, const uint8_t* immediate, const uint8_t* code_end) noexcept
+    {
+        switch (opcode)
+        {
+        case OP_SLOAD:
+        case OP_SSTORE:
+            if (m_push_distance == 1)
+                add_unique(scratch.prefetch_keys, m_keys_begin, m_push_value);
+            break;
+
+        case OP_BALANCE:
+        case OP_EXTCODESIZE:
+        case OP_EXTCODECOPY:
+        case OP_EXTCODEHASH:
+            if (m_push_distance == 1)
+                add_address();
+            break;
+
+        case OP_CALL:
+        case OP_CALLCODE:
+        case OP_DELEGATECALL:
+        case OP_STATICCALL:
+            if (m_push_distance == 2)
+                add_address();
+            break;
+        }
+
+        if (opcode >= OP_PUSH1 && opcode <= OP_PUSH32)
+        {
+            // The missing bytes of the PUSH at the end of the code are zeros.
+            const auto push_size = static_cast<size_t>(opcode - OP_PUSH1) + 1;
+            const auto available = std::min(push_size, static_cast<size_t>(code_end - immediate));
+            m_push_value = {};
+            std::copy_n(immediate, available, &m_push_value.bytes[32 - push_size]);
+            m_push_distance = 1;
+        }
+        else if (opcode == OP_GAS && m_push_distance == 1)
+            m_push_distance = 2;
+        else
+            m_push_distance = 0;
+    }
+
+    /// Ends the block starting with the BEGINBLOCK at the given index.
+    void end_block(size_t block_index) const noexcept
+    {
+        const auto num_keys = scratch.prefetch_keys.size() - m_keys_begin;
+        const auto num_addresses = scratch.prefetch_addresses.size() - m_addresses_begin;
+        if (num_keys == 0 && num_addresses == 0)
+            return;
+
+        scratch.prefetch_blocks.push_back({static_cast<uint32_t>(block_index),
+            static_cast<uint32_t>(m_keys_begin), static_cast<uint32_t>(num_keys),
+            static_cast<uint32_t>(m_addresses_begin), static_cast<uint32_t>(num_addresses)});
+    }
+};
+
+/// Collects the precharged instructions of the basic block (see ANALYSIS_PRECHARGE).
+///
+/// The top stack items pushed in the block are tracked through the PUSHes, DUPs and SWAPs,
+/// the items produced by other instructions are unknown. The memory and dynamic gas
+/// instructions having all the operands determining the costs known are precharged.
+class precharge_collector
+{
+    static constexpr auto unknown = std::numeric_limits<uint64_t>::max();
+
+    /// The limit of the memory end of the precharged instructions.
+    /// The instructions beyond it run out of gas anyway, so they are left to do it themselves.
+    static constexpr uint64_t max_memory_end = std::numeric_limits<uint32_t>::max();
+
+    /// The limit of the block base gas cost including the precharged dynamic costs.
+    static constexpr int64_t max_gas_cost = std::numeric_limits<int32_t>::max();
+
+    /// The values of the tracked top stack items, the top first.
+    std::array<uint64_t, 4> m_items{};
+    size_t m_num_items = 0;
+
+    uint64_t m_memory_end = 0;
+
+    /// The flag set after the instruction preventing precharging the following ones.
+    bool m_stopped = false;
+
+    [[nodiscard]] uint64_t item(size_t index) const noexcept
+    {
+        return index < m_num_items ? m_items[index] : unknown;
+    }
+
+    void push(uint64_t value) noexcept
+    {
+        std::copy_backward(m_items.begin(), m_items.end() - 1, m_items.end());
+        m_items[0] = value;
+        m_num_items = std::min(m_num_items + 1, m_items.size());
+    }
+
+    void pop(size_t n) noexcept
+    {
+        n = std::min(n, m_num_items);
+        std::copy(m_items.begin() + static_cast<std::ptrdiff_t>(n), m_items.end(), m_items.begin());
+        m_num_items -= n;
+    }
+
+    /// Checks if the memory area accessed by the instruction is known and within limits.
+    /// The offset does not matter for the empty area.
+    static bool is_known_memory(uint64_t offset, uint64_t size) noexcept
+    {
+        if (size == 0)
+            return true;
+        return offset <= max_memory_end && size <= max_memory_end - offset;
+    }
+
+    static int64_t num_words(uint64_t size) noexcept
+    {
+        return size != unknown ? static_cast<int64_t>((size + 31) / 32) : 0;
+    }
+
+    /// Returns the precharged opcode of the instruction, adding its dynamic cost to the gas cost.
+    /// Returns 0 if the instruction cannot be precharged.
+    int precharge(evmc_revision rev, uint8_t opcode, int64_t& gas_cost) noexcept
+    {
+        int precharged = 0;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        int64_t cost = 0;
+        switch (opcode)
+        {
+        case OP_MLOAD:
+        case OP_MSTORE:
+        case OP_MSTORE8:
+            precharged = opcode == OP_MLOAD ?
+                             OPX_PRECHARGED_MLOAD :
+                             (opcode == OP_MSTORE ? OPX_PRECHARGED_MSTORE : OPX_PRECHARGED_MSTORE8);
+            offset = item(0);
+            size = opcode == OP_MSTORE8 ? 1 : 32;
+            break;
+
+        case OP_SHA3:
+            precharged = OPX_PRECHARGED_SHA3;
+            offset = item(0);
+            size = item(1);
+            cost = num_words(size) * 6;
+            break;
+
+        case OP_CALLDATACOPY:
+        case OP_CODECOPY:
+            precharged = opcode == OP_CALLDATACOPY ? OPX_PRECHARGED_CALLDATACOPY :
+                                                     OPX_PRECHARGED_CODECOPY;
+            offset = item(0);
+            size = item(2);
+            cost = num_words(size) * 3;
+            break;
+
+        case OP_EXP:
+        {
+            const auto exponent = item(1);
+            if (exponent == unknown)
+                return 0;
+            int exponent_significant_bytes = 0;
+            for (auto e = exponent; e != 0; e >>= 8)
+                ++exponent_significant_bytes;
+            precharged = OPX_PRECHARGED_EXP;
+            cost = exponent_significant_bytes * (rev >= EVMC_SPURIOUS_DRAGON ? 50 : 10);
+            break;
+        }
+
+        default:
+            return 0;
+        }
+
+        // The block base gas cost is clamped to 32 bits, so keep it far from the limit.
+        if (!is_known_memory(offset, size) || gas_cost + cost > max_gas_cost)
+            return 0;
+        m_memory_end = std::max(m_memory_end, size != 0 ? offset + size : 0);
+        gas_cost += cost;
+        return precharged;
+    }
+
+public:
+    /// Starts the new block.
+    void begin_block() noexcept
+    {
+        m_num_items = 0;
+        m_memory_end = 0;
+        m_stopped = false;
+    }
+
+    /// Records the instruction, the immediate is the code following the opcode.
+    /// Returns the intrinsic opcode of the precharged instruction replacing it or 0.
+    /// The dynamic cost of the precharged instruction is added to the gas cost of the block.
+    int add(evmc_revision rev, const op_table& op_tbl, uint8_t opcode, const uint8_t* immediate,
+        const uint8_t* code_end, int64_t& gas_cost) noexcept
+    {
+        switch (opcode)
+        {
+        // The instructions observing the gas left or the memory size: the precharging
+        // of the following instructions would change the results.
+        case OP_GAS:
+        case OP_MSIZE:
+        case OP_CALL:
+        case OP_CALLCODE:
+        case OP_DELEGATECALL:
+        case OP_STATICCALL:
+        case OP_CREATE:
+        case OP_CREATE2:
+        case OP_SSTORE:
+        // The instructions failing other than by running out of gas: the precharging
+        // of the following instructions could change the status code.
+        case OP_RETURNDATACOPY:
+        case OP_LOG0:
+        case OP_LOG1:
+        case OP_LOG2:
+        case OP_LOG3:
+        case OP_LOG4:
+            m_stopped = true;
+            break;
+        }
+        if (op_tbl[opcode].fn == op_tbl[OP_INVALID].fn)
+            m_stopped = true;
+        if (m_stopped)
+            return 0;
+
+        const auto precharged = precharge(rev, opcode, gas_cost);
+
+        if (opcode >= OP_PUSH1 && opcode <= OP_PUSH8)
+        {
+            // The missing bytes of the PUSH at the end of the code are zeros.
+            const auto push_size = static_cast<size_t>(opcode - OP_PUSH1) + 1;
+            const auto available = std::min(push_size, static_cast<size_t>(code_end - immediate));
+            uint64_t value = 0;
+            for (size_t i = 0; i < push_size; ++i)
+                value = (value << 8) | (i < available ? immediate[i] : 0);
+            push(value);
+        }
+        else if (opcode >= OP_DUP1 && opcode <= OP_DUP16)
+            push(item(static_cast<size_t>(opcode - OP_DUP1)));
+        else if (opcode >= OP_SWAP1 && opcode <= OP_SWAP16)
+        {
+            const auto index = static_cast<size_t>(opcode - OP_SWAP1) + 1;
+            if (index < m_num_items)
+                std::swap(m_items[0], m_items[index]);
+            else if (m_num_items != 0)
+                m_items[0] = unknown;
+        }
+        else
+        {
+            const auto& info = op_tbl[opcode];
+            pop(static_cast<size_t>(info.stack_req));
+            for (auto i = 0; i < info.stack_req + info.stack_change; ++i)
+                push(unknown);
+        }
+        return precharged;
+    }
+
+    /// The highest memory end of the precharged instructions of the block, 0 if none.
+    [[nodiscard]] uint64_t memory_end() const noexcept { return m_memory_end; }
+};
+
+/// Computes the layout of the arrays in the code_analysis arena.
+class arena_layout
+{
+    size_t m_size = 0;
+
+public:
+    /// Places the array of count objects of type T after the previous ones.
+    /// Returns the offset of the array. Empty arrays take no space, not even for the padding.
+    template <typename T>
+    size_t add(size_t count) noexcept
+    {
+        if (count == 0)
+            return m_size;
+        const auto offset = (m_size + alignof(T) - 1) / alignof(T) * alignof(T);
+        m_size = offset + count * sizeof(T);
+        return offset;
+    }
+
+    [[nodiscard]] size_t size() const noexcept { return m_size; }
+};
+
+template <typename T>
+span<T> make_span(uint8_t* arena, size_t offset, size_t count) noexcept
+{
+    return {reinterpret_cast<T*>(arena + offset), count};
+}
+
+/// Builds the instructions of the code starting at the begin offset into the scratch.
+///
+/// For the lazy analysis (the lazy not null) only the segment of the code reachable from
+/// the begin offset without jumps is built: the building stops after the terminator
+/// not being JUMPI or at the JUMPDEST already analyzed (see lazy_continue).
+void build_instructions(evmc_revision rev, const uint8_t* code, size_t code_size, size_t begin,
+    bool fusion, bool track_opcodes, bool track_code_offsets, bool track_prefetch,
+    bool precharge_enabled, bool elide_checks, const lazy_analysis* lazy) noexcept
 {
     const auto& op_tbl = get_op_table(rev);
     const auto opx_beginblock_fn = op_tbl[OPX_BEGINBLOCK].fn;
+    auto& instrs = scratch.instrs;
+    auto& static_jumps = scratch.static_jumps;
+    auto& opcodes = scratch.opcodes;
+    auto& code_offsets = scratch.code_offsets;
 
-    code_analysis analysis;
+    // Create first block. The stack is empty at the code start, unless jumped to.
+    instrs.emplace_back(opx_beginblock_fn);
+    const auto first_is_jumpdest = begin != code_size && code[begin] == OP_JUMPDEST;
+    auto block = begin == 0 && !first_is_jumpdest ? block_analysis{0, 0, 0} : block_analysis{0};
+    if (track_code_offsets)
+        code_offsets.push_back(static_cast<int32_t>(begin));
+    prefetch_collector prefetch;
+    if (track_prefetch)
+        prefetch.begin_block();
+    precharge_collector precharge;
+    if (precharge_enabled)
+        precharge.begin_block();
 
-    const auto max_instrs_size = code_size + 1;
-    analysis.instrs.reserve(max_instrs_size);
+    // Replaces the BEGINBLOCK of the block being closed if the stack checks are not needed.
+    const auto elide_stack_checks = [&](const block_analysis& b) noexcept {
+        if (!b.is_stack_proven())
+            return;
 
-    // This is 2x more than needed but using (code_size / 2 + 1) increases page-faults 1000x.
-    const auto max_args_storage_size = code_size + 1;
-    analysis.push_values.reserve(max_args_storage_size);
+        instrs[b.begin_block_index].fn = op_tbl[OPX_BEGINBLOCK_GAS].fn;
+        if (track_opcodes)
+        {
+            opcodes.resize(instrs.size(), OPX_BEGINBLOCK);
+            opcodes[b.begin_block_index] = OPX_BEGINBLOCK_GAS;
+        }
+    };
+
+    // Injects the OPX_PRECHARGE_MEMORY after the BEGINBLOCK of the block being closed.
+    const auto inject_precharge_memory = [&](const block_analysis& b) noexcept {
+        const auto memory_end = precharge.memory_end();
+        if (memory_end == 0)
+            return;
+
+        const auto index = b.begin_block_index + 1;
+        auto& injected = *instrs.emplace(instrs.begin() + static_cast<std::ptrdiff_t>(index),
+            op_tbl[OPX_PRECHARGE_MEMORY].fn);
+        injected.arg.number = static_cast<int64_t>(memory_end);
+        if (track_opcodes)
+        {
+            opcodes.insert(
+                opcodes.begin() + static_cast<std::ptrdiff_t>(index), OPX_PRECHARGE_MEMORY);
+        }
+        if (track_code_offsets)
+        {
+            code_offsets.insert(code_offsets.begin() + static_cast<std::ptrdiff_t>(index),
+                code_offsets[b.begin_block_index]);
+        }
 
-    // Create first block.
-    analysis.instrs.emplace_back(opx_beginblock_fn);
-    auto block = block_analysis{0};
+        // Only the static jump terminating the block can be after the injected instruction.
+        if (!static_jumps.empty() && static_jumps.back() >= index)
+            ++static_jumps.back();
+    };
 
     const auto code_end = code + code_size;
-    auto code_pos = code;
+    auto code_pos = code + begin;
+
+    // The flag whenever the previous instruction was the small PUSH in the same block.
+    bool after_small_push = false;
+
+    // The flag whenever the code has JUMPs or JUMPIs with the destinations not known statically.
+    bool has_dynamic_jumps = false;
 
     while (code_pos != code_end)
     {
+        const auto offset = static_cast<int32_t>(code_pos - code);
         const auto opcode = *code_pos++;
         const auto& opcode_info = op_tbl[opcode];
+        int instr_opcode = opcode;
+        int64_t jump_dst = -1;  // The destination of the static jump.
 
         block.stack_req = std::max(block.stack_req, opcode_info.stack_req - block.stack_change);
         block.stack_change += opcode_info.stack_change;
@@ -71,18 +804,39 @@ code_analysis analyze(evmc_revision rev, const uint8_t* code, size_t code_size)
 
         block.gas_cost += opcode_info.gas_cost;
 
+        if (track_prefetch)
+            prefetch.add(opcode, code_pos, code_end);
+        const auto precharged_opcode =
+            precharge_enabled ?
+                precharge.add(rev, op_tbl, opcode, code_pos, code_end, block.gas_cost) :
+                0;
+
         if (opcode == OP_JUMPDEST)
         {
             // The JUMPDEST is always the first instruction in the block.
             // We don't have to insert anything to the instruction table.
-            analysis.jumpdest_offsets.emplace_back(static_cast<int32_t>(code_pos - code - 1));
-            analysis.jumpdest_targets.emplace_back(
-                static_cast<int32_t>(analysis.instrs.size() - 1));
+            scratch.jumpdest_offsets.emplace_back(static_cast<int32_t>(code_pos - code - 1));
+            scratch.jumpdest_targets.emplace_back(static_cast<int32_t>(instrs.size() - 1));
+        }
+        else if ((opcode == OP_JUMP || opcode == OP_JUMPI) && after_small_push)
+        {
+            // Replace the PUSH with the static jump. The push value (the jump destination)
+            // is kept in the argument until resolved.
+            instr_opcode = opcode == OP_JUMP ? OPX_STATIC_JUMP : OPX_STATIC_JUMPI;
+            instrs.back().fn = op_tbl[static_cast<size_t>(instr_opcode)].fn;
+            static_jumps.emplace_back(instrs.size() - 1);
+            const auto dst = instrs.back().arg.small_push_value;
+            jump_dst = dst < code_size ? static_cast<int64_t>(dst) : -1;
         }
         else
-            analysis.instrs.emplace_back(opcode_info.fn);
+        {
+            if (opcode == OP_JUMP || opcode == OP_JUMPI)
+                has_dynamic_jumps = true;
+            instrs.emplace_back(opcode_info.fn);
+        }
 
-        auto& instr = analysis.instrs.back();
+        auto& instr = instrs.back();
+        after_small_push = false;
 
         bool is_terminator = false;  // A flag whenever this is a block terminating instruction.
         switch (opcode)
@@ -109,6 +863,7 @@ code_analysis analyze(evmc_revision rev, const uint8_t* code, size_t code_size)
                 insert_bit_pos -= 8;
             }
             instr.arg.small_push_value = value;
+            after_small_push = true;
             break;
         }
 
@@ -117,7 +872,7 @@ code_analysis analyze(evmc_revision rev, const uint8_t* code, size_t code_size)
             const auto push_size = static_cast<size_t>(opcode - OP_PUSH1) + 1;
             const auto push_end = code_pos + push_size;
 
-            auto& push_value = analysis.push_values.emplace_back();
+            auto& push_value = scratch.push_values.emplace_back();
             // TODO: Add as_bytes() helper to intx.
             const auto push_value_bytes = reinterpret_cast<uint8_t*>(intx::as_words(push_value));
             auto insert_pos = &push_value_bytes[push_size - 1];
@@ -154,31 +909,383 @@ code_analysis analyze(evmc_revision rev, const uint8_t* code, size_t code_size)
             break;
         }
 
+        if (track_opcodes && opcode != OP_JUMPDEST)
+        {
+            // The instructions not recorded are the BEGINBLOCKs injected at block starts.
+            // The static jump replaces the recorded PUSH.
+            opcodes.resize(instrs.size() - 1, OPX_BEGINBLOCK);
+            opcodes.push_back(instr_opcode);
+            if (fusion)
+                fuse_last(instrs, opcodes, static_jumps, rev, op_tbl);
+        }
+
+        if (precharged_opcode != 0)
+        {
+            // The superinstruction of the PUSH and the precharged instruction
+            // has its own precharged variant.
+            auto precharged = precharged_opcode;
+            if (instrs.back().fn == op_tbl[OPX_PUSH_MLOAD].fn)
+                precharged = OPX_PRECHARGED_PUSH_MLOAD;
+            else if (instrs.back().fn == op_tbl[OPX_PUSH_MSTORE].fn)
+                precharged = OPX_PRECHARGED_PUSH_MSTORE;
+            instrs.back().fn = op_tbl[static_cast<size_t>(precharged)].fn;
+            if (track_opcodes)
+                opcodes.back() = precharged;
+        }
+
+        // The new instruction (if any) is from this offset. The static jump or
+        // the superinstruction keeps the offset of the first instruction it replaces.
+        if (track_code_offsets)
+            code_offsets.resize(instrs.size(), offset);
+
         // If this is a terminating instruction or the next instruction is a JUMPDEST.
-        if (is_terminator || (code_pos != code_end && *code_pos == OP_JUMPDEST))
+        const auto next_is_jumpdest = code_pos != code_end && *code_pos == OP_JUMPDEST;
+        if (is_terminator || next_is_jumpdest)
         {
             // Save current block.
-            analysis.instrs[block.begin_block_index].arg.block = block.close();
+            instrs[block.begin_block_index].arg.block = block.close();
+            if (track_prefetch)
+                prefetch.end_block(block.begin_block_index);
+            if (elide_checks && lazy != nullptr)
+                elide_stack_checks(block);
+            else if (elide_checks)
+                scratch.blocks.push_back({block, jump_dst, !is_terminator || opcode == OP_JUMPI});
+            if (precharge_enabled)
+                inject_precharge_memory(block);
+
+            if (lazy != nullptr)
+            {
+                // The code after the terminator not being JUMPI is reachable only by jumps.
+                if (is_terminator && opcode != OP_JUMPI)
+                    return;
 
-            // Create new block.
-            analysis.instrs.emplace_back(opx_beginblock_fn);
-            block = block_analysis{analysis.instrs.size() - 1};
+                // Continue in the already analyzed segment.
+                const auto next_offset = static_cast<size_t>(code_pos - code);
+                if (next_is_jumpdest && lazy->is_analyzed(next_offset))
+                {
+                    instrs.emplace_back(lazy_continue).arg.number =
+                        static_cast<int64_t>(next_offset);
+                    return;
+                }
+            }
+
+            // Create new block. The block not starting with the JUMPDEST is entered only
+            // by the fall-through from the current block (or is unreachable).
+            instrs.emplace_back(opx_beginblock_fn);
+            const auto [min_height, max_height] = block.exit_heights();
+            block = next_is_jumpdest ? block_analysis{instrs.size() - 1} :
+                                       block_analysis{instrs.size() - 1, min_height, max_height};
+            if (track_code_offsets)
+                code_offsets.push_back(static_cast<int32_t>(code_pos - code));
+            if (track_prefetch)
+                prefetch.begin_block();
+            if (precharge_enabled)
+                precharge.begin_block();
         }
     }
 
     // Save current block.
-    analysis.instrs[block.begin_block_index].arg.block = block.close();
+    instrs[block.begin_block_index].arg.block = block.close();
+    if (track_prefetch)
+        prefetch.end_block(block.begin_block_index);
+    if (elide_checks && lazy != nullptr)
+        elide_stack_checks(block);
+    else if (elide_checks)
+        scratch.blocks.push_back({block, -1, false});
+    if (precharge_enabled)
+        inject_precharge_memory(block);
+
+    if (elide_checks && lazy == nullptr)
+    {
+        // A dynamic jump may enter any block starting with the JUMPDEST, so then only
+        // the bounds propagated along the fall-through edges during the building are kept.
+        if (!has_dynamic_jumps)
+            propagate_stack_heights(scratch.blocks);
+        for (const auto& b : scratch.blocks)
+            elide_stack_checks(b.block);
+    }
 
     // Make sure the last block is terminated.
     // TODO: This is not needed if the last instruction is a terminating one.
-    analysis.instrs.emplace_back(op_tbl[OP_STOP].fn);
+    instrs.emplace_back(op_tbl[OP_STOP].fn);
+    if (track_code_offsets)
+        code_offsets.push_back(static_cast<int32_t>(code_size));
+}
+
+/// Replaces the BEGINBLOCKs of the empty blocks followed by other blocks (e.g. the sequences
+/// of JUMPDESTs) with OPX_EMPTY_BLOCKS passing all the following empty blocks at once.
+/// The opcodes of the instructions are updated if not null.
+void skip_empty_blocks(
+    const op_table& op_tbl, std::vector<instruction>& instrs, int* opcodes) noexcept
+{
+    const auto beginblock_fn = op_tbl[OPX_BEGINBLOCK].fn;
+    const auto beginblock_gas_fn = op_tbl[OPX_BEGINBLOCK_GAS].fn;
+    const auto empty_blocks_fn = op_tbl[OPX_EMPTY_BLOCKS].fn;
+
+    // The empty blocks need no stack checks, so they always start with OPX_BEGINBLOCK_GAS.
+    // Going backwards, the empty blocks following the current one are already replaced.
+    uint64_t num_blocks = 0;
+    uint64_t gas_cost = 0;
+    for (auto i = instrs.size() - 1; i > 0; --i)
+    {
+        auto& instr = instrs[i - 1];
+        const auto next_fn = instrs[i].fn;
+        if (next_fn != empty_blocks_fn)
+        {
+            num_blocks = 0;
+            gas_cost = 0;
+        }
+
+        const auto next_is_block =
+            next_fn == beginblock_fn || next_fn == beginblock_gas_fn || next_fn == empty_blocks_fn;
+        if (instr.fn != beginblock_gas_fn || !next_is_block)
+            continue;
+
+        ++num_blocks;
+        gas_cost += instr.arg.block.gas_cost;
+        instr.fn = empty_blocks_fn;
+        instr.arg.number = static_cast<int64_t>(num_blocks | (gas_cost << 32));
+        if (opcodes != nullptr)
+            opcodes[i - 1] = OPX_EMPTY_BLOCKS;
+    }
+}
+
+/// Moves the results from the scratch to the single, exactly sized arena of the new analysis.
+/// The space for the labels and the jumpdest lookup structure of the given sizes
+/// is also allocated in the arena but not initialized.
+code_analysis pack(
+    evmc_revision rev, size_t num_labels, size_t map_size, size_t num_words) noexcept
+{
+    const auto& op_tbl = get_op_table(rev);
+    const auto& instrs = scratch.instrs;
+
+    auto analysis = allocate_analysis({instrs.size(), num_labels, scratch.push_values.size(),
+        scratch.jumpdest_offsets.size(), map_size, num_words, scratch.code_offsets.size(),
+        scratch.prefetch_blocks.size(), scratch.prefetch_keys.size(),
+        scratch.prefetch_addresses.size()});
+
+    std::uninitialized_copy(instrs.begin(), instrs.end(), analysis.instrs.data());
+    std::uninitialized_copy(
+        scratch.push_values.begin(), scratch.push_values.end(), analysis.push_values.data());
+    std::uninitialized_copy(scratch.jumpdest_offsets.begin(), scratch.jumpdest_offsets.end(),
+        analysis.jumpdest_offsets.data());
+    std::uninitialized_copy(scratch.jumpdest_targets.begin(), scratch.jumpdest_targets.end(),
+        analysis.jumpdest_targets.data());
+    std::uninitialized_copy(scratch.code_offsets.begin(), scratch.code_offsets.end(),
+        analysis.code_offsets.data());
+    std::uninitialized_copy(scratch.prefetch_blocks.begin(), scratch.prefetch_blocks.end(),
+        analysis.prefetch_blocks.data());
+    std::uninitialized_copy(scratch.prefetch_keys.begin(), scratch.prefetch_keys.end(),
+        analysis.prefetch_keys.data());
+    std::uninitialized_copy(scratch.prefetch_addresses.begin(), scratch.prefetch_addresses.end(),
+        analysis.prefetch_addresses.data());
+
+    for (const auto& hints : analysis.prefetch_blocks)
+        analysis.instrs[hints.block_index].fn = opx_beginblock_prefetch;
+
+    // Point the instructions using the push values to the copies in the arena.
+    const auto push_full_fn = op_tbl[OP_PUSH32].fn;
+    const auto address_mask_and_fn = op_tbl[OPX_PUSH_ADDRESS_MASK_AND].fn;
+    for (auto& instr : analysis.instrs)
+    {
+        if (instr.fn == push_full_fn || instr.fn == address_mask_and_fn)
+        {
+            const auto index = instr.arg.push_value - scratch.push_values.data();
+            instr.arg.push_value = &analysis.push_values[static_cast<size_t>(index)];
+        }
+    }
+
+    return analysis;
+}
+}  // namespace
+
+code_analysis allocate_analysis(const code_analysis_sizes& sizes) noexcept
+{
+    arena_layout layout;
+    const auto instrs_offset = layout.add<instruction>(sizes.instrs);
+    const auto labels_offset = layout.add<const void*>(sizes.labels);
+    const auto push_values_offset = layout.add<intx::uint256>(sizes.push_values);
+    const auto jumpdest_offsets_offset = layout.add<int32_t>(sizes.jumpdests);
+    const auto jumpdest_targets_offset = layout.add<int32_t>(sizes.jumpdests);
+    const auto jumpdest_map_offset = layout.add<int32_t>(sizes.jumpdest_map);
+    const auto jumpdest_bitmap_offset = layout.add<uint64_t>(sizes.jumpdest_bitmap);
+    const auto jumpdest_rank_offset = layout.add<int32_t>(sizes.jumpdest_bitmap);
+    const auto code_offsets_offset = layout.add<int32_t>(sizes.code_offsets);
+    const auto prefetch_blocks_offset = layout.add<prefetch_hints>(sizes.prefetch_blocks);
+    const auto prefetch_keys_offset = layout.add<evmc::bytes32>(sizes.prefetch_keys);
+    const auto prefetch_addresses_offset = layout.add<evmc::address>(sizes.prefetch_addresses);
+
+    code_analysis analysis;
+    analysis.arena_size = layout.size();
+    analysis.arena.reset(new uint8_t[analysis.arena_size]);
+    const auto arena = analysis.arena.get();
+    analysis.instrs = make_span<instruction>(arena, instrs_offset, sizes.instrs);
+    analysis.labels = make_span<const void*>(arena, labels_offset, sizes.labels);
+    analysis.push_values = make_span<intx::uint256>(arena, push_values_offset, sizes.push_values);
+    analysis.jumpdest_offsets =
+        make_span<int32_t>(arena, jumpdest_offsets_offset, sizes.jumpdests);
+    analysis.jumpdest_targets =
+        make_span<int32_t>(arena, jumpdest_targets_offset, sizes.jumpdests);
+    analysis.jumpdest_map = make_span<int32_t>(arena, jumpdest_map_offset, sizes.jumpdest_map);
+    analysis.jumpdest_bitmap =
+        make_span<uint64_t>(arena, jumpdest_bitmap_offset, sizes.jumpdest_bitmap);
+    analysis.jumpdest_rank = make_span<int32_t>(arena, jumpdest_rank_offset, sizes.jumpdest_bitmap);
+    analysis.code_offsets = make_span<int32_t>(arena, code_offsets_offset, sizes.code_offsets);
+    analysis.prefetch_blocks =
+        make_span<prefetch_hints>(arena, prefetch_blocks_offset, sizes.prefetch_blocks);
+    analysis.prefetch_keys =
+        make_span<evmc::bytes32>(arena, prefetch_keys_offset, sizes.prefetch_keys);
+    analysis.prefetch_addresses =
+        make_span<evmc::address>(arena, prefetch_addresses_offset, sizes.prefetch_addresses);
+    return analysis;
+}
+
+void build_labels(code_analysis& analysis, evmc_revision rev, const int* opcodes) noexcept
+{
+    const auto dispatch_table = get_threaded_dispatch_table();
+    const auto& op_tbl = get_op_table(rev);
+
+    // The interpreter implements the instructions as defined in the latest revision,
+    // e.g. the instructions undefined in the given revision must use the fallback.
+    const auto& latest_op_tbl = get_op_table(EVMC_MAX_REVISION);
+    const auto fallback = dispatch_table[op_table_size];
+    for (size_t i = 0; i < analysis.labels.size(); ++i)
+    {
+        const auto op = static_cast<size_t>(opcodes[i]);
+        new (&analysis.labels[i]) const void*{
+            op_tbl[op].fn == latest_op_tbl[op].fn ? dispatch_table[op] : fallback};
+    }
+}
 
-    // FIXME: assert(analysis.instrs.size() <= max_instrs_size);
+code_analysis analyze(
+    evmc_revision rev, const uint8_t* code, size_t code_size, uint32_t flags) noexcept
+{
+    if ((flags & ANALYSIS_LAZY) != 0)
+    {
+        // The threaded-code interpreter is not supported by the lazy analysis.
+        code_analysis analysis;
+        analysis.lazy = std::make_unique<lazy_analysis>(
+            rev, code, code_size, flags & ~uint32_t{ANALYSIS_THREADED_CODE});
+        return analysis;
+    }
+
+    scratch.clear();
+    auto& instrs = scratch.instrs;
+    auto& static_jumps = scratch.static_jumps;
+    auto& opcodes = scratch.opcodes;
+
+    const auto max_instrs_size = code_size + 1;
+    instrs.reserve(max_instrs_size);
+
+    // Every large push (PUSH9 to PUSH32) takes at least 10 bytes of code,
+    // except the one truncated by the end of the code.
+    const auto max_push_values_size = code_size / 10 + 1;
+    scratch.push_values.reserve(max_push_values_size);
+
+    const auto fusion = (flags & ANALYSIS_FUSION) != 0;
+    const auto dispatch_table =
+        (flags & ANALYSIS_THREADED_CODE) != 0 ? get_threaded_dispatch_table() : nullptr;
+    const auto track_opcodes = fusion || dispatch_table != nullptr;
+    if (track_opcodes)
+        opcodes.reserve(max_instrs_size);
+
+    const auto track_code_offsets = (flags & ANALYSIS_CODE_OFFSETS) != 0;
+    if (track_code_offsets)
+        scratch.code_offsets.reserve(max_instrs_size);
+
+    const auto track_prefetch = (flags & ANALYSIS_PREFETCH_HINTS) != 0;
+    const auto precharge = (flags & ANALYSIS_PRECHARGE) != 0;
+    const auto elide_checks = (flags & ANALYSIS_ELIDE_CHECKS) != 0;
+
+    build_instructions(rev, code, code_size, 0, fusion, track_opcodes, track_code_offsets,
+        track_prefetch, precharge, elide_checks, nullptr);
+
+    if (track_opcodes)
+    {
+        opcodes.resize(instrs.size() - 1, OPX_BEGINBLOCK);
+        opcodes.push_back(OP_STOP);
+    }
+    if (elide_checks)
+        skip_empty_blocks(get_op_table(rev), instrs, track_opcodes ? opcodes.data() : nullptr);
+
+    // FIXME: assert(instrs.size() <= max_instrs_size);
 
     // Make sure the push_values has not been reallocated. Otherwise iterators are invalid.
-    assert(analysis.push_values.size() <= max_args_storage_size);
+    assert(scratch.push_values.size() <= max_push_values_size);
+
+    const auto num_instrs = instrs.size();
+    const auto dense_map = code_size <= code_analysis::max_dense_jumpdest_map_code_size;
+    auto analysis = pack(rev, dispatch_table != nullptr ? num_instrs : 0,
+        dense_map ? code_size : 0, dense_map ? 0 : (code_size + 63) / 64);
+
+    build_jumpdest_map(analysis);
+
+    for (const auto index : static_jumps)
+    {
+        auto& arg = analysis.instrs[index].arg;
+        const auto dst = arg.small_push_value;
+        arg.number = dst < code_size ? find_jumpdest(analysis, static_cast<int>(dst)) : -1;
+    }
+
+    if (dispatch_table != nullptr)
+    {
+        build_labels(analysis, rev, opcodes.data());
+
+        // The BEGINBLOCKs with the prefetch hints are not implemented by the interpreter.
+        for (const auto& hints : analysis.prefetch_blocks)
+            analysis.labels[hints.block_index] = dispatch_table[op_table_size];
+    }
+
+    if ((flags & ANALYSIS_JIT) != 0)
+        analysis.jit = std::make_unique<jit_tier>();
+
+    if (code_size > max_retained_scratch_code_size)
+        scratch = {};
 
     return analysis;
 }
 
+code_analysis analyze_segment(
+    const lazy_analysis& lazy, const uint8_t* code, size_t code_size, size_t begin) noexcept
+{
+    const auto rev = lazy.revision();
+    const auto& op_tbl = get_op_table(rev);
+
+    // The push values storage must not be reallocated during the building,
+    // so it is reserved for all the large pushes in the code.
+    scratch.clear();
+    scratch.push_values.reserve(lazy.num_large_pushes());
+    const auto fusion = (lazy.flags() & ANALYSIS_FUSION) != 0;
+    const auto precharge = (lazy.flags() & ANALYSIS_PRECHARGE) != 0;
+    const auto elide_checks = (lazy.flags() & ANALYSIS_ELIDE_CHECKS) != 0;
+    build_instructions(rev, code, code_size, begin, fusion, fusion, false, false, precharge,
+        elide_checks, &lazy);
+    if (elide_checks)
+        skip_empty_blocks(op_tbl, scratch.instrs, nullptr);
+
+    auto segment = pack(rev, 0, 0, 0);
+    for (auto& instr : segment.instrs)
+    {
+        if (instr.fn == op_tbl[OP_JUMP].fn)
+            instr.fn = lazy_jump;
+        else if (instr.fn == op_tbl[OP_JUMPI].fn)
+            instr.fn = lazy_jumpi;
+        else if (instr.fn == op_tbl[OPX_STATIC_JUMP].fn)
+            instr.fn = lazy_static_jump;
+        else if (instr.fn == op_tbl[OPX_STATIC_JUMPI].fn)
+            instr.fn = lazy_static_jumpi;
+        else if (instr.fn == op_tbl[OPX_ISZERO_STATIC_JUMPI].fn)
+            instr.fn = lazy_iszero_static_jumpi;
+    }
+
+    if (scratch.instrs.capacity() > max_retained_scratch_code_size)
+        scratch = {};
+
+    return segment;
+}
+
+code_analysis::code_analysis() noexcept = default;
+code_analysis::code_analysis(code_analysis&&) noexcept = default;
+code_analysis& code_analysis::operator=(code_analysis&&) noexcept = default;
+code_analysis::~code_analysis() noexcept = default;
 }  // namespace evmone
@@ -3,21 +3,26 @@
 // Licensed under the Apache License, Version 2.0.
 #pragma once
 
+#include "keccak.hpp"
 #include "limits.hpp"
+#include "prefetch.hpp"
 #include <evmc/evmc.hpp>
 #include <evmc/instructions.h>
 #include <evmc/utils.h>
 #include <intx/intx.hpp>
 #include <array>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace evmone
 {
 using uint256 = intx::uint256;
 
-using bytes32 = std::array<uint8_t, 32>;
-
 using bytes = std::basic_string<uint8_t>;
 
 /// The stack for 256-bit EVM words.
@@ -40,6 +45,9 @@ struct evm_stack
     /// Default constructor. Sets the top_item pointer to below the stack bottom.
     [[clang::no_sanitize("bounds")]] evm_stack() noexcept : top_item{storage - 1} {}
 
+    /// Removes all items. The storage is not zeroed, the items are always written before read.
+    [[clang::no_sanitize("bounds")]] void clear() noexcept { top_item = storage - 1; }
+
     /// The current number of items on the stack.
     int size() noexcept { return static_cast<int>(top_item + 1 - storage); }
 
@@ -58,32 +66,118 @@ struct evm_stack
 
 /// The EVM memory.
 ///
-/// At this point it is a wrapper for std::vector<uint8_t> with initial allocation of 4k.
-/// Some benchmarks has been done to confirm 4k is ok-ish value.
-/// Also std::basic_string<uint8_t> has been tried but not faster and we don't want SSO
-/// if initial_capacity is used.
-/// In future, transition to std::realloc() + std::free() planned.
+/// On 64-bit systems the memory is backed by a virtual address range of reserved_size bytes
+/// reserved once (with mmap() or VirtualAlloc()). Pages are committed lazily when the memory
+/// grows and are zero-initialized by the OS on first access, so growing never copies
+/// the content and never zero-fills eagerly. The heap is used instead when the memory grows
+/// beyond the reserved range or the reservation is not possible.
+///
+/// All bytes between size() and the end of the committed space are zero.
 class evm_memory
 {
-    /// The initial memory allocation.
+public:
+    /// The size of the reserved virtual address range: far more than ever reachable
+    /// under the Ethereum block gas limits.
+    static constexpr size_t reserved_size = 32 * 1024 * 1024;
+
+private:
+    /// The initial heap allocation.
     static constexpr size_t initial_capacity = 4 * 1024;
 
-    std::vector<uint8_t> m_memory;
+    /// The maximum space kept by clear() for reuse.
+    static constexpr size_t max_retained_capacity = 1024 * 1024;
+
+    /// The memory content.
+    uint8_t* m_data = nullptr;
+
+    size_t m_size = 0;
+
+    /// The size of the space available for m_data without reallocation.
+    size_t m_capacity = 0;
+
+    /// The reserved virtual address range or null if not available.
+    uint8_t* m_reservation = nullptr;
+
+    /// The committed part of the reserved range.
+    size_t m_committed = 0;
+
+    /// Extends the capacity to fit the new size. Returns false if allocation fails.
+    [[nodiscard]] EVMC_EXPORT bool grow(size_t new_size) noexcept;
+
+    /// Moves the content to the heap. Returns false if allocation fails.
+    [[nodiscard]] bool move_to_heap(size_t new_capacity) noexcept;
 
 public:
-    evm_memory() noexcept { m_memory.reserve(initial_capacity); }
+    EVMC_EXPORT evm_memory() noexcept;
+    EVMC_EXPORT ~evm_memory() noexcept;
 
     evm_memory(const evm_memory&) = delete;
     evm_memory& operator=(const evm_memory&) = delete;
 
-    uint8_t& operator[](size_t index) noexcept { return m_memory[index]; }
+    uint8_t& operator[](size_t index) noexcept { return m_data[index]; }
+
+    [[nodiscard]] size_t size() const noexcept { return m_size; }
+
+    /// Returns true if the memory is backed by the reserved virtual address range.
+    [[nodiscard]] bool is_reserved() const noexcept
+    {
+        return m_reservation != nullptr && m_data == m_reservation;
+    }
+
+    /// Grows the memory to the new size, the new bytes are zeros.
+    /// The new size must not be smaller than the current one.
+    /// Returns false if allocation fails.
+    [[nodiscard]] bool resize(size_t new_size) noexcept
+    {
+        if (new_size > m_capacity && !grow(new_size))
+            return false;
+        m_size = new_size;
+        return true;
+    }
+
+    /// Sets the size to 0. Only up to max_retained_capacity of the space is kept for reuse.
+    EVMC_EXPORT void clear() noexcept;
+};
+
+/// The return data of the last call.
+///
+/// The output of the call result is not copied: the buffer owns the result and keeps it
+/// until the return data is replaced or cleared. The results of the evmone executions
+/// reference the memory of the callee, so the return data is shared with the callee frame.
+class return_data_buffer
+{
+    evmc_result m_result{};
+
+public:
+    return_data_buffer() noexcept = default;
+    ~return_data_buffer() noexcept { clear(); }
+
+    return_data_buffer(const return_data_buffer&) = delete;
+    return_data_buffer& operator=(const return_data_buffer&) = delete;
+
+    [[nodiscard]] size_t size() const noexcept { return m_result.output_size; }
 
-    [[nodiscard]] size_t size() const noexcept { return m_memory.size(); }
+    const uint8_t& operator[](size_t index) const noexcept { return m_result.output_data[index]; }
+
+    /// Takes the ownership of the call result and returns it.
+    const evmc_result& assign(evmc::result result) noexcept
+    {
+        clear();
+        m_result = result.release_raw();
+        return m_result;
+    }
 
-    void resize(size_t new_size) { m_memory.resize(new_size); }
+    /// Releases the result.
+    void clear() noexcept
+    {
+        if (m_result.release != nullptr)
+            m_result.release(&m_result);
+        m_result = {};
+    }
 };
 
 struct instruction;
+class VM;
 
 struct block_info
 {
@@ -125,16 +219,46 @@ struct execution_state
     /// This is only needed to correctly calculate the "current gas left" value.
     uint32_t current_block_cost = 0;
 
-    struct code_analysis* analysis = nullptr;
-    bytes return_data;
+    const struct code_analysis* analysis = nullptr;
+    return_data_buffer return_data;
     const evmc_message* msg = nullptr;
     const uint8_t* code = nullptr;
     size_t code_size = 0;
 
-    evmc::HostContext host;
+    host_context host;
 
     evmc_revision rev = {};
 
+    /// The recent results of the SHA3 instruction.
+    keccak_memo sha3_memo;
+
+    /// The VM executing the calls as the nested frames (see set_host_nested_calls()),
+    /// null if the calls are passed to the host.
+    VM* nested_vm = nullptr;
+
+    /// Resets the state for a new execution. The allocated stack and memory are reused.
+    void reset(evmc_revision revision, const evmc_message& message,
+        const evmc_host_interface& host_interface, evmc_host_context* host_ctx,
+        const uint8_t* code_ptr, size_t code_sz, prefetch_fn prefetch = nullptr) noexcept
+    {
+        status = EVMC_SUCCESS;
+        gas_left = message.gas;
+        stack.clear();
+        memory.clear();
+        output_offset = 0;
+        output_size = 0;
+        current_block_cost = 0;
+        analysis = nullptr;
+        return_data.clear();
+        msg = &message;
+        code = code_ptr;
+        code_size = code_sz;
+        host = host_context{host_interface, host_ctx, prefetch};
+        rev = revision;
+        sha3_memo.clear();
+        nested_vm = nullptr;
+    }
+
     /// Terminates the execution with the given status code.
     const instruction* exit(evmc_status_code status_code) noexcept
     {
@@ -167,7 +291,129 @@ enum intrinsic_opcodes
     /// This instruction is defined as alias for JUMPDEST and replaces all JUMPDEST instructions.
     /// It is also injected at beginning of basic blocks not being the valid jump destination.
     /// It checks basic block execution requirements and terminates execution if they are not met.
-    OPX_BEGINBLOCK = OP_JUMPDEST
+    OPX_BEGINBLOCK = OP_JUMPDEST,
+
+    /// The JUMP with the constant jump destination.
+    ///
+    /// This instruction replaces the sequence of PUSH and JUMP instructions.
+    /// The jump destination is resolved during analysis: the argument is the index of
+    /// the target instruction or -1 if the destination is invalid.
+    OPX_STATIC_JUMP = 0x100,
+
+    /// The JUMPI with the constant jump destination.
+    ///
+    /// This instruction replaces the sequence of PUSH and JUMPI instructions.
+    /// The argument is the same as for OPX_STATIC_JUMP.
+    OPX_STATIC_JUMPI,
+
+    /// The superinstructions created by the optional fusion pass (see ANALYSIS_FUSION).
+    ///
+    /// Each of them replaces a sequence of instructions in a basic block. The base gas cost
+    /// and the stack requirements of the block are computed from the original instructions.
+
+    /// The small PUSH followed by ADD, SUB, MUL, AND, OR, EQ, LT, GT, SHL or SHR.
+    /// The argument is the push value.
+    OPX_PUSH_ADD,
+    OPX_PUSH_SUB,
+    OPX_PUSH_MUL,
+    OPX_PUSH_AND,
+    OPX_PUSH_OR,
+    OPX_PUSH_EQ,
+    OPX_PUSH_LT,
+    OPX_PUSH_GT,
+    OPX_PUSH_SHL,
+    OPX_PUSH_SHR,
+
+    /// The small PUSH followed by MLOAD or MSTORE.
+    /// The argument is the push value (the memory offset).
+    OPX_PUSH_MLOAD,
+    OPX_PUSH_MSTORE,
+
+    /// The PUSH of the 20-byte mask (2^160 - 1) followed by AND, i.e. the address cleanup.
+    OPX_PUSH_ADDRESS_MASK_AND,
+
+    /// The DUPn followed by SWAPm. The argument is n | (m << 8).
+    OPX_DUP_SWAP,
+
+    /// The SWAPn followed by POP. The argument is n.
+    OPX_SWAP_POP,
+
+    /// The ISZERO followed by OPX_STATIC_JUMPI.
+    /// The argument is the same as for OPX_STATIC_JUMP.
+    OPX_ISZERO_STATIC_JUMPI,
+
+    /// The memory expansion of the block (see ANALYSIS_PRECHARGE).
+    ///
+    /// This instruction is injected directly after the BEGINBLOCK of the block having
+    /// precharged instructions. The argument is the highest memory end of them:
+    /// the memory is expanded to it at once, charging the expansion cost.
+    OPX_PRECHARGE_MEMORY,
+
+    /// The instructions with the operands known by the analysis, precharged by the block.
+    ///
+    /// They neither check the memory size nor charge the dynamic gas cost: the memory is
+    /// already expanded by OPX_PRECHARGE_MEMORY and the dynamic cost is included
+    /// in the base gas cost of the block.
+    OPX_PRECHARGED_MLOAD,
+    OPX_PRECHARGED_MSTORE,
+    OPX_PRECHARGED_MSTORE8,
+    OPX_PRECHARGED_SHA3,
+    OPX_PRECHARGED_CALLDATACOPY,
+    OPX_PRECHARGED_CODECOPY,
+    OPX_PRECHARGED_EXP,
+    OPX_PRECHARGED_PUSH_MLOAD,
+    OPX_PRECHARGED_PUSH_MSTORE,
+
+    /// The BEGINBLOCK of the block with the stack requirements proven by the analysis
+    /// (see ANALYSIS_ELIDE_CHECKS). Only the gas is checked.
+    OPX_BEGINBLOCK_GAS,
+
+    /// The BEGINBLOCK of the empty block followed by other empty blocks, e.g. the sequence
+    /// of JUMPDESTs (see ANALYSIS_ELIDE_CHECKS).
+    ///
+    /// It charges the gas of all the empty blocks from this one on and continues at the first
+    /// non-empty block. The argument is the number of these empty blocks | (their gas << 32).
+    OPX_EMPTY_BLOCKS,
+};
+
+/// The flags controlling the optional transformations done by the analysis.
+enum analysis_flags : uint32_t
+{
+    /// Fuse frequent sequences of instructions into superinstructions.
+    ANALYSIS_FUSION = 1 << 0,
+
+    /// Build the labels for the threaded-code interpreter (if available in the build).
+    ANALYSIS_THREADED_CODE = 1 << 1,
+
+    /// Analyze the code lazily, the segments of the code on first entry (see lazy_analysis).
+    /// The threaded-code interpreter is not used then.
+    ANALYSIS_LAZY = 1 << 2,
+
+    /// Record the code offsets of the instructions (see code_analysis::code_offsets),
+    /// e.g. for tracing. Ignored by the lazy analysis.
+    ANALYSIS_CODE_OFFSETS = 1 << 3,
+
+    /// Record the statically known storage keys and account addresses accessed in the basic
+    /// blocks (see code_analysis::prefetch_blocks), passed to the host prefetch callback
+    /// at the block start. Ignored by the lazy analysis.
+    ANALYSIS_PREFETCH_HINTS = 1 << 4,
+
+    /// Precharge the dynamic gas costs and the memory expansion of the instructions with
+    /// the operands pushed in the same basic block at the block start (see OPX_PRECHARGE_MEMORY).
+    /// Only the instructions before the first one observing the gas left or the memory size,
+    /// or possibly failing other than by running out of gas, are precharged.
+    ANALYSIS_PRECHARGE = 1 << 5,
+
+    /// Elide the stack checks of the blocks where the stack height propagated from the code
+    /// start or from the preceding blocks along the fall-through edges proves the stack
+    /// requirements (see OPX_BEGINBLOCK_GAS), and pass the runs of empty blocks at once
+    /// (see OPX_EMPTY_BLOCKS). In the full analysis of the code without the dynamic jumps
+    /// the stack height is propagated along the static jumps too.
+    ANALYSIS_ELIDE_CHECKS = 1 << 6,
+
+    /// Compile the code with the JIT after the number of executions (see jit_tier).
+    /// Ignored by the lazy analysis.
+    ANALYSIS_JIT = 1 << 7,
 };
 
 struct op_table_entry
@@ -178,7 +424,17 @@ struct op_table_entry
     int8_t stack_change;
 };
 
-using op_table = std::array<op_table_entry, 256>;
+/// The number of op table entries: all EVM opcodes followed by the intrinsic opcodes
+/// not aliased with any EVM opcode.
+constexpr size_t op_table_size = OPX_EMPTY_BLOCKS + 1;
+
+using op_table = std::array<op_table_entry, op_table_size>;
+
+/// Checks if the argument of the instruction of the opcode is the pointer to the push value.
+constexpr bool has_push_value_arg(int opcode) noexcept
+{
+    return (opcode >= OP_PUSH9 && opcode <= OP_PUSH32) || opcode == OPX_PUSH_ADDRESS_MASK_AND;
+}
 
 struct instruction
 {
@@ -188,37 +444,195 @@ struct instruction
     explicit constexpr instruction(instruction_exec_fn f) noexcept : fn{f}, arg{} {};
 };
 
+class lazy_analysis;
+class jit_tier;
+
+/// The prefetch hints of the basic block: the ranges of code_analysis::prefetch_keys
+/// and code_analysis::prefetch_addresses.
+struct prefetch_hints
+{
+    /// The index of the BEGINBLOCK instruction of the block.
+    uint32_t block_index;
+
+    uint32_t keys_offset;
+    uint32_t num_keys;
+    uint32_t addresses_offset;
+    uint32_t num_addresses;
+};
+
+/// The non-owning view of the array of objects.
+template <typename T>
+class span
+{
+    T* m_data = nullptr;
+    size_t m_size = 0;
+
+public:
+    constexpr span() noexcept = default;
+    constexpr span(T* data, size_t size) noexcept : m_data{data}, m_size{size} {}
+
+    [[nodiscard]] constexpr T* data() const noexcept { return m_data; }
+    [[nodiscard]] constexpr size_t size() const noexcept { return m_size; }
+    [[nodiscard]] constexpr bool empty() const noexcept { return m_size == 0; }
+
+    constexpr T& operator[](size_t index) const noexcept { return m_data[index]; }
+
+    constexpr T* begin() const noexcept { return m_data; }
+    constexpr T* end() const noexcept { return m_data + m_size; }
+};
+
+/// The result of the code analysis.
+///
+/// All the arrays are stored in the single memory block (the arena) allocated with the exact
+/// size, in the order they are declared. The instructions are followed directly by the data
+/// they refer to, so the executed analysis occupies as few cache lines and pages as possible.
+/// The type is move-only because the arrays are views of the owned arena.
+///
+/// In the lazy analysis mode all the arrays are empty and the code is analyzed
+/// by the lazy_analysis on demand.
 struct code_analysis
 {
-    std::vector<instruction> instrs;
+    /// The maximum code size for which the dense jumpdest map is built.
+    /// The map takes 4 bytes per code byte, so it is used only for small code where it stays
+    /// in L1 data cache. Bigger code uses the bitmap with ranks taking ~0.2 byte per code byte.
+    static constexpr size_t max_dense_jumpdest_map_code_size = 4 * 1024;
+
+    span<instruction> instrs;
+
+    /// The addresses of the threaded-code interpreter labels matching the elements of instrs.
+    /// Built only with ANALYSIS_THREADED_CODE, empty otherwise.
+    span<const void*> labels;
 
     /// Storage for large push values.
-    std::vector<intx::uint256> push_values;
+    span<intx::uint256> push_values;
 
     /// The offsets of JUMPDESTs in the original code.
     /// These are values that JUMP/JUMPI receives as an argument.
     /// The elements are sorted.
-    std::vector<int32_t> jumpdest_offsets;
+    span<int32_t> jumpdest_offsets;
 
     /// The indexes of the instructions in the generated instruction table
     /// matching the elements from jumdest_offsets.
     /// This is value to which the next instruction pointer must be set in JUMP/JUMPI.
-    std::vector<int32_t> jumpdest_targets;
+    span<int32_t> jumpdest_targets;
+
+    /// The dense map from code offsets to jumpdest targets, -1 for invalid jump destinations.
+    /// Built only for code of size up to max_dense_jumpdest_map_code_size, empty otherwise.
+    span<int32_t> jumpdest_map;
+
+    /// The bitmap of JUMPDEST offsets. Built for code too big for the dense map.
+    span<uint64_t> jumpdest_bitmap;
+
+    /// The number of JUMPDESTs before each word of the jumpdest_bitmap.
+    /// This is the index in jumpdest_targets of the first JUMPDEST in the word.
+    span<int32_t> jumpdest_rank;
+
+    /// The code offsets of the instructions matching the elements of instrs:
+    /// the offset of the (first) EVM instruction it has been created from,
+    /// the offset of the block start for BEGINBLOCKs and the code size for the final STOP.
+    /// Recorded only with ANALYSIS_CODE_OFFSETS, empty otherwise.
+    span<int32_t> code_offsets;
+
+    /// The prefetch hints of the basic blocks having any, sorted by the block_index.
+    /// The BEGINBLOCKs of these blocks are replaced with opx_beginblock_prefetch.
+    /// Recorded only with ANALYSIS_PREFETCH_HINTS, empty otherwise.
+    span<prefetch_hints> prefetch_blocks;
+
+    /// The storage keys pushed directly before SLOAD or SSTORE, unique within the block.
+    span<evmc::bytes32> prefetch_keys;
+
+    /// The addresses pushed directly before BALANCE, EXTCODESIZE, EXTCODECOPY or EXTCODEHASH
+    /// or followed by GAS and the call, unique within the block.
+    span<evmc::address> prefetch_addresses;
+
+    /// The memory block holding all the arrays.
+    std::unique_ptr<uint8_t[]> arena;
+
+    /// The size of the arena in bytes.
+    size_t arena_size = 0;
+
+    /// The state of the lazy analysis, only with ANALYSIS_LAZY.
+    std::unique_ptr<lazy_analysis> lazy;
+
+    /// The tiering state of the JIT, only with ANALYSIS_JIT.
+    std::unique_ptr<jit_tier> jit;
+
+    code_analysis() noexcept;
+    code_analysis(code_analysis&&) noexcept;
+    code_analysis& operator=(code_analysis&&) noexcept;
+    ~code_analysis() noexcept;
 };
 
+inline int popcount(uint64_t x) noexcept
+{
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt64(x));
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+
+/// Finds the instruction index of the jump destination at the given code offset.
+/// Returns -1 if the offset is not a valid jump destination.
 inline int find_jumpdest(const code_analysis& analysis, int offset) noexcept
 {
-    const auto begin = std::begin(analysis.jumpdest_offsets);
-    const auto end = std::end(analysis.jumpdest_offsets);
-    const auto it = std::lower_bound(begin, end, offset);
-    return (it != end && *it == offset) ?
-               analysis.jumpdest_targets[static_cast<size_t>(it - begin)] :
-               -1;
+    const auto pos = static_cast<size_t>(offset);
+
+    if (!analysis.jumpdest_map.empty())
+        return pos < analysis.jumpdest_map.size() ? analysis.jumpdest_map[pos] : -1;
+
+    const auto word_index = pos / 64;
+    if (word_index >= analysis.jumpdest_bitmap.size())
+        return -1;
+
+    const auto word = analysis.jumpdest_bitmap[word_index];
+    const auto mask = uint64_t{1} << (pos % 64);
+    if ((word & mask) == 0)
+        return -1;
+
+    const auto rank = analysis.jumpdest_rank[word_index] + popcount(word & (mask - 1));
+    return analysis.jumpdest_targets[static_cast<size_t>(rank)];
 }
 
+/// The sizes of the arrays of the code_analysis.
+struct code_analysis_sizes
+{
+    size_t instrs;
+    size_t labels;
+    size_t push_values;
+    size_t jumpdests;
+    size_t jumpdest_map;
+
+    /// The size of the jumpdest_bitmap, also the size of the jumpdest_rank.
+    size_t jumpdest_bitmap;
+
+    size_t code_offsets = 0;
+    size_t prefetch_blocks = 0;
+    size_t prefetch_keys = 0;
+    size_t prefetch_addresses = 0;
+};
+
+/// Creates the code_analysis with the arrays of the given sizes allocated in the arena.
+/// The content of the arrays is not initialized.
+code_analysis allocate_analysis(const code_analysis_sizes& sizes) noexcept;
+
+/// Builds the labels of the threaded-code interpreter for the instructions of the opcodes.
+/// The threaded-code interpreter must be available and the labels allocated.
+void build_labels(code_analysis& analysis, evmc_revision rev, const int* opcodes) noexcept;
+
+/// Analyzes the code. The flags are the combination of analysis_flags.
 EVMC_EXPORT code_analysis analyze(
-    evmc_revision rev, const uint8_t* code, size_t code_size) noexcept;
+    evmc_revision rev, const uint8_t* code, size_t code_size, uint32_t flags = 0) noexcept;
 
 EVMC_EXPORT const op_table& get_op_table(evmc_revision rev) noexcept;
 
+/// Executes the call of the instruction: in the nested frame if the host of the state
+/// supports the nested calls (see set_host_nested_calls()), by the host otherwise.
+evmc::result execute_call(execution_state& state, const evmc_message& msg) noexcept;
+
+/// The BEGINBLOCK of the block having the prefetch hints (see code_analysis::prefetch_blocks).
+/// Passes the hints to the host after the block requirements are checked.
+const instruction* opx_beginblock_prefetch(
+    const instruction* instr, execution_state& state) noexcept;
+
 }  // namespace evmone
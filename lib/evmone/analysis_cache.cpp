@@ -0,0 +1,290 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "analysis_cache.hpp"
+#include "jit.hpp"
+#include "lazy_analysis.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace evmone
+{
+namespace
+{
+inline uint64_t load64le(const uint8_t* data) noexcept
+{
+    uint64_t x;
+    std::memcpy(&x, data, sizeof(x));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    return x;
+}
+
+inline uint64_t rotl(uint64_t x, int s) noexcept
+{
+    return (x << s) | (x >> (64 - s));
+}
+
+/// The estimated memory used by the cache entry, including the segments
+/// of the lazy analysis analyzed so far and the code compiled by the JIT.
+inline size_t memory_size(const code_analysis& analysis, size_t code_size) noexcept
+{
+    const auto lazy_size = analysis.lazy != nullptr ? analysis.lazy->memory_size() : 0;
+    const auto jit_size = analysis.jit != nullptr ? analysis.jit->memory_size() : 0;
+    return sizeof(code_analysis) + code_size + analysis.arena_size + lazy_size + jit_size;
+}
+}  // namespace
+
+uint64_t hash_code(const uint8_t* code, size_t code_size) noexcept
+{
+    // The FxHash-like mixing of 8-byte words followed by the MurmurHash3 finalizer.
+    constexpr uint64_t k = 0x517cc1b727220a95;
+
+    auto h = uint64_t{code_size} * k;
+    const auto end = code + code_size;
+    for (; end - code >= 8; code += 8)
+        h = (rotl(h, 5) ^ load64le(code)) * k;
+
+    if (code != end)
+    {
+        uint8_t tail[8] = {};
+        std::memcpy(tail, code, static_cast<size_t>(end - code));
+        h = (rotl(h, 5) ^ load64le(tail)) * k;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53;
+    h ^= h >> 33;
+    return h;
+}
+
+analysis_cache::analysis_cache(size_t capacity, size_t num_shards) noexcept
+  : m_num_shards{std::max(num_shards, size_t{1})},
+    m_shards{new shard[m_num_shards]},
+    m_capacity{capacity}
+{}
+
+std::shared_ptr<const code_analysis> analysis_cache::get(
+    evmc_revision rev, const uint8_t* code, size_t code_size, uint32_t flags) noexcept
+{
+    const auto k = key{hash_code(code, code_size), rev, flags};
+    auto& s = get_shard(k);
+
+    if (m_capacity == 0)
+    {
+        s.misses.fetch_add(1, std::memory_order_relaxed);
+        return std::make_shared<const code_analysis>(analyze(rev, code, code_size, flags));
+    }
+
+    const auto is_same_code = [code, code_size](const bytes& c) noexcept {
+        return std::equal(c.begin(), c.end(), code, code + code_size);
+    };
+
+    const auto hit = [&s](entry& e) noexcept {
+        // Avoid writing to the entry's cache line if already marked.
+        if (!e.referenced.load(std::memory_order_relaxed))
+            e.referenced.store(true, std::memory_order_relaxed);
+        if (e.analysis->lazy != nullptr || e.analysis->jit != nullptr)
+            charge_growth(s, e);
+        s.hits.fetch_add(1, std::memory_order_relaxed);
+        return e.analysis;
+    };
+
+    {
+        std::shared_lock lock{s.mutex};
+        const auto it = s.index.find(k);
+        if (it != s.index.end() && is_same_code(*it->second->code))
+            return hit(*it->second);
+    }
+
+    std::unique_lock lock{s.mutex};
+
+    // Check again, the entry might have been inserted while the lock was released.
+    if (const auto it = s.index.find(k); it != s.index.end())
+    {
+        if (is_same_code(*it->second->code))
+            return hit(*it->second);
+
+        // Hash collision. Drop the old entry, the new one is going to replace it.
+        s.size -= it->second->size.load(std::memory_order_relaxed);
+        s.entries.erase(it->second);
+        s.index.erase(it);
+    }
+
+    if (const auto it = s.pending.find(k); it != s.pending.end())
+    {
+        // Another thread is analyzing the code. Wait for its result.
+        const auto pending = it->second;
+        lock.unlock();
+        if (is_same_code(*pending.code))
+        {
+            s.hits.fetch_add(1, std::memory_order_relaxed);
+            return pending.result.get();
+        }
+
+        // Hash collision with the pending analysis. Analyze without caching.
+        s.misses.fetch_add(1, std::memory_order_relaxed);
+        return std::make_shared<const code_analysis>(analyze(rev, code, code_size, flags));
+    }
+
+    auto code_copy = std::make_shared<const bytes>(code, code + code_size);
+    std::promise<std::shared_ptr<const code_analysis>> promise;
+    s.pending.emplace(k, pending_analysis{code_copy, promise.get_future().share()});
+    lock.unlock();
+
+    s.misses.fetch_add(1, std::memory_order_relaxed);
+    auto analysis = std::make_shared<const code_analysis>(analyze(rev, code, code_size, flags));
+    promise.set_value(analysis);
+
+    lock.lock();
+    s.pending.erase(k);
+    insert(s, k, std::move(code_copy), analysis);
+    return analysis;
+}
+
+bool analysis_cache::insert(shard& s, const key& k, std::shared_ptr<const bytes> code,
+    std::shared_ptr<const code_analysis> analysis) const noexcept
+{
+    const auto size = memory_size(*analysis, code->size());
+
+    // Do not flush the whole shard for a single oversized entry.
+    const auto capacity = shard_capacity();
+    if (size > capacity)
+        return false;
+
+    // Make room first, so the new entry is not evicted immediately.
+    evict(s, capacity - size);
+    s.entries.emplace_front(k, std::move(code), std::move(analysis), size);
+    s.index.emplace(k, s.entries.begin());
+    s.size += size;
+    return true;
+}
+
+void analysis_cache::set_capacity(size_t capacity) noexcept
+{
+    m_capacity = capacity;
+    for (size_t i = 0; i < m_num_shards; ++i)
+    {
+        auto& s = m_shards[i];
+        std::unique_lock lock{s.mutex};
+        evict(s, shard_capacity());
+    }
+}
+
+void analysis_cache::clear() noexcept
+{
+    for (size_t i = 0; i < m_num_shards; ++i)
+    {
+        auto& s = m_shards[i];
+        std::unique_lock lock{s.mutex};
+        s.index.clear();
+        s.entries.clear();
+        s.size.store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t analysis_cache::size() const noexcept
+{
+    size_t total = 0;
+    for (size_t i = 0; i < m_num_shards; ++i)
+    {
+        const auto& s = m_shards[i];
+        std::shared_lock lock{s.mutex};
+        total += s.size.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t analysis_cache::num_entries() const noexcept
+{
+    size_t total = 0;
+    for (size_t i = 0; i < m_num_shards; ++i)
+    {
+        const auto& s = m_shards[i];
+        std::shared_lock lock{s.mutex};
+        total += s.index.size();
+    }
+    return total;
+}
+
+analysis_cache::stats analysis_cache::get_stats() const noexcept
+{
+    stats total;
+    for (size_t i = 0; i < m_num_shards; ++i)
+    {
+        total.hits += m_shards[i].hits.load(std::memory_order_relaxed);
+        total.misses += m_shards[i].misses.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+std::vector<snapshot_entry> analysis_cache::export_entries() const noexcept
+{
+    std::vector<snapshot_entry> result;
+    for (size_t i = 0; i < m_num_shards; ++i)
+    {
+        const auto& s = m_shards[i];
+        std::shared_lock lock{s.mutex};
+        for (const auto& e : s.entries)
+            result.push_back({e.k.rev, e.k.flags, e.code, e.analysis});
+    }
+    return result;
+}
+
+size_t analysis_cache::import_entries(std::vector<snapshot_entry> entries) noexcept
+{
+    if (m_capacity == 0)
+        return 0;
+
+    size_t num_inserted = 0;
+    for (auto& e : entries)
+    {
+        const auto k = key{hash_code(e.code->data(), e.code->size()), e.rev, e.flags};
+        auto& s = get_shard(k);
+        std::unique_lock lock{s.mutex};
+        if (s.index.find(k) != s.index.end())
+            continue;
+
+        if (insert(s, k, std::move(e.code), std::move(e.analysis)))
+            ++num_inserted;
+    }
+    return num_inserted;
+}
+
+void analysis_cache::evict(shard& s, size_t capacity) noexcept
+{
+    while (s.size.load(std::memory_order_relaxed) > capacity)
+    {
+        const auto last = std::prev(s.entries.end());
+        charge_growth(s, *last);
+        if (last->referenced.load(std::memory_order_relaxed))
+        {
+            // The entry has been used since it was inserted: give it the second chance.
+            last->referenced.store(false, std::memory_order_relaxed);
+            s.entries.splice(s.entries.begin(), s.entries, last);
+            continue;
+        }
+
+        s.size -= last->size.load(std::memory_order_relaxed);
+        s.index.erase(last->k);
+        s.entries.erase(last);
+    }
+}
+
+void analysis_cache::charge_growth(shard& s, entry& e) noexcept
+{
+    const auto size = memory_size(*e.analysis, e.code->size());
+    if (size == e.size.load(std::memory_order_relaxed))
+        return;
+
+    // The concurrent hits may charge the sizes out of order, but the sum of the differences
+    // charged to the shard always matches the size last stored in the entry.
+    // The unsigned wraparound of the negative difference is intended.
+    const auto charged = e.size.exchange(size, std::memory_order_relaxed);
+    s.size.fetch_add(size - charged, std::memory_order_relaxed);
+}
+}  // namespace evmone
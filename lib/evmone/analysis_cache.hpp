@@ -0,0 +1,184 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include "analysis.hpp"
+#include "analysis_snapshot.hpp"
+#include <atomic>
+#include <future>
+#include <list>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace evmone
+{
+/// Computes the fast, non-cryptographic 64-bit hash of the code.
+///
+/// This is not the Ethereum code hash. The keccak256 of the code costs about as much as
+/// the code analysis itself, so it would defeat the purpose of caching.
+/// The cache never trusts the hash alone and always compares the code bytes on hit.
+EVMC_EXPORT uint64_t hash_code(const uint8_t* code, size_t code_size) noexcept;
+
+/// The bounded, thread-safe cache of code analyses.
+///
+/// The entries are identified by the code, the EVM revision and the analysis flags.
+/// The capacity is the limit for the total memory used by cached entries (in bytes).
+/// The analyses are shared with executions, so they stay alive until the last execution
+/// using them finishes, even if evicted from the cache in the meantime (e.g. by a nested call).
+///
+/// The cache is split into shards, each protected by its own reader-writer lock and holding
+/// the equal part of the capacity. Lookups take the shared lock only. The eviction policy is
+/// the "second chance" approximation of LRU: a hit merely marks the entry as referenced and
+/// marked entries are moved to the front instead of being evicted.
+/// When multiple threads miss on the same code at the same time, only one of them analyzes
+/// the code and the others wait for its result.
+class analysis_cache
+{
+public:
+    /// The default capacity: 64 MiB.
+    static constexpr size_t default_capacity = 64 * 1024 * 1024;
+
+    /// The default number of shards.
+    static constexpr size_t default_num_shards = 16;
+
+    /// The cache statistics.
+    struct stats
+    {
+        /// The number of lookups served without analyzing the code,
+        /// including the ones waiting for the analysis done by another thread.
+        uint64_t hits = 0;
+
+        /// The number of lookups which analyzed the code.
+        uint64_t misses = 0;
+    };
+
+    explicit analysis_cache(
+        size_t capacity = default_capacity, size_t num_shards = default_num_shards) noexcept;
+
+    analysis_cache(const analysis_cache&) = delete;
+    analysis_cache& operator=(const analysis_cache&) = delete;
+
+    /// Returns the analysis of the code, from the cache or by analyzing the code
+    /// and inserting the result to the cache. The flags are passed to analyze().
+    EVMC_EXPORT std::shared_ptr<const code_analysis> get(
+        evmc_revision rev, const uint8_t* code, size_t code_size, uint32_t flags = 0) noexcept;
+
+    /// Changes the capacity and evicts the entries over the new limit.
+    /// The capacity of 0 disables the cache.
+    EVMC_EXPORT void set_capacity(size_t capacity) noexcept;
+
+    /// Removes all entries. The statistics are not reset.
+    EVMC_EXPORT void clear() noexcept;
+
+    [[nodiscard]] size_t capacity() const noexcept { return m_capacity; }
+
+    /// The total memory used by cached entries (in bytes).
+    [[nodiscard]] EVMC_EXPORT size_t size() const noexcept;
+
+    /// The number of cached entries.
+    [[nodiscard]] EVMC_EXPORT size_t num_entries() const noexcept;
+
+    [[nodiscard]] EVMC_EXPORT stats get_stats() const noexcept;
+
+    /// Returns all cached entries, e.g. to be saved with serialize_snapshot().
+    [[nodiscard]] EVMC_EXPORT std::vector<snapshot_entry> export_entries() const noexcept;
+
+    /// Inserts the entries, e.g. loaded with deserialize_snapshot(), to the cache.
+    /// The entries already cached are skipped. Returns the number of inserted entries.
+    EVMC_EXPORT size_t import_entries(std::vector<snapshot_entry> entries) noexcept;
+
+private:
+    struct key
+    {
+        uint64_t code_hash;
+        evmc_revision rev;
+        uint32_t flags;
+
+        bool operator==(const key& other) const noexcept
+        {
+            return code_hash == other.code_hash && rev == other.rev && flags == other.flags;
+        }
+    };
+
+    struct key_hash
+    {
+        size_t operator()(const key& k) const noexcept
+        {
+            return static_cast<size_t>(
+                k.code_hash ^ static_cast<uint64_t>(k.rev) ^ (uint64_t{k.flags} << 8));
+        }
+    };
+
+    struct entry
+    {
+        key k;
+        std::shared_ptr<const bytes> code;
+        std::shared_ptr<const code_analysis> analysis;
+
+        /// The memory used by the entry (in bytes), as charged to the shard.
+        /// Updated by charge_growth() under the shared lock.
+        std::atomic<size_t> size;
+
+        /// The flag set by hits, gives the entry the second chance on eviction.
+        std::atomic<bool> referenced{false};
+
+        entry(key _k, std::shared_ptr<const bytes> _code,
+            std::shared_ptr<const code_analysis> _analysis, size_t _size) noexcept
+          : k{_k}, code{std::move(_code)}, analysis{std::move(_analysis)}, size{_size}
+        {}
+    };
+
+    /// The analysis being computed by one of the threads.
+    struct pending_analysis
+    {
+        std::shared_ptr<const bytes> code;
+        std::shared_future<std::shared_ptr<const code_analysis>> result;
+    };
+
+    struct shard
+    {
+        mutable std::shared_mutex mutex;
+
+        /// The entries ordered from the most recently inserted or given the second chance.
+        std::list<entry> entries;
+
+        std::unordered_map<key, std::list<entry>::iterator, key_hash> index;
+
+        std::unordered_map<key, pending_analysis, key_hash> pending;
+
+        /// The memory used by the entries (in bytes). Atomic, because the growth of the lazy
+        /// analyses and the JIT code is charged by hits holding only the shared lock.
+        std::atomic<size_t> size{0};
+
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+    };
+
+    [[nodiscard]] shard& get_shard(const key& k) const noexcept
+    {
+        return m_shards[static_cast<size_t>(k.code_hash >> 32) % m_num_shards];
+    }
+
+    [[nodiscard]] size_t shard_capacity() const noexcept { return m_capacity / m_num_shards; }
+
+    /// Inserts the entry to the shard unless it is larger than the shard capacity.
+    /// Returns true if inserted. The shard's exclusive lock must be held.
+    bool insert(shard& s, const key& k, std::shared_ptr<const bytes> code,
+        std::shared_ptr<const code_analysis> analysis) const noexcept;
+
+    /// Evicts entries of the shard until its size fits the capacity.
+    /// The shard's exclusive lock must be held.
+    static void evict(shard& s, size_t capacity) noexcept;
+
+    /// Charges the memory allocated by the entry's analysis since it was inserted
+    /// (the segments of the lazy analysis, the JIT code) to the shard.
+    /// The shard's lock must be held.
+    static void charge_growth(shard& s, entry& e) noexcept;
+
+    const size_t m_num_shards;
+    const std::unique_ptr<shard[]> m_shards;
+    std::atomic<size_t> m_capacity;
+};
+}  // namespace evmone
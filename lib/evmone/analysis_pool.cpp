@@ -0,0 +1,217 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "analysis_pool.hpp"
+#include "jit.hpp"
+#include <algorithm>
+#include <iterator>
+
+namespace evmone
+{
+namespace
+{
+template <typename T>
+void update_max(std::atomic<T>& max, T value) noexcept
+{
+    auto current = max.load(std::memory_order_relaxed);
+    while (current < value && !max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+uint64_t elapsed_ns(std::chrono::steady_clock::time_point begin,
+    std::chrono::steady_clock::time_point end) noexcept
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+}
+}  // namespace
+
+analysis_pool::analysis_pool(analysis_cache& cache, size_t num_threads) noexcept
+  : m_cache{cache},
+    m_num_threads{std::min(num_threads, max_num_threads)},
+    m_num_queues{std::max(m_num_threads, size_t{1})},
+    m_queues{new queue[m_num_queues]}
+{}
+
+analysis_pool::~analysis_pool() noexcept
+{
+    stop();
+}
+
+void analysis_pool::set_num_threads(size_t num_threads) noexcept
+{
+    stop();
+
+    std::vector<task> tasks;
+    for (size_t i = 0; i < m_num_queues; ++i)
+    {
+        auto& q = m_queues[i];
+        std::move(q.tasks.begin(), q.tasks.end(), std::back_inserter(tasks));
+    }
+
+    m_num_threads = std::min(num_threads, max_num_threads);
+    m_num_queues = std::max(m_num_threads, size_t{1});
+    m_queues.reset(new queue[m_num_queues]);
+    for (size_t i = 0; i < tasks.size(); ++i)
+    {
+        auto& q = m_queues[i % m_num_queues].tasks;
+        q.push_back(std::move(tasks[i]));
+        std::push_heap(q.begin(), q.end());
+    }
+}
+
+bool analysis_pool::submit(evmc_revision rev, const uint8_t* code, size_t code_size,
+    uint32_t flags, uint64_t priority) noexcept
+{
+    return push({priority, 0, rev, flags, bytes{code, code_size}, {}, nullptr});
+}
+
+bool analysis_pool::submit_jit(
+    std::shared_ptr<const code_analysis> analysis, uint64_t priority) noexcept
+{
+    return push({priority, 0, EVMC_FRONTIER, 0, {}, {}, std::move(analysis)});
+}
+
+bool analysis_pool::push(task t) noexcept
+{
+    m_submitted_count.fetch_add(1, std::memory_order_relaxed);
+    if (m_depth.load(std::memory_order_relaxed) >= max_queue_size)
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    t.seq = m_next_seq.fetch_add(1, std::memory_order_relaxed);
+    t.submit_time = clock::now();
+    auto& q = m_queues[m_next_queue.fetch_add(1, std::memory_order_relaxed) % m_num_queues];
+    {
+        std::lock_guard lock{q.mutex};
+        q.tasks.push_back(std::move(t));
+        std::push_heap(q.tasks.begin(), q.tasks.end());
+        update_max(m_max_depth, m_depth.fetch_add(1) + 1);
+    }
+
+    if (!m_started.load(std::memory_order_acquire))
+        start();
+
+    // Taking the lock orders the submission with the threads checking the depth before waiting.
+    {
+        std::lock_guard lock{m_mutex};
+    }
+    m_submitted.notify_one();
+    return true;
+}
+
+void analysis_pool::wait() noexcept
+{
+    if (m_num_threads == 0)
+    {
+        while (run_next(0))
+        {
+        }
+        return;
+    }
+
+    start();
+    std::unique_lock lock{m_mutex};
+    m_idle.wait(lock, [this] { return m_depth.load() == 0 && m_running.load() == 0; });
+}
+
+analysis_pool::stats analysis_pool::get_stats() const noexcept
+{
+    stats s;
+    s.queue_depth = m_depth.load(std::memory_order_relaxed);
+    s.max_queue_depth = m_max_depth.load(std::memory_order_relaxed);
+    s.submitted = m_submitted_count.load(std::memory_order_relaxed);
+    s.dropped = m_dropped.load(std::memory_order_relaxed);
+    s.completed = m_completed.load(std::memory_order_relaxed);
+    s.total_wait_ns = m_total_wait_ns.load(std::memory_order_relaxed);
+    s.max_wait_ns = m_max_wait_ns.load(std::memory_order_relaxed);
+    s.total_analysis_ns = m_total_analysis_ns.load(std::memory_order_relaxed);
+    return s;
+}
+
+void analysis_pool::start() noexcept
+{
+    std::lock_guard lock{m_mutex};
+    if (m_started.load(std::memory_order_relaxed))
+        return;
+
+    m_threads.reserve(m_num_threads);
+    for (size_t i = 0; i < m_num_threads; ++i)
+        m_threads.emplace_back(&analysis_pool::run, this, i);
+    m_started.store(true, std::memory_order_release);
+}
+
+void analysis_pool::stop() noexcept
+{
+    {
+        std::lock_guard lock{m_mutex};
+        m_stop = true;
+    }
+    m_submitted.notify_all();
+    for (auto& t : m_threads)
+        t.join();
+    m_threads.clear();
+    m_stop = false;
+    m_started = false;
+}
+
+bool analysis_pool::run_next(size_t index) noexcept
+{
+    // Counted as running before taking the task, so the pool is not seen idle in between.
+    m_running.fetch_add(1);
+
+    task t;
+    bool found = false;
+    for (size_t i = 0; i < m_num_queues && !found; ++i)
+    {
+        auto& q = m_queues[(index + i) % m_num_queues];
+        std::lock_guard lock{q.mutex};
+        if (q.tasks.empty())
+            continue;
+        std::pop_heap(q.tasks.begin(), q.tasks.end());
+        t = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        m_depth.fetch_sub(1);
+        found = true;
+    }
+
+    if (found)
+    {
+        const auto begin = clock::now();
+        if (t.jit_analysis != nullptr)
+            t.jit_analysis->jit->compile(*t.jit_analysis);
+        else
+            m_cache.get(t.rev, t.code.data(), t.code.size(), t.flags);
+        const auto end = clock::now();
+
+        const auto wait_ns = elapsed_ns(t.submit_time, begin);
+        m_total_wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+        update_max(m_max_wait_ns, wait_ns);
+        m_total_analysis_ns.fetch_add(elapsed_ns(begin, end), std::memory_order_relaxed);
+        m_completed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (m_running.fetch_sub(1) == 1 && m_depth.load() == 0)
+    {
+        std::lock_guard lock{m_mutex};
+        m_idle.notify_all();
+    }
+    return found;
+}
+
+void analysis_pool::run(size_t index) noexcept
+{
+    while (!m_stop.load(std::memory_order_relaxed))
+    {
+        if (run_next(index))
+            continue;
+
+        std::unique_lock lock{m_mutex};
+        m_submitted.wait(lock, [this] { return m_stop || m_depth.load() != 0; });
+    }
+}
+}  // namespace evmone
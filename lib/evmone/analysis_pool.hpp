@@ -0,0 +1,186 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include "analysis_cache.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace evmone
+{
+/// The pool of background threads analyzing the submitted code into the analysis cache
+/// and compiling the hot cached analyses with the JIT.
+///
+/// The code is copied on submission and analyzed in the order of the priority (the higher first,
+/// e.g. the block number, so the code of the newest block is analyzed first), the submissions
+/// of the same priority in the submission order. The executions looking up the code being
+/// analyzed wait for the analysis in progress (see analysis_cache::get()).
+///
+/// Every thread has its own queue, the submissions are distributed round-robin and the idle
+/// threads steal from the queues of the others, so the priority order is kept per queue only.
+/// The threads are started by the first submission. The submissions over max_queue_size
+/// are dropped, the code is then analyzed by the first execution as usual.
+class analysis_pool
+{
+public:
+    /// The default number of threads.
+    static constexpr size_t default_num_threads = 2;
+
+    /// The limit of the number of threads.
+    static constexpr size_t max_num_threads = 64;
+
+    /// The limit of the pending tasks.
+    static constexpr size_t max_queue_size = 4096;
+
+    /// The pool statistics.
+    struct stats
+    {
+        /// The number of the pending tasks and its maximum.
+        size_t queue_depth = 0;
+        size_t max_queue_depth = 0;
+
+        /// The number of the submitted tasks, including the dropped ones.
+        uint64_t submitted = 0;
+
+        /// The number of the tasks dropped because the queue was full.
+        uint64_t dropped = 0;
+
+        /// The number of the analyzed (or compiled) tasks.
+        uint64_t completed = 0;
+
+        /// The total and maximum time (in nanoseconds) of the completed tasks spent in the queue.
+        uint64_t total_wait_ns = 0;
+        uint64_t max_wait_ns = 0;
+
+        /// The total time (in nanoseconds) of the analyses, including the cache lookups,
+        /// and the JIT compilations.
+        uint64_t total_analysis_ns = 0;
+    };
+
+    explicit analysis_pool(
+        analysis_cache& cache, size_t num_threads = default_num_threads) noexcept;
+
+    analysis_pool(const analysis_pool&) = delete;
+    analysis_pool& operator=(const analysis_pool&) = delete;
+
+    /// Stops the threads, the pending tasks are dropped.
+    ~analysis_pool() noexcept;
+
+    /// Changes the number of threads (up to max_num_threads), the pending tasks are kept.
+    /// With 0 threads the submitted code is analyzed by wait() in the calling thread.
+    /// Must not be called concurrently with submit() or wait().
+    void set_num_threads(size_t num_threads) noexcept;
+
+    [[nodiscard]] size_t num_threads() const noexcept { return m_num_threads; }
+
+    /// Submits the code for the analysis with the flags, see analysis_cache::get().
+    /// Returns false if dropped.
+    bool submit(evmc_revision rev, const uint8_t* code, size_t code_size, uint32_t flags,
+        uint64_t priority = 0) noexcept;
+
+    /// Submits the compilation of the analysis with the JIT, see jit_tier::compile().
+    /// The analysis must have the jit tier. Returns false if dropped.
+    bool submit_jit(std::shared_ptr<const code_analysis> analysis, uint64_t priority) noexcept;
+
+    /// Waits until all submitted code is analyzed.
+    void wait() noexcept;
+
+    [[nodiscard]] stats get_stats() const noexcept;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct task
+    {
+        uint64_t priority = 0;
+
+        /// The submission number, orders the tasks of the same priority.
+        uint64_t seq = 0;
+
+        evmc_revision rev = EVMC_FRONTIER;
+        uint32_t flags = 0;
+        bytes code;
+        clock::time_point submit_time;
+
+        /// The analysis to compile with the JIT, the code is not analyzed then.
+        std::shared_ptr<const code_analysis> jit_analysis;
+
+        /// The order of the max-heap: the higher priority first, then the earlier submission.
+        bool operator<(const task& other) const noexcept
+        {
+            return priority != other.priority ? priority < other.priority : seq > other.seq;
+        }
+    };
+
+    /// The queue of the thread, the heap of the tasks.
+    struct queue
+    {
+        std::mutex mutex;
+        std::vector<task> tasks;
+    };
+
+    /// Queues the task unless the queue is full. Returns false if dropped.
+    bool push(task t) noexcept;
+
+    /// Starts the threads unless already started.
+    void start() noexcept;
+
+    /// Stops and joins the threads, the tasks stay in the queues.
+    void stop() noexcept;
+
+    /// Analyzes the next task of the queue, or the one stolen from the other queues.
+    /// Returns false if all queues are empty.
+    bool run_next(size_t index) noexcept;
+
+    /// The loop of the thread of the queue.
+    void run(size_t index) noexcept;
+
+    analysis_cache& m_cache;
+
+    size_t m_num_threads;
+    size_t m_num_queues;
+    std::unique_ptr<queue[]> m_queues;
+    std::vector<std::thread> m_threads;
+
+    /// Protects the start and stop, used by the waits for the submissions and the idle pool.
+    std::mutex m_mutex;
+    std::condition_variable m_submitted;
+    std::condition_variable m_idle;
+    std::atomic<bool> m_started{false};
+    std::atomic<bool> m_stop{false};
+
+    /// The number of the tasks in the queues and the number of the tasks being taken or analyzed.
+    std::atomic<size_t> m_depth{0};
+    std::atomic<size_t> m_running{0};
+
+    std::atomic<size_t> m_next_queue{0};
+    std::atomic<uint64_t> m_next_seq{0};
+
+    std::atomic<size_t> m_max_depth{0};
+    std::atomic<uint64_t> m_submitted_count{0};
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<uint64_t> m_completed{0};
+    std::atomic<uint64_t> m_total_wait_ns{0};
+    std::atomic<uint64_t> m_max_wait_ns{0};
+    std::atomic<uint64_t> m_total_analysis_ns{0};
+};
+
+/// Submits the code for the background analysis into the analysis cache of the VM,
+/// with the analysis flags of the executions with the given host (may be null).
+/// The first execution of the code finds the analysis warm. The higher priority is analyzed
+/// first, e.g. the block number of the transactions calling the code.
+/// Returns false if dropped (e.g. the queue is full or the cache is disabled).
+/// The number of threads is set with the analysis_threads option.
+/// The vm must be the evmone instance.
+EVMC_EXPORT bool prefetch_analysis(evmc_vm* vm, const evmc_host_interface* host,
+    evmc_revision rev, const uint8_t* code, size_t code_size, uint64_t priority = 0) noexcept;
+
+/// Returns the statistics of the background analysis of the VM, see prefetch_analysis().
+EVMC_EXPORT analysis_pool::stats get_analysis_pool_stats(const evmc_vm* vm) noexcept;
+}  // namespace evmone
@@ -0,0 +1,426 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "analysis_snapshot.hpp"
+#include "analysis_cache.hpp"
+#include "jit.hpp"
+#include "threaded.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace evmone
+{
+namespace
+{
+constexpr uint8_t snapshot_magic[8] = {'E', 'V', 'M', 'O', 'N', 'E', 'A', 'S'};
+
+/// The alignment of all parts of the snapshot.
+constexpr size_t snapshot_alignment = 8;
+
+struct snapshot_header
+{
+    uint8_t magic[8];
+    uint32_t version;
+    uint32_t op_table_size;
+    uint64_t fingerprint;
+    uint64_t num_entries;
+};
+
+struct entry_header
+{
+    /// The size of the entry including this header.
+    uint64_t size;
+
+    /// The hash of the entry content following this header.
+    uint64_t checksum;
+
+    uint32_t rev;
+    uint32_t flags;
+    uint64_t code_size;
+    uint64_t num_instrs;
+    uint64_t num_push_values;
+    uint64_t num_jumpdests;
+    uint64_t jumpdest_map_size;
+    uint64_t jumpdest_bitmap_size;
+};
+
+/// The position-independent instruction: the opcode instead of the function pointer.
+/// For the instructions with has_push_value_arg() the argument is the push value index.
+struct serialized_instruction
+{
+    uint32_t opcode;
+    uint32_t reserved;
+    uint64_t arg;
+};
+
+static_assert(sizeof(snapshot_header) % snapshot_alignment == 0);
+static_assert(sizeof(entry_header) % snapshot_alignment == 0);
+static_assert(sizeof(serialized_instruction) == 16);
+static_assert(sizeof(instruction_argument) == sizeof(uint64_t));
+
+/// Computes the fingerprint of the op tables. The analysis results (e.g. the block gas costs)
+/// depend on them, so the snapshot is not valid for the build with different op tables.
+uint64_t op_tables_fingerprint() noexcept
+{
+    bytes data;
+    for (int r = 0; r <= EVMC_MAX_REVISION; ++r)
+    {
+        for (const auto& e : get_op_table(static_cast<evmc_revision>(r)))
+        {
+            const auto gas_cost = static_cast<uint16_t>(e.gas_cost);
+            data.push_back(static_cast<uint8_t>(gas_cost));
+            data.push_back(static_cast<uint8_t>(gas_cost >> 8));
+            data.push_back(static_cast<uint8_t>(e.stack_req));
+            data.push_back(static_cast<uint8_t>(e.stack_change));
+        }
+    }
+    return hash_code(data.data(), data.size()) ^ snapshot_format_version;
+}
+
+void append(bytes& out, const void* data, size_t size)
+{
+    out.append(static_cast<const uint8_t*>(data), size);
+    out.resize((out.size() + snapshot_alignment - 1) / snapshot_alignment * snapshot_alignment);
+}
+
+template <typename T>
+void append(bytes& out, span<T> s)
+{
+    append(out, s.data(), s.size() * sizeof(T));
+}
+
+/// Builds the maps from the instruction functions to the opcodes for the revision.
+/// The functions shared by multiple opcodes (e.g. all PUSH9-PUSH32) map to the first one.
+/// This is sufficient, because the threaded-code labels of these opcodes are also the same.
+std::unordered_map<instruction_exec_fn, uint32_t> make_opcode_map(evmc_revision rev)
+{
+    std::unordered_map<instruction_exec_fn, uint32_t> map;
+    const auto& op_tbl = get_op_table(rev);
+    for (size_t op = 0; op < op_tbl.size(); ++op)
+        map.emplace(op_tbl[op].fn, static_cast<uint32_t>(op));
+    return map;
+}
+
+/// Serializes the entry. Returns false if the analysis has unknown instructions.
+bool serialize_entry(bytes& out, const snapshot_entry& entry,
+    const std::unordered_map<instruction_exec_fn, uint32_t>& opcode_map)
+{
+    const auto& analysis = *entry.analysis;
+    const auto header_pos = out.size();
+
+    entry_header header{};
+    header.rev = static_cast<uint32_t>(entry.rev);
+    header.flags = entry.flags;
+    header.code_size = entry.code->size();
+    header.num_instrs = analysis.instrs.size();
+    header.num_push_values = analysis.push_values.size();
+    header.num_jumpdests = analysis.jumpdest_offsets.size();
+    header.jumpdest_map_size = analysis.jumpdest_map.size();
+    header.jumpdest_bitmap_size = analysis.jumpdest_bitmap.size();
+    append(out, &header, sizeof(header));
+
+    append(out, entry.code->data(), entry.code->size());
+
+    for (const auto& instr : analysis.instrs)
+    {
+        const auto it = opcode_map.find(instr.fn);
+        if (it == opcode_map.end())
+            return false;
+
+        serialized_instruction s{it->second, 0, 0};
+        if (has_push_value_arg(static_cast<int>(s.opcode)))
+            s.arg = static_cast<uint64_t>(instr.arg.push_value - analysis.push_values.data());
+        else
+            std::memcpy(&s.arg, static_cast<const void*>(&instr.arg), sizeof(s.arg));
+        append(out, &s, sizeof(s));
+    }
+
+    append(out, analysis.push_values);
+    append(out, analysis.jumpdest_offsets);
+    append(out, analysis.jumpdest_targets);
+    append(out, analysis.jumpdest_map);
+    append(out, analysis.jumpdest_bitmap);
+    append(out, analysis.jumpdest_rank);
+
+    header.size = out.size() - header_pos;
+    const auto content = &out[header_pos + sizeof(header)];
+    header.checksum = hash_code(content, header.size - sizeof(header));
+    std::memcpy(&out[header_pos], &header, sizeof(header));
+    return true;
+}
+
+/// The reader of the snapshot parts with bounds checking.
+class reader
+{
+    const uint8_t* m_pos;
+    const uint8_t* m_end;
+
+public:
+    reader(const uint8_t* data, size_t size) noexcept : m_pos{data}, m_end{data + size} {}
+
+    /// Returns the pointer to the next part of the size or nullptr if out of bounds.
+    const uint8_t* take(size_t size) noexcept
+    {
+        if (size > static_cast<size_t>(m_end - m_pos))
+            return nullptr;
+        const auto p = m_pos;
+        const auto padded_size =
+            (size + snapshot_alignment - 1) / snapshot_alignment * snapshot_alignment;
+        m_pos += std::min(padded_size, static_cast<size_t>(m_end - m_pos));
+        return p;
+    }
+
+    /// Copies the next part to the span. Returns false if out of bounds.
+    template <typename T>
+    bool read(span<T> s) noexcept
+    {
+        const auto n = s.size() * sizeof(T);
+        const auto p = take(n);
+        if (p == nullptr)
+            return false;
+        if (n != 0)
+            std::memcpy(s.data(), p, n);
+        return true;
+    }
+};
+
+bool is_valid_target(int64_t target, size_t num_instrs) noexcept
+{
+    return target >= -1 && target < static_cast<int64_t>(num_instrs);
+}
+
+/// Deserializes and rebinds the entry content. Returns false if the content is invalid.
+bool deserialize_entry(const entry_header& header, reader& r, snapshot_entry& entry) noexcept
+{
+    if (header.rev > EVMC_MAX_REVISION)
+        return false;
+
+    // The sizes are limited by the size of the entry, this also prevents overflows.
+    const auto max_count = header.size;
+    if (header.code_size > max_count || header.num_instrs > max_count ||
+        header.num_push_values > max_count || header.num_jumpdests > max_count ||
+        header.jumpdest_map_size > max_count || header.jumpdest_bitmap_size > max_count)
+        return false;
+
+    entry.rev = static_cast<evmc_revision>(header.rev);
+    entry.flags = header.flags;
+
+    const auto code = r.take(header.code_size);
+    if (code == nullptr)
+        return false;
+    entry.code = std::make_shared<const bytes>(code, header.code_size);
+
+    const auto num_instrs = static_cast<size_t>(header.num_instrs);
+    const auto dispatch_table =
+        (header.flags & ANALYSIS_THREADED_CODE) != 0 ? get_threaded_dispatch_table() : nullptr;
+    auto analysis = allocate_analysis({num_instrs, dispatch_table != nullptr ? num_instrs : 0,
+        static_cast<size_t>(header.num_push_values), static_cast<size_t>(header.num_jumpdests),
+        static_cast<size_t>(header.jumpdest_map_size),
+        static_cast<size_t>(header.jumpdest_bitmap_size)});
+
+    // Rebind the instructions to the current op table.
+    const auto instrs = r.take(num_instrs * sizeof(serialized_instruction));
+    if (instrs == nullptr || num_instrs == 0)
+        return false;
+    const auto& op_tbl = get_op_table(entry.rev);
+    std::vector<int> opcodes(num_instrs);
+    for (size_t i = 0; i < num_instrs; ++i)
+    {
+        serialized_instruction s;
+        std::memcpy(&s, &instrs[i * sizeof(s)], sizeof(s));
+        if (s.opcode >= op_table_size)
+            return false;
+        const auto opcode = static_cast<int>(s.opcode);
+        opcodes[i] = opcode;
+
+        auto& instr = *new (&analysis.instrs[i]) instruction{op_tbl[s.opcode].fn};
+        if (has_push_value_arg(opcode))
+        {
+            if (s.arg >= analysis.push_values.size())
+                return false;
+            instr.arg.push_value = &analysis.push_values[static_cast<size_t>(s.arg)];
+        }
+        else
+            std::memcpy(static_cast<void*>(&instr.arg), &s.arg, sizeof(s.arg));
+
+        if ((opcode == OPX_STATIC_JUMP || opcode == OPX_STATIC_JUMPI ||
+                opcode == OPX_ISZERO_STATIC_JUMPI) &&
+            !is_valid_target(instr.arg.number, num_instrs))
+            return false;
+    }
+
+    // The execution must not run over the instructions end.
+    if (opcodes.back() != OP_STOP)
+        return false;
+
+    if (!r.read(analysis.push_values) || !r.read(analysis.jumpdest_offsets) ||
+        !r.read(analysis.jumpdest_targets) || !r.read(analysis.jumpdest_map) ||
+        !r.read(analysis.jumpdest_bitmap) || !r.read(analysis.jumpdest_rank))
+        return false;
+
+    for (const auto target : analysis.jumpdest_targets)
+    {
+        if (!is_valid_target(target, num_instrs))
+            return false;
+    }
+    for (const auto target : analysis.jumpdest_map)
+    {
+        if (!is_valid_target(target, num_instrs))
+            return false;
+    }
+
+    // The ranks must be consistent with the bitmap, they are used as the jumpdest_targets indexes.
+    size_t rank = 0;
+    for (size_t i = 0; i < analysis.jumpdest_bitmap.size(); ++i)
+    {
+        if (static_cast<size_t>(analysis.jumpdest_rank[i]) != rank)
+            return false;
+        rank += static_cast<size_t>(popcount(analysis.jumpdest_bitmap[i]));
+    }
+    if (rank > analysis.jumpdest_targets.size())
+        return false;
+
+    if (dispatch_table != nullptr)
+        build_labels(analysis, entry.rev, opcodes.data());
+
+    // The execution counts are not saved, the code is compiled after the threshold again.
+    if ((header.flags & ANALYSIS_JIT) != 0)
+        analysis.jit = std::make_unique<jit_tier>();
+
+    entry.analysis = std::make_shared<const code_analysis>(std::move(analysis));
+    return true;
+}
+}  // namespace
+
+bytes serialize_snapshot(const std::vector<snapshot_entry>& entries) noexcept
+{
+    snapshot_header header{};
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version = snapshot_format_version;
+    header.op_table_size = op_table_size;
+    header.fingerprint = op_tables_fingerprint();
+
+    bytes out;
+    append(out, &header, sizeof(header));
+
+    std::unordered_map<instruction_exec_fn, uint32_t> opcode_maps[EVMC_MAX_REVISION + 1];
+    for (const auto& entry : entries)
+    {
+        // The lazy analyses, the code offsets (only used for tracing)
+        // and the prefetch hints are not serialized.
+        if (entry.analysis->lazy || !entry.analysis->code_offsets.empty() ||
+            !entry.analysis->prefetch_blocks.empty())
+            continue;
+
+        auto& opcode_map = opcode_maps[entry.rev];
+        if (opcode_map.empty())
+            opcode_map = make_opcode_map(entry.rev);
+
+        const auto entry_pos = out.size();
+        if (serialize_entry(out, entry, opcode_map))
+            ++header.num_entries;
+        else
+            out.resize(entry_pos);
+    }
+
+    std::memcpy(&out[0], &header, sizeof(header));
+    return out;
+}
+
+std::vector<snapshot_entry> deserialize_snapshot(const uint8_t* data, size_t size) noexcept
+{
+    std::vector<snapshot_entry> entries;
+
+    snapshot_header header;
+    if (size < sizeof(header))
+        return entries;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0 ||
+        header.version != snapshot_format_version || header.op_table_size != op_table_size ||
+        header.fingerprint != op_tables_fingerprint())
+        return entries;
+
+    auto pos = sizeof(header);
+    for (uint64_t i = 0; i < header.num_entries; ++i)
+    {
+        entry_header entry_hdr;
+        if (size - pos < sizeof(entry_hdr))
+            break;
+        std::memcpy(&entry_hdr, &data[pos], sizeof(entry_hdr));
+        if (entry_hdr.size < sizeof(entry_hdr) || entry_hdr.size > size - pos ||
+            entry_hdr.size % snapshot_alignment != 0)
+            break;
+
+        const auto content = &data[pos + sizeof(entry_hdr)];
+        const auto content_size = static_cast<size_t>(entry_hdr.size) - sizeof(entry_hdr);
+        pos += static_cast<size_t>(entry_hdr.size);
+
+        // Skip the corrupted entries, the following ones can still be valid.
+        if (hash_code(content, content_size) != entry_hdr.checksum)
+            continue;
+
+        reader r{content, content_size};
+        snapshot_entry entry;
+        if (deserialize_entry(entry_hdr, r, entry))
+            entries.emplace_back(std::move(entry));
+    }
+    return entries;
+}
+
+bool save_snapshot_file(const char* path, const bytes& snapshot) noexcept
+{
+    // Write to the temporary file first, so the existing snapshot is replaced atomically.
+    const auto tmp_path = std::string{path} + ".tmp";
+    const auto f = std::fopen(tmp_path.c_str(), "wb");
+    if (f == nullptr)
+        return false;
+    const auto written = std::fwrite(snapshot.data(), 1, snapshot.size(), f);
+    const auto closed = std::fclose(f) == 0;
+    if (written != snapshot.size() || !closed)
+    {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return std::rename(tmp_path.c_str(), path) == 0;
+}
+
+std::vector<snapshot_entry> load_snapshot_file(const char* path) noexcept
+{
+#if defined(_WIN32)
+    std::ifstream file{path, std::ios::binary};
+    const auto data = bytes{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    return deserialize_snapshot(data.data(), data.size());
+#else
+    const auto fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return {};
+
+    std::vector<snapshot_entry> entries;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        const auto size = static_cast<size_t>(st.st_size);
+        const auto p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            entries = deserialize_snapshot(static_cast<const uint8_t*>(p), size);
+            munmap(p, size);
+        }
+    }
+    close(fd);
+    return entries;
+#endif
+}
+}  // namespace evmone
@@ -0,0 +1,52 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include "analysis.hpp"
+#include <memory>
+#include <vector>
+
+namespace evmone
+{
+/// The version of the snapshot format. Must be changed with any change of the format
+/// or of the analysis results, e.g. new intrinsic instructions.
+constexpr uint32_t snapshot_format_version = 1;
+
+/// The code analysis with the code and the parameters it has been created with.
+struct snapshot_entry
+{
+    evmc_revision rev;
+    uint32_t flags;
+    std::shared_ptr<const bytes> code;
+    std::shared_ptr<const code_analysis> analysis;
+};
+
+/// Serializes the code analyses into the snapshot.
+///
+/// The format is versioned, position-independent and aligned to 8 bytes, so it can be read
+/// in place from the read-only memory-mapped file. The analyses are not used from the file
+/// directly: deserialize_snapshot() copies them to the new arenas while rebinding them.
+/// The instruction functions are stored as the opcodes (the indexes in the op_table)
+/// and the push value pointers as the indexes in the push values array.
+/// The threaded-code labels are not stored. The lazy analyses and the analyses with
+/// the code offsets are skipped.
+///
+/// The snapshot is valid only for the build of evmone with the same op tables
+/// (gas costs and stack requirements), this is checked with the fingerprint in the header.
+EVMC_EXPORT bytes serialize_snapshot(const std::vector<snapshot_entry>& entries) noexcept;
+
+/// Deserializes the code analyses from the snapshot and rebinds them: the instruction
+/// functions and the threaded-code labels are taken from the current op tables.
+/// Returns no entries if the snapshot is invalid or created by incompatible build.
+/// The individual corrupted entries are skipped.
+EVMC_EXPORT std::vector<snapshot_entry> deserialize_snapshot(
+    const uint8_t* data, size_t size) noexcept;
+
+/// Writes the snapshot to the file. Returns false on failure.
+EVMC_EXPORT bool save_snapshot_file(const char* path, const bytes& snapshot) noexcept;
+
+/// Deserializes the snapshot from the file, memory-mapped read-only if supported.
+/// The mapping is released after the analyses are copied. Returns no entries on failure.
+EVMC_EXPORT std::vector<snapshot_entry> load_snapshot_file(const char* path) noexcept;
+}  // namespace evmone
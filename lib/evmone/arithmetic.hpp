@@ -0,0 +1,143 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include <intx/intx.hpp>
+
+/// The 64-bit fast paths of the uint256 arithmetic.
+///
+/// Most of the values in the EVM execution are small (counters, offsets, lengths), but
+/// the generic uint256 multiplication and especially the multiword division do the full
+/// 256-bit work regardless. These functions first check the upper words of the operands
+/// and use the native 64-bit (or 128-bit) arithmetic when the operands fit in 64 bits.
+/// The additions, subtractions and comparisons are not specialized: the generic versions
+/// are a few instructions without branches, the check would cost more than it saves.
+namespace evmone::arith
+{
+using intx::uint256;
+
+/// Checks if the value fits in 64 bits, i.e. the upper 3 words are zero.
+inline bool fits_u64(const uint256& x) noexcept
+{
+    const auto w = intx::as_words(x);
+    return (w[1] | w[2] | w[3]) == 0;
+}
+
+/// Returns the low 64 bits of the value.
+inline uint64_t low_u64(const uint256& x) noexcept
+{
+    return intx::as_words(x)[0];
+}
+
+#ifdef __SIZEOF_INT128__
+/// The native 128-bit unsigned integer of GCC and Clang.
+__extension__ typedef unsigned __int128 native_uint128;
+#endif
+
+/// Creates the value from the two lowest words.
+inline uint256 make_u128(uint64_t lo, uint64_t hi) noexcept
+{
+    uint256 x{lo};
+    intx::as_words(x)[1] = hi;
+    return x;
+}
+
+inline uint256 mul(const uint256& a, const uint256& b) noexcept
+{
+#ifdef __SIZEOF_INT128__
+    if (fits_u64(a) && fits_u64(b))
+    {
+        const auto p = static_cast<native_uint128>(low_u64(a)) * low_u64(b);
+        return make_u128(static_cast<uint64_t>(p), static_cast<uint64_t>(p >> 64));
+    }
+#endif
+    return a * b;
+}
+
+/// The unsigned division, the divisor must not be zero.
+inline uint256 div(const uint256& a, const uint256& b) noexcept
+{
+    if (fits_u64(a) && fits_u64(b))
+        return low_u64(a) / low_u64(b);
+    return a / b;
+}
+
+/// The unsigned remainder, the divisor must not be zero.
+inline uint256 mod(const uint256& a, const uint256& b) noexcept
+{
+    if (fits_u64(a) && fits_u64(b))
+        return low_u64(a) % low_u64(b);
+    return a % b;
+}
+
+/// The signed division, the divisor must not be zero.
+/// The values fitting in 64 bits are non-negative, so the unsigned division is used.
+inline uint256 sdiv(const uint256& a, const uint256& b) noexcept
+{
+    if (fits_u64(a) && fits_u64(b))
+        return low_u64(a) / low_u64(b);
+    return intx::sdivrem(a, b).quot;
+}
+
+/// The signed remainder, the divisor must not be zero.
+inline uint256 smod(const uint256& a, const uint256& b) noexcept
+{
+    if (fits_u64(a) && fits_u64(b))
+        return low_u64(a) % low_u64(b);
+    return intx::sdivrem(a, b).rem;
+}
+
+/// The (x + y) % m, the modulus must not be zero.
+inline uint256 addmod(const uint256& x, const uint256& y, const uint256& m) noexcept
+{
+#ifdef __SIZEOF_INT128__
+    if (fits_u64(x) && fits_u64(y) && fits_u64(m))
+    {
+        const auto s = static_cast<native_uint128>(low_u64(x)) + low_u64(y);
+        return static_cast<uint64_t>(s % low_u64(m));
+    }
+#endif
+    return intx::addmod(x, y, m);
+}
+
+/// The (x * y) % m, the modulus must not be zero.
+inline uint256 mulmod(const uint256& x, const uint256& y, const uint256& m) noexcept
+{
+#ifdef __SIZEOF_INT128__
+    if (fits_u64(x) && fits_u64(y) && fits_u64(m))
+    {
+        const auto p = static_cast<native_uint128>(low_u64(x)) * low_u64(y);
+        return static_cast<uint64_t>(p % low_u64(m));
+    }
+#endif
+    return intx::mulmod(x, y, m);
+}
+
+/// The base to the power of the exponent, modulo 2^256.
+inline uint256 exp(const uint256& base, const uint256& exponent) noexcept
+{
+    if (!fits_u64(exponent))
+        return intx::exp(base, exponent);
+
+    auto e = low_u64(exponent);
+
+    // The powers of 2 (frequent e.g. in the Solidity generated code) are the shifts.
+    if (base == 2)
+        return e < 256 ? uint256{1} << static_cast<unsigned>(e) : 0;
+
+    // The square-and-multiply with the exponent in the 64-bit register,
+    // the multiplications use the fast path while the values are small.
+    uint256 result = 1;
+    auto b = base;
+    while (e != 0)
+    {
+        if ((e & 1) != 0)
+            result = mul(result, b);
+        e >>= 1;
+        if (e != 0)
+            b = mul(b, b);
+    }
+    return result;
+}
+}  // namespace evmone::arith
@@ -0,0 +1,70 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "batch_workers.hpp"
+#include <algorithm>
+
+namespace evmone
+{
+batch_workers::~batch_workers() noexcept
+{
+    {
+        std::lock_guard lock{m_mutex};
+        m_stop = true;
+    }
+    m_started.notify_all();
+    for (auto& t : m_threads)
+        t.join();
+}
+
+void batch_workers::run(size_t num_threads, const std::function<void()>& job) noexcept
+{
+    std::unique_lock run_lock{m_run_mutex, std::defer_lock};
+    num_threads = std::min(num_threads, max_num_threads);
+    if (num_threads == 0 || !run_lock.try_lock())
+    {
+        job();
+        return;
+    }
+
+    {
+        std::lock_guard lock{m_mutex};
+        for (auto i = m_threads.size(); i < num_threads; ++i)
+            m_threads.emplace_back(&batch_workers::run_thread, this, i, m_generation);
+        m_job = &job;
+        m_num_active = num_threads;
+        m_num_pending = num_threads;
+        ++m_generation;
+    }
+    m_started.notify_all();
+
+    job();
+
+    std::unique_lock lock{m_mutex};
+    m_finished.wait(lock, [this] { return m_num_pending == 0; });
+    m_job = nullptr;
+}
+
+void batch_workers::run_thread(size_t index, uint64_t generation) noexcept
+{
+    std::unique_lock lock{m_mutex};
+    while (true)
+    {
+        m_started.wait(lock, [this, generation] { return m_stop || m_generation != generation; });
+        if (m_stop)
+            return;
+
+        generation = m_generation;
+        if (index >= m_num_active)
+            continue;
+
+        const auto& job = *m_job;
+        lock.unlock();
+        job();
+        lock.lock();
+        if (--m_num_pending == 0)
+            m_finished.notify_one();
+    }
+}
+}  // namespace evmone
@@ -0,0 +1,62 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace evmone
+{
+/// The persistent threads executing the batches of the VM, see execute_batch().
+///
+/// The threads are created by the first batch needing them and live with the VM, so their
+/// thread-local execution states are reused by the following batches. One batch uses
+/// the threads at a time, the concurrent batches are executed by the calling thread only.
+class batch_workers
+{
+public:
+    /// The limit of the number of threads.
+    static constexpr size_t max_num_threads = 256;
+
+    batch_workers() noexcept = default;
+
+    batch_workers(const batch_workers&) = delete;
+    batch_workers& operator=(const batch_workers&) = delete;
+
+    /// Stops and joins the threads.
+    ~batch_workers() noexcept;
+
+    /// Runs the job in the calling thread and concurrently in num_threads of the threads
+    /// (up to max_num_threads), returns when all of them have finished.
+    void run(size_t num_threads, const std::function<void()>& job) noexcept;
+
+private:
+    /// The loop of the thread, the generation is the one of the last run before its creation.
+    void run_thread(size_t index, uint64_t generation) noexcept;
+
+    /// Taken by the run using the threads.
+    std::mutex m_run_mutex;
+
+    std::mutex m_mutex;
+    std::condition_variable m_started;
+    std::condition_variable m_finished;
+    std::vector<std::thread> m_threads;
+
+    const std::function<void()>* m_job = nullptr;
+
+    /// The number of the runs, the threads start the job when it changes.
+    uint64_t m_generation = 0;
+
+    /// The number of the threads running the job of the current run and not finished yet.
+    size_t m_num_active = 0;
+    size_t m_num_pending = 0;
+
+    bool m_stop = false;
+};
+}  // namespace evmone
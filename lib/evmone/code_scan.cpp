@@ -0,0 +1,115 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "code_scan.hpp"
+#include "analysis.hpp"
+#include <evmc/instructions.h>
+#include <algorithm>
+#include <cstring>
+
+namespace evmone
+{
+namespace
+{
+/// The size of the code chunk classified at once: the number of bits in the mask.
+constexpr size_t chunk_size = 64;
+
+/// The classification of the bytes of the code chunk, the bit i is for the byte i.
+struct chunk_masks
+{
+    /// The bytes equal to JUMPDEST.
+    uint64_t jumpdests;
+
+    /// The bytes equal to any of PUSH1-PUSH32.
+    uint64_t pushes;
+};
+
+inline int countr_zero(uint64_t x) noexcept
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+/// Classifies the bytes of the chunk without branches.
+chunk_masks classify(const uint8_t* chunk) noexcept
+{
+    chunk_masks m{0, 0};
+    for (size_t i = 0; i < chunk_size; ++i)
+    {
+        const auto byte = chunk[i];
+        m.jumpdests |= uint64_t{byte == OP_JUMPDEST} << i;
+        m.pushes |= uint64_t{(byte & 0xe0) == OP_PUSH1} << i;
+    }
+    return m;
+}
+}  // namespace
+
+code_scan scan_code(const uint8_t* code, size_t code_size, uint64_t* jumpdest_bitmap) noexcept
+{
+    // Every chunk is classified at once, then the push data are skipped by iterating only
+    // over the PUSH instructions.
+    code_scan result;
+
+    // The number of push data bytes continuing from the previous chunk.
+    size_t skip = 0;
+
+    for (size_t base = 0; base < code_size; base += chunk_size)
+    {
+        // The last incomplete chunk is padded with STOPs.
+        uint8_t padded_chunk[chunk_size];
+        auto chunk = &code[base];
+        if (code_size - base < chunk_size)
+        {
+            std::memset(padded_chunk, OP_STOP, chunk_size);
+            std::memcpy(padded_chunk, chunk, code_size - base);
+            chunk = padded_chunk;
+        }
+
+        const auto m = classify(chunk);
+
+        // The mask of the push data bytes.
+        uint64_t data = ~uint64_t{0};
+        if (skip >= chunk_size)
+            skip -= chunk_size;
+        else
+        {
+            data = (uint64_t{1} << skip) - 1;
+            skip = 0;
+
+            auto pushes = m.pushes & ~data;
+            while (pushes != 0)
+            {
+                const auto pos = static_cast<size_t>(countr_zero(pushes));
+                const auto push_size = static_cast<size_t>(chunk[pos] - OP_PUSH1) + 1;
+                if (push_size > 8)
+                    ++result.num_large_pushes;
+
+                const auto end = pos + 1 + push_size;
+                if (end >= chunk_size)
+                {
+                    // The push data continue to the next chunk.
+                    if (pos + 1 < chunk_size)
+                        data |= ~uint64_t{0} << (pos + 1);
+                    skip = end - chunk_size;
+                    break;
+                }
+
+                data |= ((uint64_t{1} << push_size) - 1) << (pos + 1);
+                pushes &= ~((uint64_t{1} << end) - 1);
+            }
+        }
+
+        const auto jumpdests = m.jumpdests & ~data;
+        jumpdest_bitmap[base / chunk_size] = jumpdests;
+        result.num_jumpdests += static_cast<size_t>(popcount(jumpdests));
+    }
+
+    return result;
+}
+}  // namespace evmone
@@ -0,0 +1,30 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include <evmc/utils.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace evmone
+{
+/// The summary of the code collected by scan_code().
+struct code_scan
+{
+    /// The number of valid jump destinations (JUMPDESTs not being the push data).
+    size_t num_jumpdests = 0;
+
+    /// The number of PUSH instructions with more than 8 bytes of data (PUSH9 to PUSH32).
+    size_t num_large_pushes = 0;
+};
+
+/// Scans the code for the valid jump destinations, skipping the push data.
+///
+/// This is the upfront pass of the lazy analysis and processes 64 bytes of code at a time.
+/// The bitmap of JUMPDEST offsets is written to the jumpdest_bitmap, the array of
+/// (code_size + 63) / 64 words. The bit (offset % 64) in the word (offset / 64) is set
+/// for every valid JUMPDEST.
+EVMC_EXPORT code_scan scan_code(
+    const uint8_t* code, size_t code_size, uint64_t* jumpdest_bitmap) noexcept;
+}  // namespace evmone
@@ -7,26 +7,219 @@
 /// The file name matches the evmone.h public header.
 
 #include "execution.hpp"
+#include "vm.hpp"
 #include <evmone/evmone.h>
+#include <cassert>
+#include <charconv>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <string_view>
 
-extern "C" {
-EVMC_EXPORT evmc_vm* evmc_create_evmone() noexcept
+namespace evmone
+{
+namespace
+{
+void destroy(evmc_vm* vm) noexcept
+{
+    assert(vm != nullptr);
+    delete static_cast<VM*>(vm);
+}
+
+constexpr evmc_capabilities_flagset get_capabilities(evmc_vm* /*vm*/) noexcept
+{
+    return EVMC_CAPABILITY_EVM1;
+}
+
+/// Parses the option value being a non-negative decimal number.
+bool parse_number(std::string_view value, size_t& out) noexcept
 {
-    static constexpr auto destroy = [](evmc_vm*) noexcept {};
-    static constexpr auto get_capabilities = [](evmc_vm*) noexcept
+    const auto end = value.data() + value.size();
+    const auto [ptr, ec] = std::from_chars(value.data(), end, out);
+    return ec == std::errc{} && ptr == end;
+}
+
+evmc_set_option_result set_option(evmc_vm* c_vm, char const* c_name, char const* c_value) noexcept
+{
+    const auto name = (c_name != nullptr) ? std::string_view{c_name} : std::string_view{};
+    const auto value = (c_value != nullptr) ? std::string_view{c_value} : std::string_view{};
+    auto& vm = *static_cast<VM*>(c_vm);
+
+    if (name == "analysis_cache_size")
+    {
+        // The cache capacity in MiB. The value 0 disables the cache.
+        constexpr size_t max_capacity_mib = std::numeric_limits<size_t>::max() >> 20;
+        size_t capacity_mib = 0;
+        if (!parse_number(value, capacity_mib) || capacity_mib > max_capacity_mib)
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        vm.cache.set_capacity(capacity_mib << 20);
+        return EVMC_SET_OPTION_SUCCESS;
+    }
+
+    if (name == "fusion")
+    {
+        // The superinstructions fusion in the code analysis: "on" (default) or "off".
+        if (value == "on")
+            vm.analysis_flags |= ANALYSIS_FUSION;
+        else if (value == "off")
+            vm.analysis_flags &= ~uint32_t{ANALYSIS_FUSION};
+        else
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        return EVMC_SET_OPTION_SUCCESS;
+    }
+
+    if (name == "precharge")
+    {
+        // The precharging of the dynamic gas costs at the block start: "on" (default) or "off".
+        if (value == "on")
+            vm.analysis_flags |= ANALYSIS_PRECHARGE;
+        else if (value == "off")
+            vm.analysis_flags &= ~uint32_t{ANALYSIS_PRECHARGE};
+        else
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        return EVMC_SET_OPTION_SUCCESS;
+    }
+
+    if (name == "jit")
     {
-        return evmc_capabilities_flagset{EVMC_CAPABILITY_EVM1};
-    };
+        // The JIT compilation of the code: "off" (default), "on" (after the default number
+        // of executions) or the number of the interpreted executions before the compilation.
+        // The code is interpreted if the JIT is not available on the platform.
+        size_t threshold = 0;
+        if (value == "off")
+            vm.analysis_flags &= ~uint32_t{ANALYSIS_JIT};
+        else if (value == "on")
+        {
+            vm.analysis_flags |= ANALYSIS_JIT;
+            vm.jit_threshold = default_jit_threshold;
+        }
+        else if (parse_number(value, threshold) &&
+                 threshold < std::numeric_limits<uint32_t>::max())
+        {
+            vm.analysis_flags |= ANALYSIS_JIT;
+            vm.jit_threshold = static_cast<uint32_t>(threshold);
+        }
+        else
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        return EVMC_SET_OPTION_SUCCESS;
+    }
 
-    static auto instance = evmc_vm{
+    if (name == "dispatch")
+    {
+        // The interpreter: "call" (default, the instruction functions chaining) or "threaded".
+        // The threaded-code interpreter falls back to "call" if not available in the build.
+        if (value == "threaded")
+            vm.analysis_flags |= ANALYSIS_THREADED_CODE;
+        else if (value == "call")
+            vm.analysis_flags &= ~uint32_t{ANALYSIS_THREADED_CODE};
+        else
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        return EVMC_SET_OPTION_SUCCESS;
+    }
+
+    if (name == "analysis")
+    {
+        // The code analysis mode: "full" (default) or "lazy" (the code segments on first entry).
+        // The lazy analysis uses the "call" interpreter.
+        if (value == "full")
+            vm.analysis_flags &= ~uint32_t{ANALYSIS_LAZY};
+        else if (value == "lazy")
+            vm.analysis_flags |= ANALYSIS_LAZY;
+        else
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        return EVMC_SET_OPTION_SUCCESS;
+    }
+
+    if (name == "create_analysis")
+    {
+        // The analysis of the code deployed by creates ahead of its first call:
+        // "off" (default), "sync" (in the executing thread) or "async" (in the background).
+        if (value == "off")
+            vm.create_analysis = create_analysis_mode::off;
+        else if (value == "sync")
+            vm.create_analysis = create_analysis_mode::sync;
+        else if (value == "async")
+            vm.create_analysis = create_analysis_mode::async;
+        else
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        return EVMC_SET_OPTION_SUCCESS;
+    }
+
+    if (name == "analysis_threads")
+    {
+        // The number of the background analysis threads, see prefetch_analysis().
+        size_t num_threads = 0;
+        if (!parse_number(value, num_threads) || num_threads == 0 ||
+            num_threads > analysis_pool::max_num_threads)
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        vm.pool.set_num_threads(num_threads);
+        return EVMC_SET_OPTION_SUCCESS;
+    }
+
+    if (name == "analysis_cache_save")
+    {
+        // Saves the analysis cache snapshot to the file at the path given as the value.
+        const auto path = std::string{value};
+        if (path.empty())
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        const auto snapshot = serialize_snapshot(vm.cache.export_entries());
+        if (!save_snapshot_file(path.c_str(), snapshot))
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        return EVMC_SET_OPTION_SUCCESS;
+    }
+
+    if (name == "analysis_cache_load")
+    {
+        // Loads the analysis cache snapshot from the file at the path given as the value.
+        // The snapshot saved by incompatible build of evmone is rejected.
+        const auto path = std::string{value};
+        if (path.empty())
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        auto entries = load_snapshot_file(path.c_str());
+        if (entries.empty())
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        vm.cache.import_entries(std::move(entries));
+        return EVMC_SET_OPTION_SUCCESS;
+    }
+
+#if EVMONE_PROFILING
+    if (name == "profile_json" || name == "profile_folded")
+    {
+        // Writes the execution profile to the file at the path given as the value.
+        const auto path = std::string{value};
+        const auto profile =
+            name == "profile_json" ? vm.profile.to_json() : vm.profile.to_folded();
+        const auto f = !path.empty() ? std::fopen(path.c_str(), "w") : nullptr;
+        if (f == nullptr)
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        const auto written = std::fwrite(profile.data(), 1, profile.size(), f);
+        const auto closed = std::fclose(f) == 0;
+        if (written != profile.size() || !closed)
+            return EVMC_SET_OPTION_INVALID_VALUE;
+        return EVMC_SET_OPTION_SUCCESS;
+    }
+#endif
+
+    return EVMC_SET_OPTION_INVALID_NAME;
+}
+}  // namespace
+
+VM::VM() noexcept
+  : evmc_vm{
         EVMC_ABI_VERSION,
         "evmone",
         PROJECT_VERSION,
-        destroy,
+        evmone::destroy,
         evmone::execute,
-        get_capabilities,
-        /* set_option(): */ nullptr,
-    };
-    return &instance;
+        evmone::get_capabilities,
+        evmone::set_option,
+    }
+{}
+}  // namespace evmone
+
+extern "C" {
+EVMC_EXPORT evmc_vm* evmc_create_evmone() noexcept
+{
+    return new evmone::VM{};
 }
 }
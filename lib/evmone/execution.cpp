@@ -4,32 +4,487 @@
 
 #include "execution.hpp"
 #include "analysis.hpp"
+#include "jit.hpp"
+#include "lazy_analysis.hpp"
+#include "threaded.hpp"
+#include "tracing.hpp"
+#include "vm.hpp"
+#include <evmc/helpers.h>
+#include <algorithm>
+#include <atomic>
+#include <limits>
 #include <memory>
+#include <vector>
 
 namespace evmone
 {
-evmc_result execute(evmc_vm* /*unused*/, const evmc_host_interface* host, evmc_host_context* ctx,
-    evmc_revision rev, const evmc_message* msg, const uint8_t* code, size_t code_size) noexcept
+namespace
+{
+/// Set by the destructor of the state_pool of the thread, trivial so it outlives the pool.
+thread_local bool state_pool_destroyed = false;
+
+/// The pool of execution states for reuse by executions in a single thread.
+///
+/// The execution_state is big (the stack alone is 32 KiB) so allocating and value-initializing
+/// it for every execution is expensive. Nested calls are executed in the same thread, so
+/// at most two states per call depth are in use at the same time: the one of the frame
+/// and the one of its last callee, kept by the frame's return data.
+/// Released states are kept in the LIFO order so the most recently used (and likely cache-hot)
+/// one is reused first.
+///
+/// Every state keeps its memory reservation (see evm_memory), so only a few released states
+/// are kept: the deep call graphs must not leave hundreds of idle reservations in every thread.
+/// The states released over the limit are destroyed.
+class execution_state_pool
 {
-    auto analysis = analyze(rev, code, code_size);
+    /// The limit of kept states.
+    static constexpr size_t max_size = 16;
+
+    std::vector<std::unique_ptr<execution_state>> m_states;
+
+public:
+    ~execution_state_pool() noexcept { state_pool_destroyed = true; }
+
+    std::unique_ptr<execution_state> acquire() noexcept
+    {
+        if (m_states.empty())
+            return std::make_unique<execution_state>();
+
+        auto state = std::move(m_states.back());
+        m_states.pop_back();
+        return state;
+    }
+
+    void release(std::unique_ptr<execution_state> state) noexcept
+    {
+        if (m_states.size() < max_size)
+            m_states.emplace_back(std::move(state));
+    }
+};
+
+thread_local execution_state_pool state_pool;
+
+/// The frames of the nested calls executed in the thread (see set_host_nested_calls()),
+/// indexed by the call depth.
+///
+/// The frame of the depth is used by a single call at a time: the result of the call references
+/// the memory of the frame and is kept by the caller's return data, which is cleared before
+/// the caller's next call. The finished frame releases its own return data, so the frames
+/// of the deeper calls are free. The frames are allocated on the first use and kept
+/// up to max_retained_depth, so the usual call graphs do not allocate. The deeper frames
+/// (each with its memory reservation) are destroyed by trim() after the execution.
+class nested_frames
+{
+    /// The number of frames kept by trim().
+    static constexpr size_t max_retained_depth = 16;
+
+    std::vector<std::unique_ptr<execution_state>> m_frames;
+
+public:
+    execution_state& get(int32_t depth) noexcept
+    {
+        const auto index = static_cast<size_t>(depth);
+        if (index >= m_frames.size())
+            m_frames.resize(index + 1);
+        auto& frame = m_frames[index];
+        if (frame == nullptr)
+            frame = std::make_unique<execution_state>();
+        return *frame;
+    }
 
-    auto state = std::make_unique<execution_state>();
-    state->analysis = &analysis;
-    state->msg = msg;
-    state->code = code;
-    state->code_size = code_size;
-    state->host = evmc::HostContext{*host, ctx};
-    state->gas_left = msg->gas;
-    state->rev = rev;
+    /// Destroys the frames over max_retained_depth not used by the executions of the thread
+    /// in progress: the frames of the depth and deeper are free after the execution
+    /// of the message of the depth finishes.
+    void trim(int32_t depth) noexcept
+    {
+        const auto keep = std::max(static_cast<size_t>(depth), max_retained_depth);
+        if (m_frames.size() > keep)
+            m_frames.resize(keep);
+    }
+};
 
-    const auto* instr = &state->analysis->instrs[0];
+thread_local nested_frames call_frames;
+
+#if EVMONE_PROFILING
+/// Executes the code with the instrumented interpreter chaining instruction functions
+/// and adds the statistics to the profiler.
+void execute_profiled(execution_state& state, const code_analysis& analysis, profiler& p) noexcept
+{
+    std::vector<profile_counters> counters(analysis.instrs.size());
+    const auto begin = analysis.instrs.data();
+    const auto* instr = begin;
+    while (instr != nullptr)
+    {
+        auto& c = counters[static_cast<size_t>(instr - begin)];
+        const auto gas_before = state.gas_left;
+        const auto start = read_cycles();
+        const auto next = instr->fn(instr, state);
+        c.cycles += read_cycles() - start;
+        c.gas += gas_before - state.gas_left;
+        ++c.executions;
+        instr = next;
+    }
+    p.add(state.rev, state.code, state.code_size, analysis, counters.data());
+}
+#endif
+
+/// Executes the code with the interpreter chaining instruction functions and reports
+/// each step to the tracer. The analysis must have the code offsets and no superinstructions.
+///
+/// The base gas costs of the block are charged by its BEGINBLOCK in advance, so the gas
+/// reported before each instruction adds back the base costs of the instructions
+/// of the block not executed yet. The static jumps are reported as the original PUSH
+/// and JUMP/JUMPI. If the block fails its gas or stack requirements check, the steps
+/// of the block are not reported.
+void execute_traced(execution_state& state, const code_analysis& analysis, tracer& t) noexcept
+{
+    const auto& op_tbl = get_op_table(state.rev);
+    const auto beginblock_fn = op_tbl[OPX_BEGINBLOCK].fn;
+    const auto static_jump_fn = op_tbl[OPX_STATIC_JUMP].fn;
+    const auto static_jumpi_fn = op_tbl[OPX_STATIC_JUMPI].fn;
+    const auto depth = static_cast<uint16_t>(state.msg->depth + 1);
+    const auto code = state.code;
+    const auto code_size = state.code_size;
+
+    // The base gas cost of the current block not reported yet.
+    int64_t block_cost_left = 0;
+
+    const auto begin = analysis.instrs.data();
+    const auto* instr = begin;
     while (instr != nullptr)
-        instr = instr->fn(instr, *state);
+    {
+        const auto index = static_cast<size_t>(instr - begin);
+        const auto pc = static_cast<size_t>(analysis.code_offsets[index]);
+        const auto opcode = pc < code_size ? code[pc] : uint8_t{OP_STOP};
+        const auto gas = state.gas_left + block_cost_left;
+
+        if (instr->fn == beginblock_fn)
+        {
+            const auto block_cost = int64_t{instr->arg.block.gas_cost};
+            instr = instr->fn(instr, state);
+            if (instr == nullptr)
+                break;
+
+            block_cost_left = block_cost;
+            if (opcode == OP_JUMPDEST)
+            {
+                const auto jumpdest_cost = op_tbl[OP_JUMPDEST].gas_cost;
+                t.step(static_cast<uint32_t>(pc), opcode, depth, state.gas_left + block_cost_left,
+                    jumpdest_cost, state.memory.size(), state.stack);
+                block_cost_left -= jumpdest_cost;
+            }
+            continue;
+        }
+
+        const auto base_cost = op_tbl[opcode].gas_cost;
+        if (instr->fn == static_jump_fn || instr->fn == static_jumpi_fn)
+        {
+            // Report the PUSH, then the jump with the destination on the stack.
+            t.step(static_cast<uint32_t>(pc), opcode, depth, gas, base_cost, state.memory.size(),
+                state.stack);
+            block_cost_left -= base_cost;
+
+            const auto push_end = std::min(pc + 1 + static_cast<size_t>(opcode - OP_PUSH1 + 1),
+                code_size);
+            uint256 dest = 0;
+            for (auto p = pc + 1; p < push_end; ++p)
+                dest = (dest << 8) | code[p];
 
-    const auto gas_left =
-        (state->status == EVMC_SUCCESS || state->status == EVMC_REVERT) ? state->gas_left : 0;
+            const auto jump_opcode = instr->fn == static_jump_fn ? OP_JUMP : OP_JUMPI;
+            const auto jump_cost = op_tbl[jump_opcode].gas_cost;
+            t.step(static_cast<uint32_t>(push_end), jump_opcode, depth,
+                state.gas_left + block_cost_left, jump_cost, state.memory.size(), state.stack,
+                &dest);
+            block_cost_left -= jump_cost;
 
+            instr = instr->fn(instr, state);
+            continue;
+        }
+
+        const auto id = t.step(static_cast<uint32_t>(pc), opcode, depth, gas, base_cost,
+            state.memory.size(), state.stack);
+        block_cost_left -= base_cost;
+
+        const auto gas_before = state.gas_left;
+        instr = instr->fn(instr, state);
+        if (state.gas_left != gas_before)
+            t.set_gas_cost(id, base_cost + gas_before - state.gas_left);
+    }
+}
+
+/// Returns the analysis flags for the traced executions: the code offsets are recorded
+/// and the analysis modes changing the instructions layout are disabled.
+constexpr uint32_t traced_analysis_flags(uint32_t flags) noexcept
+{
+    return (flags & ~uint32_t{ANALYSIS_FUSION | ANALYSIS_THREADED_CODE | ANALYSIS_LAZY |
+                              ANALYSIS_PRECHARGE | ANALYSIS_ELIDE_CHECKS | ANALYSIS_JIT}) |
+           ANALYSIS_CODE_OFFSETS;
+}
+
+/// Returns the analysis flags for the executions with the given host.
+uint32_t get_analysis_flags(const VM& vm, const evmc_host_interface* host) noexcept
+{
+    if (vm.current_tracer != nullptr)
+        return traced_analysis_flags(vm.analysis_flags);
+    if (vm.prefetch != nullptr && host == vm.prefetch_host)
+        return vm.analysis_flags | ANALYSIS_PREFETCH_HINTS;
+    return vm.analysis_flags;
+}
+
+/// Returns the prefetch callback for the executions with the given host, null if not enabled.
+prefetch_fn get_prefetch(const VM& vm, const evmc_host_interface* host) noexcept
+{
+    return host == vm.prefetch_host ? vm.prefetch : nullptr;
+}
+
+/// Counts the execution of the analysis for the JIT and returns the compiled code if published.
+/// The execution reaching the threshold submits the compilation to the VM::pool.
+/// The analyses not cached are not compiled.
+const jit_code* enter_jit(VM& vm, const std::shared_ptr<const code_analysis>& analysis) noexcept
+{
+    auto& tier = *analysis->jit;
+    if (tier.count(vm.jit_threshold) && vm.cache.capacity() != 0 &&
+        !vm.pool.submit_jit(analysis, std::numeric_limits<uint64_t>::max()))
+        tier.cancel(vm.jit_threshold);
+    return tier.code();
+}
+
+/// Executes the code of the analysis in the already reset state.
+void execute(
+    VM& vm, execution_state& state, const std::shared_ptr<const code_analysis>& shared) noexcept
+{
+    const auto& analysis = *shared;
+    state.analysis = &analysis;
+
+    if (vm.current_tracer != nullptr && !analysis.code_offsets.empty())
+        execute_traced(state, analysis, *vm.current_tracer);
+    else
+#if EVMONE_PROFILING
+    // The segments of the lazy analysis are not profiled.
+    if (!analysis.lazy)
+        execute_profiled(state, analysis, vm.profile);
+    else
+#endif
+    if (const auto native = analysis.jit != nullptr ? enter_jit(vm, shared) : nullptr)
+        native->execute(state);
+    else if (!analysis.labels.empty())
+        execute_threaded(state);
+    else
+    {
+        const auto* instr = analysis.lazy ? analysis.lazy->start() : &analysis.instrs[0];
+        while (instr != nullptr)
+            instr = instr->fn(instr, state);
+    }
+
+    // The return data of the last call is not needed anymore, release the callee's state.
+    state.return_data.clear();
+}
+
+int64_t get_gas_left(const execution_state& state) noexcept
+{
+    return (state.status == EVMC_SUCCESS || state.status == EVMC_REVERT) ? state.gas_left : 0;
+}
+
+/// Creates the result with the copy of the output, the state can be reused then.
+evmc_result make_result(execution_state& state) noexcept
+{
     return evmc::make_result(
-        state->status, gas_left, &state->memory[state->output_offset], state->output_size);
+        state.status, get_gas_left(state), &state.memory[state.output_offset], state.output_size);
+}
+
+/// Releases the result created by make_shared_result(), returning the state to the pool.
+void release_shared_result(const evmc_result* result) noexcept
+{
+    std::unique_ptr<execution_state> state{
+        static_cast<execution_state*>(evmc_get_const_optional_storage(result)->pointer)};
+    if (!state_pool_destroyed)
+        state_pool.release(std::move(state));
+}
+
+/// Creates the result referencing the output in the memory of the state, without copying it.
+/// The result keeps the state until released.
+///
+/// The results of creates are copied: the host sets the create_address
+/// sharing the optional storage of the result.
+evmc_result make_shared_result(std::unique_ptr<execution_state> state) noexcept
+{
+    if (state->output_size == 0 || state->msg->kind == EVMC_CREATE ||
+        state->msg->kind == EVMC_CREATE2)
+    {
+        const auto result = make_result(*state);
+        state_pool.release(std::move(state));
+        return result;
+    }
+
+    evmc_result result{};
+    result.status_code = state->status;
+    result.gas_left = get_gas_left(*state);
+    result.output_data = &state->memory[state->output_offset];
+    result.output_size = state->output_size;
+    result.release = release_shared_result;
+    evmc_get_optional_storage(&result)->pointer = state.release();
+    return result;
+}
+
+/// Enables the nested calls of the state reset for the execution with the host.
+void set_nested_calls(VM& vm, execution_state& state, const evmc_host_interface* host) noexcept
+{
+    if (host == vm.nested_host)
+        state.nested_vm = &vm;
+}
+
+/// Analyzes the code deployed by the create into the cache ahead of its first call,
+/// see VM::create_analysis. The code is the output of the init code execution.
+void analyze_deployed_code(VM& vm, const evmc_host_interface* host, evmc_revision rev,
+    const evmc_message& msg, evmc_status_code status, const uint8_t* code,
+    size_t code_size) noexcept
+{
+    if (vm.create_analysis == create_analysis_mode::off || status != EVMC_SUCCESS ||
+        (msg.kind != EVMC_CREATE && msg.kind != EVMC_CREATE2) || code_size == 0 ||
+        vm.cache.capacity() == 0)
+        return;
+
+    // The code over the limit is not going to be deployed.
+    if (rev >= EVMC_SPURIOUS_DRAGON && code_size > size_t{max_code_size})
+        return;
+
+    const auto flags = get_analysis_flags(vm, host);
+    if (vm.create_analysis == create_analysis_mode::sync)
+        vm.cache.get(rev, code, code_size, flags);
+    else
+    {
+        // The created contract is likely called by the following transactions of the block.
+        vm.pool.submit(rev, code, code_size, flags, std::numeric_limits<uint64_t>::max());
+    }
+}
+
+/// Executes the messages of the batch taking the next one from the shared index.
+void execute_batch_worker(VM& vm, const std::shared_ptr<const code_analysis>& analysis,
+    evmc_revision rev, const uint8_t* code, size_t code_size, const evmc_message* msgs,
+    const batch_host* hosts, evmc_result* results, size_t count, std::atomic<size_t>& next) noexcept
+{
+    auto state = state_pool.acquire();
+    for (auto i = next.fetch_add(1, std::memory_order_relaxed); i < count;
+         i = next.fetch_add(1, std::memory_order_relaxed))
+    {
+        state->reset(rev, msgs[i], *hosts[i].host, hosts[i].context, code, code_size,
+            get_prefetch(vm, hosts[i].host));
+        set_nested_calls(vm, *state, hosts[i].host);
+        execute(vm, *state, analysis);
+        call_frames.trim(msgs[i].depth);
+        results[i] = make_result(*state);
+    }
+    state_pool.release(std::move(state));
+}
+}  // namespace
+
+evmc_result execute(evmc_vm* c_vm, const evmc_host_interface* host, evmc_host_context* ctx,
+    evmc_revision rev, const evmc_message* msg, const uint8_t* code, size_t code_size) noexcept
+{
+    auto& vm = *static_cast<VM*>(c_vm);
+
+    // Keep the reference to the analysis, the cache entry may be evicted by nested calls.
+    const auto analysis = vm.cache.get(rev, code, code_size, get_analysis_flags(vm, host));
+
+    auto state = state_pool.acquire();
+    state->reset(rev, *msg, *host, ctx, code, code_size, get_prefetch(vm, host));
+    set_nested_calls(vm, *state, host);
+    execute(vm, *state, analysis);
+    analyze_deployed_code(vm, host, rev, *msg, state->status, &state->memory[state->output_offset],
+        state->output_size);
+    call_frames.trim(msg->depth);
+    return make_shared_result(std::move(state));
+}
+
+evmc::result execute_call(execution_state& state, const evmc_message& msg) noexcept
+{
+    auto* const vm = state.nested_vm;
+    if (vm == nullptr)
+        return state.host.call(msg);
+
+    const auto host = state.host.get_interface();
+    const auto context = state.host.get_context();
+    auto callee_msg = msg;
+    const uint8_t* code = nullptr;
+    size_t code_size = 0;
+    if (!vm->nested_calls.begin_call(context, &callee_msg, &code, &code_size))
+        return state.host.call(msg);
+
+    // The result of the previous call of the depth references the frame.
+    state.return_data.clear();
+
+    const auto analysis = vm->cache.get(state.rev, code, code_size, get_analysis_flags(*vm, host));
+    auto& frame = call_frames.get(callee_msg.depth);
+    frame.reset(state.rev, callee_msg, *host, context, code, code_size, state.host.get_prefetch());
+    frame.nested_vm = vm;
+    execute(*vm, frame, analysis);
+
+    evmc_result result{};
+    result.status_code = frame.status;
+    result.gas_left = get_gas_left(frame);
+    result.output_data = &frame.memory[frame.output_offset];
+    result.output_size = frame.output_size;
+    vm->nested_calls.end_call(context, &callee_msg, &result);
+    analyze_deployed_code(*vm, host, state.rev, callee_msg, result.status_code,
+        result.output_data, result.output_size);
+    return evmc::result{result};
+}
+
+void execute_batch(evmc_vm* c_vm, evmc_revision rev, const uint8_t* code, size_t code_size,
+    const evmc_message* msgs, const batch_host* hosts, evmc_result* results, size_t count,
+    size_t num_threads) noexcept
+{
+    if (count == 0)
+        return;
+
+    auto& vm = *static_cast<VM*>(c_vm);
+
+    // The prefetch hints are analyzed if any of the hosts supports them.
+    const auto prefetch_host = std::find_if(hosts, hosts + count,
+        [&vm](const batch_host& h) noexcept { return get_prefetch(vm, h.host) != nullptr; });
+    const auto flags =
+        get_analysis_flags(vm, prefetch_host != hosts + count ? prefetch_host->host : nullptr);
+    const auto analysis = vm.cache.get(rev, code, code_size, flags);
+
+    // The messages are taken one by one, so the threads stay busy
+    // even if the execution costs of the messages differ much.
+    // The traced executions are done in the calling thread only, the tracer is not thread-safe.
+    // The calling thread is also the worker.
+    std::atomic<size_t> next{0};
+    const auto max_workers = vm.current_tracer != nullptr ? size_t{1} : num_threads;
+    const auto num_workers = std::min(std::max(max_workers, size_t{1}), count);
+    vm.batch_threads.run(num_workers - 1, [&]() noexcept {
+        execute_batch_worker(
+            vm, analysis, rev, code, code_size, msgs, hosts, results, count, next);
+    });
+}
+
+void set_host_prefetch(evmc_vm* vm, const evmc_host_interface* host, prefetch_fn prefetch) noexcept
+{
+    auto& v = *static_cast<VM*>(vm);
+    v.prefetch_host = prefetch != nullptr ? host : nullptr;
+    v.prefetch = prefetch;
+}
+
+bool prefetch_analysis(evmc_vm* vm, const evmc_host_interface* host, evmc_revision rev,
+    const uint8_t* code, size_t code_size, uint64_t priority) noexcept
+{
+    auto& v = *static_cast<VM*>(vm);
+    if (v.cache.capacity() == 0)
+        return false;
+    return v.pool.submit(rev, code, code_size, get_analysis_flags(v, host), priority);
+}
+
+analysis_pool::stats get_analysis_pool_stats(const evmc_vm* vm) noexcept
+{
+    return static_cast<const VM*>(vm)->pool.get_stats();
+}
+
+void set_host_nested_calls(
+    evmc_vm* vm, const evmc_host_interface* host, const nested_call_interface* nested) noexcept
+{
+    auto& v = *static_cast<VM*>(vm);
+    v.nested_host = nested != nullptr ? host : nullptr;
+    v.nested_calls = nested != nullptr ? *nested : nested_call_interface{};
 }
 }  // namespace evmone
@@ -4,9 +4,31 @@
 #pragma once
 
 #include <evmc/evmc.h>
+#include <evmc/utils.h>
+#include <cstddef>
 
 namespace evmone
 {
 evmc_result execute(evmc_vm* vm, const evmc_host_interface* host, evmc_host_context* ctx,
     evmc_revision rev, const evmc_message* msg, const uint8_t* code, size_t code_size) noexcept;
+
+/// The host of the message executed in the batch.
+struct batch_host
+{
+    const evmc_host_interface* host;
+    evmc_host_context* context;
+};
+
+/// Executes the messages against the same code, like execute() for each of them.
+///
+/// The code is analyzed (or looked up in the analysis cache) only once and the execution state
+/// is reused by the following messages. The msgs, hosts and results are arrays of the count
+/// size, the results must be released by the caller.
+/// With num_threads greater than 1 the messages are distributed across additional threads,
+/// so the hosts must allow being used concurrently (e.g. each message has its own host).
+/// The additional threads are kept by the VM and reused by the following batches.
+/// The vm must be the evmone instance.
+EVMC_EXPORT void execute_batch(evmc_vm* vm, evmc_revision rev, const uint8_t* code,
+    size_t code_size, const evmc_message* msgs, const batch_host* hosts, evmc_result* results,
+    size_t count, size_t num_threads = 1) noexcept;
 }  // namespace evmone
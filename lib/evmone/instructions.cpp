@@ -3,7 +3,9 @@
 // Licensed under the Apache License, Version 2.0.
 
 #include "analysis.hpp"
-#include <ethash/keccak.hpp>
+#include "arithmetic.hpp"
+#include "memory_ops.hpp"
+#include <algorithm>
 
 namespace evmone
 {
@@ -45,7 +47,11 @@ inline bool check_memory(execution_state& state, const uint256& offset, uint64_t
             return false;
         }
 
-        state.memory.resize(static_cast<size_t>(new_words * word_size));
+        if (!state.memory.resize(static_cast<size_t>(new_words * word_size)))
+        {
+            state.exit(EVMC_OUT_OF_GAS);
+            return false;
+        }
     }
 
     return true;
@@ -80,7 +86,9 @@ const instruction* op_add(const instruction* instr, execution_state& state) noex
 
 const instruction* op_mul(const instruction* instr, execution_state& state) noexcept
 {
-    state.stack.top() *= state.stack.pop();
+    const auto x = state.stack.pop();
+    auto& y = state.stack.top();
+    y = arith::mul(x, y);
     return ++instr;
 }
 
@@ -94,7 +102,7 @@ const instruction* op_sub(const instruction* instr, execution_state& state) noex
 const instruction* op_div(const instruction* instr, execution_state& state) noexcept
 {
     auto& v = state.stack[1];
-    v = v != 0 ? state.stack[0] / v : 0;
+    v = v != 0 ? arith::div(state.stack[0], v) : 0;
     state.stack.pop();
     return ++instr;
 }
@@ -102,7 +110,7 @@ const instruction* op_div(const instruction* instr, execution_state& state) noex
 const instruction* op_sdiv(const instruction* instr, execution_state& state) noexcept
 {
     auto& v = state.stack[1];
-    v = v != 0 ? intx::sdivrem(state.stack[0], v).quot : 0;
+    v = v != 0 ? arith::sdiv(state.stack[0], v) : 0;
     state.stack.pop();
     return ++instr;
 }
@@ -110,7 +118,7 @@ const instruction* op_sdiv(const instruction* instr, execution_state& state) noe
 const instruction* op_mod(const instruction* instr, execution_state& state) noexcept
 {
     auto& v = state.stack[1];
-    v = v != 0 ? state.stack[0] % v : 0;
+    v = v != 0 ? arith::mod(state.stack[0], v) : 0;
     state.stack.pop();
     return ++instr;
 }
@@ -118,7 +126,7 @@ const instruction* op_mod(const instruction* instr, execution_state& state) noex
 const instruction* op_smod(const instruction* instr, execution_state& state) noexcept
 {
     auto& v = state.stack[1];
-    v = v != 0 ? intx::sdivrem(state.stack[0], v).rem : 0;
+    v = v != 0 ? arith::smod(state.stack[0], v) : 0;
     state.stack.pop();
     return ++instr;
 }
@@ -129,7 +137,7 @@ const instruction* op_addmod(const instruction* instr, execution_state& state) n
     const auto y = state.stack.pop();
     auto& m = state.stack.top();
 
-    m = m != 0 ? intx::addmod(x, y, m) : 0;
+    m = m != 0 ? arith::addmod(x, y, m) : 0;
     return ++instr;
 }
 
@@ -139,23 +147,32 @@ const instruction* op_mulmod(const instruction* instr, execution_state& state) n
     const auto y = state.stack.pop();
     auto& m = state.stack.top();
 
-    m = m != 0 ? intx::mulmod(x, y, m) : 0;
+    m = m != 0 ? arith::mulmod(x, y, m) : 0;
     return ++instr;
 }
 
+/// The Precharged variants of the instructions skip the memory checks and the dynamic gas
+/// charging, done by the block (see OPX_PRECHARGE_MEMORY).
+///
+/// The instructions with the revision dependent semantics are instantiated for the revision
+/// of their op table (see op_tables), so they do not check the revision of the state.
+template <evmc_revision Rev, bool Precharged>
 const instruction* op_exp(const instruction* instr, execution_state& state) noexcept
 {
     const auto base = state.stack.pop();
     auto& exponent = state.stack.top();
 
-    const auto exponent_significant_bytes =
-        static_cast<int>(intx::count_significant_words<uint8_t>(exponent));
-    const auto exponent_cost = state.rev >= EVMC_SPURIOUS_DRAGON ? 50 : 10;
-    const auto additional_cost = exponent_significant_bytes * exponent_cost;
-    if ((state.gas_left -= additional_cost) < 0)
-        return state.exit(EVMC_OUT_OF_GAS);
+    if (!Precharged)
+    {
+        const auto exponent_significant_bytes =
+            static_cast<int>(intx::count_significant_words<uint8_t>(exponent));
+        constexpr auto exponent_cost = Rev >= EVMC_SPURIOUS_DRAGON ? 50 : 10;
+        const auto additional_cost = exponent_significant_bytes * exponent_cost;
+        if ((state.gas_left -= additional_cost) < 0)
+            return state.exit(EVMC_OUT_OF_GAS);
+    }
 
-    exponent = intx::exp(base, exponent);
+    exponent = arith::exp(base, exponent);
     return ++instr;
 }
 
@@ -296,23 +313,24 @@ const instruction* op_sar(const instruction* instr, execution_state& state) noex
     return ++instr;
 }
 
+template <bool Precharged>
 const instruction* op_sha3(const instruction* instr, execution_state& state) noexcept
 {
     const auto index = state.stack.pop();
     auto& size = state.stack.top();
 
-    if (!check_memory(state, index, size))
+    if (!Precharged && !check_memory(state, index, size))
         return nullptr;
 
     const auto i = static_cast<size_t>(index);
     const auto s = static_cast<size_t>(size);
     const auto w = num_words(s);
     const auto cost = w * 6;
-    if ((state.gas_left -= cost) < 0)
+    if (!Precharged && (state.gas_left -= cost) < 0)
         return state.exit(EVMC_OUT_OF_GAS);
 
     auto data = s != 0 ? &state.memory[i] : nullptr;
-    size = intx::be::load<uint256>(ethash::keccak256(data, s));
+    size = intx::be::unsafe::load<uint256>(state.sha3_memo.hash(data, s).data());
     return ++instr;
 }
 
@@ -388,13 +406,15 @@ const instruction* op_calldatasize(const instruction* instr, execution_state& st
     return ++instr;
 }
 
+template <bool Precharged>
 const instruction* op_calldatacopy(const instruction* instr, execution_state& state) noexcept
 {
     const auto mem_index = state.stack.pop();
     const auto input_index = state.stack.pop();
     const auto size = state.stack.pop();
 
-    if (!check_memory(state, mem_index, size))
+    const auto old_memory_size = state.memory.size();
+    if (!Precharged && !check_memory(state, mem_index, size))
         return nullptr;
 
     auto dst = static_cast<size_t>(mem_index);
@@ -404,14 +424,14 @@ const instruction* op_calldatacopy(const instruction* instr, execution_state& st
     auto copy_size = std::min(s, state.msg->input_size - src);
 
     const auto copy_cost = num_words(s) * 3;
-    if ((state.gas_left -= copy_cost) < 0)
+    if (!Precharged && (state.gas_left -= copy_cost) < 0)
         return state.exit(EVMC_OUT_OF_GAS);
 
-    if (copy_size > 0)
-        std::memcpy(&state.memory[dst], &state.msg->input_data[src], copy_size);
-
-    if (s - copy_size > 0)
-        std::memset(&state.memory[dst + copy_size], 0, s - copy_size);
+    if (s > 0)
+    {
+        copy_padded(&state.memory[dst], s, state.msg->input_data + src, copy_size,
+            dirty_size(dst, old_memory_size));
+    }
     return ++instr;
 }
 
@@ -421,6 +441,7 @@ const instruction* op_codesize(const instruction* instr, execution_state& state)
     return ++instr;
 }
 
+template <bool Precharged>
 const instruction* op_codecopy(const instruction* instr, execution_state& state) noexcept
 {
     // TODO: Similar to op_calldatacopy().
@@ -429,7 +450,8 @@ const instruction* op_codecopy(const instruction* instr, execution_state& state)
     const auto input_index = state.stack.pop();
     const auto size = state.stack.pop();
 
-    if (!check_memory(state, mem_index, size))
+    const auto old_memory_size = state.memory.size();
+    if (!Precharged && !check_memory(state, mem_index, size))
         return nullptr;
 
     auto dst = static_cast<size_t>(mem_index);
@@ -438,47 +460,50 @@ const instruction* op_codecopy(const instruction* instr, execution_state& state)
     auto copy_size = std::min(s, state.code_size - src);
 
     const auto copy_cost = num_words(s) * 3;
-    if ((state.gas_left -= copy_cost) < 0)
+    if (!Precharged && (state.gas_left -= copy_cost) < 0)
         return state.exit(EVMC_OUT_OF_GAS);
 
     // TODO: Add unit tests for each combination of conditions.
-    if (copy_size > 0)
-        std::memcpy(&state.memory[dst], &state.code[src], copy_size);
-
-    if (s - copy_size > 0)
-        std::memset(&state.memory[dst + copy_size], 0, s - copy_size);
+    if (s > 0)
+    {
+        copy_padded(
+            &state.memory[dst], s, &state.code[src], copy_size, dirty_size(dst, old_memory_size));
+    }
     return ++instr;
 }
 
+template <bool Precharged>
 const instruction* op_mload(const instruction* instr, execution_state& state) noexcept
 {
     auto& index = state.stack.top();
 
-    if (!check_memory(state, index, 32))
+    if (!Precharged && !check_memory(state, index, 32))
         return nullptr;
 
-    index = intx::be::unsafe::load<uint256>(&state.memory[static_cast<size_t>(index)]);
+    index = load_word(&state.memory[static_cast<size_t>(index)]);
     return ++instr;
 }
 
+template <bool Precharged>
 const instruction* op_mstore(const instruction* instr, execution_state& state) noexcept
 {
     const auto index = state.stack.pop();
     const auto value = state.stack.pop();
 
-    if (!check_memory(state, index, 32))
+    if (!Precharged && !check_memory(state, index, 32))
         return nullptr;
 
-    intx::be::unsafe::store(&state.memory[static_cast<size_t>(index)], value);
+    store_word(&state.memory[static_cast<size_t>(index)], value);
     return ++instr;
 }
 
+template <bool Precharged>
 const instruction* op_mstore8(const instruction* instr, execution_state& state) noexcept
 {
     const auto index = state.stack.pop();
     const auto value = state.stack.pop();
 
-    if (!check_memory(state, index, 1))
+    if (!Precharged && !check_memory(state, index, 1))
         return nullptr;
 
     state.memory[static_cast<size_t>(index)] = static_cast<uint8_t>(value);
@@ -493,13 +518,14 @@ const instruction* op_sload(const instruction* instr, execution_state& state) no
     return ++instr;
 }
 
+template <evmc_revision Rev>
 const instruction* op_sstore(const instruction* instr, execution_state& state) noexcept
 {
     // TODO: Implement static mode violation in analysis.
     if (state.msg->flags & EVMC_STATIC)
         return state.exit(EVMC_STATIC_MODE_VIOLATION);
 
-    if (state.rev >= EVMC_ISTANBUL)
+    if constexpr (Rev >= EVMC_ISTANBUL)
     {
         const auto correction = state.current_block_cost - instr->arg.number;
         const auto gas_left = state.gas_left + correction;
@@ -514,9 +540,9 @@ const instruction* op_sstore(const instruction* instr, execution_state& state) n
     switch (status)
     {
     case EVMC_STORAGE_UNCHANGED:
-        if (state.rev >= EVMC_ISTANBUL)
+        if constexpr (Rev >= EVMC_ISTANBUL)
             cost = 800;
-        else if (state.rev == EVMC_CONSTANTINOPLE)
+        else if constexpr (Rev == EVMC_CONSTANTINOPLE)
             cost = 200;
         else
             cost = 5000;
@@ -525,9 +551,9 @@ const instruction* op_sstore(const instruction* instr, execution_state& state) n
         cost = 5000;
         break;
     case EVMC_STORAGE_MODIFIED_AGAIN:
-        if (state.rev >= EVMC_ISTANBUL)
+        if constexpr (Rev >= EVMC_ISTANBUL)
             cost = 800;
-        else if (state.rev == EVMC_CONSTANTINOPLE)
+        else if constexpr (Rev == EVMC_CONSTANTINOPLE)
             cost = 200;
         else
             cost = 5000;
@@ -572,6 +598,23 @@ const instruction* op_jumpi(const instruction* instr, execution_state& state) no
     return instr;
 }
 
+const instruction* opx_static_jump(const instruction* instr, execution_state& state) noexcept
+{
+    const auto target = instr->arg.number;
+    if (target < 0)
+        return state.exit(EVMC_BAD_JUMP_DESTINATION);
+
+    return &state.analysis->instrs[static_cast<size_t>(target)];
+}
+
+const instruction* opx_static_jumpi(const instruction* instr, execution_state& state) noexcept
+{
+    // The jump destination is not on the stack, only the condition.
+    if (state.stack.pop() != 0)
+        return opx_static_jump(instr, state);
+    return ++instr;
+}
+
 const instruction* op_pc(const instruction* instr, execution_state& state) noexcept
 {
     state.stack.push(instr->arg.number);
@@ -612,6 +655,7 @@ const instruction* op_extcodecopy(const instruction* instr, execution_state& sta
     const auto input_index = state.stack.pop();
     const auto size = state.stack.pop();
 
+    const auto old_memory_size = state.memory.size();
     if (!check_memory(state, mem_index, size))
         return nullptr;
 
@@ -626,7 +670,12 @@ const instruction* op_extcodecopy(const instruction* instr, execution_state& sta
     auto data = s != 0 ? &state.memory[dst] : nullptr;
     auto num_bytes_copied = state.host.copy_code(addr, src, data, s);
     if (s - num_bytes_copied > 0)
-        std::memset(&state.memory[dst + num_bytes_copied], 0, s - num_bytes_copied);
+    {
+        // Only the zero-filling of the part not copied by the host.
+        const auto pad_index = dst + num_bytes_copied;
+        copy_padded(&state.memory[pad_index], s - num_bytes_copied, nullptr, 0,
+            dirty_size(pad_index, old_memory_size));
+    }
     return ++instr;
 }
 
@@ -660,7 +709,7 @@ const instruction* op_returndatacopy(const instruction* instr, execution_state&
         return state.exit(EVMC_OUT_OF_GAS);
 
     if (s > 0)
-        std::memcpy(&state.memory[dst], &state.return_data[src], s);
+        copy_padded(&state.memory[dst], s, &state.return_data[src], s, s);
     return ++instr;
 }
 
@@ -808,7 +857,7 @@ const instruction* op_return(const instruction*, execution_state& state) noexcep
     return state.exit(status_code);
 }
 
-template <evmc_call_kind kind>
+template <evmc_revision Rev, evmc_call_kind kind>
 const instruction* op_call(const instruction* instr, execution_state& state) noexcept
 {
     const auto arg = instr->arg;
@@ -854,7 +903,7 @@ const instruction* op_call(const instruction* instr, execution_state& state) noe
         if (has_value && state.msg->flags & EVMC_STATIC)
             return state.exit(EVMC_STATIC_MODE_VIOLATION);
 
-        if (has_value || state.rev < EVMC_SPURIOUS_DRAGON)
+        if (has_value || Rev < EVMC_SPURIOUS_DRAGON)
         {
             if (!state.host.account_exists(dst))
                 cost += 25000;
@@ -868,7 +917,7 @@ const instruction* op_call(const instruction* instr, execution_state& state) noe
     if (gas < msg.gas)
         msg.gas = static_cast<int64_t>(gas);
 
-    if (state.rev >= EVMC_TANGERINE_WHISTLE)
+    if constexpr (Rev >= EVMC_TANGERINE_WHISTLE)
         msg.gas = std::min(msg.gas, gas_left - gas_left / 64);
     else if (msg.gas > gas_left)
         return state.exit(EVMC_OUT_OF_GAS);
@@ -912,8 +961,7 @@ const instruction* op_call(const instruction* instr, execution_state& state) noe
         msg.gas += 2300;  // Add stipend.
     }
 
-    auto result = state.host.call(msg);
-    state.return_data.assign(result.output_data, result.output_size);
+    const auto& result = state.return_data.assign(execute_call(state, msg));
 
 
     state.stack[0] = result.status_code == EVMC_SUCCESS;
@@ -931,6 +979,7 @@ const instruction* op_call(const instruction* instr, execution_state& state) noe
     return ++instr;
 }
 
+template <evmc_revision Rev>
 const instruction* op_delegatecall(const instruction* instr, execution_state& state) noexcept
 {
     const auto arg = instr->arg;
@@ -965,7 +1014,7 @@ const instruction* op_delegatecall(const instruction* instr, execution_state& st
     if (gas < msg.gas)
         msg.gas = static_cast<int64_t>(gas);
 
-    if (state.rev >= EVMC_TANGERINE_WHISTLE)
+    if constexpr (Rev >= EVMC_TANGERINE_WHISTLE)
         msg.gas = std::min(msg.gas, gas_left - gas_left / 64);
     else if (msg.gas > gas_left)  // TEST: gas_left vs state.gas_left.
         return state.exit(EVMC_OUT_OF_GAS);
@@ -985,8 +1034,7 @@ const instruction* op_delegatecall(const instruction* instr, execution_state& st
         msg.input_size = size_t(input_size);
     }
 
-    auto result = state.host.call(msg);
-    state.return_data.assign(result.output_data, result.output_size);
+    const auto& result = state.return_data.assign(execute_call(state, msg));
 
     state.stack[0] = result.status_code == EVMC_SUCCESS;
 
@@ -1050,8 +1098,7 @@ const instruction* op_staticcall(const instruction* instr, execution_state& stat
         msg.input_size = size_t(input_size);
     }
 
-    auto result = state.host.call(msg);
-    state.return_data.assign(result.output_data, result.output_size);
+    const auto& result = state.return_data.assign(execute_call(state, msg));
     state.stack[0] = result.status_code == EVMC_SUCCESS;
 
     if (auto copy_size = std::min(size_t(output_size), result.output_size); copy_size > 0)
@@ -1064,6 +1111,7 @@ const instruction* op_staticcall(const instruction* instr, execution_state& stat
     return ++instr;
 }
 
+template <evmc_revision Rev>
 const instruction* op_create(const instruction* instr, execution_state& state) noexcept
 {
     if (state.msg->flags & EVMC_STATIC)
@@ -1098,7 +1146,7 @@ const instruction* op_create(const instruction* instr, execution_state& state) n
 
     auto correction = state.current_block_cost - arg.number;
     msg.gas = state.gas_left + correction;
-    if (state.rev >= EVMC_TANGERINE_WHISTLE)
+    if constexpr (Rev >= EVMC_TANGERINE_WHISTLE)
         msg.gas = msg.gas - msg.gas / 64;
 
     msg.kind = EVMC_CREATE;
@@ -1113,8 +1161,7 @@ const instruction* op_create(const instruction* instr, execution_state& state) n
     msg.depth = state.msg->depth + 1;
     msg.value = intx::be::store<evmc::uint256be>(endowment);
 
-    auto result = state.host.call(msg);
-    state.return_data.assign(result.output_data, result.output_size);
+    const auto& result = state.return_data.assign(execute_call(state, msg));
     if (result.status_code == EVMC_SUCCESS)
         state.stack[0] = intx::be::load<uint256>(result.create_address);
 
@@ -1177,8 +1224,7 @@ const instruction* op_create2(const instruction* instr, execution_state& state)
     msg.create2_salt = intx::be::store<evmc::bytes32>(salt);
     msg.value = intx::be::store<evmc::uint256be>(endowment);
 
-    auto result = state.host.call(msg);
-    state.return_data.assign(result.output_data, result.output_size);
+    const auto& result = state.return_data.assign(execute_call(state, msg));
     if (result.status_code == EVMC_SUCCESS)
         state.stack[0] = intx::be::load<uint256>(result.create_address);
 
@@ -1192,6 +1238,7 @@ const instruction* op_undefined(const instruction*, execution_state& state) noex
     return state.exit(EVMC_UNDEFINED_INSTRUCTION);
 }
 
+template <evmc_revision Rev>
 const instruction* op_selfdestruct(const instruction*, execution_state& state) noexcept
 {
     if (state.msg->flags & EVMC_STATIC)
@@ -1199,9 +1246,9 @@ const instruction* op_selfdestruct(const instruction*, execution_state& state) n
 
     const auto addr = intx::be::trunc<evmc::address>(state.stack[0]);
 
-    if (state.rev >= EVMC_TANGERINE_WHISTLE)
+    if constexpr (Rev >= EVMC_TANGERINE_WHISTLE)
     {
-        if (state.rev == EVMC_TANGERINE_WHISTLE || state.host.get_balance(state.msg->destination))
+        if (Rev == EVMC_TANGERINE_WHISTLE || state.host.get_balance(state.msg->destination))
         {
             // After TANGERINE_WHISTLE apply additional cost of
             // sending value to a non-existing account.
@@ -1234,6 +1281,164 @@ const instruction* opx_beginblock(const instruction* instr, execution_state& sta
     return ++instr;
 }
 
+const instruction* opx_beginblock_gas(const instruction* instr, execution_state& state) noexcept
+{
+    auto& block = instr->arg.block;
+
+    if ((state.gas_left -= block.gas_cost) < 0)
+        return state.exit(EVMC_OUT_OF_GAS);
+
+    state.current_block_cost = block.gas_cost;
+    return ++instr;
+}
+
+const instruction* opx_empty_blocks(const instruction* instr, execution_state& state) noexcept
+{
+    const auto arg = static_cast<uint64_t>(instr->arg.number);
+
+    if ((state.gas_left -= static_cast<int64_t>(arg >> 32)) < 0)
+        return state.exit(EVMC_OUT_OF_GAS);
+
+    return instr + (arg & 0xffffffff);
+}
+
+const instruction* opx_precharge_memory(const instruction* instr, execution_state& state) noexcept
+{
+    if (!check_memory(state, 0, static_cast<uint64_t>(instr->arg.number)))
+        return nullptr;
+    return ++instr;
+}
+
+inline uint256 add(const uint256& a, const uint256& b) noexcept
+{
+    return a + b;
+}
+
+inline uint256 sub(const uint256& a, const uint256& b) noexcept
+{
+    return a - b;
+}
+
+inline uint256 mul(const uint256& a, const uint256& b) noexcept
+{
+    return arith::mul(a, b);
+}
+
+inline uint256 bit_and(const uint256& a, const uint256& b) noexcept
+{
+    return a & b;
+}
+
+inline uint256 bit_or(const uint256& a, const uint256& b) noexcept
+{
+    return a | b;
+}
+
+inline uint256 eq(const uint256& a, const uint256& b) noexcept
+{
+    return a == b;
+}
+
+inline uint256 lt(const uint256& a, const uint256& b) noexcept
+{
+    return a < b;
+}
+
+inline uint256 gt(const uint256& a, const uint256& b) noexcept
+{
+    return a > b;
+}
+
+/// The PUSH followed by the binary instruction Op.
+/// The push value is the first (top) operand of the instruction.
+template <uint256 Op(const uint256&, const uint256&) noexcept>
+const instruction* opx_push_binop(const instruction* instr, execution_state& state) noexcept
+{
+    auto& x = state.stack.top();
+    x = Op(instr->arg.small_push_value, x);
+    return ++instr;
+}
+
+const instruction* opx_push_shl(const instruction* instr, execution_state& state) noexcept
+{
+    const auto shift = instr->arg.small_push_value;
+    auto& x = state.stack.top();
+    x = shift < 256 ? x << static_cast<unsigned>(shift) : 0;
+    return ++instr;
+}
+
+const instruction* opx_push_shr(const instruction* instr, execution_state& state) noexcept
+{
+    const auto shift = instr->arg.small_push_value;
+    auto& x = state.stack.top();
+    x = shift < 256 ? x >> static_cast<unsigned>(shift) : 0;
+    return ++instr;
+}
+
+template <bool Precharged>
+const instruction* opx_push_mload(const instruction* instr, execution_state& state) noexcept
+{
+    const auto index = uint256{instr->arg.small_push_value};
+
+    if (!Precharged && !check_memory(state, index, 32))
+        return nullptr;
+
+    state.stack.push(load_word(&state.memory[static_cast<size_t>(index)]));
+    return ++instr;
+}
+
+template <bool Precharged>
+const instruction* opx_push_mstore(const instruction* instr, execution_state& state) noexcept
+{
+    const auto index = uint256{instr->arg.small_push_value};
+
+    if (!Precharged && !check_memory(state, index, 32))
+        return nullptr;
+
+    store_word(&state.memory[static_cast<size_t>(index)], state.stack.pop());
+    return ++instr;
+}
+
+const instruction* opx_push_address_mask_and(
+    const instruction* instr, execution_state& state) noexcept
+{
+    // Keep the low 160 bits. The intx words are in the order of significance.
+    const auto words = intx::as_words(state.stack.top());
+    words[2] &= 0xffffffff;
+    words[3] = 0;
+    return ++instr;
+}
+
+const instruction* opx_dup_swap(const instruction* instr, execution_state& state) noexcept
+{
+    const auto dup_index = static_cast<int>(instr->arg.number & 0xff) - 1;
+    const auto swap_index = static_cast<int>(instr->arg.number >> 8);
+
+    // The item duplicated to the top ends up swapped at the swap index
+    // and the item from there (before the push) is the new top.
+    const auto item = state.stack[dup_index];
+    state.stack.push(state.stack[swap_index - 1]);
+    state.stack[swap_index] = item;
+    return ++instr;
+}
+
+const instruction* opx_swap_pop(const instruction* instr, execution_state& state) noexcept
+{
+    const auto index = static_cast<int>(instr->arg.number);
+    state.stack[index] = state.stack.top();
+    state.stack.pop();
+    return ++instr;
+}
+
+const instruction* opx_iszero_static_jumpi(
+    const instruction* instr, execution_state& state) noexcept
+{
+    if (state.stack.pop() == 0)
+        return opx_static_jump(instr, state);
+    return ++instr;
+}
+
+template <evmc_revision Rev>
 constexpr op_table create_op_table_frontier() noexcept
 {
     auto table = op_table{};
@@ -1252,7 +1457,7 @@ constexpr op_table create_op_table_frontier() noexcept
     table[OP_SMOD] = {op_smod, 5, 2, -1};
     table[OP_ADDMOD] = {op_addmod, 8, 3, -2};
     table[OP_MULMOD] = {op_mulmod, 8, 3, -2};
-    table[OP_EXP] = {op_exp, 10, 2, -1};
+    table[OP_EXP] = {op_exp<Rev, false>, 10, 2, -1};
     table[OP_SIGNEXTEND] = {op_signextend, 5, 2, -1};
     table[OP_LT] = {op_lt, 3, 2, -1};
     table[OP_GT] = {op_gt, 3, 2, -1};
@@ -1265,7 +1470,7 @@ constexpr op_table create_op_table_frontier() noexcept
     table[OP_XOR] = {op_xor, 3, 2, -1};
     table[OP_NOT] = {op_not, 3, 1, 0};
     table[OP_BYTE] = {op_byte, 3, 2, -1};
-    table[OP_SHA3] = {op_sha3, 30, 2, -1};
+    table[OP_SHA3] = {op_sha3<false>, 30, 2, -1};
     table[OP_ADDRESS] = {op_address, 2, 0, 1};
     table[OP_BALANCE] = {op_balance, 20, 1, 0};
     table[OP_ORIGIN] = {op_origin, 2, 0, 1};
@@ -1273,9 +1478,9 @@ constexpr op_table create_op_table_frontier() noexcept
     table[OP_CALLVALUE] = {op_callvalue, 2, 0, 1};
     table[OP_CALLDATALOAD] = {op_calldataload, 3, 1, 0};
     table[OP_CALLDATASIZE] = {op_calldatasize, 2, 0, 1};
-    table[OP_CALLDATACOPY] = {op_calldatacopy, 3, 3, -3};
+    table[OP_CALLDATACOPY] = {op_calldatacopy<false>, 3, 3, -3};
     table[OP_CODESIZE] = {op_codesize, 2, 0, 1};
-    table[OP_CODECOPY] = {op_codecopy, 3, 3, -3};
+    table[OP_CODECOPY] = {op_codecopy<false>, 3, 3, -3};
     table[OP_GASPRICE] = {op_gasprice, 2, 0, 1};
     table[OP_EXTCODESIZE] = {op_extcodesize, 20, 1, 0};
     table[OP_EXTCODECOPY] = {op_extcodecopy, 20, 4, -4};
@@ -1286,17 +1491,52 @@ constexpr op_table create_op_table_frontier() noexcept
     table[OP_DIFFICULTY] = {op_difficulty, 2, 0, 1};
     table[OP_GASLIMIT] = {op_gaslimit, 2, 0, 1};
     table[OP_POP] = {op_pop, 2, 1, -1};
-    table[OP_MLOAD] = {op_mload, 3, 1, 0};
-    table[OP_MSTORE] = {op_mstore, 3, 2, -2};
-    table[OP_MSTORE8] = {op_mstore8, 3, 2, -2};
+    table[OP_MLOAD] = {op_mload<false>, 3, 1, 0};
+    table[OP_MSTORE] = {op_mstore<false>, 3, 2, -2};
+    table[OP_MSTORE8] = {op_mstore8<false>, 3, 2, -2};
     table[OP_SLOAD] = {op_sload, 50, 1, 0};
-    table[OP_SSTORE] = {op_sstore, 0, 2, -2};
+    table[OP_SSTORE] = {op_sstore<Rev>, 0, 2, -2};
     table[OP_JUMP] = {op_jump, 8, 1, -1};
     table[OP_JUMPI] = {op_jumpi, 10, 2, -2};
     table[OP_PC] = {op_pc, 2, 0, 1};
     table[OP_MSIZE] = {op_msize, 2, 0, 1};
     table[OP_GAS] = {op_gas, 2, 0, 1};
     table[OPX_BEGINBLOCK] = {opx_beginblock, 1, 0, 0};  // Replaces JUMPDEST.
+    table[OPX_STATIC_JUMP] = {opx_static_jump, 11, 0, 0};     // Replaces PUSH + JUMP.
+    table[OPX_STATIC_JUMPI] = {opx_static_jumpi, 13, 1, -1};  // Replaces PUSH + JUMPI.
+
+    // The superinstructions. The base costs and stack requirements are for information only,
+    // the analysis uses the ones of the replaced instructions.
+    table[OPX_PUSH_ADD] = {opx_push_binop<add>, 6, 1, 0};
+    table[OPX_PUSH_SUB] = {opx_push_binop<sub>, 6, 1, 0};
+    table[OPX_PUSH_MUL] = {opx_push_binop<mul>, 8, 1, 0};
+    table[OPX_PUSH_AND] = {opx_push_binop<bit_and>, 6, 1, 0};
+    table[OPX_PUSH_OR] = {opx_push_binop<bit_or>, 6, 1, 0};
+    table[OPX_PUSH_EQ] = {opx_push_binop<eq>, 6, 1, 0};
+    table[OPX_PUSH_LT] = {opx_push_binop<lt>, 6, 1, 0};
+    table[OPX_PUSH_GT] = {opx_push_binop<gt>, 6, 1, 0};
+    table[OPX_PUSH_MLOAD] = {opx_push_mload<false>, 6, 0, 1};
+    table[OPX_PUSH_MSTORE] = {opx_push_mstore<false>, 6, 1, -1};
+    table[OPX_PUSH_ADDRESS_MASK_AND] = {opx_push_address_mask_and, 6, 1, 0};
+    table[OPX_DUP_SWAP] = {opx_dup_swap, 6, 2, 1};
+    table[OPX_SWAP_POP] = {opx_swap_pop, 5, 2, -1};
+    table[OPX_ISZERO_STATIC_JUMPI] = {opx_iszero_static_jumpi, 16, 1, -1};
+
+    // The precharged instructions (see ANALYSIS_PRECHARGE), the costs are of the replaced ones.
+    table[OPX_PRECHARGE_MEMORY] = {opx_precharge_memory, 0, 0, 0};
+    table[OPX_PRECHARGED_MLOAD] = {op_mload<true>, 3, 1, 0};
+    table[OPX_PRECHARGED_MSTORE] = {op_mstore<true>, 3, 2, -2};
+    table[OPX_PRECHARGED_MSTORE8] = {op_mstore8<true>, 3, 2, -2};
+    table[OPX_PRECHARGED_SHA3] = {op_sha3<true>, 30, 2, -1};
+    table[OPX_PRECHARGED_CALLDATACOPY] = {op_calldatacopy<true>, 3, 3, -3};
+    table[OPX_PRECHARGED_CODECOPY] = {op_codecopy<true>, 3, 3, -3};
+    table[OPX_PRECHARGED_EXP] = {op_exp<Rev, true>, 10, 2, -1};
+    table[OPX_PRECHARGED_PUSH_MLOAD] = {opx_push_mload<true>, 6, 0, 1};
+    table[OPX_PRECHARGED_PUSH_MSTORE] = {opx_push_mstore<true>, 6, 1, -1};
+
+    // The BEGINBLOCKs with the checks elided (see ANALYSIS_ELIDE_CHECKS).
+    table[OPX_BEGINBLOCK_GAS] = {opx_beginblock_gas, 1, 0, 0};
+    table[OPX_EMPTY_BLOCKS] = {opx_empty_blocks, 1, 0, 0};
 
     for (auto op = size_t{OP_PUSH1}; op <= OP_PUSH8; ++op)
         table[op] = {op_push_small, 3, 0, 1};
@@ -1343,25 +1583,27 @@ constexpr op_table create_op_table_frontier() noexcept
     table[OP_LOG3] = {op_log<OP_LOG3>, 4 * 375, 5, -5};
     table[OP_LOG4] = {op_log<OP_LOG4>, 5 * 375, 6, -6};
 
-    table[OP_CREATE] = {op_create, 32000, 3, -2};
-    table[OP_CALL] = {op_call<EVMC_CALL>, 40, 7, -6};
-    table[OP_CALLCODE] = {op_call<EVMC_CALLCODE>, 40, 7, -6};
+    table[OP_CREATE] = {op_create<Rev>, 32000, 3, -2};
+    table[OP_CALL] = {op_call<Rev, EVMC_CALL>, 40, 7, -6};
+    table[OP_CALLCODE] = {op_call<Rev, EVMC_CALLCODE>, 40, 7, -6};
     table[OP_RETURN] = {op_return<EVMC_SUCCESS>, 0, 2, -2};
     table[OP_INVALID] = {op_invalid, 0, 0, 0};
-    table[OP_SELFDESTRUCT] = {op_selfdestruct, 0, 1, -1};
+    table[OP_SELFDESTRUCT] = {op_selfdestruct<Rev>, 0, 1, -1};
     return table;
 }
 
+template <evmc_revision Rev>
 constexpr op_table create_op_table_homestead() noexcept
 {
-    auto table = create_op_table_frontier();
-    table[OP_DELEGATECALL] = {op_delegatecall, 40, 6, -5};
+    auto table = create_op_table_frontier<Rev>();
+    table[OP_DELEGATECALL] = {op_delegatecall<Rev>, 40, 6, -5};
     return table;
 }
 
+template <evmc_revision Rev>
 constexpr op_table create_op_table_tangerine_whistle() noexcept
 {
-    auto table = create_op_table_homestead();
+    auto table = create_op_table_homestead<Rev>();
     table[OP_BALANCE].gas_cost = 400;
     table[OP_EXTCODESIZE].gas_cost = 700;
     table[OP_EXTCODECOPY].gas_cost = 700;
@@ -1373,9 +1615,10 @@ constexpr op_table create_op_table_tangerine_whistle() noexcept
     return table;
 }
 
+template <evmc_revision Rev>
 constexpr op_table create_op_table_byzantium() noexcept
 {
-    auto table = create_op_table_tangerine_whistle();
+    auto table = create_op_table_tangerine_whistle<Rev>();
     table[OP_RETURNDATASIZE] = {op_returndatasize, 2, 0, 1};
     table[OP_RETURNDATACOPY] = {op_returndatacopy, 3, 3, -3};
     table[OP_STATICCALL] = {op_staticcall, 700, 6, -5};
@@ -1383,20 +1626,24 @@ constexpr op_table create_op_table_byzantium() noexcept
     return table;
 }
 
+template <evmc_revision Rev>
 constexpr op_table create_op_table_constantinople() noexcept
 {
-    auto table = create_op_table_byzantium();
+    auto table = create_op_table_byzantium<Rev>();
     table[OP_SHL] = {op_shl, 3, 2, -1};
     table[OP_SHR] = {op_shr, 3, 2, -1};
     table[OP_SAR] = {op_sar, 3, 2, -1};
+    table[OPX_PUSH_SHL] = {opx_push_shl, 6, 1, 0};
+    table[OPX_PUSH_SHR] = {opx_push_shr, 6, 1, 0};
     table[OP_EXTCODEHASH] = {op_extcodehash, 400, 1, 0};
     table[OP_CREATE2] = {op_create2, 32000, 4, -3};
     return table;
 }
 
+template <evmc_revision Rev>
 constexpr op_table create_op_table_istanbul() noexcept
 {
-    auto table = create_op_table_constantinople();
+    auto table = create_op_table_constantinople<Rev>();
     table[OP_BALANCE] = {op_balance, 700, 1, 0};
     table[OP_CHAINID] = {op_chainid, 2, 0, 1};
     table[OP_EXTCODEHASH] = {op_extcodehash, 700, 1, 0};
@@ -1405,16 +1652,19 @@ constexpr op_table create_op_table_istanbul() noexcept
     return table;
 }
 
+/// The op tables of the revisions. The tables of the revisions changing only the semantics
+/// of the instructions (e.g. Spurious Dragon) are created by the previous revision's function,
+/// instantiating the instructions for the revision.
 constexpr op_table op_tables[] = {
-    create_op_table_frontier(),           // Frontier
-    create_op_table_homestead(),          // Homestead
-    create_op_table_tangerine_whistle(),  // Tangerine Whistle
-    create_op_table_tangerine_whistle(),  // Spurious Dragon
-    create_op_table_byzantium(),          // Byzantium
-    create_op_table_constantinople(),     // Constantinople
-    create_op_table_constantinople(),     // Petersburg
-    create_op_table_istanbul(),           // Istanbul
-    create_op_table_istanbul(),           // Berlin
+    create_op_table_frontier<EVMC_FRONTIER>(),
+    create_op_table_homestead<EVMC_HOMESTEAD>(),
+    create_op_table_tangerine_whistle<EVMC_TANGERINE_WHISTLE>(),
+    create_op_table_tangerine_whistle<EVMC_SPURIOUS_DRAGON>(),
+    create_op_table_byzantium<EVMC_BYZANTIUM>(),
+    create_op_table_constantinople<EVMC_CONSTANTINOPLE>(),
+    create_op_table_constantinople<EVMC_PETERSBURG>(),
+    create_op_table_istanbul<EVMC_ISTANBUL>(),
+    create_op_table_istanbul<EVMC_BERLIN>(),
 };
 static_assert(sizeof(op_tables) / sizeof(op_tables[0]) > EVMC_MAX_REVISION,
     "op table entry missing for an EVMC revision");
@@ -1424,4 +1674,25 @@ EVMC_EXPORT const op_table& get_op_table(evmc_revision rev) noexcept
 {
     return op_tables[rev];
 }
+
+const instruction* opx_beginblock_prefetch(
+    const instruction* instr, execution_state& state) noexcept
+{
+    const auto next = opx_beginblock(instr, state);
+    if (next == nullptr || !state.host.has_prefetch())
+        return next;
+
+    const auto& analysis = *state.analysis;
+    const auto index = static_cast<uint32_t>(instr - analysis.instrs.data());
+    const auto hints = std::lower_bound(analysis.prefetch_blocks.begin(),
+        analysis.prefetch_blocks.end(), index,
+        [](const prefetch_hints& h, uint32_t i) noexcept { return h.block_index < i; });
+    if (hints != analysis.prefetch_blocks.end() && hints->block_index == index)
+    {
+        state.host.prefetch(state.msg->destination,
+            analysis.prefetch_keys.data() + hints->keys_offset, hints->num_keys,
+            analysis.prefetch_addresses.data() + hints->addresses_offset, hints->num_addresses);
+    }
+    return next;
+}
 }  // namespace evmone
@@ -0,0 +1,900 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+/// @file
+/// The baseline JIT compiler.
+///
+/// The native code mirrors the threaded-code interpreter (see threaded.cpp) with the dispatch
+/// removed: the code of every instruction falls through to the code of the next one and
+/// the static jumps are direct native jumps. The registers hold:
+/// - rbx: the execution state,
+/// - r12: the instructions of the analysis,
+/// - r13: the native addresses of the instructions (for the dynamic continuations),
+/// - r14: the stack top pointer,
+/// - r15: the gas left.
+/// The registers are callee-saved, so they survive the calls of the instruction functions.
+/// Before every call the gas left and the stack top pointer are stored in the state
+/// and they are loaded back after it. If the called function returns other than the next
+/// instruction (e.g. JUMP), the execution continues at the native address of the returned one.
+///
+/// Only x86-64 with the System V ABI (Linux, macOS, BSDs) is supported. Other platforms
+/// use the interpreter.
+
+#include "jit.hpp"
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define EVMONE_JIT_X86_64 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define EVMONE_JIT_X86_64 0
+#endif
+
+namespace evmone
+{
+namespace
+{
+#if EVMONE_JIT_X86_64
+
+enum reg : uint8_t
+{
+    rax = 0,
+    rcx = 1,
+    rdx = 2,
+    rbx = 3,
+    rsi = 6,
+    rdi = 7,
+    r12 = 12,
+    r13 = 13,
+    r14 = 14,
+    r15 = 15,
+};
+
+constexpr auto state_reg = rbx;
+constexpr auto instrs_reg = r12;
+constexpr auto targets_reg = r13;
+constexpr auto top_reg = r14;
+constexpr auto gas_reg = r15;
+
+/// The condition codes of Jcc and SETcc.
+enum cond : uint8_t
+{
+    cond_b = 0x2,
+    cond_e = 0x4,
+    cond_ne = 0x5,
+    cond_l = 0xc,
+    cond_g = 0xf,
+};
+
+/// The opcode extensions (the reg field of ModRM) of the group instructions.
+enum ext : uint8_t
+{
+    ext_add = 0,
+    ext_adc = 2,
+    ext_not = 2,
+    ext_call = 2,
+    ext_jmp = 4,
+    ext_shr = 5,
+    ext_sub = 5,
+    ext_cmp = 7,
+};
+
+/// The offsets of the execution_state fields used by the native code.
+struct state_layout
+{
+    int32_t status;
+    int32_t gas_left;
+    int32_t top_item;
+    int32_t stack_storage;
+    int32_t current_block_cost;
+};
+
+state_layout get_state_layout(const execution_state& state) noexcept
+{
+    const auto base = reinterpret_cast<const uint8_t*>(&state);
+    const auto offset = [base](const void* field) noexcept {
+        return static_cast<int32_t>(static_cast<const uint8_t*>(field) - base);
+    };
+    return {offset(&state.status), offset(&state.gas_left), offset(&state.stack.top_item),
+        offset(&state.stack.storage[0]), offset(&state.current_block_cost)};
+}
+
+constexpr bool is_int8(int64_t v) noexcept
+{
+    return v >= std::numeric_limits<int8_t>::min() && v <= std::numeric_limits<int8_t>::max();
+}
+
+constexpr bool is_int32(int64_t v) noexcept
+{
+    return v >= std::numeric_limits<int32_t>::min() && v <= std::numeric_limits<int32_t>::max();
+}
+
+/// The minimal x86-64 assembler of the instructions used by the compiler.
+///
+/// The memory operands are always [base + disp]. The jumps are rel32 to the labels,
+/// resolved by link().
+class assembler
+{
+    struct fixup
+    {
+        size_t pos;
+        size_t label;
+    };
+
+    std::vector<uint8_t> m_code;
+    std::vector<size_t> m_labels;
+    std::vector<fixup> m_fixups;
+
+    static constexpr auto unbound = std::numeric_limits<size_t>::max();
+
+    void byte(unsigned b) noexcept { m_code.push_back(static_cast<uint8_t>(b)); }
+
+    void imm32(uint32_t v) noexcept
+    {
+        for (unsigned i = 0; i < 4; ++i)
+            byte((v >> (8 * i)) & 0xff);
+    }
+
+    void imm64(uint64_t v) noexcept
+    {
+        for (unsigned i = 0; i < 8; ++i)
+            byte((v >> (8 * i)) & 0xff);
+    }
+
+    void rex(bool w, unsigned r, unsigned index, unsigned base) noexcept
+    {
+        const auto b = 0x40u | (w ? 8u : 0u) | ((r >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+        if (b != 0x40)
+            byte(b);
+    }
+
+    /// The ModRM (with SIB for rsp/r12 base) and the displacement of [base + disp].
+    void mem(unsigned r, reg base, int32_t disp) noexcept
+    {
+        const auto short_disp = is_int8(disp);
+        byte((short_disp ? 0x40u : 0x80u) | ((r & 7) << 3) | (base & 7u));
+        if ((base & 7) == 4)
+            byte(0x24);
+        if (short_disp)
+            byte(static_cast<uint8_t>(disp));
+        else
+            imm32(static_cast<uint32_t>(disp));
+    }
+
+    void rel32(size_t label) noexcept
+    {
+        m_fixups.push_back({m_code.size(), label});
+        imm32(0);
+    }
+
+public:
+    explicit assembler(size_t num_labels) noexcept : m_labels(num_labels, unbound) {}
+
+    [[nodiscard]] size_t size() const noexcept { return m_code.size(); }
+
+    size_t new_label() noexcept
+    {
+        m_labels.push_back(unbound);
+        return m_labels.size() - 1;
+    }
+
+    void bind(size_t label) noexcept { m_labels[label] = m_code.size(); }
+
+    [[nodiscard]] size_t label_offset(size_t label) const noexcept { return m_labels[label]; }
+
+    /// The instruction with the 64-bit register and memory operands.
+    void op_mem(unsigned opcode, unsigned r, reg base, int32_t disp, bool w = true) noexcept
+    {
+        rex(w, r, 0, base);
+        byte(opcode);
+        mem(r, base, disp);
+    }
+
+    /// The instruction with two 64-bit register operands: opcode r, rm.
+    void op_reg(unsigned opcode, unsigned r, reg rm) noexcept
+    {
+        rex(true, r, 0, rm);
+        byte(opcode);
+        byte(0xc0u | ((r & 7) << 3) | (rm & 7u));
+    }
+
+    void load(reg dst, reg base, int32_t disp) noexcept { op_mem(0x8b, dst, base, disp); }
+
+    void store(reg base, int32_t disp, reg src) noexcept { op_mem(0x89, src, base, disp); }
+
+    /// Stores the 32-bit immediate sign-extended to the qword.
+    void store_imm(reg base, int32_t disp, int32_t v) noexcept
+    {
+        op_mem(0xc7, 0, base, disp);
+        imm32(static_cast<uint32_t>(v));
+    }
+
+    /// Stores the 32-bit immediate to the dword.
+    void store_imm_dword(reg base, int32_t disp, uint32_t v) noexcept
+    {
+        op_mem(0xc7, 0, base, disp, false);
+        imm32(v);
+    }
+
+    /// The group 1 instruction (add, adc, sub, cmp, ...) of the register and the immediate.
+    void alu_imm(ext e, reg r, int32_t v) noexcept
+    {
+        rex(true, 0, 0, r);
+        byte(is_int8(v) ? 0x83 : 0x81);
+        byte(0xc0u | (unsigned{e} << 3) | (r & 7u));
+        if (is_int8(v))
+            byte(static_cast<uint8_t>(v));
+        else
+            imm32(static_cast<uint32_t>(v));
+    }
+
+    /// The group 1 instruction of the memory qword and the 8-bit immediate.
+    void alu_mem_imm8(ext e, reg base, int32_t disp, int8_t v) noexcept
+    {
+        op_mem(0x83, e, base, disp);
+        byte(static_cast<uint8_t>(v));
+    }
+
+    /// Loads the immediate, the flags are not affected.
+    void mov_imm(reg r, uint64_t v) noexcept
+    {
+        if (v <= std::numeric_limits<uint32_t>::max())
+        {
+            // The 32-bit mov zero-extends to the full register.
+            rex(false, 0, 0, r);
+            byte(0xb8u + (r & 7u));
+            imm32(static_cast<uint32_t>(v));
+        }
+        else
+        {
+            rex(true, 0, 0, r);
+            byte(0xb8u + (r & 7u));
+            imm64(v);
+        }
+    }
+
+    void mov(reg dst, reg src) noexcept { op_reg(0x89, src, dst); }
+
+    void lea(reg dst, reg base, int32_t disp) noexcept { op_mem(0x8d, dst, base, disp); }
+
+    /// Sets al to the condition, then zero-extends it to eax.
+    void setcc_movzx(cond c) noexcept
+    {
+        byte(0x0f);
+        byte(0x90u | c);
+        byte(0xc0);
+        byte(0x0f);
+        byte(0xb6);
+        byte(0xc0);
+    }
+
+    void shr_imm(reg r, uint8_t v) noexcept
+    {
+        rex(true, 0, 0, r);
+        byte(0xc1);
+        byte(0xc0u | (ext_shr << 3) | (r & 7u));
+        byte(v);
+    }
+
+    void call(reg r) noexcept
+    {
+        rex(false, 0, 0, r);
+        byte(0xff);
+        byte(0xc0u | (ext_call << 3) | (r & 7u));
+    }
+
+    /// jmp [base + index * 8]
+    void jmp_table(reg base, reg index) noexcept
+    {
+        rex(false, 0, index, base);
+        byte(0xff);
+        byte(0x40u | (ext_jmp << 3) | 4u);
+        byte(0xc0u | ((index & 7u) << 3) | (base & 7u));
+        byte(0);
+    }
+
+    void jmp(size_t label) noexcept
+    {
+        byte(0xe9);
+        rel32(label);
+    }
+
+    void jcc(cond c, size_t label) noexcept
+    {
+        byte(0x0f);
+        byte(0x80u | c);
+        rel32(label);
+    }
+
+    void push(reg r) noexcept
+    {
+        rex(false, 0, 0, r);
+        byte(0x50u + (r & 7u));
+    }
+
+    void pop(reg r) noexcept
+    {
+        rex(false, 0, 0, r);
+        byte(0x58u + (r & 7u));
+    }
+
+    void ret() noexcept { byte(0xc3); }
+
+    /// Resolves the jumps and copies the code to the output of size().
+    void link(uint8_t* out) noexcept
+    {
+        for (const auto& f : m_fixups)
+        {
+            const auto rel = static_cast<int64_t>(m_labels[f.label]) -
+                             static_cast<int64_t>(f.pos + sizeof(int32_t));
+            const auto v = static_cast<uint32_t>(static_cast<int32_t>(rel));
+            for (unsigned i = 0; i < 4; ++i)
+                m_code[f.pos + i] = static_cast<uint8_t>(v >> (8 * i));
+        }
+        std::memcpy(out, m_code.data(), m_code.size());
+    }
+};
+
+/// The displacement of the word of the stack item relative to the stack top pointer.
+constexpr int32_t item(int index, int word = 0) noexcept
+{
+    return -32 * index + 8 * word;
+}
+
+/// The compiler of the instructions of the analysis.
+class compiler
+{
+    assembler m_asm;
+    const code_analysis& m_analysis;
+    const state_layout m_layout;
+
+    /// The opcodes of the instruction functions of the revision.
+    std::unordered_map<instruction_exec_fn, int> m_opcodes;
+
+    const size_t m_num_instrs;
+
+    /// The shared exit paths.
+    const size_t m_return;
+    const size_t m_dispatch;
+    const size_t m_exit_success;
+    const size_t m_exit_out_of_gas;
+    const size_t m_exit_underflow;
+    const size_t m_exit_overflow;
+    const size_t m_exit_bad_jump;
+
+    /// The label of the instruction of the index.
+    static size_t instr_label(size_t index) noexcept { return index; }
+
+    int32_t instr_disp(size_t index) const noexcept
+    {
+        return static_cast<int32_t>(index * sizeof(instruction));
+    }
+
+    void sync() noexcept
+    {
+        m_asm.store(state_reg, m_layout.gas_left, gas_reg);
+        m_asm.store(state_reg, m_layout.top_item, top_reg);
+    }
+
+    void reload() noexcept
+    {
+        m_asm.load(gas_reg, state_reg, m_layout.gas_left);
+        m_asm.load(top_reg, state_reg, m_layout.top_item);
+    }
+
+    void add_top(int n) noexcept
+    {
+        m_asm.alu_imm(n > 0 ? ext_add : ext_sub, top_reg, n > 0 ? 32 * n : -32 * n);
+    }
+
+    /// Sets the high 3 words of the stack item to zero.
+    void clear_high_words(int index) noexcept
+    {
+        for (int w = 1; w < 4; ++w)
+            m_asm.store_imm(top_reg, item(index, w), 0);
+    }
+
+    /// Charges the gas, jumping to the out of gas exit if it is not enough.
+    void charge_gas(uint64_t cost) noexcept
+    {
+        if (is_int32(static_cast<int64_t>(cost)))
+            m_asm.alu_imm(ext_sub, gas_reg, static_cast<int32_t>(cost));
+        else
+        {
+            m_asm.mov_imm(rax, cost);
+            m_asm.op_reg(0x29, rax, gas_reg);  // sub r15, rax
+        }
+        m_asm.jcc(cond_l, m_exit_out_of_gas);
+    }
+
+    void emit_beginblock(const block_info& block, bool check_stack) noexcept
+    {
+        charge_gas(block.gas_cost);
+
+        if (check_stack && (block.stack_req > 0 || block.stack_max_growth > 0))
+        {
+            // The stack items are compared by their offset in the state:
+            // the offset of the top item of the stack of height h is storage + (h - 1) * 32.
+            m_asm.mov(rax, top_reg);
+            m_asm.op_reg(0x29, state_reg, rax);  // sub rax, rbx
+            if (block.stack_req > 0)
+            {
+                m_asm.alu_imm(ext_cmp, rax, m_layout.stack_storage + (block.stack_req - 1) * 32);
+                m_asm.jcc(cond_l, m_exit_underflow);
+            }
+            if (block.stack_max_growth > 0)
+            {
+                m_asm.alu_imm(ext_cmp, rax,
+                    m_layout.stack_storage +
+                        (evm_stack::limit - block.stack_max_growth - 1) * 32);
+                m_asm.jcc(cond_g, m_exit_overflow);
+            }
+        }
+
+        m_asm.store_imm_dword(state_reg, m_layout.current_block_cost, block.gas_cost);
+    }
+
+    /// The static jump to the target instruction, -1 for the invalid jump destination.
+    void jump_to(cond c, int64_t target) noexcept
+    {
+        const auto label = target >= 0 ? instr_label(static_cast<size_t>(target)) : m_exit_bad_jump;
+        m_asm.jcc(c, label);
+    }
+
+    /// Pops the item and sets ZF if it is zero.
+    void pop_test_zero() noexcept
+    {
+        add_top(-1);
+        m_asm.load(rax, top_reg, item(-1));
+        for (int w = 1; w < 4; ++w)
+            m_asm.op_mem(0x0b, rax, top_reg, item(-1, w));  // or rax, [m]
+    }
+
+    /// The binary operation on the top items computed word by word with the carry:
+    /// top[-1] = top[0] op top[-1].
+    void emit_sub() noexcept
+    {
+        for (int w = 0; w < 4; ++w)
+        {
+            m_asm.load(rax, top_reg, item(0, w));
+            m_asm.op_mem(w == 0 ? 0x2b : 0x1b, rax, top_reg, item(1, w));  // sub/sbb rax, [m]
+            m_asm.store(top_reg, item(1, w), rax);
+        }
+        add_top(-1);
+    }
+
+    /// Compares the items a and b setting CF if a < b.
+    void compare_below(int a, int b) noexcept
+    {
+        for (int w = 0; w < 4; ++w)
+        {
+            m_asm.load(rax, top_reg, item(a, w));
+            m_asm.op_mem(w == 0 ? 0x2b : 0x1b, rax, top_reg, item(b, w));  // sub/sbb rax, [m]
+        }
+    }
+
+    /// Stores the flag in eax as the item.
+    void store_flag(int index) noexcept
+    {
+        m_asm.store(top_reg, item(index), rax);
+        clear_high_words(index);
+    }
+
+    /// The bitwise operation top[-1] op= top[0].
+    void emit_bitwise(unsigned opcode) noexcept
+    {
+        for (int w = 0; w < 4; ++w)
+        {
+            m_asm.load(rax, top_reg, item(0, w));
+            m_asm.op_mem(opcode, rax, top_reg, item(1, w));
+        }
+        add_top(-1);
+    }
+
+    void copy_item(int dst, int src) noexcept
+    {
+        for (int w = 0; w < 4; ++w)
+        {
+            m_asm.load(rax, top_reg, item(src, w));
+            m_asm.store(top_reg, item(dst, w), rax);
+        }
+    }
+
+    void emit_call(size_t index, instruction_exec_fn fn) noexcept
+    {
+        sync();
+        m_asm.lea(rdi, instrs_reg, instr_disp(index));
+        m_asm.mov(rsi, state_reg);
+        m_asm.mov_imm(rax, reinterpret_cast<uint64_t>(fn));
+        m_asm.call(rax);
+        m_asm.op_reg(0x85, rax, rax);  // test rax, rax
+        m_asm.jcc(cond_e, m_return);
+        reload();
+        if (index + 1 == m_num_instrs)
+        {
+            m_asm.jmp(m_dispatch);
+            return;
+        }
+        m_asm.lea(rcx, instrs_reg, instr_disp(index + 1));
+        m_asm.op_reg(0x39, rcx, rax);  // cmp rax, rcx
+        m_asm.jcc(cond_ne, m_dispatch);
+    }
+
+    /// Emits the inlined instruction. Returns false if it is not inlined.
+    bool emit_inline(size_t index, int opcode, const instruction_argument& arg) noexcept
+    {
+        switch (opcode)
+        {
+        case OPX_BEGINBLOCK:
+            emit_beginblock(arg.block, true);
+            return true;
+
+        case OPX_BEGINBLOCK_GAS:
+            emit_beginblock(arg.block, false);
+            return true;
+
+        case OPX_EMPTY_BLOCKS:
+        {
+            const auto a = static_cast<uint64_t>(arg.number);
+            charge_gas(a >> 32);
+            m_asm.jmp(instr_label(index + (a & 0xffffffff)));
+            return true;
+        }
+
+        case OP_STOP:
+            m_asm.jmp(m_exit_success);
+            return true;
+
+        case OP_ADD:
+            for (int w = 0; w < 4; ++w)
+            {
+                m_asm.load(rax, top_reg, item(0, w));
+                m_asm.op_mem(w == 0 ? 0x01 : 0x11, rax, top_reg, item(1, w));  // add/adc [m], rax
+            }
+            add_top(-1);
+            return true;
+
+        case OP_SUB:
+            emit_sub();
+            return true;
+
+        case OP_LT:
+            compare_below(0, 1);
+            m_asm.setcc_movzx(cond_b);
+            store_flag(1);
+            add_top(-1);
+            return true;
+
+        case OP_GT:
+            compare_below(1, 0);
+            m_asm.setcc_movzx(cond_b);
+            store_flag(1);
+            add_top(-1);
+            return true;
+
+        case OP_EQ:
+            m_asm.load(rax, top_reg, item(0));
+            m_asm.op_mem(0x33, rax, top_reg, item(1));  // xor rax, [m]
+            for (int w = 1; w < 4; ++w)
+            {
+                m_asm.load(rcx, top_reg, item(0, w));
+                m_asm.op_mem(0x33, rcx, top_reg, item(1, w));  // xor rcx, [m]
+                m_asm.op_reg(0x09, rcx, rax);                  // or rax, rcx
+            }
+            m_asm.setcc_movzx(cond_e);
+            store_flag(1);
+            add_top(-1);
+            return true;
+
+        case OP_ISZERO:
+            m_asm.load(rax, top_reg, item(0));
+            for (int w = 1; w < 4; ++w)
+                m_asm.op_mem(0x0b, rax, top_reg, item(0, w));  // or rax, [m]
+            m_asm.setcc_movzx(cond_e);
+            store_flag(0);
+            return true;
+
+        case OP_AND:
+            emit_bitwise(0x21);
+            return true;
+
+        case OP_OR:
+            emit_bitwise(0x09);
+            return true;
+
+        case OP_XOR:
+            emit_bitwise(0x31);
+            return true;
+
+        case OP_NOT:
+            for (int w = 0; w < 4; ++w)
+                m_asm.op_mem(0xf7, ext_not, top_reg, item(0, w));
+            return true;
+
+        case OP_POP:
+            add_top(-1);
+            return true;
+
+        case OPX_STATIC_JUMP:
+            m_asm.jmp(arg.number >= 0 ? instr_label(static_cast<size_t>(arg.number)) :
+                                        m_exit_bad_jump);
+            return true;
+
+        case OPX_STATIC_JUMPI:
+            pop_test_zero();
+            jump_to(cond_ne, arg.number);
+            return true;
+
+        case OPX_ISZERO_STATIC_JUMPI:
+            pop_test_zero();
+            jump_to(cond_e, arg.number);
+            return true;
+
+        case OPX_PUSH_ADD:
+            m_asm.mov_imm(rax, arg.small_push_value);
+            m_asm.op_mem(0x01, rax, top_reg, item(0));  // add [m], rax
+            for (int w = 1; w < 4; ++w)
+                m_asm.alu_mem_imm8(ext_adc, top_reg, item(0, w), 0);
+            return true;
+
+        case OPX_PUSH_AND:
+            m_asm.mov_imm(rax, arg.small_push_value);
+            m_asm.op_mem(0x21, rax, top_reg, item(0));  // and [m], rax
+            clear_high_words(0);
+            return true;
+
+        case OPX_PUSH_OR:
+            m_asm.mov_imm(rax, arg.small_push_value);
+            m_asm.op_mem(0x09, rax, top_reg, item(0));  // or [m], rax
+            return true;
+
+        case OPX_PUSH_ADDRESS_MASK_AND:
+            m_asm.mov_imm(rax, 0xffffffff);
+            m_asm.op_mem(0x21, rax, top_reg, item(0, 2));  // and [m], rax
+            m_asm.store_imm(top_reg, item(0, 3), 0);
+            return true;
+
+        case OPX_SWAP_POP:
+            copy_item(static_cast<int>(arg.number), 0);
+            add_top(-1);
+            return true;
+
+        case OPX_DUP_SWAP:
+        {
+            // The item at the dup index is pushed and swapped with the item at the swap index.
+            // Both items are read before any is written, word by word.
+            const auto dup_index = static_cast<int>(arg.number & 0xff) - 1;
+            const auto swap_index = static_cast<int>(arg.number >> 8);
+            for (int w = 0; w < 4; ++w)
+            {
+                m_asm.load(rax, top_reg, item(dup_index, w));
+                m_asm.load(rcx, top_reg, item(swap_index - 1, w));
+                m_asm.store(top_reg, item(-1, w), rcx);
+                m_asm.store(top_reg, item(swap_index - 1, w), rax);
+            }
+            add_top(1);
+            return true;
+        }
+
+        default:
+            break;
+        }
+
+        if (opcode >= OP_PUSH1 && opcode <= OP_PUSH8)
+        {
+            const auto value = arg.small_push_value;
+            if (value <= uint64_t{std::numeric_limits<int32_t>::max()})
+                m_asm.store_imm(top_reg, item(-1), static_cast<int32_t>(value));
+            else
+            {
+                m_asm.mov_imm(rax, value);
+                m_asm.store(top_reg, item(-1), rax);
+            }
+            clear_high_words(-1);
+            add_top(1);
+            return true;
+        }
+
+        if (opcode >= OP_PUSH9 && opcode <= OP_PUSH32)
+        {
+            m_asm.mov_imm(rcx, reinterpret_cast<uint64_t>(arg.push_value));
+            for (int w = 0; w < 4; ++w)
+            {
+                m_asm.load(rax, rcx, 8 * w);
+                m_asm.store(top_reg, item(-1, w), rax);
+            }
+            add_top(1);
+            return true;
+        }
+
+        if (opcode >= OP_DUP1 && opcode <= OP_DUP16)
+        {
+            copy_item(-1, opcode - OP_DUP1);
+            add_top(1);
+            return true;
+        }
+
+        if (opcode >= OP_SWAP1 && opcode <= OP_SWAP16)
+        {
+            const auto n = opcode - OP_SWAP1 + 1;
+            for (int w = 0; w < 4; ++w)
+            {
+                m_asm.load(rax, top_reg, item(0, w));
+                m_asm.load(rcx, top_reg, item(n, w));
+                m_asm.store(top_reg, item(0, w), rcx);
+                m_asm.store(top_reg, item(n, w), rax);
+            }
+            return true;
+        }
+
+        return false;
+    }
+
+    void emit_exit(size_t label, evmc_status_code status) noexcept
+    {
+        m_asm.bind(label);
+        sync();
+        m_asm.store_imm_dword(state_reg, m_layout.status, static_cast<uint32_t>(status));
+        m_asm.jmp(m_return);
+    }
+
+public:
+    compiler(const code_analysis& analysis, const execution_state& state) noexcept
+      : m_asm{analysis.instrs.size()},
+        m_analysis{analysis},
+        m_layout{get_state_layout(state)},
+        m_num_instrs{analysis.instrs.size()},
+        m_return{m_asm.new_label()},
+        m_dispatch{m_asm.new_label()},
+        m_exit_success{m_asm.new_label()},
+        m_exit_out_of_gas{m_asm.new_label()},
+        m_exit_underflow{m_asm.new_label()},
+        m_exit_overflow{m_asm.new_label()},
+        m_exit_bad_jump{m_asm.new_label()}
+    {
+        // The intrinsic opcodes of the same functions as EVM opcodes (e.g. BEGINBLOCK)
+        // come first, the EVM opcodes win.
+        const auto& op_tbl = get_op_table(state.rev);
+        for (auto op = op_table_size; op-- > 0;)
+            m_opcodes[op_tbl[op].fn] = static_cast<int>(op);
+    }
+
+    /// Compiles the code. Returns the code size, the code is output by link().
+    size_t compile() noexcept
+    {
+        // The prologue. The 5 registers pushed align the stack to 16 bytes for the calls.
+        for (const auto r : {rbx, r12, r13, r14, r15})
+            m_asm.push(r);
+        m_asm.mov(state_reg, rdi);
+        m_asm.mov(instrs_reg, rsi);
+        m_asm.mov(targets_reg, rdx);
+        reload();
+
+        for (size_t i = 0; i < m_num_instrs; ++i)
+        {
+            m_asm.bind(instr_label(i));
+            const auto& instr = m_analysis.instrs[i];
+            const auto it = m_opcodes.find(instr.fn);
+            const auto opcode = it != m_opcodes.end() ? it->second : -1;
+            if (!emit_inline(i, opcode, instr.arg))
+                emit_call(i, instr.fn);
+        }
+
+        // The instruction returned by the instruction function in rax.
+        m_asm.bind(m_dispatch);
+        m_asm.op_reg(0x29, instrs_reg, rax);  // sub rax, r12
+        m_asm.shr_imm(rax, 4);
+        m_asm.jmp_table(targets_reg, rax);
+
+        emit_exit(m_exit_success, EVMC_SUCCESS);
+        emit_exit(m_exit_out_of_gas, EVMC_OUT_OF_GAS);
+        emit_exit(m_exit_underflow, EVMC_STACK_UNDERFLOW);
+        emit_exit(m_exit_overflow, EVMC_STACK_OVERFLOW);
+        emit_exit(m_exit_bad_jump, EVMC_BAD_JUMP_DESTINATION);
+
+        m_asm.bind(m_return);
+        for (const auto r : {r15, r14, r13, r12, rbx})
+            m_asm.pop(r);
+        m_asm.ret();
+
+        return m_asm.size();
+    }
+
+    void link(uint8_t* out, std::vector<const void*>& targets) noexcept
+    {
+        m_asm.link(out);
+        targets.resize(m_num_instrs);
+        for (size_t i = 0; i < m_num_instrs; ++i)
+            targets[i] = out + m_asm.label_offset(instr_label(i));
+    }
+};
+
+static_assert(sizeof(instruction) == 16, "The instruction index is computed with shift by 4");
+static_assert(sizeof(evmc_status_code) == sizeof(uint32_t));
+static_assert(sizeof(execution_state::current_block_cost) == sizeof(uint32_t));
+
+/// The maximum number of instructions compiled, so the displacements fit 32 bits.
+constexpr size_t max_compiled_instrs = size_t{1} << 24;
+
+#endif
+}  // namespace
+
+jit_code::~jit_code() noexcept
+{
+#if EVMONE_JIT_X86_64
+    if (m_code != nullptr)
+        munmap(m_code, m_code_size);
+#endif
+}
+
+std::unique_ptr<jit_code> jit_code::compile(
+    const code_analysis& analysis, const execution_state& state) noexcept
+{
+#if EVMONE_JIT_X86_64
+    if (analysis.lazy || analysis.instrs.empty() || analysis.instrs.size() > max_compiled_instrs)
+        return nullptr;
+
+    compiler c{analysis, state};
+    const auto size = c.compile();
+
+    const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const auto mapped_size = (size + page_size - 1) / page_size * page_size;
+    const auto ptr =
+        mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return nullptr;
+
+    std::unique_ptr<jit_code> code{new jit_code};
+    code->m_code = ptr;
+    code->m_code_size = mapped_size;
+    c.link(static_cast<uint8_t*>(ptr), code->m_targets);
+
+    // The code is never writable and executable at the same time.
+    if (mprotect(ptr, mapped_size, PROT_READ | PROT_EXEC) != 0)
+        return nullptr;
+    return code;
+#else
+    (void)analysis;
+    (void)state;
+    return nullptr;
+#endif
+}
+
+void jit_code::execute(execution_state& state) const noexcept
+{
+    const auto entry = reinterpret_cast<entry_fn>(m_code);
+    entry(&state, state.analysis->instrs.data(), m_targets.data());
+}
+
+jit_tier::~jit_tier() noexcept
+{
+    delete m_code.load(std::memory_order_relaxed);
+}
+
+void jit_tier::compile(const code_analysis& analysis) noexcept
+{
+    if (code() != nullptr)
+        return;
+
+    // Only the layout of the state is used by the compiler, the same for all states.
+    static const auto layout_state = std::make_unique<execution_state>();
+    auto compiled = jit_code::compile(analysis, *layout_state);
+    if (compiled == nullptr)
+        return;
+
+    // The repeated request might have published the code in the meantime.
+    jit_code* expected = nullptr;
+    if (m_code.compare_exchange_strong(expected, compiled.get(), std::memory_order_release,
+            std::memory_order_relaxed))
+        compiled.release();
+}
+
+bool is_jit_available() noexcept
+{
+    return EVMONE_JIT_X86_64 != 0;
+}
+}  // namespace evmone
@@ -0,0 +1,129 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include "analysis.hpp"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace evmone
+{
+/// The default number of executions of the code after which it is compiled by the JIT.
+constexpr uint32_t default_jit_threshold = 100;
+
+/// The native code compiled from the code analysis by the baseline JIT compiler.
+///
+/// Every instruction of the analysis is compiled in order to the native code block.
+/// The BEGINBLOCK checks of the basic blocks (with exactly the gas and stack semantics
+/// of block_info), the stack manipulation, the simple arithmetic and bitwise instructions
+/// and the static jumps are inlined. All other instructions call their instruction functions
+/// with the state synchronized, so they keep the interpreter semantics. The gas left and
+/// the stack top pointer are kept in registers between the calls.
+///
+/// The native code references the instructions of the analysis, so it is valid only
+/// as long as the analysis it has been compiled from.
+class jit_code
+{
+    /// The entry point: the state, the instructions of the analysis
+    /// and the native addresses of the instructions.
+    using entry_fn = void (*)(execution_state*, const instruction*, const void* const*);
+
+    /// The executable memory.
+    void* m_code = nullptr;
+    size_t m_code_size = 0;
+
+    /// The native addresses of the instructions, indexed as the instructions of the analysis.
+    /// The instructions returned by the called instruction functions are continued here.
+    std::vector<const void*> m_targets;
+
+    jit_code() noexcept = default;
+
+public:
+    EVMC_EXPORT ~jit_code() noexcept;
+
+    jit_code(const jit_code&) = delete;
+    jit_code& operator=(const jit_code&) = delete;
+
+    /// Compiles the analysis for the executions in the states like the given one
+    /// (only the layout of the state is used). The analysis must not be lazy.
+    /// Returns null if the JIT is not available on this platform or the compilation fails.
+    [[nodiscard]] EVMC_EXPORT static std::unique_ptr<jit_code> compile(
+        const code_analysis& analysis, const execution_state& state) noexcept;
+
+    /// The size of the native code in bytes.
+    [[nodiscard]] size_t size() const noexcept { return m_code_size; }
+
+    /// The memory used by the compiled code (in bytes): the native code and the targets.
+    [[nodiscard]] size_t memory_size() const noexcept
+    {
+        return sizeof(*this) + m_code_size + m_targets.capacity() * sizeof(m_targets[0]);
+    }
+
+    /// Executes the code. The state's analysis must be the compiled one.
+    EVMC_EXPORT void execute(execution_state& state) const noexcept;
+};
+
+/// The tiering state of the analysis for the JIT (see ANALYSIS_JIT).
+///
+/// The analysis is interpreted until the number of its executions reaches the threshold.
+/// The execution reaching it requests the compilation, which is done in the background
+/// (see analysis_pool::submit_jit()), and the analysis is interpreted until the compiled
+/// code is published. The compiled code is owned by the tier and published to
+/// the executions in all threads.
+class jit_tier
+{
+    std::atomic<uint32_t> m_executions{0};
+    std::atomic<jit_code*> m_code{nullptr};
+
+public:
+    jit_tier() noexcept = default;
+    EVMC_EXPORT ~jit_tier() noexcept;
+
+    jit_tier(const jit_tier&) = delete;
+    jit_tier& operator=(const jit_tier&) = delete;
+
+    /// Counts the execution. Returns true for the execution counted after the threshold number
+    /// of them, which requests the compilation: with the threshold 0 the first execution.
+    [[nodiscard]] bool count(uint32_t threshold) noexcept
+    {
+        // The counting stops after the threshold, so it cannot wrap around.
+        return m_executions.load(std::memory_order_relaxed) <= threshold &&
+               m_executions.fetch_add(1, std::memory_order_relaxed) == threshold;
+    }
+
+    /// Cancels the request of the compilation (e.g. dropped by the pool),
+    /// so the next execution counted requests it again.
+    void cancel(uint32_t threshold) noexcept
+    {
+        m_executions.store(threshold, std::memory_order_relaxed);
+    }
+
+    /// Compiles the analysis of this tier and publishes the code, unless already published.
+    EVMC_EXPORT void compile(const code_analysis& analysis) noexcept;
+
+    /// The compiled code if already published, null for the interpreted execution.
+    [[nodiscard]] const jit_code* code() const noexcept
+    {
+        return m_code.load(std::memory_order_acquire);
+    }
+
+    /// The memory used by the compiled code (in bytes), 0 until published.
+    [[nodiscard]] size_t memory_size() const noexcept
+    {
+        const auto c = code();
+        return c != nullptr ? c->memory_size() : 0;
+    }
+
+    /// The number of the executions counted. The counting stops shortly after the threshold.
+    [[nodiscard]] uint32_t num_executions() const noexcept
+    {
+        return m_executions.load(std::memory_order_relaxed);
+    }
+};
+
+/// Checks if the JIT is available on this platform (x86-64 with the System V ABI).
+/// The analysis is always interpreted if not.
+EVMC_EXPORT bool is_jit_available() noexcept;
+}  // namespace evmone
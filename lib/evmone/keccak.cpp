@@ -0,0 +1,168 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "keccak.hpp"
+#include <ethash/keccak.hpp>
+#include <cstring>
+
+namespace evmone
+{
+namespace
+{
+constexpr uint64_t round_constants[24] = {0x0000000000000001, 0x0000000000008082,
+    0x800000000000808a, 0x8000000080008000, 0x000000000000808b, 0x0000000080000001,
+    0x8000000080008081, 0x8000000000008009, 0x000000000000008a, 0x0000000000000088,
+    0x0000000080008009, 0x000000008000000a, 0x000000008000808b, 0x800000000000008b,
+    0x8000000000008089, 0x8000000000008003, 0x8000000000008002, 0x8000000000000080,
+    0x000000000000800a, 0x800000008000000a, 0x8000000080008081, 0x8000000000008080,
+    0x0000000080000001, 0x8000000080008008};
+
+/// The rate of Keccak-256 in 64-bit words.
+constexpr size_t rate_words = 17;
+
+inline uint64_t rol(uint64_t x, int s) noexcept
+{
+    return (x << s) | (x >> (64 - s));
+}
+
+/// Computes Keccak-256 of the input of num_words words fitting in the single block.
+/// The words are in the little-endian order of the Keccak lanes, as on the supported
+/// (little-endian) architectures.
+inline bytes32 keccak256_words(const uint64_t* words, size_t num_words) noexcept
+{
+    uint64_t state[25]{};
+    for (size_t i = 0; i < num_words; ++i)
+        state[i] = words[i];
+
+    // The padding: the 0x01 byte after the input and the 0x80 byte at the end of the block.
+    state[num_words] ^= 0x01;
+    state[rate_words - 1] ^= 0x8000000000000000;
+
+    keccakf1600(state);
+
+    bytes32 hash;
+    std::memcpy(hash.data(), state, sizeof(hash));
+    return hash;
+}
+
+/// Computes the index of the memo entry from the input words.
+inline size_t memo_index(const uint64_t* words, size_t num_entries) noexcept
+{
+    uint64_t h = 0;
+    for (size_t i = 0; i < 8; ++i)
+        h ^= words[i];
+    h *= 0x9e3779b97f4a7c15;
+    return static_cast<size_t>(h >> 32) % num_entries;
+}
+}  // namespace
+
+void keccakf1600(uint64_t st[25]) noexcept
+{
+    // The steps within each round are unrolled, the lanes are indexed as x + 5 * y.
+    for (const auto rc : round_constants)
+    {
+        // Theta.
+        const auto c0 = st[0] ^ st[5] ^ st[10] ^ st[15] ^ st[20];
+        const auto c1 = st[1] ^ st[6] ^ st[11] ^ st[16] ^ st[21];
+        const auto c2 = st[2] ^ st[7] ^ st[12] ^ st[17] ^ st[22];
+        const auto c3 = st[3] ^ st[8] ^ st[13] ^ st[18] ^ st[23];
+        const auto c4 = st[4] ^ st[9] ^ st[14] ^ st[19] ^ st[24];
+        const auto d0 = c4 ^ rol(c1, 1);
+        const auto d1 = c0 ^ rol(c2, 1);
+        const auto d2 = c1 ^ rol(c3, 1);
+        const auto d3 = c2 ^ rol(c4, 1);
+        const auto d4 = c3 ^ rol(c0, 1);
+
+        // Rho and pi.
+        const auto b0 = st[0] ^ d0;
+        const auto b1 = rol(st[6] ^ d1, 44);
+        const auto b2 = rol(st[12] ^ d2, 43);
+        const auto b3 = rol(st[18] ^ d3, 21);
+        const auto b4 = rol(st[24] ^ d4, 14);
+        const auto b5 = rol(st[3] ^ d3, 28);
+        const auto b6 = rol(st[9] ^ d4, 20);
+        const auto b7 = rol(st[10] ^ d0, 3);
+        const auto b8 = rol(st[16] ^ d1, 45);
+        const auto b9 = rol(st[22] ^ d2, 61);
+        const auto b10 = rol(st[1] ^ d1, 1);
+        const auto b11 = rol(st[7] ^ d2, 6);
+        const auto b12 = rol(st[13] ^ d3, 25);
+        const auto b13 = rol(st[19] ^ d4, 8);
+        const auto b14 = rol(st[20] ^ d0, 18);
+        const auto b15 = rol(st[4] ^ d4, 27);
+        const auto b16 = rol(st[5] ^ d0, 36);
+        const auto b17 = rol(st[11] ^ d1, 10);
+        const auto b18 = rol(st[17] ^ d2, 15);
+        const auto b19 = rol(st[23] ^ d3, 56);
+        const auto b20 = rol(st[2] ^ d2, 62);
+        const auto b21 = rol(st[8] ^ d3, 55);
+        const auto b22 = rol(st[14] ^ d4, 39);
+        const auto b23 = rol(st[15] ^ d0, 41);
+        const auto b24 = rol(st[21] ^ d1, 2);
+
+        // Chi.
+        st[0] = b0 ^ (~b1 & b2);
+        st[1] = b1 ^ (~b2 & b3);
+        st[2] = b2 ^ (~b3 & b4);
+        st[3] = b3 ^ (~b4 & b0);
+        st[4] = b4 ^ (~b0 & b1);
+        st[5] = b5 ^ (~b6 & b7);
+        st[6] = b6 ^ (~b7 & b8);
+        st[7] = b7 ^ (~b8 & b9);
+        st[8] = b8 ^ (~b9 & b5);
+        st[9] = b9 ^ (~b5 & b6);
+        st[10] = b10 ^ (~b11 & b12);
+        st[11] = b11 ^ (~b12 & b13);
+        st[12] = b12 ^ (~b13 & b14);
+        st[13] = b13 ^ (~b14 & b10);
+        st[14] = b14 ^ (~b10 & b11);
+        st[15] = b15 ^ (~b16 & b17);
+        st[16] = b16 ^ (~b17 & b18);
+        st[17] = b17 ^ (~b18 & b19);
+        st[18] = b18 ^ (~b19 & b15);
+        st[19] = b19 ^ (~b15 & b16);
+        st[20] = b20 ^ (~b21 & b22);
+        st[21] = b21 ^ (~b22 & b23);
+        st[22] = b22 ^ (~b23 & b24);
+        st[23] = b23 ^ (~b24 & b20);
+        st[24] = b24 ^ (~b20 & b21);
+
+        // Iota.
+        st[0] ^= rc;
+    }
+}
+
+bytes32 keccak256(const uint8_t* data, size_t size) noexcept
+{
+    if (size == 32 || size == 64)
+    {
+        uint64_t words[8];
+        std::memcpy(words, data, size);
+        return keccak256_words(words, size / 8);
+    }
+
+    bytes32 hash;
+    const auto h = ethash::keccak256(data, size);
+    std::memcpy(hash.data(), h.bytes, sizeof(hash));
+    return hash;
+}
+
+bytes32 keccak_memo::hash(const uint8_t* data, size_t size) noexcept
+{
+    if (size != 32 && size != 64)
+        return keccak256(data, size);
+
+    uint64_t words[8]{};
+    std::memcpy(words, data, size);
+
+    auto& e = m_entries[memo_index(words, num_entries)];
+    if (e.size == size && std::memcmp(e.input, words, sizeof(words)) == 0)
+        return e.hash;
+
+    e.hash = keccak256_words(words, size / 8);
+    std::memcpy(e.input, words, sizeof(words));
+    e.size = size;
+    return e.hash;
+}
+}  // namespace evmone
@@ -0,0 +1,58 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include <evmc/utils.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace evmone
+{
+using bytes32 = std::array<uint8_t, 32>;
+
+/// The Keccak-f[1600] permutation of the state of 25 lanes.
+EVMC_EXPORT void keccakf1600(uint64_t state[25]) noexcept;
+
+/// Computes Keccak-256 of the data. The 32 and 64-byte inputs (the words and the pairs
+/// of words hashed e.g. for the Solidity mapping slots) take the single block fast path,
+/// the other sizes are hashed by ethash.
+EVMC_EXPORT bytes32 keccak256(const uint8_t* data, size_t size) noexcept;
+
+/// The small cache of the recent Keccak-256 results of the 32 and 64-byte inputs.
+///
+/// The same mapping slots are often hashed repeatedly in a single execution (e.g. in loops).
+/// The cache is direct-mapped, a hit costs the comparison of the input
+/// instead of the permutation.
+class keccak_memo
+{
+    static constexpr size_t num_entries = 16;
+
+    struct entry
+    {
+        /// The input words or the words of the 32-byte input followed by zeros.
+        uint64_t input[8];
+
+        /// The input size: 32 or 64, 0 for the empty entry.
+        uint64_t size;
+
+        bytes32 hash;
+    };
+
+    entry m_entries[num_entries];
+
+public:
+    keccak_memo() noexcept { clear(); }
+
+    /// Removes all entries.
+    void clear() noexcept
+    {
+        for (auto& e : m_entries)
+            e.size = 0;
+    }
+
+    /// Computes Keccak-256 of the data, using the cached result if available.
+    EVMC_EXPORT bytes32 hash(const uint8_t* data, size_t size) noexcept;
+};
+}  // namespace evmone
@@ -0,0 +1,176 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "lazy_analysis.hpp"
+#include "code_scan.hpp"
+#include <limits>
+
+namespace evmone
+{
+lazy_analysis::lazy_analysis(
+    evmc_revision rev, const uint8_t* code, size_t code_size, uint32_t flags) noexcept
+  : m_rev{rev},
+    m_flags{flags},
+    m_code{code, code_size},
+    m_jumpdest_bitmap((code_size + 63) / 64),
+    m_jumpdest_rank(m_jumpdest_bitmap.size())
+{
+    const auto scanned = scan_code(code, code_size, m_jumpdest_bitmap.data());
+    m_num_jumpdests = scanned.num_jumpdests;
+    m_num_large_pushes = scanned.num_large_pushes;
+
+    int32_t rank = 0;
+    for (size_t w = 0; w < m_jumpdest_bitmap.size(); ++w)
+    {
+        m_jumpdest_rank[w] = rank;
+        rank += popcount(m_jumpdest_bitmap[w]);
+    }
+
+    m_entries.reset(new std::atomic<const instruction*>[m_num_jumpdests + 1]);
+    for (size_t i = 0; i <= m_num_jumpdests; ++i)
+        m_entries[i].store(nullptr, std::memory_order_relaxed);
+
+    const auto size = sizeof(*this) + m_code.size() +
+                      m_jumpdest_bitmap.size() * sizeof(m_jumpdest_bitmap[0]) +
+                      m_jumpdest_rank.size() * sizeof(m_jumpdest_rank[0]) +
+                      (m_num_jumpdests + 1) * sizeof(m_entries[0]);
+    m_memory_size.store(size, std::memory_order_relaxed);
+}
+
+std::atomic<const instruction*>* lazy_analysis::jumpdest_entry(size_t offset) const noexcept
+{
+    const auto word_index = offset / 64;
+    if (word_index >= m_jumpdest_bitmap.size())
+        return nullptr;
+
+    const auto word = m_jumpdest_bitmap[word_index];
+    const auto mask = uint64_t{1} << (offset % 64);
+    if ((word & mask) == 0)
+        return nullptr;
+
+    const auto rank = m_jumpdest_rank[word_index] + popcount(word & (mask - 1));
+    return &m_entries[static_cast<size_t>(rank)];
+}
+
+const instruction* lazy_analysis::analyze_entry(
+    std::atomic<const instruction*>& entry, size_t offset) noexcept
+{
+    std::lock_guard lock{m_mutex};
+
+    // Check again, the segment might have been analyzed by another thread.
+    if (const auto instr = entry.load(std::memory_order_relaxed); instr != nullptr)
+        return instr;
+
+    auto segment = analyze_segment(*this, m_code.data(), m_code.size(), offset);
+    const auto instrs = segment.instrs.data();
+
+    // The JUMPDEST at the offset is also listed in the segment, this is the same entry then.
+    entry.store(instrs, std::memory_order_release);
+    for (size_t i = 0; i < segment.jumpdest_offsets.size(); ++i)
+    {
+        const auto e = jumpdest_entry(static_cast<size_t>(segment.jumpdest_offsets[i]));
+        e->store(&instrs[static_cast<size_t>(segment.jumpdest_targets[i])],
+            std::memory_order_release);
+    }
+
+    // The instructions stay in place, the arena is moved with the segment.
+    m_memory_size.fetch_add(sizeof(segment) + segment.arena_size, std::memory_order_relaxed);
+    m_segments.emplace_back(std::move(segment));
+    return instrs;
+}
+
+const instruction* lazy_analysis::start() noexcept
+{
+    auto& entry = m_entries[m_num_jumpdests];
+    if (const auto instr = entry.load(std::memory_order_acquire); instr != nullptr)
+        return instr;
+    return analyze_entry(entry, 0);
+}
+
+const instruction* lazy_analysis::jumpdest(size_t offset) noexcept
+{
+    const auto entry = jumpdest_entry(offset);
+    if (entry == nullptr)
+        return nullptr;
+    if (const auto instr = entry->load(std::memory_order_acquire); instr != nullptr)
+        return instr;
+    return analyze_entry(*entry, offset);
+}
+
+bool lazy_analysis::is_analyzed(size_t offset) const noexcept
+{
+    const auto entry = jumpdest_entry(offset);
+    return entry != nullptr && entry->load(std::memory_order_relaxed) != nullptr;
+}
+
+size_t lazy_analysis::num_segments() noexcept
+{
+    std::lock_guard lock{m_mutex};
+    return m_segments.size();
+}
+
+size_t lazy_analysis::num_instructions() noexcept
+{
+    std::lock_guard lock{m_mutex};
+    size_t n = 0;
+    for (const auto& segment : m_segments)
+        n += segment.instrs.size();
+    return n;
+}
+
+namespace
+{
+const instruction* jump_to(execution_state& state, const intx::uint256& dst) noexcept
+{
+    const instruction* target = nullptr;
+    if (std::numeric_limits<int>::max() < dst ||
+        (target = state.analysis->lazy->jumpdest(static_cast<size_t>(dst))) == nullptr)
+        return state.exit(EVMC_BAD_JUMP_DESTINATION);
+    return target;
+}
+}  // namespace
+
+const instruction* lazy_jump(const instruction*, execution_state& state) noexcept
+{
+    return jump_to(state, state.stack.pop());
+}
+
+const instruction* lazy_jumpi(const instruction* instr, execution_state& state) noexcept
+{
+    if (state.stack[1] != 0)
+        instr = jump_to(state, state.stack[0]);
+    else
+        ++instr;
+
+    state.stack.pop();
+    state.stack.pop();
+    return instr;
+}
+
+const instruction* lazy_static_jump(const instruction* instr, execution_state& state) noexcept
+{
+    // The argument is the jump destination, not resolved by the lazy analysis.
+    return jump_to(state, instr->arg.small_push_value);
+}
+
+const instruction* lazy_static_jumpi(const instruction* instr, execution_state& state) noexcept
+{
+    if (state.stack.pop() != 0)
+        return lazy_static_jump(instr, state);
+    return ++instr;
+}
+
+const instruction* lazy_iszero_static_jumpi(
+    const instruction* instr, execution_state& state) noexcept
+{
+    if (state.stack.pop() == 0)
+        return lazy_static_jump(instr, state);
+    return ++instr;
+}
+
+const instruction* lazy_continue(const instruction* instr, execution_state& state) noexcept
+{
+    return state.analysis->lazy->jumpdest(static_cast<size_t>(instr->arg.number));
+}
+}  // namespace evmone
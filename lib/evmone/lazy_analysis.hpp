@@ -0,0 +1,106 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include "analysis.hpp"
+#include <atomic>
+#include <mutex>
+
+namespace evmone
+{
+/// The lazy code analysis (see ANALYSIS_LAZY).
+///
+/// Only the JUMPDESTs are found upfront (with scan_code()). The code is analyzed in segments
+/// on the first entry: from the code start or from the JUMPDEST being the jump destination.
+/// The segment spans the basic blocks reachable without jumps. It is finished by
+/// the terminator not being JUMPI, the code end, or the lazy_continue instruction when
+/// the following JUMPDEST has been analyzed already.
+///
+/// The segments are memoized, so the analysis being in the cache is shared by
+/// following executions, also from other threads. The analyzed segments are never modified,
+/// the new ones are created under the lock and published with the atomic entry pointers.
+class lazy_analysis
+{
+    evmc_revision m_rev;
+    uint32_t m_flags;
+
+    /// The copy of the code, the code given to the analysis is not guaranteed to outlive it.
+    bytes m_code;
+
+    size_t m_num_jumpdests = 0;
+    size_t m_num_large_pushes = 0;
+
+    /// The bitmap of valid JUMPDESTs and the ranks of its words, as in code_analysis.
+    std::vector<uint64_t> m_jumpdest_bitmap;
+    std::vector<int32_t> m_jumpdest_rank;
+
+    /// The first instructions of the analyzed JUMPDESTs, indexed by the JUMPDEST rank.
+    /// The additional last entry is for the code start.
+    std::unique_ptr<std::atomic<const instruction*>[]> m_entries;
+
+    std::mutex m_mutex;
+
+    /// The analyzed segments.
+    std::vector<code_analysis> m_segments;
+
+    /// The memory used by the lazy analysis (in bytes), growing with the analyzed segments.
+    std::atomic<size_t> m_memory_size{0};
+
+    /// Returns the entry of the JUMPDEST at the code offset.
+    /// Returns nullptr if the offset is not a valid jump destination.
+    std::atomic<const instruction*>* jumpdest_entry(size_t offset) const noexcept;
+
+    /// Analyzes the segment starting at the offset if the entry is still not set.
+    const instruction* analyze_entry(
+        std::atomic<const instruction*>& entry, size_t offset) noexcept;
+
+public:
+    lazy_analysis(
+        evmc_revision rev, const uint8_t* code, size_t code_size, uint32_t flags) noexcept;
+
+    [[nodiscard]] evmc_revision revision() const noexcept { return m_rev; }
+    [[nodiscard]] uint32_t flags() const noexcept { return m_flags; }
+    [[nodiscard]] size_t num_large_pushes() const noexcept { return m_num_large_pushes; }
+
+    /// The memory used by the lazy analysis (in bytes), including the segments analyzed so far.
+    [[nodiscard]] size_t memory_size() const noexcept
+    {
+        return m_memory_size.load(std::memory_order_relaxed);
+    }
+
+    /// Returns the first instruction of the code, analyzing the first segment if needed.
+    EVMC_EXPORT const instruction* start() noexcept;
+
+    /// Returns the first instruction of the JUMPDEST at the code offset,
+    /// analyzing the segment if needed. Returns nullptr if not a valid jump destination.
+    EVMC_EXPORT const instruction* jumpdest(size_t offset) noexcept;
+
+    /// Checks if the JUMPDEST at the code offset has been analyzed.
+    [[nodiscard]] EVMC_EXPORT bool is_analyzed(size_t offset) const noexcept;
+
+    /// Returns the number of analyzed segments.
+    [[nodiscard]] EVMC_EXPORT size_t num_segments() noexcept;
+
+    /// Returns the total number of instructions in the analyzed segments.
+    [[nodiscard]] EVMC_EXPORT size_t num_instructions() noexcept;
+};
+
+/// Analyzes the segment of the code starting at the begin offset (see lazy_analysis).
+/// The jumps are replaced with the lazy variants. The JUMPDESTs found in the segment
+/// are listed in the jumpdest_offsets and jumpdest_targets.
+code_analysis analyze_segment(
+    const lazy_analysis& lazy, const uint8_t* code, size_t code_size, size_t begin) noexcept;
+
+/// The instructions of the lazy analysis.
+/// These are the variants of JUMP, JUMPI and the intrinsic static jumps finding the
+/// jump destination with the lazy_analysis, and the lazy_continue instruction to continue
+/// in another segment at the code offset in the argument.
+const instruction* lazy_jump(const instruction* instr, execution_state& state) noexcept;
+const instruction* lazy_jumpi(const instruction* instr, execution_state& state) noexcept;
+const instruction* lazy_static_jump(const instruction* instr, execution_state& state) noexcept;
+const instruction* lazy_static_jumpi(const instruction* instr, execution_state& state) noexcept;
+const instruction* lazy_iszero_static_jumpi(
+    const instruction* instr, execution_state& state) noexcept;
+const instruction* lazy_continue(const instruction* instr, execution_state& state) noexcept;
+}  // namespace evmone
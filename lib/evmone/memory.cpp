@@ -0,0 +1,212 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "analysis.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if UINTPTR_MAX == UINT64_MAX && defined(_WIN32)
+#define EVMONE_MEMORY_RESERVATION 1
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif UINTPTR_MAX == UINT64_MAX && (defined(__unix__) || defined(__APPLE__))
+#define EVMONE_MEMORY_RESERVATION 1
+#include <sys/mman.h>
+#else
+// The address space is too precious on 32-bit systems, use the heap only.
+#define EVMONE_MEMORY_RESERVATION 0
+#endif
+
+namespace evmone
+{
+namespace
+{
+/// The granularity of committing the reserved space. Limits the number of system calls.
+constexpr size_t commit_granularity = 64 * 1024;
+
+static_assert(evm_memory::reserved_size % commit_granularity == 0);
+
+#if EVMONE_MEMORY_RESERVATION && defined(_WIN32)
+
+inline uint8_t* reserve(size_t size) noexcept
+{
+    return static_cast<uint8_t*>(VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS));
+}
+
+inline void release(uint8_t* p, size_t /*size*/) noexcept
+{
+    VirtualFree(p, 0, MEM_RELEASE);
+}
+
+inline bool commit(uint8_t* p, size_t size) noexcept
+{
+    return VirtualAlloc(p, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+}
+
+/// Returns the pages to the OS. They will be zeroed when committed again.
+inline bool decommit(uint8_t* p, size_t size) noexcept
+{
+    return VirtualFree(p, size, MEM_DECOMMIT) != 0;
+}
+
+#elif EVMONE_MEMORY_RESERVATION
+
+#ifdef MAP_NORESERVE
+constexpr int map_flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#else
+constexpr int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#endif
+
+inline uint8_t* reserve(size_t size) noexcept
+{
+    // The PROT_NONE mapping is not accounted as committed memory.
+    const auto p = mmap(nullptr, size, PROT_NONE, map_flags, -1, 0);
+    return p != MAP_FAILED ? static_cast<uint8_t*>(p) : nullptr;
+}
+
+inline void release(uint8_t* p, size_t size) noexcept
+{
+    munmap(p, size);
+}
+
+inline bool commit(uint8_t* p, size_t size) noexcept
+{
+    return mprotect(p, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+/// Returns the pages to the OS by replacing them with a fresh PROT_NONE mapping.
+/// They will be zeroed when committed again.
+inline bool decommit(uint8_t* p, size_t size) noexcept
+{
+    return mmap(p, size, PROT_NONE, map_flags | MAP_FIXED, -1, 0) != MAP_FAILED;
+}
+
+#else
+
+inline uint8_t* reserve(size_t /*size*/) noexcept
+{
+    return nullptr;
+}
+
+inline void release(uint8_t* /*p*/, size_t /*size*/) noexcept {}
+
+inline bool commit(uint8_t* /*p*/, size_t /*size*/) noexcept
+{
+    return false;
+}
+
+inline bool decommit(uint8_t* /*p*/, size_t /*size*/) noexcept
+{
+    return false;
+}
+
+#endif
+}  // namespace
+
+evm_memory::evm_memory() noexcept : m_reservation{reserve(reserved_size)}
+{
+    m_data = m_reservation;
+}
+
+evm_memory::~evm_memory() noexcept
+{
+    if (!is_reserved())
+        std::free(m_data);
+    if (m_reservation != nullptr)
+        release(m_reservation, reserved_size);
+}
+
+bool evm_memory::grow(size_t new_size) noexcept
+{
+    if (is_reserved())
+    {
+        if (new_size <= reserved_size)
+        {
+            // At least double the committed space, the pages are not touched anyway.
+            const auto aligned_size =
+                (new_size + (commit_granularity - 1)) / commit_granularity * commit_granularity;
+            const auto new_committed =
+                std::min(std::max(aligned_size, 2 * m_committed), reserved_size);
+            if (commit(m_reservation + m_committed, new_committed - m_committed))
+            {
+                m_committed = new_committed;
+                m_capacity = new_committed;
+                return true;
+            }
+            // Committing failed, e.g. because of the limit of memory mappings. Fall back to heap.
+        }
+        return move_to_heap(std::max(new_size, 2 * m_capacity));
+    }
+
+    // The heap mode.
+    const auto new_capacity = std::max({new_size, 2 * m_capacity, initial_capacity});
+    const auto new_data = static_cast<uint8_t*>(std::realloc(m_data, new_capacity));
+    if (new_data == nullptr)
+        return false;
+    std::memset(new_data + m_capacity, 0, new_capacity - m_capacity);
+    m_data = new_data;
+    m_capacity = new_capacity;
+    return true;
+}
+
+bool evm_memory::move_to_heap(size_t new_capacity) noexcept
+{
+    // The calloc() is likely to provide big allocations as zeroed pages directly from the OS.
+    const auto new_data = static_cast<uint8_t*>(std::calloc(new_capacity, 1));
+    if (new_data == nullptr)
+        return false;
+    std::memcpy(new_data, m_data, m_size);
+
+    // The reserved space is not used until clear(). Make sure it is zeroed by then.
+    if (m_committed != 0 && !decommit(m_reservation, m_committed))
+    {
+        release(m_reservation, reserved_size);
+        m_reservation = nullptr;
+    }
+    m_committed = 0;
+
+    m_data = new_data;
+    m_capacity = new_capacity;
+    return true;
+}
+
+void evm_memory::clear() noexcept
+{
+    if (is_reserved())
+    {
+        if (m_size <= max_retained_capacity)
+        {
+            std::memset(m_data, 0, m_size);
+        }
+        else
+        {
+            // Zero the retained part and return the rest of the pages to the OS.
+            std::memset(m_data, 0, max_retained_capacity);
+            if (decommit(m_data + max_retained_capacity, m_committed - max_retained_capacity))
+                m_capacity = m_committed = max_retained_capacity;
+            else
+                std::memset(m_data + max_retained_capacity, 0, m_size - max_retained_capacity);
+        }
+    }
+    else if (m_reservation != nullptr || m_capacity > max_retained_capacity)
+    {
+        // Go back to the reserved space (if available) or release the big heap allocation.
+        std::free(m_data);
+        m_data = m_reservation;
+        m_capacity = m_committed;
+    }
+    else if (m_size != 0)
+    {
+        std::memset(m_data, 0, m_size);
+    }
+    m_size = 0;
+}
+}  // namespace evmone
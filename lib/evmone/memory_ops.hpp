@@ -0,0 +1,184 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include <intx/intx.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define EVMONE_MEMORY_SSSE3 1
+#elif defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#define EVMONE_MEMORY_NEON 1
+#endif
+
+/// @file
+/// The memory copy and fill primitives of the instructions accessing the EVM memory.
+///
+/// The short ranges (up to 32 bytes, the most common in the EVM) are handled with the fixed-size
+/// overlapping moves compiled to the vector loads and stores, the longer ones with the library
+/// memcpy() and memset().
+
+namespace evmone
+{
+namespace detail
+{
+/// Copies up to 32 bytes with the pair of the fixed-size overlapping moves.
+/// The source and destination must not overlap.
+inline void copy_short(uint8_t* dst, const uint8_t* src, size_t size) noexcept
+{
+    if (size >= 16)
+    {
+        uint8_t head[16];
+        uint8_t tail[16];
+        std::memcpy(head, src, 16);
+        std::memcpy(tail, src + size - 16, 16);
+        std::memcpy(dst, head, 16);
+        std::memcpy(dst + size - 16, tail, 16);
+    }
+    else if (size >= 8)
+    {
+        uint64_t head;
+        uint64_t tail;
+        std::memcpy(&head, src, 8);
+        std::memcpy(&tail, src + size - 8, 8);
+        std::memcpy(dst, &head, 8);
+        std::memcpy(dst + size - 8, &tail, 8);
+    }
+    else if (size >= 4)
+    {
+        uint32_t head;
+        uint32_t tail;
+        std::memcpy(&head, src, 4);
+        std::memcpy(&tail, src + size - 4, 4);
+        std::memcpy(dst, &head, 4);
+        std::memcpy(dst + size - 4, &tail, 4);
+    }
+    else if (size != 0)
+    {
+        // The first, middle and last byte cover the sizes 1 to 3.
+        const auto first = src[0];
+        const auto middle = src[size / 2];
+        const auto last = src[size - 1];
+        dst[0] = first;
+        dst[size / 2] = middle;
+        dst[size - 1] = last;
+    }
+}
+
+/// Zero-fills up to 32 bytes with the pair of the fixed-size overlapping stores.
+inline void fill_zero_short(uint8_t* dst, size_t size) noexcept
+{
+    static constexpr uint8_t zeros[16]{};
+    if (size >= 16)
+    {
+        std::memcpy(dst, zeros, 16);
+        std::memcpy(dst + size - 16, zeros, 16);
+    }
+    else if (size >= 8)
+    {
+        std::memcpy(dst, zeros, 8);
+        std::memcpy(dst + size - 8, zeros, 8);
+    }
+    else if (size >= 4)
+    {
+        std::memcpy(dst, zeros, 4);
+        std::memcpy(dst + size - 4, zeros, 4);
+    }
+    else if (size != 0)
+    {
+        dst[0] = 0;
+        dst[size / 2] = 0;
+        dst[size - 1] = 0;
+    }
+}
+}  // namespace detail
+
+/// Copies the data to the memory range of the given size, zero-filling the part of the range
+/// beyond the data (the data_size must not be greater than the size).
+///
+/// Only the first dirty_size bytes of the range may be non-zero, the rest is known to be zero
+/// (e.g. added by the memory expansion of the instruction), so it is not zero-filled again.
+/// The memory and the data must not overlap.
+inline void copy_padded(uint8_t* dst, size_t size, const uint8_t* data, size_t data_size,
+    size_t dirty_size) noexcept
+{
+    if (data_size <= 32)
+        detail::copy_short(dst, data, data_size);
+    else
+        std::memcpy(dst, data, data_size);
+
+    const auto fill_size = std::min(size, dirty_size);
+    if (fill_size <= data_size)
+        return;
+
+    const auto n = fill_size - data_size;
+    if (n <= 32)
+        detail::fill_zero_short(dst + data_size, n);
+    else
+        std::memset(dst + data_size, 0, n);
+}
+
+/// Returns the number of the bytes of the destination range at the offset which may be non-zero:
+/// the bytes at and above the memory size before the expansion (the old_size) are zero.
+inline size_t dirty_size(size_t offset, size_t old_size) noexcept
+{
+    return old_size > offset ? old_size - offset : 0;
+}
+
+/// Loads the big-endian 256-bit word, the MLOAD.
+inline intx::uint256 load_word(const uint8_t* src) noexcept
+{
+#if EVMONE_MEMORY_SSSE3
+    // The byte reversal of the 32 bytes: the swapped 16-byte halves reversed with PSHUFB,
+    // stored as the little-endian words of the uint256.
+    static_assert(sizeof(intx::uint256) == 32);
+    const auto reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    const auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+    intx::uint256 x;
+    auto* const p = reinterpret_cast<uint8_t*>(&x);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_shuffle_epi8(lo, reverse));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 16), _mm_shuffle_epi8(hi, reverse));
+    return x;
+#elif EVMONE_MEMORY_NEON
+    static_assert(sizeof(intx::uint256) == 32);
+    const auto hi = vld1q_u8(src);
+    const auto lo = vld1q_u8(src + 16);
+    intx::uint256 x;
+    auto* const p = reinterpret_cast<uint8_t*>(&x);
+    const auto rev_lo = vrev64q_u8(lo);
+    const auto rev_hi = vrev64q_u8(hi);
+    vst1q_u8(p, vextq_u8(rev_lo, rev_lo, 8));
+    vst1q_u8(p + 16, vextq_u8(rev_hi, rev_hi, 8));
+    return x;
+#else
+    return intx::be::unsafe::load<intx::uint256>(src);
+#endif
+}
+
+/// Stores the 256-bit word as big-endian, the MSTORE.
+inline void store_word(uint8_t* dst, const intx::uint256& x) noexcept
+{
+#if EVMONE_MEMORY_SSSE3
+    const auto reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const auto* const p = reinterpret_cast<const uint8_t*>(&x);
+    const auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_shuffle_epi8(hi, reverse));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_shuffle_epi8(lo, reverse));
+#elif EVMONE_MEMORY_NEON
+    const auto* const p = reinterpret_cast<const uint8_t*>(&x);
+    const auto rev_lo = vrev64q_u8(vld1q_u8(p));
+    const auto rev_hi = vrev64q_u8(vld1q_u8(p + 16));
+    vst1q_u8(dst, vextq_u8(rev_hi, rev_hi, 8));
+    vst1q_u8(dst + 16, vextq_u8(rev_lo, rev_lo, 8));
+#else
+    intx::be::unsafe::store(dst, x);
+#endif
+}
+}  // namespace evmone
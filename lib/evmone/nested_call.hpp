@@ -0,0 +1,47 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include <evmc/evmc.h>
+#include <evmc/utils.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace evmone
+{
+/// The host callbacks of the nested calls executed by evmone directly.
+///
+/// The calls (CALL, CALLCODE, DELEGATECALL, STATICCALL, CREATE, CREATE2) of the executions
+/// with the registered host are not passed to evmc_host_interface::call(). Instead, the host
+/// begins the call, evmone executes the callee code in the frame reserved for the call depth
+/// in the thread, and the host ends the call with the result. The host keeps the ownership of
+/// the state: beginning and ending the call do what its call() does around the execution of
+/// the callee code. The callee is executed with the same host interface and context.
+struct nested_call_interface
+{
+    /// Begins the call of the message, e.g. takes the state snapshot and transfers the value.
+    ///
+    /// The host may modify the message (e.g. set the destination and clear the input
+    /// of creates), except the depth, and provides the code of the callee (e.g. the init code
+    /// of creates), valid until end_call(). Returns false if the call must be executed with
+    /// evmc_host_interface::call() instead (e.g. precompiles), nothing is done by the host then.
+    bool (*begin_call)(evmc_host_context* context, evmc_message* msg, const uint8_t** code,
+        size_t* code_size) noexcept;
+
+    /// Ends the call begun by begin_call() with the result of the callee, e.g. reverts
+    /// the state on failure or deploys the created code. The message is the one begun.
+    /// The host may modify the result (e.g. the status code, the gas left
+    /// and the create address) but must not release it.
+    void (*end_call)(
+        evmc_host_context* context, const evmc_message* msg, evmc_result* result) noexcept;
+};
+
+/// Enables the nested calls for the executions with the given host interface.
+///
+/// This is the extension for the hosts linked with evmone, the callbacks are not part of EVMC.
+/// The executions with other hosts are not affected. Only one host interface can be registered,
+/// the null nested call interface disables the nested calls. The callbacks are copied.
+EVMC_EXPORT void set_host_nested_calls(
+    evmc_vm* vm, const evmc_host_interface* host, const nested_call_interface* nested) noexcept;
+}  // namespace evmone
@@ -0,0 +1,69 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include <evmc/evmc.hpp>
+#include <evmc/utils.h>
+#include <cstddef>
+
+namespace evmone
+{
+/// The host callback receiving the prefetch hints of the basic block about to be executed.
+///
+/// The keys are the statically known storage keys of the account (the destination of the
+/// executed message) accessed by SLOAD or SSTORE in the block. The addresses are the
+/// statically known accounts accessed by BALANCE, EXTCODE* or the calls in the block.
+/// The hints are only the hints: the block may not access all of them (e.g. it terminates
+/// early) and may access other ones. The host is expected to start loading the state
+/// asynchronously and return immediately.
+using prefetch_fn = void (*)(evmc_host_context* context, const evmc_address* account,
+    const evmc_bytes32* keys, size_t num_keys, const evmc_address* addresses,
+    size_t num_addresses) noexcept;
+
+/// The evmc::HostContext with the optional prefetch extension.
+///
+/// The prefetch() is a no-op for hosts not providing the prefetch callback.
+class host_context : public evmc::HostContext
+{
+    const evmc_host_interface* m_interface = nullptr;
+    evmc_host_context* m_context = nullptr;
+    prefetch_fn m_prefetch = nullptr;
+
+public:
+    host_context() noexcept = default;
+
+    host_context(const evmc_host_interface& interface, evmc_host_context* ctx,
+        prefetch_fn prefetch_function = nullptr) noexcept
+      : evmc::HostContext{interface, ctx},
+        m_interface{&interface},
+        m_context{ctx},
+        m_prefetch{prefetch_function}
+    {}
+
+    [[nodiscard]] const evmc_host_interface* get_interface() const noexcept { return m_interface; }
+
+    [[nodiscard]] evmc_host_context* get_context() const noexcept { return m_context; }
+
+    [[nodiscard]] prefetch_fn get_prefetch() const noexcept { return m_prefetch; }
+
+    [[nodiscard]] bool has_prefetch() const noexcept { return m_prefetch != nullptr; }
+
+    /// Passes the prefetch hints to the host, if it supports them.
+    void prefetch(const evmc_address& account, const evmc_bytes32* keys, size_t num_keys,
+        const evmc_address* addresses, size_t num_addresses) const noexcept
+    {
+        if (m_prefetch != nullptr)
+            m_prefetch(m_context, &account, keys, num_keys, addresses, num_addresses);
+    }
+};
+
+/// Enables the prefetch hints for the executions with the given host interface.
+///
+/// The code is then analyzed with ANALYSIS_PREFETCH_HINTS and the prefetch callback is called
+/// at the start of every basic block with any statically known storage keys or addresses.
+/// The executions with other hosts are not affected. Only one host interface can be
+/// registered, the null prefetch disables the hints.
+EVMC_EXPORT void set_host_prefetch(
+    evmc_vm* vm, const evmc_host_interface* host, prefetch_fn prefetch) noexcept;
+}  // namespace evmone
@@ -0,0 +1,222 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "profiler.hpp"
+#include "analysis_cache.hpp"
+#include <evmc/instructions.h>
+#include <array>
+#include <cinttypes>
+#include <cstdio>
+#include <unordered_map>
+
+namespace evmone
+{
+namespace
+{
+/// The names of the intrinsic opcodes starting from OPX_STATIC_JUMP.
+constexpr const char* intrinsic_names[] = {
+    "STATIC_JUMP",
+    "STATIC_JUMPI",
+    "PUSH_ADD",
+    "PUSH_SUB",
+    "PUSH_MUL",
+    "PUSH_AND",
+    "PUSH_OR",
+    "PUSH_EQ",
+    "PUSH_LT",
+    "PUSH_GT",
+    "PUSH_SHL",
+    "PUSH_SHR",
+    "PUSH_MLOAD",
+    "PUSH_MSTORE",
+    "PUSH_ADDRESS_MASK_AND",
+    "DUP_SWAP",
+    "SWAP_POP",
+    "ISZERO_STATIC_JUMPI",
+    "PRECHARGE_MEMORY",
+    "PRECHARGED_MLOAD",
+    "PRECHARGED_MSTORE",
+    "PRECHARGED_MSTORE8",
+    "PRECHARGED_SHA3",
+    "PRECHARGED_CALLDATACOPY",
+    "PRECHARGED_CODECOPY",
+    "PRECHARGED_EXP",
+    "PRECHARGED_PUSH_MLOAD",
+    "PRECHARGED_PUSH_MSTORE",
+    "BEGINBLOCK_GAS",
+    "EMPTY_BLOCKS",
+};
+static_assert(std::size(intrinsic_names) == op_table_size - OPX_STATIC_JUMP);
+
+using opcode_map = std::unordered_map<instruction_exec_fn, int>;
+
+/// Returns the maps from the instruction functions to the opcodes for all revisions.
+/// The functions shared by multiple opcodes map to the first of them.
+const std::array<opcode_map, EVMC_MAX_REVISION + 1>& get_opcode_maps() noexcept
+{
+    static const auto maps = [] {
+        std::array<opcode_map, EVMC_MAX_REVISION + 1> m;
+        for (size_t r = 0; r < m.size(); ++r)
+        {
+            const auto& op_tbl = get_op_table(static_cast<evmc_revision>(r));
+            for (size_t op = 0; op < op_tbl.size(); ++op)
+                m[r].emplace(op_tbl[op].fn, static_cast<int>(op));
+        }
+        return m;
+    }();
+    return maps;
+}
+
+std::string to_hex(uint64_t x)
+{
+    char buf[17];
+    std::snprintf(buf, sizeof(buf), "%016" PRIx64, x);
+    return buf;
+}
+}  // namespace
+
+std::string opcode_name(int opcode) noexcept
+{
+    if (opcode == OPX_BEGINBLOCK)
+        return "BEGINBLOCK";
+
+    if (opcode >= OPX_STATIC_JUMP && opcode < static_cast<int>(op_table_size))
+        return intrinsic_names[opcode - OPX_STATIC_JUMP];
+
+    const auto names = evmc_get_instruction_names_table(EVMC_MAX_REVISION);
+    if (opcode >= 0 && opcode <= 0xff && names[opcode] != nullptr)
+        return names[opcode];
+
+    return "UNDEFINED";
+}
+
+std::vector<int32_t> find_block_offsets(const uint8_t* code, size_t code_size) noexcept
+{
+    // This follows the blocks splitting of the analysis: the new block starts at the code start,
+    // after the terminating instruction and at the JUMPDEST.
+    std::vector<int32_t> offsets{0};
+    size_t pos = 0;
+    while (pos < code_size)
+    {
+        const auto opcode = code[pos++];
+        if (opcode >= OP_PUSH1 && opcode <= OP_PUSH32)
+            pos = std::min(pos + static_cast<size_t>(opcode - OP_PUSH1 + 1), code_size);
+
+        const auto is_terminator = opcode == OP_JUMP || opcode == OP_JUMPI ||
+                                   opcode == OP_STOP || opcode == OP_RETURN ||
+                                   opcode == OP_REVERT || opcode == OP_SELFDESTRUCT;
+        const auto next_is_jumpdest = pos < code_size && code[pos] == OP_JUMPDEST;
+        if (is_terminator || next_is_jumpdest)
+            offsets.push_back(static_cast<int32_t>(pos));
+    }
+    return offsets;
+}
+
+void profiler::add(evmc_revision rev, const uint8_t* code, size_t code_size,
+    const code_analysis& analysis, const profile_counters* counters) noexcept
+{
+    const auto& map = get_opcode_maps()[rev];
+    const auto& op_tbl = get_op_table(rev);
+    const auto beginblock_fn = op_tbl[OPX_BEGINBLOCK].fn;
+    const auto block_offsets = find_block_offsets(code, code_size);
+    const auto code_hash = hash_code(code, code_size);
+
+    // Resolve the keys before taking the lock.
+    std::vector<std::pair<key, profile_counters>> entries;
+    size_t block_index = 0;
+    for (size_t i = 0; i < analysis.instrs.size(); ++i)
+    {
+        // The BEGINBLOCK variants are reported as the BEGINBLOCK.
+        auto fn = analysis.instrs[i].fn;
+        if (fn == opx_beginblock_prefetch || fn == op_tbl[OPX_BEGINBLOCK_GAS].fn ||
+            fn == op_tbl[OPX_EMPTY_BLOCKS].fn)
+            fn = beginblock_fn;
+        if (fn == beginblock_fn && i != 0)
+            ++block_index;
+
+        if (counters[i].executions == 0)
+            continue;
+
+        const auto it = map.find(fn);
+        const auto opcode = it != map.end() ? it->second : -1;
+        const auto offset = block_index < block_offsets.size() ? block_offsets[block_index] : -1;
+        entries.push_back({{{code_hash, offset}, opcode}, counters[i]});
+    }
+
+    std::lock_guard lock{m_mutex};
+    for (const auto& [k, c] : entries)
+        m_counters[k] += c;
+}
+
+std::map<int, profile_counters> profiler::opcodes() const noexcept
+{
+    std::map<int, profile_counters> result;
+    std::lock_guard lock{m_mutex};
+    for (const auto& [k, c] : m_counters)
+        result[k.opcode] += c;
+    return result;
+}
+
+std::map<profile_block, profile_counters> profiler::blocks() const noexcept
+{
+    std::map<profile_block, profile_counters> result;
+    std::lock_guard lock{m_mutex};
+    for (const auto& [k, c] : m_counters)
+    {
+        auto& b = result[k.block];
+        b.cycles += c.cycles;
+        b.gas += c.gas;
+        if (k.opcode == OPX_BEGINBLOCK)
+            b.executions += c.executions;
+    }
+    return result;
+}
+
+std::string profiler::to_json() const noexcept
+{
+    const auto counters_json = [](const profile_counters& c) {
+        return "\"executions\": " + std::to_string(c.executions) +
+               ", \"cycles\": " + std::to_string(c.cycles) + ", \"gas\": " + std::to_string(c.gas);
+    };
+
+    std::string json = "{\n  \"opcodes\": [";
+    const char* separator = "\n";
+    for (const auto& [opcode, c] : opcodes())
+    {
+        json += separator;
+        json += "    {\"opcode\": \"" + opcode_name(opcode) + "\", " + counters_json(c) + "}";
+        separator = ",\n";
+    }
+    json += "\n  ],\n  \"blocks\": [";
+    separator = "\n";
+    for (const auto& [block, c] : blocks())
+    {
+        json += separator;
+        json += "    {\"code_hash\": \"" + to_hex(block.code_hash) +
+                "\", \"offset\": " + std::to_string(block.offset) + ", " + counters_json(c) + "}";
+        separator = ",\n";
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+std::string profiler::to_folded() const noexcept
+{
+    std::string folded;
+    std::lock_guard lock{m_mutex};
+    for (const auto& [k, c] : m_counters)
+    {
+        folded += "code_" + to_hex(k.block.code_hash) + ";block_" +
+                  std::to_string(k.block.offset) + ";" + opcode_name(k.opcode) + " " +
+                  std::to_string(c.cycles) + "\n";
+    }
+    return folded;
+}
+
+void profiler::reset() noexcept
+{
+    std::lock_guard lock{m_mutex};
+    m_counters.clear();
+}
+}  // namespace evmone
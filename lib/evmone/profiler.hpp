@@ -0,0 +1,120 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include "analysis.hpp"
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace evmone
+{
+/// Reads the CPU timestamp counter (rdtsc) or the steady clock in nanoseconds
+/// where the counter is not available.
+inline uint64_t read_cycles() noexcept
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+/// The execution statistics of instructions.
+struct profile_counters
+{
+    uint64_t executions = 0;
+    uint64_t cycles = 0;
+    int64_t gas = 0;
+
+    profile_counters& operator+=(const profile_counters& other) noexcept
+    {
+        executions += other.executions;
+        cycles += other.cycles;
+        gas += other.gas;
+        return *this;
+    }
+};
+
+/// The basic block identified by the code hash (see hash_code()) and the code offset
+/// of the block start.
+struct profile_block
+{
+    uint64_t code_hash;
+    int32_t offset;
+
+    bool operator<(const profile_block& other) const noexcept
+    {
+        return code_hash < other.code_hash ||
+               (code_hash == other.code_hash && offset < other.offset);
+    }
+};
+
+/// The collector of the per-opcode and per-block execution statistics.
+///
+/// The statistics are collected by the interpreter only in the builds with EVMONE_PROFILING
+/// enabled, otherwise the instrumentation is compiled out. The instructions are reported
+/// by the opcodes of their implementations, so the superinstructions and other intrinsic
+/// instructions are reported as such, and opcodes sharing the implementation
+/// (e.g. PUSH9-PUSH32) are reported as the first of them. The base gas cost of the whole
+/// block is charged by its BEGINBLOCK instruction, the other instructions report
+/// the additional dynamic gas costs. The cycles of the call instructions include
+/// the nested executions.
+class profiler
+{
+    struct key
+    {
+        profile_block block;
+        int opcode;
+
+        bool operator<(const key& other) const noexcept
+        {
+            return block < other.block || (!(other.block < block) && opcode < other.opcode);
+        }
+    };
+
+    mutable std::mutex m_mutex;
+
+    /// The statistics of the opcodes in the blocks.
+    std::map<key, profile_counters> m_counters;
+
+public:
+    /// Adds the statistics of the execution. The counters are the statistics of
+    /// the instructions of the analysis of the code, indexed as the instructions.
+    EVMC_EXPORT void add(evmc_revision rev, const uint8_t* code, size_t code_size,
+        const code_analysis& analysis, const profile_counters* counters) noexcept;
+
+    /// Returns the statistics aggregated by the opcode.
+    [[nodiscard]] EVMC_EXPORT std::map<int, profile_counters> opcodes() const noexcept;
+
+    /// Returns the statistics aggregated by the block. The block executions are
+    /// the executions of its BEGINBLOCK instruction.
+    [[nodiscard]] EVMC_EXPORT std::map<profile_block, profile_counters> blocks() const noexcept;
+
+    /// Exports the statistics as JSON with the "opcodes" and "blocks" arrays.
+    [[nodiscard]] EVMC_EXPORT std::string to_json() const noexcept;
+
+    /// Exports the cycles in the folded stacks format of the flamegraph tools:
+    /// the line "code_<hash>;block_<offset>;<opcode name> <cycles>" for every opcode in a block.
+    [[nodiscard]] EVMC_EXPORT std::string to_folded() const noexcept;
+
+    /// Removes all collected statistics.
+    EVMC_EXPORT void reset() noexcept;
+};
+
+/// Returns the name of the opcode, including the intrinsic opcodes.
+EVMC_EXPORT std::string opcode_name(int opcode) noexcept;
+
+/// Finds the code offsets of the basic blocks, in the order of the BEGINBLOCK instructions
+/// of the code analysis.
+EVMC_EXPORT std::vector<int32_t> find_block_offsets(
+    const uint8_t* code, size_t code_size) noexcept;
+}  // namespace evmone
@@ -0,0 +1,392 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "speculative.hpp"
+#include <intx/intx.hpp>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace evmone
+{
+namespace
+{
+/// Checks if the address is in the range of the precompiled contracts.
+bool is_precompile(const evmc::address& addr) noexcept
+{
+    for (size_t i = 0; i < sizeof(addr.bytes) - 1; ++i)
+    {
+        if (addr.bytes[i] != 0)
+            return false;
+    }
+    return addr.bytes[sizeof(addr.bytes) - 1] != 0 && addr.bytes[sizeof(addr.bytes) - 1] <= 0x09;
+}
+
+state_location storage_location(const evmc::address& addr, const evmc::bytes32& key) noexcept
+{
+    return {addr, key, location_kind::storage};
+}
+
+state_location balance_location(const evmc::address& addr) noexcept
+{
+    return {addr, {}, location_kind::balance};
+}
+
+/// Runs the job for every index up to the count, distributed across the threads.
+template <typename Job>
+void run_parallel(size_t count, size_t num_threads, const Job& job) noexcept
+{
+    std::atomic<size_t> next{0};
+    const auto worker = [&]() noexcept {
+        for (auto i = next.fetch_add(1, std::memory_order_relaxed); i < count;
+             i = next.fetch_add(1, std::memory_order_relaxed))
+            job(i);
+    };
+
+    const auto num_workers = std::min(std::max(num_threads, size_t{1}), count);
+    std::vector<std::thread> threads;
+    threads.reserve(num_workers - 1);
+    for (size_t i = 1; i < num_workers; ++i)
+        threads.emplace_back(worker);
+
+    // The calling thread is also the worker.
+    worker();
+
+    for (auto& t : threads)
+        t.join();
+}
+}  // namespace
+
+mv_memory::mv_memory(size_t num_shards) noexcept
+  : m_num_shards{std::max(num_shards, size_t{1})}, m_shards{new shard[m_num_shards]}
+{}
+
+bool mv_memory::read(const state_location& location, uint32_t tx_index, version& ver,
+    evmc::bytes32& value) const noexcept
+{
+    const auto& s = get_shard(location);
+    std::shared_lock lock{s.mutex};
+    const auto it = s.versions.find(location);
+    if (it == s.versions.end())
+        return false;
+
+    auto v = it->second.lower_bound(tx_index);
+    if (v == it->second.begin())
+        return false;
+    --v;
+    ver = {v->first, v->second.incarnation};
+    value = v->second.value;
+    return true;
+}
+
+void mv_memory::write(const state_location& location, version ver,
+    const evmc::bytes32& value) noexcept
+{
+    auto& s = get_shard(location);
+    std::unique_lock lock{s.mutex};
+    s.versions[location][ver.tx_index] = {ver.incarnation, value};
+}
+
+void mv_memory::erase(const state_location& location, uint32_t tx_index) noexcept
+{
+    auto& s = get_shard(location);
+    std::unique_lock lock{s.mutex};
+    const auto it = s.versions.find(location);
+    if (it == s.versions.end())
+        return;
+    it->second.erase(tx_index);
+    if (it->second.empty())
+        s.versions.erase(it);
+}
+
+speculative_host::speculative_host(evmc_vm* vm, evmc_revision rev,
+    const evmc_host_interface& base, evmc_host_context* base_context, mv_memory& memory,
+    uint32_t tx_index) noexcept
+  : m_vm{vm}, m_rev{rev}, m_base{base, base_context}, m_memory{memory}, m_tx_index{tx_index}
+{}
+
+evmc::result speculative_host::execute(const evmc_message& msg) noexcept
+{
+    ++m_incarnation;
+    m_unsupported = false;
+    m_reads.clear();
+    m_writes.clear();
+    m_journal.clear();
+    m_logs.clear();
+    m_selfdestructs.clear();
+    m_accounts.clear();
+    return call(msg);
+}
+
+bool speculative_host::validate() const noexcept
+{
+    for (const auto& [location, record] : m_reads)
+    {
+        version ver;
+        evmc::bytes32 value;
+        if (!m_memory.read(location, m_tx_index, ver, value))
+            ver = {};
+        if (ver != record.ver)
+            return false;
+    }
+    return true;
+}
+
+void speculative_host::publish() noexcept
+{
+    // Remove the writes of the previous incarnation not repeated by this one.
+    for (const auto& location : m_published)
+    {
+        if (m_writes.count(location) == 0)
+            m_memory.erase(location, m_tx_index);
+    }
+
+    m_published.clear();
+    for (const auto& [location, value] : m_writes)
+    {
+        m_memory.write(location, {m_tx_index, m_incarnation}, value);
+        m_published.push_back(location);
+    }
+}
+
+evmc::bytes32 speculative_host::read_original(const state_location& location) const noexcept
+{
+    const auto [it, inserted] = m_reads.try_emplace(location);
+    auto& record = it->second;
+    if (inserted && !m_memory.read(location, m_tx_index, record.ver, record.value))
+    {
+        switch (location.kind)
+        {
+        case location_kind::storage:
+            record.value = m_base.get_storage(location.address, location.key);
+            break;
+        case location_kind::balance:
+            record.value = m_base.get_balance(location.address);
+            break;
+        case location_kind::destructed:
+            break;
+        }
+    }
+    return record.value;
+}
+
+evmc::bytes32 speculative_host::read(const state_location& location) const noexcept
+{
+    const auto it = m_writes.find(location);
+    return it != m_writes.end() ? it->second : read_original(location);
+}
+
+void speculative_host::write(const state_location& location, const evmc::bytes32& value) noexcept
+{
+    const auto [it, inserted] = m_writes.try_emplace(location, value);
+    m_journal.push_back({location, !inserted, it->second});
+    it->second = value;
+}
+
+bool speculative_host::is_destructed(const evmc::address& addr) const noexcept
+{
+    // Only the selfdestructs of the preceding transactions, the account is destroyed
+    // at the end of the transaction.
+    return read_original({addr, {}, location_kind::destructed}) != evmc::bytes32{};
+}
+
+bool speculative_host::account_exists(const evmc::address& addr) const noexcept
+{
+    if (is_destructed(addr))
+        return false;
+    return m_base.account_exists(addr) || read(balance_location(addr)) != evmc::bytes32{};
+}
+
+evmc::bytes32 speculative_host::get_storage(
+    const evmc::address& addr, const evmc::bytes32& key) const noexcept
+{
+    const auto location = storage_location(addr, key);
+    if (const auto it = m_writes.find(location); it != m_writes.end())
+        return it->second;
+    return is_destructed(addr) ? evmc::bytes32{} : read_original(location);
+}
+
+evmc_storage_status speculative_host::set_storage(
+    const evmc::address& addr, const evmc::bytes32& key, const evmc::bytes32& value) noexcept
+{
+    // The statuses of EIP-2200 relative to the value at the transaction start.
+    const auto location = storage_location(addr, key);
+    const auto original = is_destructed(addr) ? evmc::bytes32{} : read_original(location);
+    const auto it = m_writes.find(location);
+    const auto current = it != m_writes.end() ? it->second : original;
+    if (current == value)
+        return EVMC_STORAGE_UNCHANGED;
+
+    write(location, value);
+    if (!(current == original))
+        return EVMC_STORAGE_MODIFIED_AGAIN;
+    if (original == evmc::bytes32{})
+        return EVMC_STORAGE_ADDED;
+    return value == evmc::bytes32{} ? EVMC_STORAGE_DELETED : EVMC_STORAGE_MODIFIED;
+}
+
+evmc::uint256be speculative_host::get_balance(const evmc::address& addr) const noexcept
+{
+    return read(balance_location(addr));
+}
+
+size_t speculative_host::get_code_size(const evmc::address& addr) const noexcept
+{
+    return is_destructed(addr) ? 0 : m_base.get_code_size(addr);
+}
+
+evmc::bytes32 speculative_host::get_code_hash(const evmc::address& addr) const noexcept
+{
+    return is_destructed(addr) ? evmc::bytes32{} : m_base.get_code_hash(addr);
+}
+
+size_t speculative_host::copy_code(const evmc::address& addr, size_t code_offset,
+    uint8_t* buffer_data, size_t buffer_size) const noexcept
+{
+    return is_destructed(addr) ? 0 : m_base.copy_code(addr, code_offset, buffer_data, buffer_size);
+}
+
+void speculative_host::selfdestruct(
+    const evmc::address& addr, const evmc::address& beneficiary) noexcept
+{
+    const auto balance = intx::be::load<intx::uint256>(get_balance(addr));
+    write(balance_location(addr), {});
+    if (!(beneficiary == addr))
+    {
+        const auto beneficiary_balance = intx::be::load<intx::uint256>(get_balance(beneficiary));
+        write(balance_location(beneficiary),
+            intx::be::store<evmc::uint256be>(beneficiary_balance + balance));
+    }
+    write({addr, {}, location_kind::destructed}, intx::be::store<evmc::bytes32>(intx::uint256{1}));
+    m_selfdestructs.push_back({addr, beneficiary});
+}
+
+evmc::result speculative_host::call(const evmc_message& msg) noexcept
+{
+    if (msg.kind == EVMC_CREATE || msg.kind == EVMC_CREATE2 || is_precompile(msg.destination))
+    {
+        m_unsupported = true;
+        return evmc::result{EVMC_REJECTED, 0, nullptr, 0};
+    }
+
+    // The account of the executed code: the storage, the balance and the ADDRESS.
+    auto account = msg.destination;
+    if (msg.kind == EVMC_CALLCODE)
+        account = msg.sender;
+    else if (msg.kind == EVMC_DELEGATECALL && !m_accounts.empty())
+        account = m_accounts.back();
+
+    const auto journal_size = m_journal.size();
+    const auto num_logs = m_logs.size();
+    const auto num_selfdestructs = m_selfdestructs.size();
+
+    // The balance of the transaction sender is checked here, evmone checks it for the calls.
+    const auto value = intx::be::load<intx::uint256>(msg.value);
+    if (msg.kind == EVMC_CALL && value != 0)
+    {
+        const auto sender_balance = intx::be::load<intx::uint256>(get_balance(msg.sender));
+        if (sender_balance < value)
+            return evmc::result{EVMC_REJECTED, msg.gas, nullptr, 0};
+        write(balance_location(msg.sender),
+            intx::be::store<evmc::uint256be>(sender_balance - value));
+        const auto balance = intx::be::load<intx::uint256>(get_balance(account));
+        write(balance_location(account), intx::be::store<evmc::uint256be>(balance + value));
+    }
+
+    std::basic_string<uint8_t> code(get_code_size(msg.destination), 0);
+    copy_code(msg.destination, 0, code.data(), code.size());
+    if (code.empty())
+        return evmc::result{EVMC_SUCCESS, msg.gas, nullptr, 0};
+
+    auto nested_msg = msg;
+    nested_msg.destination = account;
+    m_accounts.push_back(account);
+    auto result = evmc::result{m_vm->execute(
+        m_vm, &get_interface(), to_context(), m_rev, &nested_msg, code.data(), code.size())};
+    m_accounts.pop_back();
+
+    if (result.status_code != EVMC_SUCCESS)
+    {
+        // Undo the writes of the call in the reverse order.
+        while (m_journal.size() > journal_size)
+        {
+            const auto& e = m_journal.back();
+            if (e.existed)
+                m_writes[e.location] = e.previous;
+            else
+                m_writes.erase(e.location);
+            m_journal.pop_back();
+        }
+        m_logs.resize(num_logs);
+        m_selfdestructs.resize(num_selfdestructs);
+    }
+    return result;
+}
+
+evmc_tx_context speculative_host::get_tx_context() const noexcept
+{
+    return m_base.get_tx_context();
+}
+
+evmc::bytes32 speculative_host::get_block_hash(int64_t block_number) const noexcept
+{
+    return m_base.get_block_hash(block_number);
+}
+
+void speculative_host::emit_log(const evmc::address& addr, const uint8_t* data, size_t data_size,
+    const evmc::bytes32 topics[], size_t num_topics) noexcept
+{
+    m_logs.push_back({addr, {data, data_size}, {topics, topics + num_topics}});
+}
+
+parallel_execution execute_parallel(evmc_vm* vm, evmc_revision rev,
+    const evmc_host_interface& host, evmc_host_context* context, const evmc_message* msgs,
+    size_t count, size_t num_threads) noexcept
+{
+    parallel_execution execution;
+    execution.memory = std::make_unique<mv_memory>();
+    execution.transactions.reserve(count);
+    execution.results.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        execution.transactions.emplace_back(std::make_unique<speculative_host>(
+            vm, rev, host, context, *execution.memory, static_cast<uint32_t>(i)));
+        execution.results.emplace_back(EVMC_REJECTED, 0, nullptr, 0);
+    }
+
+    // Every round executes the pending transactions and validates them, and the following ones,
+    // in order. The lowest invalid transaction reads only from the valid ones, so it is valid
+    // after the next round and the rounds end after at most count of them.
+    auto& txs = execution.transactions;
+    std::vector<size_t> pending(count);
+    for (size_t i = 0; i < count; ++i)
+        pending[i] = i;
+
+    auto limit = count;
+    while (!pending.empty())
+    {
+        run_parallel(pending.size(), num_threads, [&](size_t k) noexcept {
+            const auto i = pending[k];
+            execution.results[i] = txs[i]->execute(msgs[i]);
+            txs[i]->publish();
+        });
+        execution.num_executions += pending.size();
+
+        // The transactions lower than the first executed one stay valid.
+        const auto first = pending.front();
+        pending.clear();
+        for (auto i = first; i < limit; ++i)
+        {
+            if (!txs[i]->validate())
+                pending.push_back(i);
+            else if (txs[i]->is_unsupported() && pending.empty())
+                limit = i;  // The final execution of all the preceding ones needs the base host.
+        }
+    }
+
+    execution.num_completed = limit;
+    return execution;
+}
+}  // namespace evmone
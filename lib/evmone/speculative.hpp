@@ -0,0 +1,312 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include <evmc/evmc.hpp>
+#include <evmc/utils.h>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace evmone
+{
+/// The kind of the state location.
+enum class location_kind : uint8_t
+{
+    storage,
+    balance,
+
+    /// The account has been selfdestructed, the value is non-zero then.
+    destructed,
+};
+
+/// The location of the state read or written by the speculative execution.
+struct state_location
+{
+    evmc::address address;
+
+    /// The storage key, zero for other kinds.
+    evmc::bytes32 key;
+
+    location_kind kind = location_kind::storage;
+
+    bool operator==(const state_location& other) const noexcept
+    {
+        return kind == other.kind && address == other.address && key == other.key;
+    }
+
+    bool operator<(const state_location& other) const noexcept
+    {
+        if (kind != other.kind)
+            return kind < other.kind;
+        if (!(address == other.address))
+            return address < other.address;
+        return key < other.key;
+    }
+};
+
+/// The version of the value: the transaction incarnation which has written it.
+struct version
+{
+    /// The transaction index of the value read from the base host.
+    static constexpr uint32_t base = 0xffffffff;
+
+    uint32_t tx_index = base;
+    uint32_t incarnation = 0;
+
+    bool operator==(const version& other) const noexcept
+    {
+        return tx_index == other.tx_index && incarnation == other.incarnation;
+    }
+
+    bool operator!=(const version& other) const noexcept { return !(*this == other); }
+};
+
+/// The multi-version memory of the transactions of one block executed in parallel.
+///
+/// Every location keeps the values written by the transactions, ordered by the transaction index.
+/// The transaction reads the value written by the highest lower transaction,
+/// or the base state if none of them has written the location.
+/// The memory is thread-safe: it is split into shards, each protected by its own
+/// reader-writer lock.
+class mv_memory
+{
+public:
+    /// The default number of shards.
+    static constexpr size_t default_num_shards = 64;
+
+    explicit mv_memory(size_t num_shards = default_num_shards) noexcept;
+
+    mv_memory(const mv_memory&) = delete;
+    mv_memory& operator=(const mv_memory&) = delete;
+
+    /// Reads the value written by the highest transaction lower than tx_index.
+    /// Returns false if no such transaction has written the location.
+    EVMC_EXPORT bool read(const state_location& location, uint32_t tx_index, version& ver,
+        evmc::bytes32& value) const noexcept;
+
+    /// Writes the value of the transaction incarnation.
+    EVMC_EXPORT void write(const state_location& location, version ver,
+        const evmc::bytes32& value) noexcept;
+
+    /// Removes the value written by the transaction.
+    EVMC_EXPORT void erase(const state_location& location, uint32_t tx_index) noexcept;
+
+private:
+    struct location_hash
+    {
+        size_t operator()(const state_location& l) const noexcept
+        {
+            return std::hash<evmc::address>{}(l.address) ^
+                   (std::hash<evmc::bytes32>{}(l.key) * 31) ^ static_cast<size_t>(l.kind);
+        }
+    };
+
+    struct entry
+    {
+        uint32_t incarnation;
+        evmc::bytes32 value;
+    };
+
+    struct shard
+    {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<state_location, std::map<uint32_t, entry>, location_hash> versions;
+    };
+
+    shard& get_shard(const state_location& location) const noexcept
+    {
+        return m_shards[location_hash{}(location) % m_num_shards];
+    }
+
+    size_t m_num_shards;
+    std::unique_ptr<shard[]> m_shards;
+};
+
+/// The host executing the transaction speculatively over the mv_memory.
+///
+/// Every state read is recorded with the version of the value observed and every write
+/// (SSTORE, the value transfers, LOG and SELFDESTRUCT) is buffered in the host instead of
+/// being passed to the base host. The nested calls are executed by the host itself with the
+/// same buffers, so the writes of the reverted calls are discarded.
+/// The base host is only used for the reads of the state not written in the block
+/// (the code included) and the block context, so it must allow concurrent reads
+/// if the transactions are executed in parallel.
+///
+/// The creates and the calls of the precompiles are not supported: they fail and mark
+/// the execution with is_unsupported(), so the transaction must be executed by the base host.
+/// The final state of the selfdestructed accounts is only reflected by the later transactions:
+/// their storage and code are empty then.
+class speculative_host : public evmc::Host
+{
+public:
+    /// The recorded read.
+    struct read_record
+    {
+        version ver;
+        evmc::bytes32 value;
+    };
+
+    struct log_record
+    {
+        evmc::address address;
+        std::basic_string<uint8_t> data;
+        std::vector<evmc::bytes32> topics;
+    };
+
+    struct selfdestruct_record
+    {
+        evmc::address address;
+        evmc::address beneficiary;
+    };
+
+    speculative_host(evmc_vm* vm, evmc_revision rev, const evmc_host_interface& base,
+        evmc_host_context* base_context, mv_memory& memory, uint32_t tx_index) noexcept;
+
+    speculative_host(const speculative_host&) = delete;
+    speculative_host& operator=(const speculative_host&) = delete;
+
+    /// Executes the message as the new incarnation of the transaction.
+    /// The read and write sets of the previous incarnation are discarded.
+    EVMC_EXPORT evmc::result execute(const evmc_message& msg) noexcept;
+
+    /// Checks if the values read by the last incarnation are still the ones
+    /// seen by the transaction in the mv_memory. Only the versions are compared.
+    [[nodiscard]] EVMC_EXPORT bool validate() const noexcept;
+
+    /// Writes the write set to the mv_memory, replacing the one of the previous incarnation.
+    EVMC_EXPORT void publish() noexcept;
+
+    [[nodiscard]] uint32_t tx_index() const noexcept { return m_tx_index; }
+
+    /// The number of executions of the transaction.
+    [[nodiscard]] uint32_t incarnation() const noexcept { return m_incarnation; }
+
+    /// The execution has used the unsupported host features, its results are not valid.
+    [[nodiscard]] bool is_unsupported() const noexcept { return m_unsupported; }
+
+    [[nodiscard]] const std::map<state_location, read_record>& reads() const noexcept
+    {
+        return m_reads;
+    }
+
+    [[nodiscard]] const std::map<state_location, evmc::bytes32>& writes() const noexcept
+    {
+        return m_writes;
+    }
+
+    [[nodiscard]] const std::vector<log_record>& logs() const noexcept { return m_logs; }
+
+    [[nodiscard]] const std::vector<selfdestruct_record>& selfdestructs() const noexcept
+    {
+        return m_selfdestructs;
+    }
+
+    bool account_exists(const evmc::address& addr) const noexcept override;
+
+    evmc::bytes32 get_storage(
+        const evmc::address& addr, const evmc::bytes32& key) const noexcept override;
+
+    evmc_storage_status set_storage(const evmc::address& addr, const evmc::bytes32& key,
+        const evmc::bytes32& value) noexcept override;
+
+    evmc::uint256be get_balance(const evmc::address& addr) const noexcept override;
+
+    size_t get_code_size(const evmc::address& addr) const noexcept override;
+
+    evmc::bytes32 get_code_hash(const evmc::address& addr) const noexcept override;
+
+    size_t copy_code(const evmc::address& addr, size_t code_offset, uint8_t* buffer_data,
+        size_t buffer_size) const noexcept override;
+
+    void selfdestruct(
+        const evmc::address& addr, const evmc::address& beneficiary) noexcept override;
+
+    evmc::result call(const evmc_message& msg) noexcept override;
+
+    evmc_tx_context get_tx_context() const noexcept override;
+
+    evmc::bytes32 get_block_hash(int64_t block_number) const noexcept override;
+
+    void emit_log(const evmc::address& addr, const uint8_t* data, size_t data_size,
+        const evmc::bytes32 topics[], size_t num_topics) noexcept override;
+
+private:
+    /// The write undone when the call reverts.
+    struct journal_entry
+    {
+        state_location location;
+        bool existed;
+        evmc::bytes32 previous;
+    };
+
+    /// Reads the value seen at the transaction start, recording the read.
+    evmc::bytes32 read_original(const state_location& location) const noexcept;
+
+    /// Reads the current value: the one written by the transaction or the original one.
+    evmc::bytes32 read(const state_location& location) const noexcept;
+
+    void write(const state_location& location, const evmc::bytes32& value) noexcept;
+
+    bool is_destructed(const evmc::address& addr) const noexcept;
+
+    evmc_vm* m_vm;
+    evmc_revision m_rev;
+    evmc::HostContext m_base;
+    mv_memory& m_memory;
+    uint32_t m_tx_index;
+    uint32_t m_incarnation = 0;
+    bool m_unsupported = false;
+
+    mutable std::map<state_location, read_record> m_reads;
+    std::map<state_location, evmc::bytes32> m_writes;
+    std::vector<journal_entry> m_journal;
+    std::vector<log_record> m_logs;
+    std::vector<selfdestruct_record> m_selfdestructs;
+
+    /// The locations written to the mv_memory by the last publish().
+    std::vector<state_location> m_published;
+
+    /// The accounts of the calls being executed, the storage context of DELEGATECALL.
+    std::vector<evmc::address> m_accounts;
+};
+
+/// The result of the block executed with execute_parallel().
+struct parallel_execution
+{
+    std::unique_ptr<mv_memory> memory;
+
+    /// The hosts of the transactions with the read and write sets of the final incarnations.
+    std::vector<std::unique_ptr<speculative_host>> transactions;
+
+    /// The results of the transactions, valid for the completed ones only.
+    std::vector<evmc::result> results;
+
+    /// The number of the leading transactions executed. If less than the count,
+    /// the next transaction is not supported by the speculative_host and must be executed
+    /// by the base host after applying the writes of these ones.
+    size_t num_completed = 0;
+
+    /// The total number of executions, including the re-executions.
+    size_t num_executions = 0;
+};
+
+/// Executes the transactions of the block optimistically in parallel.
+///
+/// All the transactions are executed with the speculative_host over the shared mv_memory,
+/// then validated in order. The invalid ones are re-executed and the following ones validated
+/// again until all are valid. The result is the same as the result of the sequential
+/// execution in the order of the msgs: the state written by the transaction
+/// is its write set applied over the writes of all the preceding transactions.
+/// The base host is not modified, its reads must be thread-safe for num_threads greater than 1.
+/// The vm must be the evmone instance.
+EVMC_EXPORT parallel_execution execute_parallel(evmc_vm* vm, evmc_revision rev,
+    const evmc_host_interface& host, evmc_host_context* context, const evmc_message* msgs,
+    size_t count, size_t num_threads = 1) noexcept;
+}  // namespace evmone
@@ -0,0 +1,493 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+/// @file
+/// The threaded-code interpreter.
+///
+/// This is the alternative to chaining the instruction functions in execute().
+/// The analysis provides the label address for each instruction (code_analysis::labels)
+/// so every instruction jumps directly to the next one ("direct threaded code") instead of
+/// returning to the dispatch loop. The hot instructions are implemented inline, with the gas
+/// left and the stack top pointer kept in local variables (registers). All other instructions
+/// fall back to calling the instruction function with the state synchronized.
+///
+/// This requires the "labels as values" extension of GCC and Clang. The interpreter is
+/// experimental and built only with EVMONE_THREADED_DISPATCH=1; otherwise (and with other
+/// compilers) the function chaining is used for all executions.
+
+#include "threaded.hpp"
+#include <initializer_list>
+#include <limits>
+#include <utility>
+
+#ifndef EVMONE_THREADED_DISPATCH
+#define EVMONE_THREADED_DISPATCH 0
+#endif
+
+#if EVMONE_THREADED_DISPATCH && defined(__GNUC__)
+
+// The computed goto is the non-standard extension.
+#pragma GCC diagnostic ignored "-Wpedantic"
+#ifdef __clang__
+#pragma clang diagnostic ignored "-Wgnu-label-as-value"
+#endif
+
+namespace evmone
+{
+namespace
+{
+using dispatch_table = std::array<const void*, op_table_size + 1>;
+
+struct label_entry
+{
+    int opcode;
+    const void* label;
+};
+
+dispatch_table make_dispatch_table(
+    std::initializer_list<label_entry> entries, const void* fallback) noexcept
+{
+    dispatch_table table;
+    table.fill(fallback);
+    for (const auto& e : entries)
+        table[static_cast<size_t>(e.opcode)] = e.label;
+    return table;
+}
+
+/// The interpreter. When called with nullptr returns the dispatch table.
+const void* const* run(execution_state* state_ptr) noexcept
+{
+    // clang-format off
+    static const auto table = make_dispatch_table({
+        {OP_STOP, &&op_stop},
+        {OP_ADD, &&op_add},
+        {OP_MUL, &&op_mul},
+        {OP_SUB, &&op_sub},
+        {OP_LT, &&op_lt},
+        {OP_GT, &&op_gt},
+        {OP_EQ, &&op_eq},
+        {OP_ISZERO, &&op_iszero},
+        {OP_AND, &&op_and},
+        {OP_OR, &&op_or},
+        {OP_XOR, &&op_xor},
+        {OP_NOT, &&op_not},
+        {OP_SHL, &&op_shl},
+        {OP_SHR, &&op_shr},
+        {OP_POP, &&op_pop},
+        {OP_JUMP, &&op_jump},
+        {OP_JUMPI, &&op_jumpi},
+        {OPX_BEGINBLOCK, &&opx_beginblock},
+        {OPX_BEGINBLOCK_GAS, &&opx_beginblock_gas},
+        {OPX_EMPTY_BLOCKS, &&opx_empty_blocks},
+        {OPX_STATIC_JUMP, &&opx_static_jump},
+        {OPX_STATIC_JUMPI, &&opx_static_jumpi},
+        {OP_PUSH1, &&op_push_small}, {OP_PUSH2, &&op_push_small},
+        {OP_PUSH3, &&op_push_small}, {OP_PUSH4, &&op_push_small},
+        {OP_PUSH5, &&op_push_small}, {OP_PUSH6, &&op_push_small},
+        {OP_PUSH7, &&op_push_small}, {OP_PUSH8, &&op_push_small},
+        {OP_PUSH9, &&op_push_full}, {OP_PUSH10, &&op_push_full},
+        {OP_PUSH11, &&op_push_full}, {OP_PUSH12, &&op_push_full},
+        {OP_PUSH13, &&op_push_full}, {OP_PUSH14, &&op_push_full},
+        {OP_PUSH15, &&op_push_full}, {OP_PUSH16, &&op_push_full},
+        {OP_PUSH17, &&op_push_full}, {OP_PUSH18, &&op_push_full},
+        {OP_PUSH19, &&op_push_full}, {OP_PUSH20, &&op_push_full},
+        {OP_PUSH21, &&op_push_full}, {OP_PUSH22, &&op_push_full},
+        {OP_PUSH23, &&op_push_full}, {OP_PUSH24, &&op_push_full},
+        {OP_PUSH25, &&op_push_full}, {OP_PUSH26, &&op_push_full},
+        {OP_PUSH27, &&op_push_full}, {OP_PUSH28, &&op_push_full},
+        {OP_PUSH29, &&op_push_full}, {OP_PUSH30, &&op_push_full},
+        {OP_PUSH31, &&op_push_full}, {OP_PUSH32, &&op_push_full},
+        {OP_DUP1, &&op_dup1}, {OP_DUP2, &&op_dup2}, {OP_DUP3, &&op_dup3}, {OP_DUP4, &&op_dup4},
+        {OP_DUP5, &&op_dup5}, {OP_DUP6, &&op_dup6}, {OP_DUP7, &&op_dup7}, {OP_DUP8, &&op_dup8},
+        {OP_DUP9, &&op_dup9}, {OP_DUP10, &&op_dup10}, {OP_DUP11, &&op_dup11},
+        {OP_DUP12, &&op_dup12}, {OP_DUP13, &&op_dup13}, {OP_DUP14, &&op_dup14},
+        {OP_DUP15, &&op_dup15}, {OP_DUP16, &&op_dup16},
+        {OP_SWAP1, &&op_swap1}, {OP_SWAP2, &&op_swap2}, {OP_SWAP3, &&op_swap3},
+        {OP_SWAP4, &&op_swap4}, {OP_SWAP5, &&op_swap5}, {OP_SWAP6, &&op_swap6},
+        {OP_SWAP7, &&op_swap7}, {OP_SWAP8, &&op_swap8}, {OP_SWAP9, &&op_swap9},
+        {OP_SWAP10, &&op_swap10}, {OP_SWAP11, &&op_swap11}, {OP_SWAP12, &&op_swap12},
+        {OP_SWAP13, &&op_swap13}, {OP_SWAP14, &&op_swap14}, {OP_SWAP15, &&op_swap15},
+        {OP_SWAP16, &&op_swap16},
+        {OPX_PUSH_ADD, &&opx_push_add},
+        {OPX_PUSH_SUB, &&opx_push_sub},
+        {OPX_PUSH_MUL, &&opx_push_mul},
+        {OPX_PUSH_AND, &&opx_push_and},
+        {OPX_PUSH_OR, &&opx_push_or},
+        {OPX_PUSH_EQ, &&opx_push_eq},
+        {OPX_PUSH_LT, &&opx_push_lt},
+        {OPX_PUSH_GT, &&opx_push_gt},
+        {OPX_PUSH_SHL, &&opx_push_shl},
+        {OPX_PUSH_SHR, &&opx_push_shr},
+        {OPX_PUSH_ADDRESS_MASK_AND, &&opx_push_address_mask_and},
+        {OPX_DUP_SWAP, &&opx_dup_swap},
+        {OPX_SWAP_POP, &&opx_swap_pop},
+        {OPX_ISZERO_STATIC_JUMPI, &&opx_iszero_static_jumpi},
+    }, &&fallback);
+    // clang-format on
+
+    if (state_ptr == nullptr)
+        return table.data();
+
+    auto& state = *state_ptr;
+    const auto* const instrs = state.analysis->instrs.data();
+    const auto* const labels = state.analysis->labels.data();
+
+    size_t pc = 0;
+    auto gas_left = state.gas_left;
+    auto* top = state.stack.top_item;
+
+    // The jump destination of the dynamic JUMP or JUMPI.
+    const uint256* jump_dst = nullptr;
+
+#define ARG (instrs[pc].arg)
+#define DISPATCH() goto* labels[pc]
+#define NEXT() \
+    ++pc;      \
+    DISPATCH()
+#define SYNC()                  \
+    state.gas_left = gas_left; \
+    state.stack.top_item = top
+#define EXIT(STATUS_CODE)        \
+    SYNC();                      \
+    state.status = STATUS_CODE; \
+    return nullptr
+
+    DISPATCH();
+
+fallback:
+{
+    SYNC();
+    const auto next = instrs[pc].fn(&instrs[pc], state);
+    if (next == nullptr)
+        return nullptr;
+    gas_left = state.gas_left;
+    top = state.stack.top_item;
+    pc = static_cast<size_t>(next - instrs);
+    DISPATCH();
+}
+
+opx_beginblock:
+{
+    const auto& block = ARG.block;
+    if ((gas_left -= block.gas_cost) < 0)
+    {
+        EXIT(EVMC_OUT_OF_GAS);
+    }
+
+    const auto stack_size = static_cast<int>(top + 1 - state.stack.storage);
+    if (stack_size < block.stack_req)
+    {
+        EXIT(EVMC_STACK_UNDERFLOW);
+    }
+    if (stack_size + block.stack_max_growth > evm_stack::limit)
+    {
+        EXIT(EVMC_STACK_OVERFLOW);
+    }
+
+    state.current_block_cost = block.gas_cost;
+    NEXT();
+}
+
+opx_beginblock_gas:
+{
+    const auto& block = ARG.block;
+    if ((gas_left -= block.gas_cost) < 0)
+    {
+        EXIT(EVMC_OUT_OF_GAS);
+    }
+
+    state.current_block_cost = block.gas_cost;
+    NEXT();
+}
+
+opx_empty_blocks:
+{
+    const auto arg = static_cast<uint64_t>(ARG.number);
+    if ((gas_left -= static_cast<int64_t>(arg >> 32)) < 0)
+    {
+        EXIT(EVMC_OUT_OF_GAS);
+    }
+
+    pc += arg & 0xffffffff;
+    DISPATCH();
+}
+
+op_stop:
+{
+    EXIT(EVMC_SUCCESS);
+}
+
+op_add:
+    top[-1] += top[0];
+    --top;
+    NEXT();
+
+op_mul:
+    top[-1] *= top[0];
+    --top;
+    NEXT();
+
+op_sub:
+    top[-1] = top[0] - top[-1];
+    --top;
+    NEXT();
+
+op_lt:
+    top[-1] = top[0] < top[-1];
+    --top;
+    NEXT();
+
+op_gt:
+    top[-1] = top[0] > top[-1];
+    --top;
+    NEXT();
+
+op_eq:
+    top[-1] = top[0] == top[-1];
+    --top;
+    NEXT();
+
+op_iszero:
+    top[0] = top[0] == 0;
+    NEXT();
+
+op_and:
+    top[-1] &= top[0];
+    --top;
+    NEXT();
+
+op_or:
+    top[-1] |= top[0];
+    --top;
+    NEXT();
+
+op_xor:
+    top[-1] ^= top[0];
+    --top;
+    NEXT();
+
+op_not:
+    top[0] = ~top[0];
+    NEXT();
+
+op_shl:
+    top[-1] <<= top[0];
+    --top;
+    NEXT();
+
+op_shr:
+    top[-1] >>= top[0];
+    --top;
+    NEXT();
+
+op_pop:
+    --top;
+    NEXT();
+
+op_jump:
+    jump_dst = top--;
+    goto jump;
+
+op_jumpi:
+    if (top[-1] != 0)
+    {
+        jump_dst = top;
+        top -= 2;
+        goto jump;
+    }
+    top -= 2;
+    NEXT();
+
+jump:
+{
+    const auto& dst = *jump_dst;
+    auto target = -1;
+    if (std::numeric_limits<int>::max() < dst ||
+        (target = find_jumpdest(*state.analysis, static_cast<int>(dst))) < 0)
+    {
+        EXIT(EVMC_BAD_JUMP_DESTINATION);
+    }
+    pc = static_cast<size_t>(target);
+    DISPATCH();
+}
+
+opx_static_jump:
+{
+    const auto target = ARG.number;
+    if (target < 0)
+    {
+        EXIT(EVMC_BAD_JUMP_DESTINATION);
+    }
+    pc = static_cast<size_t>(target);
+    DISPATCH();
+}
+
+opx_static_jumpi:
+    if (*top-- != 0)
+        goto opx_static_jump;
+    NEXT();
+
+opx_iszero_static_jumpi:
+    if (*top-- == 0)
+        goto opx_static_jump;
+    NEXT();
+
+op_push_small:
+    *++top = ARG.small_push_value;
+    NEXT();
+
+op_push_full:
+    *++top = *ARG.push_value;
+    NEXT();
+
+#define DUP_CASE(N)           \
+    op_dup##N : ++top;        \
+    top[0] = top[-(N)];       \
+    NEXT();
+
+    DUP_CASE(1)
+    DUP_CASE(2)
+    DUP_CASE(3)
+    DUP_CASE(4)
+    DUP_CASE(5)
+    DUP_CASE(6)
+    DUP_CASE(7)
+    DUP_CASE(8)
+    DUP_CASE(9)
+    DUP_CASE(10)
+    DUP_CASE(11)
+    DUP_CASE(12)
+    DUP_CASE(13)
+    DUP_CASE(14)
+    DUP_CASE(15)
+    DUP_CASE(16)
+#undef DUP_CASE
+
+#define SWAP_CASE(N)                      \
+    op_swap##N : std::swap(top[0], top[-(N)]); \
+    NEXT();
+
+    SWAP_CASE(1)
+    SWAP_CASE(2)
+    SWAP_CASE(3)
+    SWAP_CASE(4)
+    SWAP_CASE(5)
+    SWAP_CASE(6)
+    SWAP_CASE(7)
+    SWAP_CASE(8)
+    SWAP_CASE(9)
+    SWAP_CASE(10)
+    SWAP_CASE(11)
+    SWAP_CASE(12)
+    SWAP_CASE(13)
+    SWAP_CASE(14)
+    SWAP_CASE(15)
+    SWAP_CASE(16)
+#undef SWAP_CASE
+
+    // The superinstructions. The push value is the top operand of the fused instruction.
+
+opx_push_add:
+    top[0] = uint256{ARG.small_push_value} + top[0];
+    NEXT();
+
+opx_push_sub:
+    top[0] = uint256{ARG.small_push_value} - top[0];
+    NEXT();
+
+opx_push_mul:
+    top[0] = uint256{ARG.small_push_value} * top[0];
+    NEXT();
+
+opx_push_and:
+    top[0] &= uint256{ARG.small_push_value};
+    NEXT();
+
+opx_push_or:
+    top[0] |= uint256{ARG.small_push_value};
+    NEXT();
+
+opx_push_eq:
+    top[0] = top[0] == ARG.small_push_value;
+    NEXT();
+
+opx_push_lt:
+    top[0] = uint256{ARG.small_push_value} < top[0];
+    NEXT();
+
+opx_push_gt:
+    top[0] = uint256{ARG.small_push_value} > top[0];
+    NEXT();
+
+opx_push_shl:
+    top[0] = ARG.small_push_value < 256 ? top[0] << static_cast<unsigned>(ARG.small_push_value) : 0;
+    NEXT();
+
+opx_push_shr:
+    top[0] = ARG.small_push_value < 256 ? top[0] >> static_cast<unsigned>(ARG.small_push_value) : 0;
+    NEXT();
+
+opx_push_address_mask_and:
+{
+    // Keep the low 160 bits. The intx words are in the order of significance.
+    const auto words = intx::as_words(top[0]);
+    words[2] &= 0xffffffff;
+    words[3] = 0;
+    NEXT();
+}
+
+opx_dup_swap:
+{
+    const auto dup_index = static_cast<int>(ARG.number & 0xff) - 1;
+    const auto swap_index = static_cast<int>(ARG.number >> 8);
+    const auto item = top[-dup_index];
+    ++top;
+    top[0] = top[-swap_index];
+    top[-swap_index] = item;
+    NEXT();
+}
+
+opx_swap_pop:
+    top[-ARG.number] = top[0];
+    --top;
+    NEXT();
+
+#undef EXIT
+#undef SYNC
+#undef NEXT
+#undef DISPATCH
+#undef ARG
+}
+}  // namespace
+
+const void* const* get_threaded_dispatch_table() noexcept
+{
+    return run(nullptr);
+}
+
+void execute_threaded(execution_state& state) noexcept
+{
+    run(&state);
+}
+}  // namespace evmone
+
+#else
+
+namespace evmone
+{
+const void* const* get_threaded_dispatch_table() noexcept
+{
+    return nullptr;
+}
+
+void execute_threaded(execution_state& state) noexcept
+{
+    // Not available: use the function chaining.
+    const auto* instr = &state.analysis->instrs[0];
+    while (instr != nullptr)
+        instr = instr->fn(instr, state);
+}
+}  // namespace evmone
+
+#endif
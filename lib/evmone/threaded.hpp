@@ -0,0 +1,21 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include "analysis.hpp"
+
+namespace evmone
+{
+/// Returns the dispatch table of the threaded-code interpreter: the addresses of the
+/// interpreter labels indexed by opcode (including intrinsic opcodes). The opcodes without
+/// the dedicated label map to the fallback label calling the instruction function.
+/// The additional last entry (at op_table_size) is the fallback label.
+/// Returns nullptr if the threaded-code interpreter is not available in this build,
+/// e.g. with MSVC which does not support "labels as values".
+EVMC_EXPORT const void* const* get_threaded_dispatch_table() noexcept;
+
+/// Executes the code with the threaded-code interpreter.
+/// The state's analysis must have the labels built (see ANALYSIS_THREADED_CODE).
+void execute_threaded(execution_state& state) noexcept;
+}  // namespace evmone
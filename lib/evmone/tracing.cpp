@@ -0,0 +1,82 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "tracing.hpp"
+#include "vm.hpp"
+#include <evmc/instructions.h>
+#include <cinttypes>
+#include <cstdio>
+
+namespace evmone
+{
+namespace
+{
+/// Formats the number as the hex string with the 0x prefix and without leading zeros.
+std::string to_hex(uint64_t x)
+{
+    char buf[19];
+    std::snprintf(buf, sizeof(buf), "0x%" PRIx64, x);
+    return buf;
+}
+
+/// Formats the stack item (the 32 bytes of intx::uint256) as the hex string.
+std::string to_hex(const uint8_t* item)
+{
+    uint64_t words[4];
+    std::memcpy(words, item, sizeof(words));
+
+    // The most significant non-zero word has no leading zeros, the following ones are padded.
+    auto i = 3;
+    while (i > 0 && words[i] == 0)
+        --i;
+    auto hex = to_hex(words[i]);
+    for (--i; i >= 0; --i)
+    {
+        char buf[17];
+        std::snprintf(buf, sizeof(buf), "%016" PRIx64, words[i]);
+        hex += buf;
+    }
+    return hex;
+}
+}  // namespace
+
+void set_tracer(evmc_vm* vm, tracer* t) noexcept
+{
+    static_cast<VM*>(vm)->current_tracer = t;
+}
+
+std::string format_trace_json(const uint8_t* data, size_t size)
+{
+    const auto names = evmc_get_instruction_names_table(EVMC_MAX_REVISION);
+    std::string json;
+    size_t pos = 0;
+    while (size - pos >= sizeof(trace_step))
+    {
+        trace_step step;
+        std::memcpy(&step, &data[pos], sizeof(step));
+        const auto record_size = sizeof(step) + size_t{step.num_stack_items} * 32;
+        if (size - pos < record_size)
+            break;
+
+        json += "{\"pc\":" + std::to_string(step.pc) + ",\"op\":" + std::to_string(step.opcode) +
+                ",\"gas\":\"" + to_hex(static_cast<uint64_t>(step.gas)) + "\",\"gasCost\":\"" +
+                to_hex(static_cast<uint64_t>(step.gas_cost)) +
+                "\",\"memSize\":" + std::to_string(step.memory_size) + ",\"stack\":[";
+
+        // The records have the stack top first, EIP-3155 lists the stack from the bottom.
+        for (size_t i = step.num_stack_items; i > 0; --i)
+        {
+            json += "\"" + to_hex(&data[pos + sizeof(step) + (i - 1) * 32]) + "\"";
+            if (i != 1)
+                json += ",";
+        }
+
+        const auto name = names[step.opcode];
+        json += "],\"depth\":" + std::to_string(step.depth) + ",\"opName\":\"" +
+                (name != nullptr ? name : "UNDEFINED") + "\"}\n";
+        pos += record_size;
+    }
+    return json;
+}
+}  // namespace evmone
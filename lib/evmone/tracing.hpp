@@ -0,0 +1,177 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include "analysis.hpp"
+#include <evmc/evmc.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+namespace evmone
+{
+/// The header of the trace record of a single execution step.
+///
+/// The header is followed by num_stack_items stack items (32-byte words in the native
+/// endianness of intx::uint256), starting from the stack top.
+struct trace_step
+{
+    /// The code offset of the instruction.
+    uint32_t pc;
+
+    /// The opcode of the instruction.
+    uint8_t opcode;
+
+    /// The number of the stack items following the header.
+    uint8_t num_stack_items;
+
+    /// The call depth, 1 for the top-level execution.
+    uint16_t depth;
+
+    /// The stack height before the instruction.
+    uint32_t stack_size;
+
+    uint32_t reserved;
+
+    /// The gas left before the instruction.
+    int64_t gas;
+
+    /// The gas cost of the instruction. For calls this includes the gas used by the callee.
+    int64_t gas_cost;
+
+    /// The memory size before the instruction.
+    uint64_t memory_size;
+};
+static_assert(sizeof(trace_step) == 40);
+
+/// The collector of the execution trace (in the spirit of EIP-3155).
+///
+/// The steps are written as trace_step records to the buffer provided by the caller.
+/// When the buffer cannot fit the next record, its content is passed to the flush function
+/// and the buffer is reused. Without the flush function the steps not fitting the buffer
+/// are dropped. Recording a step does not allocate. The tracer is not thread-safe.
+///
+/// The tracer is attached to the VM instance with set_tracer(). The executions of the traced
+/// VM use the interpreter loop reporting each step instead of the regular fast paths,
+/// the executions of other VM instances are not affected.
+class tracer
+{
+public:
+    /// The function receiving the full records.
+    using flush_fn = void (*)(void* context, const uint8_t* data, size_t size) noexcept;
+
+    /// The maximum number of the reported stack items.
+    static constexpr int max_stack_items = 255;
+
+private:
+    uint8_t* m_buffer;
+    size_t m_buffer_size;
+    flush_fn m_flush;
+    void* m_context;
+    int m_max_stack_items;
+
+    /// The number of bytes in the buffer.
+    size_t m_size = 0;
+
+    /// The number of bytes already flushed, the position in the whole trace of the buffer start.
+    uint64_t m_flushed = 0;
+
+    uint64_t m_num_steps = 0;
+    uint64_t m_num_dropped = 0;
+
+public:
+    /// Creates the tracer writing to the buffer of given size and reporting up to
+    /// stack_items items from the stack top in each step.
+    tracer(uint8_t* buffer, size_t buffer_size, flush_fn flush_function = nullptr,
+        void* flush_context = nullptr, int stack_items = 4) noexcept
+      : m_buffer{buffer},
+        m_buffer_size{buffer_size},
+        m_flush{flush_function},
+        m_context{flush_context},
+        m_max_stack_items{std::min(std::max(stack_items, 0), max_stack_items)}
+    {}
+
+    /// Records the step and returns the record identifier for set_gas_cost().
+    ///
+    /// The extra_top is the additional item on the stack top, used when the instruction
+    /// is reported before the value it consumes is pushed (for the static jumps).
+    uint64_t step(uint32_t pc, uint8_t opcode, uint16_t depth, int64_t gas, int64_t gas_cost,
+        uint64_t memory_size, evm_stack& stack, const uint256* extra_top = nullptr) noexcept
+    {
+        const auto stack_size = stack.size() + (extra_top != nullptr ? 1 : 0);
+        const auto num_items = std::min(stack_size, m_max_stack_items);
+        const auto record_size = sizeof(trace_step) + static_cast<size_t>(num_items) * 32;
+
+        if (m_buffer_size - m_size < record_size)
+        {
+            flush();
+            if (m_buffer_size - m_size < record_size)
+            {
+                ++m_num_dropped;
+                return ~uint64_t{0};
+            }
+        }
+
+        const auto id = m_flushed + m_size;
+        auto p = &m_buffer[m_size];
+        const trace_step header{pc, opcode, static_cast<uint8_t>(num_items), depth,
+            static_cast<uint32_t>(stack_size), 0, gas, gas_cost, memory_size};
+        std::memcpy(p, &header, sizeof(header));
+        p += sizeof(header);
+
+        auto stack_index = 0;
+        for (auto i = 0; i < num_items; ++i, p += 32)
+        {
+            const auto& item = (i == 0 && extra_top != nullptr) ? *extra_top : stack[stack_index++];
+            std::memcpy(p, &item, 32);
+        }
+
+        m_size += record_size;
+        ++m_num_steps;
+        return id;
+    }
+
+    /// Updates the gas cost of the recorded step if still in the buffer.
+    void set_gas_cost(uint64_t id, int64_t gas_cost) noexcept
+    {
+        if (id < m_flushed || id - m_flushed >= m_size)
+            return;
+        std::memcpy(&m_buffer[id - m_flushed + offsetof(trace_step, gas_cost)], &gas_cost,
+            sizeof(gas_cost));
+    }
+
+    /// Passes the records in the buffer to the flush function and clears the buffer.
+    /// Without the flush function the buffer is kept.
+    void flush() noexcept
+    {
+        if (m_flush == nullptr)
+            return;
+        if (m_size != 0)
+            m_flush(m_context, m_buffer, m_size);
+        m_flushed += m_size;
+        m_size = 0;
+    }
+
+    /// The records in the buffer.
+    [[nodiscard]] const uint8_t* data() const noexcept { return m_buffer; }
+
+    /// The number of bytes in the buffer.
+    [[nodiscard]] size_t size() const noexcept { return m_size; }
+
+    /// The number of recorded steps.
+    [[nodiscard]] uint64_t num_steps() const noexcept { return m_num_steps; }
+
+    /// The number of steps dropped because they have not fit the buffer.
+    [[nodiscard]] uint64_t num_dropped() const noexcept { return m_num_dropped; }
+};
+
+/// Attaches the tracer to the evmone VM instance, null detaches the current one.
+/// The VM must not execute concurrently while traced.
+EVMC_EXPORT void set_tracer(evmc_vm* vm, tracer* t) noexcept;
+
+/// Formats the trace records as the EIP-3155 JSON lines, one object per step.
+/// The stack contains only the recorded top items. The incomplete record at the end is ignored.
+EVMC_EXPORT std::string format_trace_json(const uint8_t* data, size_t size);
+}  // namespace evmone
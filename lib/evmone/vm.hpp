@@ -0,0 +1,79 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include "analysis_cache.hpp"
+#include "analysis_pool.hpp"
+#include "batch_workers.hpp"
+#include "jit.hpp"
+#include "nested_call.hpp"
+#include "prefetch.hpp"
+#include <evmc/evmc.h>
+
+#if EVMONE_PROFILING
+#include "profiler.hpp"
+#endif
+
+namespace evmone
+{
+class tracer;
+
+/// The analysis of the code deployed by creates, see VM::create_analysis.
+enum class create_analysis_mode
+{
+    /// The deployed code is analyzed by its first execution.
+    off,
+
+    /// The deployed code is analyzed right after the create, in the executing thread.
+    sync,
+
+    /// The deployed code is submitted to the VM::pool.
+    async,
+};
+
+/// The evmone EVMC instance.
+class VM : public evmc_vm
+{
+public:
+    /// The cache of code analyses shared by all executions of this VM instance.
+    analysis_cache cache;
+
+    /// The flags for the code analysis, see analysis_flags.
+    uint32_t analysis_flags = ANALYSIS_FUSION | ANALYSIS_PRECHARGE | ANALYSIS_ELIDE_CHECKS;
+
+    /// The number of executions of the code after which it is compiled with ANALYSIS_JIT.
+    uint32_t jit_threshold = default_jit_threshold;
+
+    /// The tracer of the executions or null if not traced, see set_tracer().
+    tracer* current_tracer = nullptr;
+
+    /// The analysis of the code returned by the successful creates,
+    /// inserted to the cache for the first call of the created contract.
+    create_analysis_mode create_analysis = create_analysis_mode::off;
+
+    /// The background analysis into the cache, destroyed before the cache.
+    /// See prefetch_analysis().
+    analysis_pool pool{cache};
+
+    /// The threads executing the batches, see execute_batch().
+    batch_workers batch_threads;
+
+    /// The host interface of the executions getting the prefetch hints and its prefetch
+    /// callback, see set_host_prefetch().
+    const evmc_host_interface* prefetch_host = nullptr;
+    prefetch_fn prefetch = nullptr;
+
+    /// The host interface of the executions with the nested calls and its nested call
+    /// callbacks, see set_host_nested_calls().
+    const evmc_host_interface* nested_host = nullptr;
+    nested_call_interface nested_calls{};
+
+#if EVMONE_PROFILING
+    /// The execution statistics of all executions of this VM instance.
+    profiler profile;
+#endif
+
+    VM() noexcept;
+};
+}  // namespace evmone
@@ -0,0 +1,133 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+/// @file
+/// The tool printing the speculative access list of the EVM code as JSON.
+///
+/// Usage: evmone-access-list [options] <code>
+///
+/// The code is the hex string or @<path> of the file with the hex code.
+/// Without the message options the access list covers all the entry paths of the code.
+/// Options:
+///   --rev=<n>          the EVM revision number (default: the latest)
+///   --address=<hex>    the executed account
+///   --caller=<hex>     the message sender
+///   --value=<hex>      the message value
+///   --input=<hex>      the call data
+
+#include <evmone/access_list.hpp>
+#include <test/utils/utils.hpp>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+namespace
+{
+/// Decodes the hex string, the 0x prefix and whitespace are skipped.
+bytes decode_hex(std::string_view hex)
+{
+    if (hex.substr(0, 2) == "0x")
+        hex.remove_prefix(2);
+    std::string digits;
+    for (const auto c : hex)
+    {
+        if (!std::isspace(static_cast<unsigned char>(c)))
+            digits += c;
+    }
+    return from_hex(digits);
+}
+
+/// Decodes the hex value into the 20 or 32-byte big-endian type, aligned right.
+template <typename T>
+T decode_value(std::string_view hex)
+{
+    const auto data = decode_hex(hex);
+    T value;
+    if (data.size() > sizeof(value.bytes))
+        throw std::invalid_argument{"value too long: " + std::string{hex}};
+    std::memcpy(&value.bytes[sizeof(value.bytes) - data.size()], data.data(), data.size());
+    return value;
+}
+
+bytes load_code(std::string_view arg)
+{
+    if (arg.substr(0, 1) != "@")
+        return decode_hex(arg);
+
+    const auto path = std::string{arg.substr(1)};
+    std::ifstream file{path};
+    if (!file)
+        throw std::invalid_argument{"cannot open " + path};
+    const std::string content{std::istreambuf_iterator<char>{file}, {}};
+    return decode_hex(content);
+}
+}  // namespace
+
+int main(int argc, const char* argv[])
+{
+    try
+    {
+        auto rev = EVMC_MAX_REVISION;
+        evmc_message msg{};
+        bool has_msg = false;
+        bytes input;
+        const char* code_arg = nullptr;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string_view arg = argv[i];
+            const auto eq = arg.find('=');
+            const auto name = arg.substr(0, eq);
+            const auto value = eq != std::string_view::npos ? arg.substr(eq + 1) : "";
+
+            if (name == "--rev")
+            {
+                rev = static_cast<evmc_revision>(std::stoi(std::string{value}));
+                continue;
+            }
+
+            if (name == "--address")
+                msg.destination = decode_value<evmc::address>(value);
+            else if (name == "--caller")
+                msg.sender = decode_value<evmc::address>(value);
+            else if (name == "--value")
+                msg.value = decode_value<evmc::bytes32>(value);
+            else if (name == "--input")
+                input = decode_hex(value);
+            else if (arg.substr(0, 2) != "--" && code_arg == nullptr)
+            {
+                code_arg = argv[i];
+                continue;
+            }
+            else
+                throw std::invalid_argument{"unknown argument: " + std::string{arg}};
+            has_msg = true;
+        }
+
+        if (code_arg == nullptr || rev < EVMC_FRONTIER || rev > EVMC_MAX_REVISION)
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--rev=<n>] [--address=<hex>] [--caller=<hex>] [--value=<hex>]"
+                         " [--input=<hex>] <code-hex | @path>\n";
+            return 1;
+        }
+
+        msg.input_data = input.data();
+        msg.input_size = input.size();
+
+        const auto code = load_code(code_arg);
+        const auto list =
+            evmone::extract_access_list(rev, code.data(), code.size(), has_msg ? &msg : nullptr);
+        std::cout << evmone::format_access_list_json(list) << "\n";
+        return 0;
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 1;
+    }
+}
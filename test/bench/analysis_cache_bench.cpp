@@ -0,0 +1,133 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+/// @file
+/// Multi-threaded benchmarks of the code analysis cache.
+///
+/// The threads look up codes picked randomly from a working set. The small working set fits
+/// the cache capacity, the large one does not. Compare "rate" across thread counts to see
+/// the throughput scaling; "hit_rate" is the fraction of lookups not analyzing the code.
+
+#include <benchmark/benchmark.h>
+#include <evmc/evmc.hpp>
+#include <evmone/analysis_cache.hpp>
+#include <evmone/evmone.h>
+#include <evmone/vm.hpp>
+#include <test/utils/bytecode.hpp>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <thread>
+
+using namespace benchmark;
+
+namespace
+{
+/// The cache capacity in MiB: fits the small working set only.
+constexpr size_t capacity_mib = 16;
+
+constexpr size_t max_working_set = 1024;
+
+/// Generates the code of 4 KiB being different for each variant.
+/// The code starts with STOP so the execution cost is negligible compared to the analysis.
+const std::vector<bytecode>& get_codes()
+{
+    static const auto codes = [] {
+        std::vector<bytecode> c;
+        for (size_t i = 0; i < max_working_set; ++i)
+        {
+            auto code = bytecode{OP_STOP} + push(i);
+            while (code.size() < 4096)
+                code += bytecode{push(code.size())} + OP_JUMPDEST + OP_POP;
+            c.emplace_back(std::move(code));
+        }
+        return c;
+    }();
+    return codes;
+}
+
+/// The xorshift64 generator seeded differently in each thread.
+class rng
+{
+    uint64_t m_state = std::hash<std::thread::id>{}(std::this_thread::get_id()) | 1;
+
+public:
+    size_t operator()(size_t bound) noexcept
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return static_cast<size_t>(m_state % bound);
+    }
+};
+
+void set_counters(
+    State& state, const evmone::analysis_cache::stats& before, const evmone::analysis_cache& cache)
+{
+    // The statistics are shared by all threads, so each thread reports (almost) the same value.
+    const auto after = cache.get_stats();
+    const auto hits = static_cast<double>(after.hits - before.hits);
+    const auto misses = static_cast<double>(after.misses - before.misses);
+    const auto lookups = hits + misses;
+    state.counters["hit_rate"] = Counter(lookups != 0 ? hits / lookups : 0, Counter::kAvgThreads);
+    state.counters["rate"] = Counter(static_cast<double>(state.iterations()), Counter::kIsRate);
+}
+
+void analysis_cache_get(State& state)
+{
+    static evmone::analysis_cache cache{capacity_mib << 20};
+
+    const auto& codes = get_codes();
+    const auto working_set = static_cast<size_t>(state.range(0));
+    auto random = rng{};
+
+    const auto before = cache.get_stats();
+    for (auto _ : state)
+    {
+        const auto& code = codes[random(working_set)];
+        auto analysis = cache.get(EVMC_ISTANBUL, code.data(), code.size());
+        DoNotOptimize(analysis);
+    }
+    set_counters(state, before, cache);
+}
+
+void analysis_cache_execute(State& state)
+{
+    static auto* const raw_vm = [] {
+        auto* vm = static_cast<evmone::VM*>(evmc_create_evmone());
+        vm->set_option(vm, "analysis_cache_size", std::to_string(capacity_mib).c_str());
+        return vm;
+    }();
+    static auto vm = evmc::VM{raw_vm};
+
+    const auto& codes = get_codes();
+    const auto working_set = static_cast<size_t>(state.range(0));
+    auto random = rng{};
+
+    auto msg = evmc_message{};
+    msg.gas = 1000000;
+
+    const auto before = raw_vm->cache.get_stats();
+    for (auto _ : state)
+    {
+        const auto& code = codes[random(working_set)];
+        auto r = vm.execute(EVMC_ISTANBUL, msg, code.data(), code.size());
+        DoNotOptimize(r.status_code);
+    }
+    set_counters(state, before, raw_vm->cache);
+}
+
+const auto max_threads = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+}  // namespace
+
+BENCHMARK(analysis_cache_get)
+    ->Arg(16)
+    ->Arg(max_working_set)
+    ->ThreadRange(1, max_threads)
+    ->UseRealTime();
+BENCHMARK(analysis_cache_execute)
+    ->Arg(16)
+    ->Arg(max_working_set)
+    ->ThreadRange(1, max_threads)
+    ->UseRealTime();
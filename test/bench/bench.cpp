@@ -2,17 +2,30 @@
 // Copyright 2019 The evmone Authors.
 // Licensed under the Apache License, Version 2.0.
 
+#include "bench_host.hpp"
+#include "json_reporter.hpp"
+#include "perf_counters.hpp"
+#include "throughput.hpp"
 #include <benchmark/benchmark.h>
 #include <evmc/evmc.hpp>
 #include <evmc/loader.h>
 #include <evmone/analysis.hpp>
 #include <evmone/evmone.h>
+#include <evmone/execution.hpp>
+#include <evmone/jit.hpp>
+#include <evmone/threaded.hpp>
 #include <test/utils/utils.hpp>
 
 #include <cctype>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
 
 
 #if HAVE_STD_FILESYSTEM
@@ -30,29 +43,273 @@ namespace
 constexpr auto gas_limit = std::numeric_limits<int64_t>::max();
 auto vm = evmc::VM{};
 
+/// The built-in evmone with the code compiled by the JIT before the first execution,
+/// benchmarking the "/jit" variants of the cases. Not created if the JIT is not available.
+auto jit_vm = evmc::VM{};
+
+/// The built-in evmone with the threaded-code interpreter, benchmarking the "/threaded"
+/// variants of the cases. Not created if the threaded-code interpreter is not in the build.
+auto threaded_vm = evmc::VM{};
+
 constexpr auto inputs_extension = ".inputs";
+constexpr auto state_extension = ".state";
+
+/// The number of messages executed with evmone::execute_batch() in a single iteration.
+/// The value 0 disables the batch mode.
+size_t batch_size = 0;
+
+/// The number of threads executing the batch.
+size_t batch_threads = 1;
+
+/// The number of threads executing every case concurrently with the same VM instance
+/// in the throughput mode. The value 0 disables the throughput mode.
+size_t num_threads = 0;
+
+/// The hardware counters collected around the execution loops, null if not enabled.
+std::unique_ptr<perf_counters> hw_counters;
+
+/// The path of the JSON results file, empty if not written.
+std::string json_out;
+
+inline void start_perf_counters() noexcept
+{
+    if (hw_counters)
+        hw_counters->start();
+}
+
+/// Stops the hardware counters and reports them per iteration, with the instructions per cycle.
+void report_perf_counters(State& state) noexcept
+{
+    if (!hw_counters)
+        return;
+
+    hw_counters->pause();
+    const auto values = hw_counters->read();
+    for (size_t i = 0; i < perf_counters::num_events; ++i)
+    {
+        if (values[i] >= 0)
+        {
+            state.counters[perf_counters::names[i]] =
+                Counter(static_cast<double>(values[i]), Counter::kAvgIterations);
+        }
+    }
 
-inline evmc::result execute(bytes_view code, bytes_view input) noexcept
+    const auto instructions = values[perf_counters::instructions];
+    const auto cycles = values[perf_counters::cycles];
+    if (instructions >= 0 && cycles > 0)
+        state.counters["ipc"] =
+            Counter(static_cast<double>(instructions) / static_cast<double>(cycles));
+}
+
+/// Creates the top-level message of the case, with the addresses of the pre-state if provided.
+inline evmc_message make_message(bytes_view input, const bench_state* pre_state) noexcept
 {
     auto msg = evmc_message{};
     msg.gas = gas_limit;
     msg.input_data = input.data();
     msg.input_size = input.size();
-    return vm.execute(EVMC_CONSTANTINOPLE, msg, code.data(), code.size());
+    if (pre_state != nullptr)
+    {
+        msg.destination = pre_state->destination;
+        msg.sender = pre_state->sender;
+    }
+    return msg;
 }
 
-void execute(State& state, bytes_view code, bytes_view input) noexcept
+inline evmc::result execute(evmc::VM& instance, bytes_view code, bytes_view input) noexcept
+{
+    const auto msg = make_message(input, nullptr);
+    return instance.execute(EVMC_CONSTANTINOPLE, msg, code.data(), code.size());
+}
+
+void execute(State& state, evmc::VM& instance, bytes_view code, bytes_view input) noexcept
 {
     auto total_gas_used = int64_t{0};
     auto iteration_gas_used = int64_t{0};
+    start_perf_counters();
     for (auto _ : state)
     {
-        auto r = execute(code, input);
+        auto r = execute(instance, code, input);
         iteration_gas_used = gas_limit - r.gas_left;
         total_gas_used += iteration_gas_used;
     }
+    report_perf_counters(state);
+    state.counters["gas_used"] = Counter(static_cast<double>(iteration_gas_used));
+    state.counters["gas_rate"] = Counter(static_cast<double>(total_gas_used), Counter::kIsRate);
+}
+
+/// Returns the seconds elapsed since the start, reported as the manual time of the iteration
+/// by the cases restoring the pre-state between the iterations.
+inline double seconds_since(std::chrono::steady_clock::time_point start) noexcept
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Executes the case with the host, the pre-state is restored between the iterations.
+///
+/// Only the execution is timed, without pausing the timer for restoring the pre-state.
+/// The time per nested call is reported as "call_time" if the case makes any calls.
+void execute_with_host(State& state, evmc::VM& instance, const bench_state& pre_state,
+    bytes_view code, bytes_view input) noexcept
+{
+    const auto msg = make_message(input, &pre_state);
+    bench_host host{instance, pre_state};
+
+    auto total_gas_used = int64_t{0};
+    auto iteration_gas_used = int64_t{0};
+    auto num_calls = size_t{0};
+    start_perf_counters();
+    for (auto _ : state)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const auto r = host.execute(msg, code);
+        state.SetIterationTime(seconds_since(start));
+
+        iteration_gas_used = gas_limit - r.gas_left;
+        total_gas_used += iteration_gas_used;
+        num_calls = host.num_calls;
+
+        if (hw_counters)
+            hw_counters->pause();
+        host.reset();
+        if (hw_counters)
+            hw_counters->resume();
+    }
+    report_perf_counters(state);
+    state.counters["gas_used"] = Counter(static_cast<double>(iteration_gas_used));
+    state.counters["gas_rate"] = Counter(static_cast<double>(total_gas_used), Counter::kIsRate);
+    state.counters["calls"] = Counter(static_cast<double>(num_calls));
+    if (num_calls != 0)
+    {
+        state.counters["call_time"] = Counter(static_cast<double>(num_calls),
+            Counter::kIsIterationInvariantRate | Counter::kInvert);
+    }
+}
+
+/// Returns the index of the thread running the benchmark.
+/// The State::thread_index member became the function in benchmark 1.6.
+template <typename S>
+auto get_thread_index(const S& state, int) noexcept -> decltype(state.thread_index())
+{
+    return state.thread_index();
+}
+
+template <typename S>
+auto get_thread_index(const S& state, long) noexcept -> decltype(state.thread_index + 0)
+{
+    return state.thread_index;
+}
+
+/// The latencies recorded in the throughput mode, the histogram of every thread.
+std::vector<latency_histogram> thread_latencies;
+
+/// Executes the case in the throughput mode, in one of the threads sharing the VM instance.
+///
+/// The thread is pinned to its CPU. The latencies of the executions of all the threads
+/// are reported as the percentiles "p50_ns" and "p99_ns" by the first thread,
+/// the gas rate is the aggregate of all the threads. Only the executions are timed.
+void execute_throughput(State& state, evmc::VM& instance, const bench_state* pre_state,
+    bytes_view code, bytes_view input) noexcept
+{
+    const auto thread_index = static_cast<size_t>(get_thread_index(state, 0));
+    pin_thread(thread_index);
+
+    const auto msg = make_message(input, pre_state);
+    std::optional<bench_host> host;
+    if (pre_state != nullptr)
+        host.emplace(instance, *pre_state);
+
+    auto& latencies = thread_latencies[thread_index];
+    latencies = {};
+    auto total_gas_used = int64_t{0};
+    auto iteration_gas_used = int64_t{0};
+    for (auto _ : state)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const auto r = host ? host->execute(msg, code) :
+                              instance.execute(EVMC_CONSTANTINOPLE, msg, code.data(), code.size());
+        const auto latency = std::chrono::steady_clock::now() - start;
+        state.SetIterationTime(std::chrono::duration<double>(latency).count());
+        latencies.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()));
+
+        iteration_gas_used = gas_limit - r.gas_left;
+        total_gas_used += iteration_gas_used;
+
+        if (host)
+            host->reset();
+    }
+    state.counters["gas_used"] =
+        Counter(static_cast<double>(iteration_gas_used), Counter::kAvgThreads);
+    state.counters["gas_rate"] = Counter(static_cast<double>(total_gas_used), Counter::kIsRate);
+
+    // All the threads have finished the loop, so their latencies are complete.
+    if (thread_index == 0)
+    {
+        latency_histogram all_latencies;
+        for (const auto& l : thread_latencies)
+            all_latencies.merge(l);
+        state.counters["p50_ns"] = Counter(static_cast<double>(all_latencies.percentile(0.5)));
+        state.counters["p99_ns"] = Counter(static_cast<double>(all_latencies.percentile(0.99)));
+    }
+}
+
+/// Executes the batch of the messages of the case in every iteration.
+///
+/// Only the batch execution is timed, the pre-states of the messages are restored
+/// between the iterations without pausing the timer.
+void execute_batch(State& state, evmc::VM& instance, const bench_state* pre_state,
+    bytes_view code, bytes_view input) noexcept
+{
+    const std::vector<evmc_message> msgs(batch_size, make_message(input, pre_state));
+    std::vector<evmone::batch_host> hosts(batch_size, evmone::batch_host{nullptr, nullptr});
+    std::vector<evmc_result> results(batch_size);
+
+    // Every message is executed with its own copy of the pre-state.
+    std::vector<bench_host> state_hosts;
+    if (pre_state != nullptr)
+    {
+        state_hosts.reserve(batch_size);
+        for (auto& h : hosts)
+        {
+            auto& state_host = state_hosts.emplace_back(instance, *pre_state);
+            h = {&bench_host::get_interface(), state_host.to_context()};
+        }
+    }
+
+    auto total_gas_used = int64_t{0};
+    auto iteration_gas_used = int64_t{0};
+    start_perf_counters();
+    for (auto _ : state)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        evmone::execute_batch(instance.get_raw_pointer(), EVMC_CONSTANTINOPLE, code.data(),
+            code.size(), msgs.data(), hosts.data(), results.data(), batch_size, batch_threads);
+        state.SetIterationTime(seconds_since(start));
+
+        for (auto& r : results)
+        {
+            iteration_gas_used = gas_limit - r.gas_left;
+            total_gas_used += iteration_gas_used;
+            if (r.release != nullptr)
+                r.release(&r);
+        }
+
+        if (!state_hosts.empty())
+        {
+            if (hw_counters)
+                hw_counters->pause();
+            for (auto& h : state_hosts)
+                h.reset();
+            if (hw_counters)
+                hw_counters->resume();
+        }
+    }
+    report_perf_counters(state);
+    const auto num_msgs = state.iterations() * batch_size;
     state.counters["gas_used"] = Counter(static_cast<double>(iteration_gas_used));
     state.counters["gas_rate"] = Counter(static_cast<double>(total_gas_used), Counter::kIsRate);
+    state.counters["msg_rate"] = Counter(static_cast<double>(num_msgs), Counter::kIsRate);
 }
 
 void analyse(State& state, bytes_view code) noexcept
@@ -74,10 +331,25 @@ struct benchmark_case
     bytes input;
     bytes expected_output;
 
+    /// The pre-state of the case executed with the host, null for the cases without the host.
+    std::shared_ptr<const bench_state> pre_state;
+
+    /// The VM executing the case.
+    evmc::VM* instance = &vm;
+
+    evmc::result execute_once() const noexcept
+    {
+        if (!pre_state)
+            return execute(*instance, *code, input);
+
+        bench_host host{*instance, *pre_state};
+        return host.execute(make_message(input, pre_state.get()), *code);
+    }
+
     void operator()(State& state) noexcept
     {
         {
-            auto r = execute(*code, input);
+            auto r = execute_once();
             if (r.status_code != EVMC_SUCCESS)
             {
                 state.SkipWithError(("failure: " + std::to_string(r.status_code)).c_str());
@@ -96,11 +368,54 @@ struct benchmark_case
             }
         }
 
-        execute(state, *code, input);
+        if (num_threads != 0)
+            execute_throughput(state, *instance, pre_state.get(), *code, input);
+        else if (batch_size != 0)
+            execute_batch(state, *instance, pre_state.get(), *code, input);
+        else if (pre_state)
+            execute_with_host(state, *instance, *pre_state, *code, input);
+        else
+            execute(state, *instance, *code, input);
     }
 };
 
 
+void register_benchmark_case(const std::string& name, const benchmark_case& b)
+{
+    const auto register_case = [](const std::string& case_name, const benchmark_case& c) {
+        auto bench = RegisterBenchmark(case_name.c_str(), c)->Unit(kMicrosecond);
+
+        if (num_threads != 0)
+        {
+            // The counters of the threads are summed, the rates are the aggregate throughput.
+            // Only the executions are timed, restoring the pre-state is not.
+            bench->Threads(static_cast<int>(num_threads))->UseManualTime();
+        }
+        else if (batch_size != 0 || c.pre_state)
+        {
+            // Only the executions are timed, by the wall clock because the batch may be executed
+            // by multiple threads. Restoring the pre-state between the iterations is not timed.
+            bench->UseManualTime();
+        }
+    };
+
+    register_case(name, b);
+
+    if (jit_vm)
+    {
+        auto jit = b;
+        jit.instance = &jit_vm;
+        register_case(name + "/jit", jit);
+    }
+
+    if (threaded_vm)
+    {
+        auto threaded = b;
+        threaded.instance = &threaded_vm;
+        register_case(name + "/threaded", threaded);
+    }
+}
+
 void load_benchmark(const fs::path& path, const std::string& name_prefix)
 {
     const auto base_name = name_prefix + path.stem().string();
@@ -128,11 +443,19 @@ void load_benchmark(const fs::path& path, const std::string& name_prefix)
     auto base = benchmark_case{};
     base.code = std::move(code);
 
+    auto state_path = path;
+    state_path.replace_extension(state_extension);
+    if (fs::exists(state_path))
+    {
+        std::ifstream state_file{state_path};
+        base.pre_state = std::make_shared<const bench_state>(load_state(state_file));
+    }
+
     auto inputs_path = path;
     inputs_path.replace_extension(inputs_extension);
     if (!fs::exists(inputs_path))
     {
-        RegisterBenchmark(base_name.c_str(), base)->Unit(kMicrosecond);
+        register_benchmark_case(base_name, base);
     }
     else
     {
@@ -159,7 +482,7 @@ void load_benchmark(const fs::path& path, const std::string& name_prefix)
 
             case state::expected_output:
                 input.expected_output = from_hexx(l);
-                RegisterBenchmark(name.c_str(), input)->Unit(kMicrosecond);
+                register_benchmark_case(name, input);
                 st = state::name;
                 break;
             }
@@ -176,7 +499,8 @@ void load_benchmarks_from_dir(const fs::path& path, const std::string& name_pref
     {
         if (e.is_directory())
             subdirs.emplace_back(e);
-        else if (e.path().extension() != inputs_extension)
+        else if (e.path().extension() != inputs_extension &&
+                 e.path().extension() != state_extension)
             files.emplace_back(e);
     }
 
@@ -195,6 +519,102 @@ void load_benchmarks_from_dir(const fs::path& path, const std::string& name_pref
 constexpr auto cli_parsing_error = -3;
 
 
+/// Parses and removes the evmone-bench options from CLI arguments.
+///
+/// --batch_size=N     Executes N messages with evmone::execute_batch() in every iteration
+///                    and reports the messages per second as "msg_rate".
+/// --batch_threads=N  The number of threads executing the batch (default 1).
+/// --threads=N        The throughput mode: every case is executed concurrently by N threads
+///                    pinned to CPUs, sharing the VM instance. Reports the aggregate
+///                    "gas_rate" and the latency percentiles "p50_ns" and "p99_ns".
+/// --perf_counters    Collects the hardware counters (Linux perf events) of the execution
+///                    loops of the threads running the benchmarks: "instructions", "cycles",
+///                    "branch_misses", "l1d_misses", "llc_misses" per iteration and "ipc".
+///                    Not collected in the throughput mode and with multiple batch threads.
+/// --json_out=PATH    Writes the results to the file in the JSON schema of json_reporter,
+///                    independent of the benchmark library version. Compare the results
+///                    of two runs with compare.py.
+///
+/// Returns false if the option value is invalid.
+bool parse_options(int& argc, char** argv)
+{
+    static constexpr auto json_out_option = "--json_out=";
+
+    int out = 1;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+
+        if (arg == "--perf_counters")
+        {
+            hw_counters = perf_counters::open();
+            if (!hw_counters)
+                std::cerr << "perf counters are not available, not collected\n";
+            continue;
+        }
+
+        if (arg.compare(0, std::strlen(json_out_option), json_out_option) == 0)
+        {
+            json_out = arg.substr(std::strlen(json_out_option));
+            if (json_out.empty())
+            {
+                std::cerr << "invalid option value: " << arg << "\n";
+                return false;
+            }
+            continue;
+        }
+
+        size_t* value = nullptr;
+        std::string value_str;
+        for (const auto& [name, var] :
+            {std::pair{"--batch_size=", &batch_size}, std::pair{"--batch_threads=", &batch_threads},
+                std::pair{"--threads=", &num_threads}})
+        {
+            if (arg.compare(0, std::strlen(name), name) == 0)
+            {
+                value = var;
+                value_str = arg.substr(std::strlen(name));
+            }
+        }
+
+        if (value == nullptr)
+        {
+            argv[out++] = argv[i];
+            continue;
+        }
+
+        if (value_str.empty() ||
+            value_str.find_first_not_of("0123456789") != std::string::npos)
+        {
+            std::cerr << "invalid option value: " << arg << "\n";
+            return false;
+        }
+        *value = std::stoul(value_str);
+    }
+    argc = out;
+
+    if (num_threads != 0 && batch_size != 0)
+    {
+        std::cerr << "The throughput mode and the batch mode cannot be combined\n";
+        return false;
+    }
+
+    thread_latencies.resize(num_threads);
+
+    // The counters are of the calling thread only.
+    if (num_threads != 0 && hw_counters)
+    {
+        std::cerr << "perf counters are not collected in the throughput mode\n";
+        hw_counters.reset();
+    }
+    if (batch_size != 0 && batch_threads > 1 && hw_counters)
+    {
+        std::cerr << "perf counters are not collected with multiple batch threads\n";
+        hw_counters.reset();
+    }
+    return true;
+}
+
 /// Parses evmone-bench CLI arguments and registers benchmark cases.
 ///
 /// The following variants of number arguments are supported (including argv[0]):
@@ -237,6 +657,12 @@ int parseargs(int argc, char** argv)
 
     if (evmc_config)
     {
+        if (batch_size != 0)
+        {
+            std::cerr << "The batch mode is supported only by the built-in evmone\n";
+            return cli_parsing_error;
+        }
+
         auto ec = evmc_loader_error_code{};
         vm = evmc::VM{evmc_load_and_configure(evmc_config, &ec)};
 
@@ -255,6 +681,20 @@ int parseargs(int argc, char** argv)
     {
         vm = evmc::VM{evmc_create_evmone()};
         std::cout << "Benchmarking evmone\n\n";
+
+        // The JIT variants compare the compiled code with the interpreter.
+        if (evmone::is_jit_available())
+        {
+            jit_vm = evmc::VM{evmc_create_evmone()};
+            jit_vm.set_option("jit", "0");
+        }
+
+        // The threaded-code interpreter variants compare it with the default dispatch.
+        if (evmone::get_threaded_dispatch_table() != nullptr)
+        {
+            threaded_vm = evmc::VM{evmc_create_evmone()};
+            threaded_vm.set_option("dispatch", "threaded");
+        }
     }
 
     if (benchmarks_dir)
@@ -274,7 +714,7 @@ int parseargs(int argc, char** argv)
         b.code = std::make_shared<bytes>(from_hex(code_hex));
         b.input = from_hex(input_hex);
         b.expected_output = from_hex(expected_output_hex);
-        RegisterBenchmark(code_hex_file, b)->Unit(kMicrosecond);
+        register_benchmark_case(code_hex_file, b);
     }
     return 0;
 }
@@ -286,6 +726,9 @@ int main(int argc, char** argv)
     {
         Initialize(&argc, argv);
 
+        if (!parse_options(argc, argv))
+            return cli_parsing_error;
+
         const auto ec = parseargs(argc, argv);
 
         if (ec == cli_parsing_error && ReportUnrecognizedArguments(argc, argv))
@@ -294,7 +737,19 @@ int main(int argc, char** argv)
         if (ec != 0)
             return ec;
 
-        RunSpecifiedBenchmarks();
+        if (json_out.empty())
+        {
+            RunSpecifiedBenchmarks();
+            return 0;
+        }
+
+        json_reporter reporter;
+        RunSpecifiedBenchmarks(&reporter);
+        if (!reporter.write(json_out, std::string{vm.name()} + ' ' + vm.version()))
+        {
+            std::cerr << "cannot write " << json_out << "\n";
+            return -1;
+        }
         return 0;
     }
     catch (const std::exception& ex)
@@ -0,0 +1,113 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "bench_host.hpp"
+#include <cstring>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+/// Decodes the big-endian number of the hex value into the N bytes.
+template <size_t N>
+void load_hex(uint8_t (&out)[N], const std::string& hex_value)
+{
+    if (hex_value.empty())
+        throw std::invalid_argument{"missing value"};
+
+    const auto value = from_hex(hex_value.size() % 2 == 0 ? hex_value : '0' + hex_value);
+    if (value.size() > N)
+        throw std::invalid_argument{"value too long: " + hex_value};
+    std::memset(out, 0, N);
+    std::memcpy(&out[N - value.size()], value.data(), value.size());
+}
+
+template <typename T>
+T load_hex(const std::string& hex_value)
+{
+    T v;
+    load_hex(v.bytes, hex_value);
+    return v;
+}
+}  // namespace
+
+bench_state load_state(std::istream& in)
+{
+    bench_state state;
+    evmc::MockedAccount* account = nullptr;
+
+    for (std::string l; std::getline(in, l);)
+    {
+        std::istringstream line{l};
+        std::string key;
+        if (!(line >> key) || key[0] == '#')
+            continue;
+
+        std::string arg1;
+        std::string arg2;
+        line >> arg1 >> arg2;
+
+        if (key == "destination")
+            state.destination = load_hex<evmc::address>(arg1);
+        else if (key == "sender")
+            state.sender = load_hex<evmc::address>(arg1);
+        else if (key == "account")
+            account = &state.accounts[load_hex<evmc::address>(arg1)];
+        else if (account == nullptr)
+            throw std::invalid_argument{"no account for: " + l};
+        else if (key == "balance")
+            account->balance = load_hex<evmc::uint256be>(arg1);
+        else if (key == "code")
+            account->code = from_hex(arg1);
+        else if (key == "storage")
+            account->storage[load_hex<evmc::bytes32>(arg1)].value = load_hex<evmc::bytes32>(arg2);
+        else
+            throw std::invalid_argument{"unknown line: " + l};
+    }
+    return state;
+}
+
+bench_host::bench_host(evmc::VM& vm, const bench_state& pre_state) noexcept
+  : m_vm{vm}, m_pre_state{pre_state}
+{
+    accounts = m_pre_state.accounts;
+}
+
+void bench_host::reset()
+{
+    accounts = m_pre_state.accounts;
+    recorded_account_accesses.clear();
+    recorded_calls.clear();
+    recorded_logs.clear();
+    recorded_selfdestructs.clear();
+    recorded_blockhashes.clear();
+    num_calls = 0;
+}
+
+evmc::result bench_host::execute(const evmc_message& msg, bytes_view code) noexcept
+{
+    m_contexts.assign(1, msg.destination);
+    return m_vm.execute(*this, rev, msg, code.data(), code.size());
+}
+
+evmc::result bench_host::call(const evmc_message& msg) noexcept
+{
+    ++num_calls;
+    const auto it = accounts.find(msg.destination);
+    if (it == accounts.end() || it->second.code.empty())
+        return evmc::result{EVMC_SUCCESS, msg.gas, nullptr, 0};
+
+    // The message destination is the code address, the storage is of the caller frame.
+    auto callee_msg = msg;
+    if (msg.kind == EVMC_DELEGATECALL || msg.kind == EVMC_CALLCODE)
+        callee_msg.destination = m_contexts.back();
+
+    // The reference stays valid when the callee adds the accounts.
+    const auto& code = it->second.code;
+    m_contexts.push_back(callee_msg.destination);
+    auto result = m_vm.execute(*this, rev, callee_msg, code.data(), code.size());
+    m_contexts.pop_back();
+    return result;
+}
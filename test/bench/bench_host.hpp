@@ -0,0 +1,69 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include <evmc/mocked_host.hpp>
+#include <test/utils/utils.hpp>
+#include <iosfwd>
+#include <unordered_map>
+#include <vector>
+
+/// The pre-state of the benchmark case executed with the host.
+///
+/// Loaded from the .state file next to the .evm file of the case. The file is the list of lines
+/// `<key> <hex values...>`, the empty lines and the lines starting with `#` are ignored:
+///
+///     destination <address>      The address of the executed code, the top-level message
+///                                destination. Its code is the code of the .evm file.
+///     sender <address>           The top-level message sender.
+///     account <address>          Begins the account, the following lines define its state:
+///     balance <value>
+///     code <hex>
+///     storage <key> <value>
+///
+/// The values and the keys are big-endian numbers up to 32 bytes, the addresses have 20 bytes.
+struct bench_state
+{
+    evmc::address destination;
+    evmc::address sender;
+    std::unordered_map<evmc::address, evmc::MockedAccount> accounts;
+};
+
+/// Loads the state file.
+///
+/// Exceptions:
+/// - std::invalid_argument when the line is invalid.
+/// - the from_hex() exceptions when the hex value is invalid.
+bench_state load_state(std::istream& in);
+
+/// The host executing the calls of the benchmark case with the VM.
+///
+/// The called accounts have the code executed, the calls to the accounts without code succeed
+/// with all gas left. The DELEGATECALL and CALLCODE callees are executed in the storage context
+/// of the caller. The failed calls do not revert the state, the benchmark cases are expected
+/// to succeed.
+class bench_host : public evmc::MockedHost
+{
+    evmc::VM& m_vm;
+    const bench_state& m_pre_state;
+
+    /// The storage contexts of the executing frames.
+    std::vector<evmc::address> m_contexts;
+
+public:
+    static constexpr auto rev = EVMC_CONSTANTINOPLE;
+
+    /// The number of calls executed since the last reset().
+    size_t num_calls = 0;
+
+    bench_host(evmc::VM& vm, const bench_state& pre_state) noexcept;
+
+    /// Restores the pre-state and clears the recorded host accesses.
+    void reset();
+
+    /// Executes the top-level message with the code of the case.
+    evmc::result execute(const evmc_message& msg, bytes_view code) noexcept;
+
+    evmc::result call(const evmc_message& msg) noexcept override;
+};
@@ -0,0 +1,159 @@
+#!/usr/bin/python3
+
+# Compares two evmone-bench runs written with --json_out and reports the regressions.
+#
+# The runs should have multiple repetitions of every benchmark (--benchmark_repetitions=N).
+# The metric (real_time_ns by default, or a counter, e.g. instructions) of the repetitions
+# of the same benchmark are compared with the two-sided Mann-Whitney U test.
+# The benchmark has regressed if the median has increased by more than the threshold
+# and the difference is significant (the p-value below alpha). For the rate counters
+# (e.g. gas_rate) the higher values are better, use --higher-is-better.
+#
+# Exits with 1 if any benchmark has regressed, with 2 on invalid input.
+#
+# Usage: compare.py [--metric M] [--threshold PERCENT] [--alpha A] BASELINE CONTENDER
+
+import argparse
+import collections
+import json
+import math
+import statistics
+import sys
+
+SCHEMA_VERSION = 1
+
+
+def load(path):
+    with open(path) as f:
+        results = json.load(f)
+    if results.get("schema_version") != SCHEMA_VERSION:
+        raise ValueError("{}: unsupported schema version".format(path))
+    return results
+
+
+def samples(results, metric):
+    """Returns the metric values of the repetitions of every successful benchmark."""
+    values = collections.OrderedDict()
+    for b in results["benchmarks"]:
+        if "error" in b:
+            continue
+        value = b[metric] if metric in b else b["counters"].get(metric)
+        if value is not None:
+            values.setdefault(b["name"], []).append(value)
+    return values
+
+
+def exact_u_distribution(n1, n2):
+    """Returns the numbers of the rank arrangements for every U value (no ties)."""
+    # counts[i][j][u]: the number of arrangements of i and j samples with the statistic u.
+    counts = [[None] * (n2 + 1) for _ in range(n1 + 1)]
+    for i in range(n1 + 1):
+        for j in range(n2 + 1):
+            if i == 0 or j == 0:
+                counts[i][j] = [1]
+                continue
+            size = i * j + 1
+            c = [0] * size
+            # The largest of the samples is in the first group (adds j to U) or in the second.
+            for u, n in enumerate(counts[i - 1][j]):
+                c[u + j] += n
+            for u, n in enumerate(counts[i][j - 1]):
+                c[u] += n
+            counts[i][j] = c
+    return counts[n1][n2]
+
+
+def mann_whitney(xs, ys):
+    """Returns the two-sided p-value of the Mann-Whitney U test."""
+    n1, n2 = len(xs), len(ys)
+    if n1 == 0 or n2 == 0:
+        return 1.0
+
+    ranked = sorted([(v, 0) for v in xs] + [(v, 1) for v in ys])
+    ranks = [0.0] * len(ranked)
+    ties = []
+    i = 0
+    while i < len(ranked):
+        j = i
+        while j + 1 < len(ranked) and ranked[j + 1][0] == ranked[i][0]:
+            j += 1
+        for k in range(i, j + 1):
+            ranks[k] = (i + j) / 2 + 1
+        ties.append(j - i + 1)
+        i = j + 1
+
+    r1 = sum(r for r, (_, group) in zip(ranks, ranked) if group == 0)
+    u1 = r1 - n1 * (n1 + 1) / 2
+    u = min(u1, n1 * n2 - u1)
+
+    # The exact distribution for the small samples without ties.
+    if all(t == 1 for t in ties) and n1 * n2 <= 400:
+        dist = exact_u_distribution(n1, n2)
+        p = 2 * sum(dist[:int(u) + 1]) / sum(dist)
+        return min(p, 1.0)
+
+    # The normal approximation with the tie correction and the continuity correction.
+    n = n1 + n2
+    tie_term = sum(t ** 3 - t for t in ties) / (n * (n - 1))
+    sigma = math.sqrt(n1 * n2 / 12 * ((n + 1) - tie_term))
+    if sigma == 0:
+        return 1.0
+    z = (abs(u - n1 * n2 / 2) - 0.5) / sigma
+    return min(math.erfc(max(z, 0) / math.sqrt(2)), 1.0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compares two evmone-bench JSON results.")
+    parser.add_argument("baseline")
+    parser.add_argument("contender")
+    parser.add_argument("--metric", default="real_time_ns",
+                        help="real_time_ns, cpu_time_ns or the counter name")
+    parser.add_argument("--higher-is-better", action="store_true",
+                        help="the higher metric values are better (the rates)")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="the regression threshold in percent of the median (default 5)")
+    parser.add_argument("--alpha", type=float, default=0.05,
+                        help="the significance level (default 0.05)")
+    args = parser.parse_args()
+
+    try:
+        base = samples(load(args.baseline), args.metric)
+        cont = samples(load(args.contender), args.metric)
+    except (OSError, ValueError, KeyError) as e:
+        print(e, file=sys.stderr)
+        return 2
+
+    regressions = 0
+    name_width = max([len(n) for n in base] + [9])
+    print("{:{w}}  {:>14} {:>14} {:>8} {:>7}".format(
+        "benchmark", "baseline", "contender", "change", "p", w=name_width))
+    for name, xs in base.items():
+        ys = cont.get(name)
+        if ys is None:
+            continue
+        bx, by = statistics.median(xs), statistics.median(ys)
+        change = (by - bx) / bx * 100 if bx != 0 else 0.0
+        p = mann_whitney(xs, ys)
+        worse = -change if args.higher_is_better else change
+        status = ""
+        if worse > args.threshold and p < args.alpha:
+            status = "REGRESSION"
+            regressions += 1
+        elif -worse > args.threshold and p < args.alpha:
+            status = "improvement"
+        print("{:{w}}  {:14.6g} {:14.6g} {:+7.2f}% {:7.4f} {}".format(
+            name, bx, by, change, p, status, w=name_width).rstrip())
+
+        if min(len(xs), len(ys)) < 3:
+            print("  too few repetitions for the significance", file=sys.stderr)
+
+    missing = [n for n in base if n not in cont]
+    if missing:
+        print("not in the contender: " + ", ".join(missing), file=sys.stderr)
+
+    print("{} regression(s)".format(regressions))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
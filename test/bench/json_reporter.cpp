@@ -0,0 +1,116 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "json_reporter.hpp"
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+
+namespace
+{
+void write_string(std::ostream& out, const std::string& s)
+{
+    out << '"';
+    for (const auto c : s)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int{c} << std::dec
+                << std::setfill(' ');
+        }
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+/// Writes the number, the NaN and infinities (not allowed in JSON) as null.
+void write_number(std::ostream& out, double x)
+{
+    if (std::isfinite(x))
+        out << x;
+    else
+        out << "null";
+}
+}  // namespace
+
+bool json_reporter::ReportContext(const Context& context)
+{
+    m_num_cpus = context.cpu_info.num_cpus;
+    m_mhz_per_cpu = context.cpu_info.cycles_per_second / 1e6;
+    return ConsoleReporter::ReportContext(context);
+}
+
+void json_reporter::ReportRuns(const std::vector<Run>& reports)
+{
+    for (const auto& run : reports)
+    {
+        if (run.run_type == Run::RT_Aggregate)
+            continue;
+
+        auto e = entry{};
+        e.name = run.benchmark_name();
+        e.repetition = 0;
+        for (auto it = m_entries.rbegin(); it != m_entries.rend(); ++it)
+        {
+            if (it->name == e.name)
+            {
+                e.repetition = it->repetition + 1;
+                break;
+            }
+        }
+        e.iterations = static_cast<int64_t>(run.iterations);
+        const auto to_ns = 1e9 / benchmark::GetTimeUnitMultiplier(run.time_unit);
+        e.real_time_ns = run.GetAdjustedRealTime() * to_ns;
+        e.cpu_time_ns = run.GetAdjustedCPUTime() * to_ns;
+        for (const auto& [name, counter] : run.counters)
+            e.counters.emplace_back(name, counter.value);
+        if (run.error_occurred)
+            e.error = run.error_message.empty() ? "error" : run.error_message;
+        m_entries.emplace_back(std::move(e));
+    }
+    ConsoleReporter::ReportRuns(reports);
+}
+
+bool json_reporter::write(const std::string& path, const std::string& vm_name) const
+{
+    std::ofstream out{path};
+    out << std::setprecision(17);
+    out << "{\n  \"schema_version\": 1,\n  \"context\": {\"vm\": ";
+    write_string(out, vm_name);
+    out << ", \"num_cpus\": " << m_num_cpus
+        << ", \"mhz_per_cpu\": " << static_cast<int64_t>(m_mhz_per_cpu) << "},\n";
+    out << "  \"benchmarks\": [";
+
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        const auto& e = m_entries[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"name\": ";
+        write_string(out, e.name);
+        out << ", \"repetition\": " << e.repetition << ", \"iterations\": " << e.iterations
+            << ", \"real_time_ns\": ";
+        write_number(out, e.real_time_ns);
+        out << ", \"cpu_time_ns\": ";
+        write_number(out, e.cpu_time_ns);
+        out << ", \"counters\": {";
+        for (size_t j = 0; j < e.counters.size(); ++j)
+        {
+            out << (j == 0 ? "" : ", ");
+            write_string(out, e.counters[j].first);
+            out << ": ";
+            write_number(out, e.counters[j].second);
+        }
+        out << '}';
+        if (!e.error.empty())
+        {
+            out << ", \"error\": ";
+            write_string(out, e.error);
+        }
+        out << '}';
+    }
+    out << "\n  ]\n}\n";
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,58 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+/// The console reporter also collecting the benchmark runs to be written as JSON.
+///
+/// The JSON does not depend on the version of the benchmark library, so the results of
+/// different evmone-bench builds can be compared (see compare.py). The schema version 1:
+///
+///     {
+///       "schema_version": 1,
+///       "context": {"vm": <name and version>, "num_cpus": <int>, "mhz_per_cpu": <int>},
+///       "benchmarks": [
+///         {
+///           "name": <string>,
+///           "repetition": <int, the index of the run of the same name>,
+///           "iterations": <int>,
+///           "real_time_ns": <number, per iteration>,
+///           "cpu_time_ns": <number, per iteration>,
+///           "counters": {<name>: <number>, ...},
+///           "error": <string, only for the failed benchmarks>
+///         }, ...
+///       ]
+///     }
+///
+/// The aggregates of the repetitions (mean, median, stddev) are not written,
+/// they are computed by the consumer from all the runs.
+class json_reporter : public benchmark::ConsoleReporter
+{
+public:
+    bool ReportContext(const Context& context) override;
+
+    void ReportRuns(const std::vector<Run>& reports) override;
+
+    /// Writes the collected runs to the file. Returns false if the file cannot be written.
+    bool write(const std::string& path, const std::string& vm_name) const;
+
+private:
+    struct entry
+    {
+        std::string name;
+        int repetition;
+        int64_t iterations;
+        double real_time_ns;
+        double cpu_time_ns;
+        std::vector<std::pair<std::string, double>> counters;
+        std::string error;
+    };
+
+    int m_num_cpus = 0;
+    double m_mhz_per_cpu = 0;
+    std::vector<entry> m_entries;
+};
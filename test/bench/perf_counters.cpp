@@ -0,0 +1,143 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "perf_counters.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#include <utility>
+
+namespace
+{
+/// The format of reading all the events of the group from the group leader.
+constexpr uint64_t read_format =
+    PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+/// Opens the event in the group of the leader, or as the disabled group leader if it is -1.
+int open_event(uint32_t type, uint64_t config, int group_fd) noexcept
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = read_format;
+    if (group_fd < 0)
+        attr.disabled = 1;  // The leader enables and disables the whole group.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+constexpr uint64_t cache_event(uint64_t cache) noexcept
+{
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+}  // namespace
+
+std::unique_ptr<perf_counters> perf_counters::open() noexcept
+{
+    static constexpr std::pair<uint32_t, uint64_t> events[num_events] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_L1D)},
+        {PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_LL)},
+    };
+
+    // The first supported event is the group leader.
+    std::unique_ptr<perf_counters> counters{new perf_counters};
+    for (size_t i = 0; i < num_events; ++i)
+    {
+        const auto [type, config] = events[i];
+        counters->m_fds[i] = open_event(type, config, counters->m_leader_fd);
+        if (counters->m_leader_fd < 0)
+            counters->m_leader_fd = counters->m_fds[i];
+    }
+    if (counters->m_leader_fd < 0)
+        return nullptr;
+    return counters;
+}
+
+perf_counters::~perf_counters()
+{
+    for (const auto fd : m_fds)
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+void perf_counters::start() noexcept
+{
+    ioctl(m_leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(m_leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void perf_counters::pause() noexcept
+{
+    ioctl(m_leader_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void perf_counters::resume() noexcept
+{
+    ioctl(m_leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+perf_counters::values perf_counters::read() const noexcept
+{
+    values v;
+    v.fill(-1);
+
+    // The group read: the number of events, the times enabled and running,
+    // then the counts in the order the events were opened.
+    uint64_t data[3 + num_events]{};
+    const auto size = ::read(m_leader_fd, data, sizeof(data));
+    if (size < static_cast<ssize_t>(3 * sizeof(uint64_t)))
+        return v;
+
+    const auto num_read = data[0];
+    const auto time_enabled = data[1];
+    const auto time_running = data[2];
+    if (time_running == 0)  // The group has not been scheduled to the PMU.
+        return v;
+
+    // The counts are scaled if the group was multiplexed with other events.
+    const auto scale = static_cast<double>(time_enabled) / static_cast<double>(time_running);
+    size_t n = 0;
+    for (size_t i = 0; i < num_events && n < num_read; ++i)
+    {
+        if (m_fds[i] >= 0)
+            v[i] = static_cast<int64_t>(static_cast<double>(data[3 + n++]) * scale);
+    }
+    return v;
+}
+
+#else
+
+std::unique_ptr<perf_counters> perf_counters::open() noexcept
+{
+    return nullptr;
+}
+
+perf_counters::~perf_counters() = default;
+
+void perf_counters::start() noexcept {}
+
+void perf_counters::pause() noexcept {}
+
+void perf_counters::resume() noexcept {}
+
+perf_counters::values perf_counters::read() const noexcept
+{
+    values v;
+    v.fill(-1);
+    return v;
+}
+
+#endif
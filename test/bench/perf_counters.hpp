@@ -0,0 +1,65 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+/// The hardware performance counters of the calling thread (the Linux perf events).
+///
+/// The kernel and hypervisor events are excluded, so the counters are available
+/// with the default perf_event_paranoid setting. The events are counted as a single group,
+/// so they cover the same periods of the execution, and the counts are scaled
+/// if the group was multiplexed with other events. The other threads (e.g. the batch
+/// execution threads) are not counted.
+class perf_counters
+{
+public:
+    enum event
+    {
+        instructions,
+        cycles,
+        branch_misses,
+        l1d_misses,
+        llc_misses,
+        num_events
+    };
+
+    /// The names of the events, used as the benchmark counter names.
+    static constexpr const char* names[num_events] = {
+        "instructions", "cycles", "branch_misses", "l1d_misses", "llc_misses"};
+
+    /// The counter values, the unsupported events have the value -1.
+    using values = std::array<int64_t, num_events>;
+
+    /// Opens the counters. Returns null if none of the events is supported,
+    /// e.g. not on Linux or the perf events are disabled in the kernel.
+    static std::unique_ptr<perf_counters> open() noexcept;
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+    ~perf_counters();
+
+    /// Resets the counters to zero and starts counting.
+    void start() noexcept;
+
+    /// Pauses counting, the counters keep the values.
+    void pause() noexcept;
+
+    /// Resumes the paused counting.
+    void resume() noexcept;
+
+    /// Reads the current values.
+    values read() const noexcept;
+
+private:
+    perf_counters() noexcept = default;
+
+    /// The perf event file descriptors, -1 for the unsupported events.
+    std::array<int, num_events> m_fds{};
+
+    /// The file descriptor of the group leader, the first supported event.
+    int m_leader_fd = -1;
+};
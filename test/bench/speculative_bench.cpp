@@ -0,0 +1,168 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+/// @file
+/// Benchmarks of the optimistic parallel execution of the block.
+///
+/// The block contains the transactions calling the same contract, each doing some hashing
+/// and incrementing the storage counter selected by the call data. The given percentage
+/// of the transactions increments the shared counter, so they conflict with each other,
+/// the others have their own counters. Compare "txs" (the rate of executed transactions)
+/// across thread counts to see the scaling, "reexecutions" is the number of the additional
+/// executions per transaction.
+
+#include <benchmark/benchmark.h>
+#include <evmc/evmc.hpp>
+#include <evmone/evmone.h>
+#include <evmone/speculative.hpp>
+#include <test/utils/bytecode.hpp>
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace benchmark;
+
+namespace
+{
+constexpr size_t block_size = 256;
+
+const auto contract = [] {
+    evmc::address addr;
+    addr.bytes[19] = 0x0c;
+    return addr;
+}();
+
+/// The code hashing in the loop of 64 iterations, then incrementing the counter
+/// at the key from the call data.
+const auto contract_code = push(64) + OP_JUMPDEST + sha3(0, 32) + push(0) + OP_MSTORE + push(1) +
+                           OP_SWAP1 + OP_SUB + OP_DUP1 + push(2) + OP_JUMPI + OP_POP +
+                           sstore(calldataload(0), add(sload(calldataload(0)), 1));
+
+/// The host with the state of the single contract, allowing the concurrent reads.
+class block_state_host : public evmc::Host
+{
+    std::unordered_map<evmc::bytes32, evmc::bytes32> m_storage;
+
+public:
+    bool account_exists(const evmc::address& addr) const noexcept override
+    {
+        return addr == contract;
+    }
+
+    evmc::bytes32 get_storage(
+        const evmc::address& /*addr*/, const evmc::bytes32& key) const noexcept override
+    {
+        const auto it = m_storage.find(key);
+        return it != m_storage.end() ? it->second : evmc::bytes32{};
+    }
+
+    evmc_storage_status set_storage(const evmc::address& /*addr*/, const evmc::bytes32& key,
+        const evmc::bytes32& value) noexcept override
+    {
+        m_storage[key] = value;
+        return EVMC_STORAGE_MODIFIED;
+    }
+
+    evmc::uint256be get_balance(const evmc::address& /*addr*/) const noexcept override
+    {
+        return {};
+    }
+
+    size_t get_code_size(const evmc::address& addr) const noexcept override
+    {
+        return addr == contract ? contract_code.size() : 0;
+    }
+
+    evmc::bytes32 get_code_hash(const evmc::address& /*addr*/) const noexcept override
+    {
+        return {};
+    }
+
+    size_t copy_code(const evmc::address& addr, size_t code_offset, uint8_t* buffer_data,
+        size_t buffer_size) const noexcept override
+    {
+        if (!(addr == contract) || code_offset >= contract_code.size())
+            return 0;
+        const auto n = std::min(buffer_size, contract_code.size() - code_offset);
+        std::copy_n(&contract_code[code_offset], n, buffer_data);
+        return n;
+    }
+
+    void selfdestruct(
+        const evmc::address& /*addr*/, const evmc::address& /*beneficiary*/) noexcept override
+    {}
+
+    evmc::result call(const evmc_message& msg) noexcept override
+    {
+        return evmc::result{EVMC_REVERT, msg.gas, nullptr, 0};
+    }
+
+    evmc_tx_context get_tx_context() const noexcept override { return {}; }
+
+    evmc::bytes32 get_block_hash(int64_t /*block_number*/) const noexcept override { return {}; }
+
+    void emit_log(const evmc::address& /*addr*/, const uint8_t* /*data*/, size_t /*data_size*/,
+        const evmc::bytes32* /*topics*/, size_t /*num_topics*/) noexcept override
+    {}
+};
+
+void parallel_block(State& state)
+{
+    const auto num_threads = static_cast<size_t>(state.range(0));
+    const auto conflict_percent = static_cast<size_t>(state.range(1));
+
+    // The conflicting transactions use the key 0 and are spread evenly over the block.
+    std::vector<evmc::bytes32> keys(block_size);
+    for (size_t i = 0; i < block_size; ++i)
+    {
+        if ((i + 1) * conflict_percent / 100 == i * conflict_percent / 100)
+        {
+            keys[i].bytes[0] = 1;
+            keys[i].bytes[30] = static_cast<uint8_t>(i >> 8);
+            keys[i].bytes[31] = static_cast<uint8_t>(i);
+        }
+    }
+
+    std::vector<evmc_message> msgs(block_size);
+    for (size_t i = 0; i < block_size; ++i)
+    {
+        msgs[i].gas = 1000000;
+        msgs[i].destination = contract;
+        msgs[i].input_data = keys[i].bytes;
+        msgs[i].input_size = sizeof(keys[i]);
+    }
+
+    static const auto vm = evmc::VM{evmc_create_evmone()};
+    block_state_host host;
+
+    size_t num_executions = 0;
+    for (auto _ : state)
+    {
+        const auto execution = evmone::execute_parallel(vm.get_raw_pointer(), EVMC_ISTANBUL,
+            host.get_interface(), host.to_context(), msgs.data(), msgs.size(), num_threads);
+        num_executions += execution.num_executions;
+        DoNotOptimize(execution.num_completed);
+    }
+
+    const auto num_txs = static_cast<double>(state.iterations() * block_size);
+    state.counters["txs"] = Counter(num_txs, Counter::kIsRate);
+    state.counters["reexecutions"] = (static_cast<double>(num_executions) - num_txs) / num_txs;
+}
+
+void parallel_block_args(internal::Benchmark* b)
+{
+    const auto max_threads = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+    for (const auto conflict_percent : {0, 10, 50, 100})
+    {
+        for (auto num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+            b->Args({num_threads, conflict_percent});
+    }
+}
+}  // namespace
+
+BENCHMARK(parallel_block)
+    ->Apply(parallel_block_args)
+    ->ArgNames({"threads", "conflict_percent"})
+    ->UseRealTime();
@@ -0,0 +1,112 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include "throughput.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+/// Returns the index of the most significant bit set, the value must not be 0.
+inline int msb_index(uint64_t x) noexcept
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return static_cast<int>(index);
+#else
+    return 63 - __builtin_clzll(x);
+#endif
+}
+}  // namespace
+
+void pin_thread(size_t index) noexcept
+{
+#ifdef __linux__
+    // The CPUs allowed before any thread is pinned, e.g. restricted with taskset.
+    static const auto allowed_cpus = [] {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            {
+                if (CPU_ISSET(cpu, &set))
+                    cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }();
+
+    if (allowed_cpus.empty())
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(allowed_cpus[index % allowed_cpus.size()], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)index;
+#endif
+}
+
+void latency_histogram::record(uint64_t ns) noexcept
+{
+    constexpr auto max_value = (uint64_t{1} << max_bits) - 1;
+    const auto v = std::min(ns, max_value);
+
+    size_t index = v;
+    if (v >= (uint64_t{1} << sub_bucket_bits))
+    {
+        const auto msb = msb_index(v);
+        const auto shift = msb - sub_bucket_bits;
+        index = (size_t(shift + 1) << sub_bucket_bits) +
+                size_t((v >> shift) - (uint64_t{1} << sub_bucket_bits));
+    }
+    ++m_counts[index];
+    ++m_total;
+}
+
+void latency_histogram::merge(const latency_histogram& other) noexcept
+{
+    for (size_t i = 0; i < num_buckets; ++i)
+        m_counts[i] += other.m_counts[i];
+    m_total += other.m_total;
+}
+
+uint64_t latency_histogram::percentile(double fraction) const noexcept
+{
+    if (m_total == 0)
+        return 0;
+
+    const auto rank = std::max(
+        uint64_t{1}, static_cast<uint64_t>(std::ceil(fraction * static_cast<double>(m_total))));
+    uint64_t count = 0;
+    size_t index = 0;
+    for (; index < num_buckets - 1; ++index)
+    {
+        count += m_counts[index];
+        if (count >= rank)
+            break;
+    }
+
+    constexpr auto sub_buckets = size_t{1} << sub_bucket_bits;
+    if (index < 2 * sub_buckets)
+        return index;
+
+    const auto shift = (index >> sub_bucket_bits) - 1;
+    const auto mantissa = uint64_t{(index & (sub_buckets - 1)) + sub_buckets};
+    return ((mantissa + 1) << shift) - 1;
+}
@@ -0,0 +1,38 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/// Pins the calling thread to the index-th CPU the process is allowed to run on
+/// (wrapping around if there are fewer CPUs). Does nothing if not supported (not on Linux).
+void pin_thread(size_t index) noexcept;
+
+/// The histogram of the execution latencies in nanoseconds.
+///
+/// The buckets are exact up to 2^sub_bucket_bits ns, then every power of two range
+/// is divided into 2^sub_bucket_bits buckets, so the percentiles have the relative error
+/// below 1/2^sub_bucket_bits (3%). Recording does not allocate.
+class latency_histogram
+{
+    static constexpr int sub_bucket_bits = 5;
+    static constexpr int max_bits = 48;
+    static constexpr size_t num_buckets = size_t{max_bits - sub_bucket_bits + 1}
+                                          << sub_bucket_bits;
+
+    std::array<uint64_t, num_buckets> m_counts{};
+    uint64_t m_total = 0;
+
+public:
+    void record(uint64_t ns) noexcept;
+
+    /// Adds the latencies recorded by the other histogram.
+    void merge(const latency_histogram& other) noexcept;
+
+    /// Returns the upper bound of the bucket of the latency below which the given fraction
+    /// (from 0 to 1) of the recorded latencies are. Returns 0 if nothing recorded.
+    uint64_t percentile(double fraction) const noexcept;
+};
@@ -0,0 +1,123 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+/// @file
+/// Benchmarks of the tracing overhead.
+///
+/// Each case executes the straight-line code repeating the sequence dominated by
+/// the given opcode, untraced and traced with the tracer streaming to the flush function
+/// discarding the records. Compare "steps" (the rate of executed EVM instructions)
+/// of the untraced and traced variants to get the per-opcode tracing overhead.
+
+#include <benchmark/benchmark.h>
+#include <evmc/evmc.hpp>
+#include <evmone/evmone.h>
+#include <evmone/tracing.hpp>
+#include <test/utils/bytecode.hpp>
+#include <vector>
+
+using namespace benchmark;
+
+namespace
+{
+constexpr auto repeats = 1000;
+
+struct tracing_case
+{
+    const char* name;
+    bytecode sequence;
+
+    /// The number of EVM instructions in the sequence.
+    int num_steps;
+};
+
+const std::vector<tracing_case>& get_cases()
+{
+    static const std::vector<tracing_case> cases{
+        {"ADD", push(1) + push(2) + OP_ADD + OP_POP, 4},
+        {"MUL", push(3) + push(5) + OP_MUL + OP_POP, 4},
+        {"MSTORE-MLOAD", push(1) + push(0) + OP_MSTORE + push(0) + OP_MLOAD + OP_POP, 6},
+        {"DUP-SWAP", bytecode{OP_DUP1} + OP_SWAP1 + OP_POP, 3},
+        {"PUSH32", push("0102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f20") +
+                       OP_POP,
+            2},
+        {"JUMP", bytecode{}, 3},
+    };
+    return cases;
+}
+
+bytes make_code(const tracing_case& c)
+{
+    bytes code = push(0);
+    for (auto i = 0; i < repeats; ++i)
+    {
+        if (c.sequence.empty())
+        {
+            // PUSH2 + JUMP to the following JUMPDEST.
+            const auto dest = code.size() + 4;
+            code += bytes{OP_PUSH2, static_cast<uint8_t>(dest >> 8), static_cast<uint8_t>(dest),
+                OP_JUMP, OP_JUMPDEST};
+        }
+        else
+            code += c.sequence;
+    }
+    return code + OP_STOP;
+}
+
+void discard(void*, const uint8_t*, size_t) noexcept {}
+
+void tracing_execute(State& state, bool traced)
+{
+    const auto& c = get_cases()[static_cast<size_t>(state.range(0))];
+    const auto code = make_code(c);
+    state.SetLabel(c.name);
+
+    auto vm = evmc::VM{evmc_create_evmone()};
+    std::vector<uint8_t> buffer(1 << 20);
+    evmone::tracer t{buffer.data(), buffer.size(), discard, nullptr};
+    if (traced)
+        evmone::set_tracer(vm.get_raw_pointer(), &t);
+
+    auto msg = evmc_message{};
+    msg.gas = 100000000;
+
+    {
+        // Check the code once.
+        const auto r = vm.execute(EVMC_ISTANBUL, msg, code.data(), code.size());
+        if (r.status_code != EVMC_SUCCESS)
+        {
+            state.SkipWithError("execution failed");
+            return;
+        }
+    }
+
+    for (auto _ : state)
+    {
+        auto r = vm.execute(EVMC_ISTANBUL, msg, code.data(), code.size());
+        DoNotOptimize(r.status_code);
+    }
+
+    state.counters["steps"] =
+        Counter(c.num_steps * repeats + 2, Counter::kIsIterationInvariantRate);
+}
+
+void tracing_untraced(State& state)
+{
+    tracing_execute(state, false);
+}
+
+void tracing_traced(State& state)
+{
+    tracing_execute(state, true);
+}
+
+void tracing_args(internal::Benchmark* b)
+{
+    for (size_t i = 0; i < get_cases().size(); ++i)
+        b->Arg(static_cast<int64_t>(i));
+}
+}  // namespace
+
+BENCHMARK(tracing_untraced)->Apply(tracing_args);
+BENCHMARK(tracing_traced)->Apply(tracing_args);
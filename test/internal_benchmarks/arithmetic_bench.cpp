@@ -0,0 +1,154 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+/// @file
+/// Benchmarks of the uint256 arithmetic split by the operand width.
+///
+/// Each arithmetic operation is benchmarked with the generic intx implementation and with
+/// the evmone::arith one having the 64-bit fast paths. The operands are random values
+/// of the given width (the argument in bits), so the cost of the fast path check
+/// is also visible for the wide operands.
+
+#include <benchmark/benchmark.h>
+#include <evmone/arithmetic.hpp>
+#include <random>
+#include <vector>
+
+using intx::uint256;
+
+namespace
+{
+constexpr size_t num_operands = 256;
+
+/// Generates the random values of the given width in bits, not zero.
+std::vector<uint256> make_operands(int width, uint64_t seed)
+{
+    std::mt19937_64 rng{seed};
+    std::vector<uint256> operands(num_operands);
+    for (auto& x : operands)
+    {
+        const auto w = intx::as_words(x);
+        for (int i = 0; i < width / 64; ++i)
+            w[i] = rng();
+        w[0] |= 1;
+    }
+    return operands;
+}
+
+template <uint256 Op(const uint256&, const uint256&) noexcept>
+void binop(benchmark::State& state)
+{
+    const auto width = static_cast<int>(state.range(0));
+    const auto a = make_operands(width, 1);
+    const auto b = make_operands(width, 2);
+
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(Op(a[i], b[i]));
+        i = (i + 1) % num_operands;
+    }
+}
+
+template <uint256 Op(const uint256&, const uint256&, const uint256&) noexcept>
+void ternop(benchmark::State& state)
+{
+    const auto width = static_cast<int>(state.range(0));
+    const auto a = make_operands(width, 1);
+    const auto b = make_operands(width, 2);
+    const auto m = make_operands(width, 3);
+
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(Op(a[i], b[i], m[i]));
+        i = (i + 1) % num_operands;
+    }
+}
+
+void exp(benchmark::State& state, uint256 (*exp_fn)(const uint256&, const uint256&) noexcept)
+{
+    // The small exponents, the width applies to the base only.
+    const auto width = static_cast<int>(state.range(0));
+    const auto base = make_operands(width, 1);
+    std::mt19937_64 rng{2};
+    std::vector<uint256> exponent(num_operands);
+    for (auto& e : exponent)
+        e = rng() % 256;
+
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(exp_fn(base[i], exponent[i]));
+        i = (i + 1) % num_operands;
+    }
+}
+
+uint256 generic_add(const uint256& a, const uint256& b) noexcept
+{
+    return a + b;
+}
+
+uint256 generic_lt(const uint256& a, const uint256& b) noexcept
+{
+    return a < b;
+}
+
+uint256 generic_mul(const uint256& a, const uint256& b) noexcept
+{
+    return a * b;
+}
+
+uint256 generic_div(const uint256& a, const uint256& b) noexcept
+{
+    return a / b;
+}
+
+uint256 generic_mod(const uint256& a, const uint256& b) noexcept
+{
+    return a % b;
+}
+
+uint256 generic_sdiv(const uint256& a, const uint256& b) noexcept
+{
+    return intx::sdivrem(a, b).quot;
+}
+
+uint256 generic_addmod(const uint256& x, const uint256& y, const uint256& m) noexcept
+{
+    return intx::addmod(x, y, m);
+}
+
+uint256 generic_mulmod(const uint256& x, const uint256& y, const uint256& m) noexcept
+{
+    return intx::mulmod(x, y, m);
+}
+
+uint256 generic_exp(const uint256& base, const uint256& exponent) noexcept
+{
+    return intx::exp(base, exponent);
+}
+
+void widths(benchmark::internal::Benchmark* b)
+{
+    b->Arg(64)->Arg(128)->Arg(256);
+}
+}  // namespace
+
+BENCHMARK_TEMPLATE(binop, generic_add)->Apply(widths);
+BENCHMARK_TEMPLATE(binop, generic_lt)->Apply(widths);
+BENCHMARK_TEMPLATE(binop, generic_mul)->Apply(widths);
+BENCHMARK_TEMPLATE(binop, evmone::arith::mul)->Apply(widths);
+BENCHMARK_TEMPLATE(binop, generic_div)->Apply(widths);
+BENCHMARK_TEMPLATE(binop, evmone::arith::div)->Apply(widths);
+BENCHMARK_TEMPLATE(binop, generic_mod)->Apply(widths);
+BENCHMARK_TEMPLATE(binop, evmone::arith::mod)->Apply(widths);
+BENCHMARK_TEMPLATE(binop, generic_sdiv)->Apply(widths);
+BENCHMARK_TEMPLATE(binop, evmone::arith::sdiv)->Apply(widths);
+BENCHMARK_TEMPLATE(ternop, generic_addmod)->Apply(widths);
+BENCHMARK_TEMPLATE(ternop, evmone::arith::addmod)->Apply(widths);
+BENCHMARK_TEMPLATE(ternop, generic_mulmod)->Apply(widths);
+BENCHMARK_TEMPLATE(ternop, evmone::arith::mulmod)->Apply(widths);
+BENCHMARK_CAPTURE(exp, generic, generic_exp)->Apply(widths);
+BENCHMARK_CAPTURE(exp, evmone, evmone::arith::exp)->Apply(widths);
@@ -4,8 +4,10 @@
 
 #include <benchmark/benchmark.h>
 #include <array>
+#include <bitset>
 #include <random>
 #include <unordered_map>
+#include <vector>
 
 #pragma GCC diagnostic error "-Wconversion"
 
@@ -312,6 +314,180 @@ void find_jumpdest_hashmap_random(benchmark::State& state)
 BENCHMARK_TEMPLATE(find_jumpdest_hashmap_random, int);
 BENCHMARK_TEMPLATE(find_jumpdest_hashmap_random, uint16_t);
 
+
+/// The code size covering all offsets in the map.
+constexpr size_t code_size = 2 * jumpdest_map_size + 1;
+
+/// The dense map: the value for every code offset, T(-1) for invalid jump destinations.
+template <typename T>
+struct dense_map_builder
+{
+    static const std::vector<T> map;
+};
+
+template <typename T>
+const std::vector<T> dense_map_builder<T>::map = []() noexcept
+{
+    auto m = std::vector<T>(code_size, T(-1));
+    for (const auto& [key, value] : map_builder<T>::map)
+        m[static_cast<size_t>(key)] = value;
+    return m;
+}
+();
+
+template <typename T>
+inline T dense(const T* map, size_t size, T offset) noexcept
+{
+    const auto pos = static_cast<size_t>(offset);
+    return pos < size ? map[pos] : T(-1);
+}
+
+/// The bitmap of valid jump destinations with the number of them before each bitmap word.
+template <typename T>
+struct bitmap_rank_map
+{
+    std::vector<uint64_t> bitmap;
+    std::vector<T> rank;
+    std::vector<T> values;
+};
+
+template <typename T>
+struct bitmap_rank_map_builder
+{
+    static const bitmap_rank_map<T> map;
+};
+
+template <typename T>
+const bitmap_rank_map<T> bitmap_rank_map_builder<T>::map = []() noexcept
+{
+    auto m = bitmap_rank_map<T>{};
+    const auto num_words = (code_size + 63) / 64;
+    m.bitmap.resize(num_words);
+    m.rank.resize(num_words);
+    for (const auto& [key, value] : map_builder<T>::map)
+    {
+        const auto pos = static_cast<size_t>(key);
+        m.bitmap[pos / 64] |= uint64_t{1} << (pos % 64);
+        m.values.push_back(value);
+    }
+    T rank = 0;
+    for (size_t i = 0; i < num_words; ++i)
+    {
+        m.rank[i] = rank;
+        rank = static_cast<T>(rank + std::bitset<64>{m.bitmap[i]}.count());
+    }
+    return m;
+}
+();
+
+template <typename T>
+inline T bitmap_rank(const bitmap_rank_map<T>& m, T offset) noexcept
+{
+    const auto pos = static_cast<size_t>(offset);
+    const auto word_index = pos / 64;
+    if (word_index >= m.bitmap.size())
+        return T(-1);
+    const auto word = m.bitmap[word_index];
+    const auto mask = uint64_t{1} << (pos % 64);
+    if ((word & mask) == 0)
+        return T(-1);
+    const auto rank = static_cast<size_t>(m.rank[word_index]) +
+                      std::bitset<64>{word & (mask - 1)}.count();
+    return m.values[rank];
+}
+
+/// Benchmarks the dense map. The map size does not depend on the number of jumpdests,
+/// so the state.range(0) is ignored.
+template <typename T>
+void find_jumpdest_dense(benchmark::State& state)
+{
+    const auto& map = dense_map_builder<T>::map;
+    const auto needle = static_cast<T>(state.range(1));
+    benchmark::ClobberMemory();
+
+    T x = T(-1);
+    for (auto _ : state)
+    {
+        x = dense(map.data(), map.size(), needle);
+        benchmark::DoNotOptimize(x);
+    }
+
+    if (needle % 2 == 1)
+    {
+        if (x != needle + 1)
+            state.SkipWithError("incorrect element found");
+    }
+    else if (x != T(-1))
+        state.SkipWithError("element should not have been found");
+}
+
+/// Benchmarks the bitmap with ranks. The state.range(0) is ignored as in the dense variant.
+template <typename T>
+void find_jumpdest_bitmap_rank(benchmark::State& state)
+{
+    const auto& map = bitmap_rank_map_builder<T>::map;
+    const auto needle = static_cast<T>(state.range(1));
+    benchmark::ClobberMemory();
+
+    T x = T(-1);
+    for (auto _ : state)
+    {
+        x = bitmap_rank(map, needle);
+        benchmark::DoNotOptimize(x);
+    }
+
+    if (needle % 2 == 1)
+    {
+        if (x != needle + 1)
+            state.SkipWithError("incorrect element found");
+    }
+    else if (x != T(-1))
+        state.SkipWithError("element should not have been found");
+}
+
+template <typename T>
+void find_jumpdest_dense_random(benchmark::State& state)
+{
+    const auto indexes = random_indexes;
+    const auto& map = dense_map_builder<T>::map;
+    benchmark::ClobberMemory();
+
+    for (auto _ : state)
+    {
+        for (auto i : indexes)
+        {
+            auto x = dense(map.data(), map.size(), static_cast<T>(i));
+            benchmark::DoNotOptimize(x);
+        }
+    }
+}
+
+template <typename T>
+void find_jumpdest_bitmap_rank_random(benchmark::State& state)
+{
+    const auto indexes = random_indexes;
+    const auto& map = bitmap_rank_map_builder<T>::map;
+    benchmark::ClobberMemory();
+
+    for (auto _ : state)
+    {
+        for (auto i : indexes)
+        {
+            auto x = bitmap_rank(map, static_cast<T>(i));
+            benchmark::DoNotOptimize(x);
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(find_jumpdest_dense, int) ARGS;
+BENCHMARK_TEMPLATE(find_jumpdest_dense, uint16_t) ARGS;
+BENCHMARK_TEMPLATE(find_jumpdest_bitmap_rank, int) ARGS;
+BENCHMARK_TEMPLATE(find_jumpdest_bitmap_rank, uint16_t) ARGS;
+BENCHMARK_TEMPLATE(find_jumpdest_dense_random, int);
+BENCHMARK_TEMPLATE(find_jumpdest_dense_random, uint16_t);
+BENCHMARK_TEMPLATE(find_jumpdest_bitmap_rank_random, int);
+BENCHMARK_TEMPLATE(find_jumpdest_bitmap_rank_random, uint16_t);
+
 }  // namespace
 
 BENCHMARK_MAIN();
\ No newline at end of file
@@ -0,0 +1,106 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+/// @file
+/// Benchmarks of the memory primitives of the copy instructions and MLOAD/MSTORE.
+///
+/// The "generic" variants are the memcpy() + memset() and the intx big-endian loads and stores
+/// used by the instructions before. The copies are benchmarked for the data filling
+/// the whole destination, the data filling the half of it (the rest zero-filled),
+/// and the padding only into the memory just expanded (known to be zero).
+
+#include <benchmark/benchmark.h>
+#include <evmone/memory_ops.hpp>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+constexpr size_t max_size = 1024 * 1024;
+
+void generic_copy_padded(uint8_t* dst, size_t size, const uint8_t* data, size_t data_size,
+    size_t /*dirty_size*/) noexcept
+{
+    if (data_size > 0)
+        std::memcpy(dst, data, data_size);
+    if (size - data_size > 0)
+        std::memset(dst + data_size, 0, size - data_size);
+}
+
+using copy_fn = void (*)(uint8_t*, size_t, const uint8_t*, size_t, size_t) noexcept;
+
+/// The destination size is the argument, the denominator selects the data size:
+/// the whole destination (1), the half (2) or nothing (0, the padding into the fresh memory).
+template <copy_fn Fn, size_t Denominator>
+void copy(benchmark::State& state)
+{
+    const auto size = static_cast<size_t>(state.range(0));
+    const auto data_size = Denominator != 0 ? size / Denominator : 0;
+    const auto dirty_size = Denominator != 0 ? size : 0;
+    std::vector<uint8_t> memory(max_size);
+    const std::vector<uint8_t> data(max_size, 0xfe);
+
+    for (auto _ : state)
+    {
+        Fn(memory.data(), size, data.data(), data_size, dirty_size);
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+
+/// The number of words in memory the loads and stores cycle through.
+constexpr size_t num_words = 64;
+
+intx::uint256 generic_load_word(const uint8_t* src) noexcept
+{
+    return intx::be::unsafe::load<intx::uint256>(src);
+}
+
+void generic_store_word(uint8_t* dst, const intx::uint256& x) noexcept
+{
+    intx::be::unsafe::store(dst, x);
+}
+
+template <intx::uint256 (*Fn)(const uint8_t*) noexcept>
+void load(benchmark::State& state)
+{
+    std::vector<uint8_t> memory(num_words * 32, 0xab);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(Fn(&memory[i * 32]));
+        i = (i + 1) % num_words;
+    }
+}
+
+template <void (*Fn)(uint8_t*, const intx::uint256&) noexcept>
+void store(benchmark::State& state)
+{
+    std::vector<uint8_t> memory(num_words * 32);
+    const auto x = intx::uint256{0x0102030405060708, 0x1112131415161718} << 100;
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        Fn(&memory[i * 32], x);
+        benchmark::ClobberMemory();
+        i = (i + 1) % num_words;
+    }
+}
+
+void sizes(benchmark::internal::Benchmark* b)
+{
+    b->Arg(5)->Arg(20)->RangeMultiplier(4)->Range(32, max_size);
+}
+}  // namespace
+
+BENCHMARK_TEMPLATE(copy, generic_copy_padded, 1)->Apply(sizes);
+BENCHMARK_TEMPLATE(copy, evmone::copy_padded, 1)->Apply(sizes);
+BENCHMARK_TEMPLATE(copy, generic_copy_padded, 2)->Apply(sizes);
+BENCHMARK_TEMPLATE(copy, evmone::copy_padded, 2)->Apply(sizes);
+BENCHMARK_TEMPLATE(copy, generic_copy_padded, 0)->Apply(sizes);
+BENCHMARK_TEMPLATE(copy, evmone::copy_padded, 0)->Apply(sizes);
+BENCHMARK_TEMPLATE(load, generic_load_word);
+BENCHMARK_TEMPLATE(load, evmone::load_word);
+BENCHMARK_TEMPLATE(store, generic_store_word);
+BENCHMARK_TEMPLATE(store, evmone::store_word);
@@ -0,0 +1,106 @@
+#!/usr/bin/python3
+
+# Collects the frequencies of opcode n-grams in EVM bytecode files,
+# e.g. the benchmark corpus test/benchmarks/*.evm.
+# This is used to select the instruction sequences worth fusing into
+# superinstructions (see fusion_rules in lib/evmone/analysis.cpp).
+#
+# The n-grams are counted statically and never cross basic block boundaries:
+# the sequence ends at the block terminator and cannot include the JUMPDEST.
+# The PUSH instructions with up to 8 bytes of data are reported as "PUSH<=8".
+#
+# Usage: opcode_ngrams.py [-n N] [-t TOP] FILE...
+
+import argparse
+import collections
+
+NAMES = {
+    0x00: "STOP", 0x01: "ADD", 0x02: "MUL", 0x03: "SUB", 0x04: "DIV", 0x05: "SDIV",
+    0x06: "MOD", 0x07: "SMOD", 0x08: "ADDMOD", 0x09: "MULMOD", 0x0a: "EXP",
+    0x0b: "SIGNEXTEND", 0x10: "LT", 0x11: "GT", 0x12: "SLT", 0x13: "SGT", 0x14: "EQ",
+    0x15: "ISZERO", 0x16: "AND", 0x17: "OR", 0x18: "XOR", 0x19: "NOT", 0x1a: "BYTE",
+    0x1b: "SHL", 0x1c: "SHR", 0x1d: "SAR", 0x20: "SHA3", 0x30: "ADDRESS", 0x31: "BALANCE",
+    0x32: "ORIGIN", 0x33: "CALLER", 0x34: "CALLVALUE", 0x35: "CALLDATALOAD",
+    0x36: "CALLDATASIZE", 0x37: "CALLDATACOPY", 0x38: "CODESIZE", 0x39: "CODECOPY",
+    0x3a: "GASPRICE", 0x3b: "EXTCODESIZE", 0x3c: "EXTCODECOPY", 0x3d: "RETURNDATASIZE",
+    0x3e: "RETURNDATACOPY", 0x3f: "EXTCODEHASH", 0x40: "BLOCKHASH", 0x41: "COINBASE",
+    0x42: "TIMESTAMP", 0x43: "NUMBER", 0x44: "DIFFICULTY", 0x45: "GASLIMIT",
+    0x46: "CHAINID", 0x47: "SELFBALANCE", 0x50: "POP", 0x51: "MLOAD", 0x52: "MSTORE",
+    0x53: "MSTORE8", 0x54: "SLOAD", 0x55: "SSTORE", 0x56: "JUMP", 0x57: "JUMPI",
+    0x58: "PC", 0x59: "MSIZE", 0x5a: "GAS", 0x5b: "JUMPDEST", 0xf0: "CREATE", 0xf1: "CALL",
+    0xf2: "CALLCODE", 0xf3: "RETURN", 0xf4: "DELEGATECALL", 0xf5: "CREATE2",
+    0xfa: "STATICCALL", 0xfd: "REVERT", 0xfe: "INVALID", 0xff: "SELFDESTRUCT",
+}
+for i in range(32):
+    NAMES[0x60 + i] = "PUSH{}".format(i + 1)
+for i in range(16):
+    NAMES[0x80 + i] = "DUP{}".format(i + 1)
+    NAMES[0x90 + i] = "SWAP{}".format(i + 1)
+for i in range(5):
+    NAMES[0xa0 + i] = "LOG{}".format(i)
+
+TERMINATORS = {0x00, 0x56, 0x57, 0xf3, 0xfd, 0xff}
+
+
+def name(opcode):
+    if 0x60 <= opcode <= 0x67:
+        return "PUSH<=8"
+    return NAMES.get(opcode, "0x{:02x}".format(opcode))
+
+
+def blocks(code):
+    """Splits the code into basic blocks, the lists of opcodes."""
+    block = []
+    pos = 0
+    while pos < len(code):
+        opcode = code[pos]
+        if opcode == 0x5b:
+            if block:
+                yield block
+            block = []
+        else:
+            block.append(opcode)
+        if 0x60 <= opcode <= 0x7f:
+            pos += opcode - 0x5f
+        pos += 1
+        if opcode in TERMINATORS:
+            yield block
+            block = []
+    if block:
+        yield block
+
+
+def load_code(path):
+    with open(path) as f:
+        text = f.read().strip()
+    if text.startswith("0x"):
+        text = text[2:]
+    return bytes.fromhex(text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("-n", type=int, default=2, help="the max n-gram length")
+    parser.add_argument("-t", "--top", type=int, default=30, help="the number of results")
+    parser.add_argument("files", nargs="+")
+    args = parser.parse_args()
+
+    total = 0
+    counts = [collections.Counter() for _ in range(args.n + 1)]
+    for path in args.files:
+        for block in blocks(load_code(path)):
+            names = [name(op) for op in block]
+            total += len(names)
+            for n in range(1, args.n + 1):
+                for i in range(len(names) - n + 1):
+                    counts[n][" ".join(names[i:i + n])] += 1
+
+    print("instructions: {}".format(total))
+    for n in range(1, args.n + 1):
+        print("\n{}-grams:".format(n))
+        for ngram, count in counts[n].most_common(args.top):
+            print("{:8} {:6.2f}%  {}".format(count, 100.0 * count / total, ngram))
+
+
+if __name__ == "__main__":
+    main()
@@ -2,14 +2,39 @@
 // Copyright 2019 The evmone Authors.
 // Licensed under the Apache License, Version 2.0.
 
+/// @file
+/// Compares the behavior of memory backends when the memory grows:
+/// - realloc: std::realloc() of the whole buffer (the new part is not zeroed),
+/// - vector: std::vector<uint8_t>::resize() (copies and zero-fills eagerly),
+/// - mmap: the virtual address range reserved once and committed lazily,
+///   as used by evmone's evm_memory on 64-bit systems (the pages are zeroed by the OS).
+/// For every backend the time of each growth step and the buffer address are printed.
+/// After the growth, every page is touched to also show the cost of the page faults.
+
 #include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define HAVE_MMAP 1
+#else
+#define HAVE_MMAP 0
+#endif
+
 using namespace std::chrono;
 using timer = high_resolution_clock;
 
+namespace
+{
+constexpr int repeats = 6;
+constexpr size_t realloc_multiplier = 2;
+constexpr size_t size_start = 128 * 1024;
+constexpr size_t size_end = 8 * 1024 * 1024;
+
 struct result
 {
     size_t size;
@@ -17,40 +42,102 @@ struct result
     decltype(timer::now() - timer::now()) duration;
 };
 
-void benchmark_realloc()
+class realloc_backend
 {
-    constexpr int repeats = 6;
-    constexpr size_t realloc_multiplier = 2;
-    constexpr size_t size_start = 128 * 1024;
-    constexpr size_t size_end = 8 * 1024 * 1024;
+    void* m_ptr = nullptr;
 
-    auto results = std::vector<result>{};
-    results.reserve(size_end / size_start);
+public:
+    ~realloc_backend() { std::free(m_ptr); }
+
+    void* resize(size_t size) noexcept { return m_ptr = std::realloc(m_ptr, size); }
+};
+
+class vector_backend
+{
+    std::vector<uint8_t> m_vector;
+
+public:
+    void* resize(size_t size)
+    {
+        m_vector.resize(size);
+        return m_vector.data();
+    }
+};
+
+#if HAVE_MMAP
+class mmap_backend
+{
+    static constexpr size_t reserved_size = 32 * 1024 * 1024;
 
-    void* m = nullptr;
+    uint8_t* m_ptr = nullptr;
+
+public:
+    mmap_backend() noexcept
+    {
+        const auto p = mmap(nullptr, reserved_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED)
+            m_ptr = static_cast<uint8_t*>(p);
+    }
+
+    ~mmap_backend()
+    {
+        if (m_ptr != nullptr)
+            munmap(m_ptr, reserved_size);
+    }
+
+    void* resize(size_t size) noexcept
+    {
+        if (m_ptr == nullptr || mprotect(m_ptr, size, PROT_READ | PROT_WRITE) != 0)
+            return nullptr;
+        return m_ptr;
+    }
+};
+#endif
+
+template <typename Backend>
+void benchmark_backend(const char* name)
+{
+    auto results = std::vector<result>{};
+    auto touch_duration = decltype(timer::now() - timer::now()){};
 
     for (int i = 0; i < repeats; ++i)
     {
+        Backend backend;
+        void* m = nullptr;
         for (auto size = size_start; size <= size_end; size *= realloc_multiplier)
         {
             const auto start_time = timer::now();
-            m = std::realloc(m, size);
+            m = backend.resize(size);
             const auto duration = timer::now() - start_time;
             results.push_back({size, m, duration});
         }
-        std::free(m);
-        m = nullptr;
+
+        if (m == nullptr)
+            break;
+
+        const auto start_time = timer::now();
+        for (size_t offset = 0; offset < size_end; offset += 4096)
+            static_cast<volatile uint8_t*>(m)[offset] = 1;
+        touch_duration += timer::now() - start_time;
     }
 
+    std::cout << name << ":\n";
     for (auto r : results)
     {
         std::cout << (r.size / 1024) << "k\t " << r.memory_ptr << "\t"
                   << duration_cast<nanoseconds>(r.duration).count() << "\n";
     }
+    std::cout << "touch all pages (avg): "
+              << duration_cast<nanoseconds>(touch_duration).count() / repeats << "\n\n";
 }
+}  // namespace
 
 int main()
 {
-    benchmark_realloc();
+    benchmark_backend<realloc_backend>("realloc");
+    benchmark_backend<vector_backend>("vector");
+#if HAVE_MMAP
+    benchmark_backend<mmap_backend>("mmap");
+#endif
     return 0;
 }
@@ -0,0 +1,206 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmone/access_list.hpp>
+#include <evmone/keccak.hpp>
+#include <gtest/gtest.h>
+#include <test/utils/bytecode.hpp>
+#include <cstring>
+
+using namespace evmone;
+
+namespace
+{
+constexpr auto rev = EVMC_ISTANBUL;
+
+evmc::bytes32 make_key(uint8_t n) noexcept
+{
+    evmc::bytes32 key;
+    key.bytes[31] = n;
+    return key;
+}
+
+evmc::address make_address(uint8_t n) noexcept
+{
+    evmc::address address;
+    address.bytes[19] = n;
+    return address;
+}
+
+std::vector<evmc::bytes32> keys(std::initializer_list<uint8_t> ns)
+{
+    std::vector<evmc::bytes32> v;
+    for (const auto n : ns)
+        v.push_back(make_key(n));
+    return v;
+}
+
+access_list extract(const bytecode& code, const evmc_message* msg = nullptr)
+{
+    return extract_access_list(rev, code.data(), code.size(), msg);
+}
+
+/// The storage slot of the Solidity mapping at the slot for the key.
+evmc::bytes32 mapping_slot(const uint8_t key[32], uint8_t slot)
+{
+    uint8_t data[64]{};
+    std::memcpy(data, key, 32);
+    data[63] = slot;
+    evmc::bytes32 result;
+    const auto hash = keccak256(data, sizeof(data));
+    std::memcpy(result.bytes, hash.data(), sizeof(result.bytes));
+    return result;
+}
+}  // namespace
+
+TEST(access_list, constants)
+{
+    const auto address = make_address(0xaa);
+    const auto code = sload(1) + sload(1) + sstore(2, 3) + push({address.bytes, sizeof(address)}) +
+                      OP_BALANCE + call(push(0xbb)).gas(OP_GAS) + OP_POP + OP_POP +
+                      push(0xcc) + OP_DUP1 + OP_SWAP1 + OP_EXTCODESIZE;
+
+    const auto list = extract(code);
+    EXPECT_EQ(list.storage_reads, keys({1}));
+    EXPECT_EQ(list.storage_writes, keys({2}));
+    EXPECT_EQ(list.accounts, (std::vector<evmc::address>{make_address(0xaa), make_address(0xcc)}));
+    EXPECT_EQ(list.calls, (std::vector<evmc::address>{make_address(0xbb)}));
+    EXPECT_FALSE(list.unknown_storage_reads);
+    EXPECT_FALSE(list.unknown_storage_writes);
+    EXPECT_FALSE(list.unknown_accounts);
+    EXPECT_FALSE(list.unknown_calls);
+    EXPECT_FALSE(list.creates);
+    EXPECT_TRUE(list.complete);
+}
+
+TEST(access_list, arithmetic)
+{
+    // The slot (3 + 4) * 2 and the address 0xff & 0x1234.
+    const auto code = push(4) + push(3) + OP_ADD + push(2) + OP_MUL + OP_SLOAD + push(0x1234) +
+                      push(0xff) + OP_AND + OP_BALANCE;
+    const auto list = extract(code);
+    EXPECT_EQ(list.storage_reads, keys({14}));
+    EXPECT_EQ(list.accounts, (std::vector<evmc::address>{make_address(0x34)}));
+}
+
+TEST(access_list, unknown)
+{
+    const auto code = calldataload(0) + OP_SLOAD + sstore(calldataload(0), 1) +
+                      calldataload(0) + OP_EXTCODEHASH + call(calldataload(0)).gas(OP_GAS) +
+                      OP_CREATE;
+    const auto list = extract(code);
+    EXPECT_TRUE(list.storage_reads.empty());
+    EXPECT_TRUE(list.unknown_storage_reads);
+    EXPECT_TRUE(list.unknown_storage_writes);
+    EXPECT_TRUE(list.unknown_accounts);
+    EXPECT_TRUE(list.unknown_calls);
+    EXPECT_TRUE(list.creates);
+    EXPECT_TRUE(list.complete);
+}
+
+TEST(access_list, mapping_slot)
+{
+    // The slot of the mapping at the slot 1 for the key 0x0a.
+    const auto code = mstore(0, 0x0a) + mstore(32, 1) + sha3(0, 64) + OP_SLOAD;
+    uint8_t key[32]{};
+    key[31] = 0x0a;
+    EXPECT_EQ(extract(code).storage_reads, (std::vector<evmc::bytes32>{mapping_slot(key, 1)}));
+
+    // The memory modified by an unknown store.
+    const auto clobbered =
+        mstore(0, 0x0a) + mstore(32, 1) + mstore8(calldataload(0), 1) + sha3(0, 64) + OP_SLOAD;
+    EXPECT_TRUE(extract(clobbered).storage_reads.empty());
+    EXPECT_TRUE(extract(clobbered).unknown_storage_reads);
+}
+
+TEST(access_list, message)
+{
+    // The mapping at the slot 0 for the caller.
+    const auto code = mstore(0, OP_CALLER) + mstore(32, 0) + sha3(0, 64) + OP_SLOAD;
+    EXPECT_TRUE(extract(code).unknown_storage_reads);
+
+    evmc_message msg{};
+    msg.sender = make_address(0x5e);
+    const auto list = extract(code, &msg);
+    EXPECT_FALSE(list.unknown_storage_reads);
+    uint8_t key[32]{};
+    key[31] = 0x5e;
+    EXPECT_EQ(list.storage_reads, (std::vector<evmc::bytes32>{mapping_slot(key, 0)}));
+}
+
+TEST(access_list, branches)
+{
+    // if (calldata[0]) sload(2) else sload(1)
+    const auto code = jumpi(10, calldataload(0)) + sload(1) + OP_STOP + OP_JUMPDEST + sload(2);
+    ASSERT_EQ(code[10], OP_JUMPDEST);
+
+    const auto list = extract(code);
+    EXPECT_EQ(list.storage_reads, keys({1, 2}));
+    EXPECT_TRUE(list.complete);
+
+    // Only the branch selected by the call data.
+    evmc_message msg{};
+    const uint8_t input[32]{1};
+    msg.input_data = input;
+    msg.input_size = sizeof(input);
+    EXPECT_EQ(extract(code, &msg).storage_reads, keys({2}));
+    msg.input_size = 0;
+    EXPECT_EQ(extract(code, &msg).storage_reads, keys({1}));
+
+    // The code after the terminator not being a jump destination is not reachable.
+    EXPECT_EQ(extract(sload(1) + OP_STOP + sload(2)).storage_reads, keys({1}));
+    EXPECT_EQ(extract(jump(4) + OP_INVALID + OP_JUMPDEST + sload(3)).storage_reads, keys({3}));
+}
+
+TEST(access_list, invalid_jump)
+{
+    // The destination not being the JUMPDEST fails the execution.
+    const auto list = extract(jump(3) + sload(1));
+    EXPECT_TRUE(list.storage_reads.empty());
+    EXPECT_TRUE(list.complete);
+
+    // The destination not known.
+    const auto dynamic = extract(calldataload(0) + OP_JUMP + OP_JUMPDEST + sload(1));
+    EXPECT_TRUE(dynamic.storage_reads.empty());
+    EXPECT_FALSE(dynamic.complete);
+}
+
+TEST(access_list, loop)
+{
+    // for (i = 0; i < n; ++i) sload(i)
+    const auto loop = [](uint8_t n) {
+        return push(0) + OP_JUMPDEST + OP_DUP1 + OP_SLOAD + OP_POP + push(1) + OP_ADD + OP_DUP1 +
+               push(n) + OP_GT + push(2) + OP_JUMPI;
+    };
+
+    const auto short_loop = extract(loop(5));
+    EXPECT_EQ(short_loop.storage_reads, keys({0, 1, 2, 3, 4}));
+    EXPECT_FALSE(short_loop.unknown_storage_reads);
+    EXPECT_TRUE(short_loop.complete);
+
+    // The loop counter becomes unknown after too many iterations.
+    const auto long_loop = extract(loop(100));
+    EXPECT_EQ(long_loop.storage_reads.size(), 8);
+    EXPECT_TRUE(long_loop.unknown_storage_reads);
+    EXPECT_TRUE(long_loop.complete);
+}
+
+TEST(access_list, stack_requirements)
+{
+    // The blocks underflowing the stack are not executed.
+    EXPECT_TRUE(extract(bytecode{OP_ADD} + sload(1)).storage_reads.empty());
+    EXPECT_TRUE(extract(bytecode{} + OP_SLOAD).storage_reads.empty());
+}
+
+TEST(access_list, json)
+{
+    const auto json = format_access_list_json(extract(sload(1) + call(push(0xbb)).gas(1)));
+    EXPECT_EQ(json,
+        "{\"storageReads\":"
+        "[\"0x0000000000000000000000000000000000000000000000000000000000000001\"],"
+        "\"storageWrites\":[],\"accounts\":[],"
+        "\"calls\":[\"0x00000000000000000000000000000000000000bb\"],"
+        "\"unknownStorageReads\":false,\"unknownStorageWrites\":false,"
+        "\"unknownAccounts\":false,\"unknownCalls\":false,\"creates\":false,\"complete\":true}");
+}
@@ -0,0 +1,235 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmone/analysis_cache.hpp>
+#include <evmone/lazy_analysis.hpp>
+#include <gtest/gtest.h>
+#include <test/utils/bytecode.hpp>
+#include <thread>
+
+using namespace evmone;
+
+TEST(analysis_cache, hash_code)
+{
+    const auto code1 = bytecode{push(1) + push(2) + OP_ADD};
+    const auto code2 = bytecode{push(1) + push(3) + OP_ADD};
+    EXPECT_EQ(hash_code(code1.data(), code1.size()), hash_code(code1.data(), code1.size()));
+    EXPECT_NE(hash_code(code1.data(), code1.size()), hash_code(code2.data(), code2.size()));
+
+    // The code size is part of the hash, so trailing zeros matter.
+    const uint8_t zeros[9] = {};
+    EXPECT_NE(hash_code(zeros, 8), hash_code(zeros, 9));
+    EXPECT_NE(hash_code(zeros, 0), hash_code(zeros, 1));
+    EXPECT_EQ(hash_code(nullptr, 0), hash_code(zeros, 0));
+}
+
+TEST(analysis_cache, hit)
+{
+    analysis_cache cache;
+    const auto code = bytecode{push(1) + push(2) + OP_ADD};
+    const auto a1 = cache.get(EVMC_PETERSBURG, code.data(), code.size());
+    EXPECT_EQ(cache.num_entries(), 1);
+    EXPECT_GT(cache.size(), code.size());
+
+    // The same code copied to a different buffer.
+    const auto code_copy = code;
+    const auto a2 = cache.get(EVMC_PETERSBURG, code_copy.data(), code_copy.size());
+    EXPECT_EQ(a1, a2);
+    EXPECT_EQ(cache.num_entries(), 1);
+    EXPECT_EQ(a1->instrs.size(), 5);
+}
+
+TEST(analysis_cache, revision_is_part_of_key)
+{
+    analysis_cache cache;
+    const auto code = bytecode{push(1) + OP_SLOAD};
+    const auto a1 = cache.get(EVMC_PETERSBURG, code.data(), code.size());
+    const auto a2 = cache.get(EVMC_ISTANBUL, code.data(), code.size());
+    EXPECT_NE(a1, a2);
+    EXPECT_EQ(cache.num_entries(), 2);
+    EXPECT_EQ(a1->instrs[0].arg.block.gas_cost, 203);
+    EXPECT_EQ(a2->instrs[0].arg.block.gas_cost, 803);
+}
+
+TEST(analysis_cache, empty_code)
+{
+    analysis_cache cache;
+    const auto a1 = cache.get(EVMC_PETERSBURG, nullptr, 0);
+    const auto a2 = cache.get(EVMC_PETERSBURG, nullptr, 0);
+    EXPECT_EQ(a1, a2);
+    EXPECT_EQ(cache.num_entries(), 1);
+}
+
+TEST(analysis_cache, lru_eviction)
+{
+    const auto code1 = bytecode{push(1)};
+    const auto code2 = bytecode{push(2)};
+    const auto code3 = bytecode{push(3)};
+
+    // Measure the size of a single entry. All entries here have the same size.
+    analysis_cache probe;
+    probe.get(EVMC_PETERSBURG, code1.data(), code1.size());
+    const auto entry_size = probe.size();
+
+    analysis_cache cache{2 * entry_size, 1};
+    const auto a1 = cache.get(EVMC_PETERSBURG, code1.data(), code1.size());
+    cache.get(EVMC_PETERSBURG, code2.data(), code2.size());
+    EXPECT_EQ(cache.num_entries(), 2);
+
+    // Use code1 so code2 is evicted first.
+    EXPECT_EQ(cache.get(EVMC_PETERSBURG, code1.data(), code1.size()), a1);
+    const auto a3 = cache.get(EVMC_PETERSBURG, code3.data(), code3.size());
+    EXPECT_EQ(cache.num_entries(), 2);
+    EXPECT_EQ(cache.size(), 2 * entry_size);
+
+    EXPECT_EQ(cache.get(EVMC_PETERSBURG, code1.data(), code1.size()), a1);
+    EXPECT_EQ(cache.get(EVMC_PETERSBURG, code3.data(), code3.size()), a3);
+
+    // The evicted analysis is still alive for its users.
+    const auto a2 = cache.get(EVMC_PETERSBURG, code2.data(), code2.size());
+    EXPECT_EQ(cache.num_entries(), 2);
+    cache.set_capacity(entry_size);
+    EXPECT_EQ(cache.num_entries(), 1);
+    EXPECT_EQ(a2->instrs.size(), 3);
+    EXPECT_EQ(cache.get(EVMC_PETERSBURG, code2.data(), code2.size()), a2);
+}
+
+TEST(analysis_cache, oversized_entry)
+{
+    const auto small = bytecode{push(1)};
+    const auto large = bytecode{1000 * push(1)};
+
+    analysis_cache probe;
+    probe.get(EVMC_PETERSBURG, small.data(), small.size());
+
+    analysis_cache cache{probe.size(), 1};
+    const auto a1 = cache.get(EVMC_PETERSBURG, small.data(), small.size());
+    const auto a2 = cache.get(EVMC_PETERSBURG, large.data(), large.size());
+    EXPECT_EQ(a2->instrs.size(), 1002);
+    EXPECT_EQ(cache.num_entries(), 1);
+    EXPECT_EQ(cache.get(EVMC_PETERSBURG, small.data(), small.size()), a1);
+}
+
+TEST(analysis_cache, lazy_segments_charged)
+{
+    analysis_cache cache;
+    const auto code = push(9) + OP_JUMP + OP_JUMPDEST + push(1) + OP_POP + OP_STOP + OP_INVALID +
+                      OP_JUMPDEST + OP_STOP;
+    const auto a = cache.get(EVMC_PETERSBURG, code.data(), code.size(), ANALYSIS_LAZY);
+    const auto inserted_size = cache.size();
+    EXPECT_GT(inserted_size, a->lazy->memory_size());
+
+    // The segments analyzed after the insertion are charged by the following hit.
+    a->lazy->start();
+    a->lazy->jumpdest(9);
+    EXPECT_EQ(cache.size(), inserted_size);
+    EXPECT_EQ(cache.get(EVMC_PETERSBURG, code.data(), code.size(), ANALYSIS_LAZY), a);
+    EXPECT_GT(cache.size(), inserted_size);
+
+    const auto charged_size = cache.size();
+    EXPECT_EQ(cache.get(EVMC_PETERSBURG, code.data(), code.size(), ANALYSIS_LAZY), a);
+    EXPECT_EQ(cache.size(), charged_size);
+
+    // The charged size is released with the entry.
+    cache.set_capacity(0);
+    EXPECT_EQ(cache.size(), 0);
+}
+
+TEST(analysis_cache, disabled)
+{
+    analysis_cache cache{0};
+    const auto code = bytecode{push(1)};
+    const auto a1 = cache.get(EVMC_PETERSBURG, code.data(), code.size());
+    const auto a2 = cache.get(EVMC_PETERSBURG, code.data(), code.size());
+    EXPECT_NE(a1, a2);
+    EXPECT_EQ(cache.num_entries(), 0);
+    EXPECT_EQ(cache.size(), 0);
+}
+
+TEST(analysis_cache, clear)
+{
+    analysis_cache cache;
+    const auto code = bytecode{push(1)};
+    const auto a1 = cache.get(EVMC_PETERSBURG, code.data(), code.size());
+    cache.clear();
+    EXPECT_EQ(cache.num_entries(), 0);
+    EXPECT_EQ(cache.size(), 0);
+    const auto a2 = cache.get(EVMC_PETERSBURG, code.data(), code.size());
+    EXPECT_NE(a1, a2);
+    EXPECT_EQ(cache.num_entries(), 1);
+}
+
+TEST(analysis_cache, stats)
+{
+    analysis_cache cache;
+    const auto code = bytecode{push(1)};
+    EXPECT_EQ(cache.get_stats().hits, 0);
+    EXPECT_EQ(cache.get_stats().misses, 0);
+    cache.get(EVMC_PETERSBURG, code.data(), code.size());
+    cache.get(EVMC_PETERSBURG, code.data(), code.size());
+    cache.get(EVMC_PETERSBURG, code.data(), code.size());
+    cache.get(EVMC_ISTANBUL, code.data(), code.size());
+    EXPECT_EQ(cache.get_stats().hits, 2);
+    EXPECT_EQ(cache.get_stats().misses, 2);
+}
+
+TEST(analysis_cache, shards)
+{
+    analysis_cache cache{analysis_cache::default_capacity, 4};
+    std::vector<std::shared_ptr<const code_analysis>> analyses;
+    for (uint64_t i = 0; i < 100; ++i)
+    {
+        const auto code = bytecode{push(i)};
+        analyses.emplace_back(cache.get(EVMC_PETERSBURG, code.data(), code.size()));
+    }
+    EXPECT_EQ(cache.num_entries(), 100);
+    for (uint64_t i = 0; i < 100; ++i)
+    {
+        const auto code = bytecode{push(i)};
+        EXPECT_EQ(cache.get(EVMC_PETERSBURG, code.data(), code.size()), analyses[i]);
+    }
+    EXPECT_EQ(cache.get_stats().misses, 100);
+    EXPECT_EQ(cache.get_stats().hits, 100);
+
+    cache.set_capacity(0);
+    EXPECT_EQ(cache.num_entries(), 0);
+    EXPECT_EQ(cache.size(), 0);
+}
+
+TEST(analysis_cache, concurrent_get)
+{
+    constexpr auto num_threads = 8;
+    constexpr auto num_codes = 16;
+    constexpr auto num_lookups = 1000;
+
+    std::vector<bytecode> codes;
+    for (uint64_t i = 0; i < num_codes; ++i)
+        codes.emplace_back(100 * push(i) + OP_JUMPDEST);
+
+    analysis_cache cache;
+    std::vector<std::vector<std::shared_ptr<const code_analysis>>> results(num_threads);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&cache, &codes, &r = results[t]] {
+            for (size_t i = 0; i < num_lookups; ++i)
+            {
+                const auto& code = codes[i % num_codes];
+                r.emplace_back(cache.get(EVMC_PETERSBURG, code.data(), code.size()));
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    // Every code has been analyzed once and all threads got the same analyses.
+    EXPECT_EQ(cache.get_stats().misses, num_codes);
+    EXPECT_EQ(cache.get_stats().hits, num_threads * num_lookups - num_codes);
+    EXPECT_EQ(cache.num_entries(), num_codes);
+    for (const auto& r : results)
+    {
+        for (size_t i = 0; i < num_lookups; ++i)
+            EXPECT_EQ(r[i], results[0][i % num_codes]);
+    }
+}
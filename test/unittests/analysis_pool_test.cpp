@@ -0,0 +1,115 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmone/analysis_pool.hpp>
+#include <gtest/gtest.h>
+#include <test/utils/bytecode.hpp>
+
+using namespace evmone;
+
+TEST(analysis_pool, analyze)
+{
+    analysis_cache cache;
+    analysis_pool pool{cache, 4};
+    for (uint64_t i = 0; i < 100; ++i)
+    {
+        const auto code = bytecode{push(i)};
+        EXPECT_TRUE(pool.submit(EVMC_PETERSBURG, code.data(), code.size(), 0, i % 3));
+    }
+    pool.wait();
+    EXPECT_EQ(cache.num_entries(), 100);
+    EXPECT_EQ(cache.get_stats().misses, 100);
+
+    const auto stats = pool.get_stats();
+    EXPECT_EQ(stats.queue_depth, 0);
+    EXPECT_GE(stats.max_queue_depth, 1);
+    EXPECT_EQ(stats.submitted, 100);
+    EXPECT_EQ(stats.dropped, 0);
+    EXPECT_EQ(stats.completed, 100);
+    EXPECT_GE(stats.total_wait_ns, stats.max_wait_ns);
+
+    // The flags are passed to the cache.
+    const auto code = bytecode{push(0)};
+    pool.submit(EVMC_PETERSBURG, code.data(), code.size(), ANALYSIS_LAZY);
+    pool.wait();
+    EXPECT_EQ(cache.num_entries(), 101);
+}
+
+TEST(analysis_pool, priority)
+{
+    const auto code1 = bytecode{push(1)};
+    const auto code2 = bytecode{push(2)};
+    const auto code3 = bytecode{push(3)};
+
+    analysis_cache probe;
+    probe.get(EVMC_PETERSBURG, code1.data(), code1.size());
+
+    // The cache of two entries keeps the last two analyzed.
+    analysis_cache cache{2 * probe.size(), 1};
+    analysis_pool pool{cache, 0};
+    pool.submit(EVMC_PETERSBURG, code1.data(), code1.size(), 0, 1);
+    pool.submit(EVMC_PETERSBURG, code2.data(), code2.size(), 0, 3);
+    pool.submit(EVMC_PETERSBURG, code3.data(), code3.size(), 0, 2);
+    EXPECT_EQ(pool.get_stats().queue_depth, 3);
+    EXPECT_EQ(cache.num_entries(), 0);
+
+    // Analyzed in the order: code2, code3, code1.
+    pool.wait();
+    EXPECT_EQ(pool.get_stats().queue_depth, 0);
+    EXPECT_EQ(pool.get_stats().completed, 3);
+    cache.get(EVMC_PETERSBURG, code3.data(), code3.size());
+    cache.get(EVMC_PETERSBURG, code1.data(), code1.size());
+    EXPECT_EQ(cache.get_stats().hits, 2);
+    EXPECT_EQ(cache.get_stats().misses, 3);
+
+    // The same priority in the submission order: code1 is evicted.
+    analysis_cache fifo_cache{2 * probe.size(), 1};
+    analysis_pool fifo_pool{fifo_cache, 0};
+    fifo_pool.submit(EVMC_PETERSBURG, code1.data(), code1.size(), 0);
+    fifo_pool.submit(EVMC_PETERSBURG, code2.data(), code2.size(), 0);
+    fifo_pool.submit(EVMC_PETERSBURG, code3.data(), code3.size(), 0);
+    fifo_pool.wait();
+    fifo_cache.get(EVMC_PETERSBURG, code2.data(), code2.size());
+    fifo_cache.get(EVMC_PETERSBURG, code3.data(), code3.size());
+    EXPECT_EQ(fifo_cache.get_stats().hits, 2);
+    EXPECT_EQ(fifo_cache.get_stats().misses, 3);
+}
+
+TEST(analysis_pool, queue_full)
+{
+    analysis_cache cache;
+    analysis_pool pool{cache, 0};
+    const auto code = bytecode{push(1)};
+    for (size_t i = 0; i < analysis_pool::max_queue_size; ++i)
+        EXPECT_TRUE(pool.submit(EVMC_PETERSBURG, code.data(), code.size(), 0));
+    EXPECT_FALSE(pool.submit(EVMC_PETERSBURG, code.data(), code.size(), 0));
+
+    auto stats = pool.get_stats();
+    EXPECT_EQ(stats.queue_depth, analysis_pool::max_queue_size);
+    EXPECT_EQ(stats.max_queue_depth, analysis_pool::max_queue_size);
+    EXPECT_EQ(stats.submitted, analysis_pool::max_queue_size + 1);
+    EXPECT_EQ(stats.dropped, 1);
+
+    // The pending tasks are kept when the threads are started.
+    pool.set_num_threads(3);
+    EXPECT_EQ(pool.num_threads(), 3);
+    pool.wait();
+    stats = pool.get_stats();
+    EXPECT_EQ(stats.queue_depth, 0);
+    EXPECT_EQ(stats.completed, analysis_pool::max_queue_size);
+    EXPECT_EQ(cache.num_entries(), 1);
+    EXPECT_EQ(cache.get_stats().misses, 1);
+}
+
+TEST(analysis_pool, destroyed_with_pending_tasks)
+{
+    analysis_cache cache;
+    const auto code = bytecode{1000 * push(1)};
+    {
+        analysis_pool pool{cache, 1};
+        for (size_t i = 0; i < 100; ++i)
+            pool.submit(EVMC_PETERSBURG, code.data(), code.size(), 0);
+    }
+    EXPECT_LE(cache.num_entries(), 1);
+}
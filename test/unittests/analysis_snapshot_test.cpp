@@ -0,0 +1,232 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmone/analysis_cache.hpp>
+#include <evmone/analysis_snapshot.hpp>
+#include <evmone/threaded.hpp>
+#include <gtest/gtest.h>
+#include <test/utils/bytecode.hpp>
+#include <cstdio>
+
+using namespace evmone;
+
+namespace
+{
+constexpr auto rev = EVMC_ISTANBUL;
+
+/// The code with jumps, large pushes and fused instructions.
+const auto test_code = bytecode{push(0) + push(100) + OP_JUMPDEST + OP_DUP1 + OP_SWAP2 + OP_ADD +
+                                OP_SWAP1 + push(1) + OP_SWAP1 + OP_SUB + OP_DUP1 + push(4) +
+                                OP_JUMPI + push("ffffffffffffffffffffffffffffffffffffffff") +
+                                OP_AND + push("0102030405060708090a0b0c0d0e0f10") + OP_POP +
+                                OP_POP + OP_CALLVALUE + OP_ISZERO + push(0x30) + OP_JUMPI +
+                                OP_STOP + OP_JUMPDEST + ret(0, 0x20)};
+
+snapshot_entry make_entry(const bytes& code, uint32_t flags)
+{
+    return {rev, flags, std::make_shared<const bytes>(code),
+        std::make_shared<const code_analysis>(analyze(rev, code.data(), code.size(), flags))};
+}
+
+/// Checks the deserialized analysis is the same as the analysis of the code.
+void check_same_analysis(const snapshot_entry& entry, const bytes& code, uint32_t flags)
+{
+    EXPECT_EQ(entry.rev, rev);
+    EXPECT_EQ(entry.flags, flags);
+    EXPECT_EQ(*entry.code, code);
+
+    const auto expected = analyze(rev, code.data(), code.size(), flags);
+    const auto& a = *entry.analysis;
+    ASSERT_EQ(a.instrs.size(), expected.instrs.size());
+    for (size_t i = 0; i < a.instrs.size(); ++i)
+    {
+        EXPECT_EQ(a.instrs[i].fn, expected.instrs[i].fn) << i;
+        const auto& op_tbl = get_op_table(rev);
+        if (a.instrs[i].fn == op_tbl[OP_PUSH32].fn ||
+            a.instrs[i].fn == op_tbl[OPX_PUSH_ADDRESS_MASK_AND].fn)
+            EXPECT_EQ(*a.instrs[i].arg.push_value, *expected.instrs[i].arg.push_value) << i;
+        else
+            EXPECT_EQ(a.instrs[i].arg.number, expected.instrs[i].arg.number) << i;
+    }
+
+    ASSERT_EQ(a.labels.size(), expected.labels.size());
+    for (size_t i = 0; i < a.labels.size(); ++i)
+        EXPECT_EQ(a.labels[i], expected.labels[i]) << i;
+
+    ASSERT_EQ(a.push_values.size(), expected.push_values.size());
+    for (size_t i = 0; i < a.push_values.size(); ++i)
+        EXPECT_EQ(a.push_values[i], expected.push_values[i]);
+
+    ASSERT_EQ(a.jumpdest_offsets.size(), expected.jumpdest_offsets.size());
+    for (size_t i = 0; i < a.jumpdest_offsets.size(); ++i)
+    {
+        EXPECT_EQ(a.jumpdest_offsets[i], expected.jumpdest_offsets[i]);
+        EXPECT_EQ(a.jumpdest_targets[i], expected.jumpdest_targets[i]);
+    }
+    for (int offset = 0; offset < static_cast<int>(code.size()); ++offset)
+        EXPECT_EQ(find_jumpdest(a, offset), find_jumpdest(expected, offset)) << offset;
+}
+}  // namespace
+
+TEST(analysis_snapshot, round_trip)
+{
+    for (const auto flags : {0u, uint32_t{ANALYSIS_FUSION}, uint32_t{ANALYSIS_THREADED_CODE},
+             uint32_t{ANALYSIS_FUSION | ANALYSIS_THREADED_CODE}})
+    {
+        const auto snapshot = serialize_snapshot({make_entry(test_code, flags)});
+        EXPECT_EQ(snapshot.size() % 8, 0);
+
+        const auto entries = deserialize_snapshot(snapshot.data(), snapshot.size());
+        ASSERT_EQ(entries.size(), 1) << flags;
+        check_same_analysis(entries[0], test_code, flags);
+    }
+}
+
+TEST(analysis_snapshot, large_code)
+{
+    // The code too large for the dense jumpdest map, the bitmap with ranks is used.
+    auto code = bytecode{};
+    while (code.size() <= code_analysis::max_dense_jumpdest_map_code_size)
+        code += push(1) + OP_POP + OP_JUMPDEST + push("0102030405060708090a") + OP_POP;
+
+    const auto snapshot = serialize_snapshot({make_entry(code, 0)});
+    const auto entries = deserialize_snapshot(snapshot.data(), snapshot.size());
+    ASSERT_EQ(entries.size(), 1);
+    EXPECT_TRUE(entries[0].analysis->jumpdest_map.empty());
+    check_same_analysis(entries[0], code, 0);
+}
+
+TEST(analysis_snapshot, multiple_entries)
+{
+    const auto code2 = bytecode{push(1) + push(2) + OP_ADD};
+    const auto snapshot =
+        serialize_snapshot({make_entry(test_code, ANALYSIS_FUSION), make_entry(code2, 0),
+            make_entry(bytes{}, 0)});
+    const auto entries = deserialize_snapshot(snapshot.data(), snapshot.size());
+    ASSERT_EQ(entries.size(), 3);
+    check_same_analysis(entries[0], test_code, ANALYSIS_FUSION);
+    check_same_analysis(entries[1], code2, 0);
+    check_same_analysis(entries[2], bytes{}, 0);
+}
+
+TEST(analysis_snapshot, lazy_analysis_skipped)
+{
+    const auto snapshot =
+        serialize_snapshot({make_entry(test_code, ANALYSIS_LAZY), make_entry(test_code, 0)});
+    const auto entries = deserialize_snapshot(snapshot.data(), snapshot.size());
+    ASSERT_EQ(entries.size(), 1);
+    EXPECT_EQ(entries[0].flags, 0);
+}
+
+TEST(analysis_snapshot, invalid_header)
+{
+    const auto snapshot = serialize_snapshot({make_entry(test_code, 0)});
+    EXPECT_EQ(deserialize_snapshot(snapshot.data(), snapshot.size()).size(), 1);
+
+    EXPECT_TRUE(deserialize_snapshot(nullptr, 0).empty());
+    EXPECT_TRUE(deserialize_snapshot(snapshot.data(), 16).empty());
+
+    // Each field of the header: the magic, the version, the op table size and the fingerprint.
+    for (const auto pos : {size_t{0}, size_t{7}, size_t{8}, size_t{12}, size_t{16}, size_t{23}})
+    {
+        auto corrupted = snapshot;
+        corrupted[pos] ^= 1;
+        EXPECT_TRUE(deserialize_snapshot(corrupted.data(), corrupted.size()).empty()) << pos;
+    }
+}
+
+TEST(analysis_snapshot, corrupted_entry)
+{
+    const auto code2 = bytecode{push(1) + push(2) + OP_ADD};
+    const auto snapshot = serialize_snapshot({make_entry(test_code, 0), make_entry(code2, 0)});
+
+    // The corruption of the first entry content is detected with the checksum,
+    // the second entry is still loaded.
+    // The snapshot header is 32 bytes and the entry header is 72 bytes, followed by the code.
+    auto corrupted = snapshot;
+    corrupted[32 + 72 + 1] ^= 0xff;
+    const auto entries = deserialize_snapshot(corrupted.data(), corrupted.size());
+    ASSERT_EQ(entries.size(), 1);
+    EXPECT_EQ(*entries[0].code, code2);
+
+    // The truncated snapshot.
+    for (size_t size = 32; size < snapshot.size(); size += 8)
+    {
+        const auto truncated = deserialize_snapshot(snapshot.data(), size);
+        EXPECT_LE(truncated.size(), 1) << size;
+    }
+}
+
+TEST(analysis_snapshot, shared_fn_labels)
+{
+    // The instruction functions shared by multiple opcodes (e.g. PUSH9-PUSH32) are serialized
+    // as the first of them. This is lossless only if the threaded-code labels of such opcodes
+    // are also the same. In older revisions the labels of the instructions not defined yet
+    // are the fallback executing the function in the instruction.
+    const auto dispatch_table = get_threaded_dispatch_table();
+    if (dispatch_table == nullptr)
+        return;
+
+    const auto& op_tbl = get_op_table(EVMC_MAX_REVISION);
+    for (size_t i = 0; i < op_tbl.size(); ++i)
+    {
+        for (size_t j = 0; j < i; ++j)
+        {
+            if (op_tbl[i].fn == op_tbl[j].fn)
+            {
+                EXPECT_EQ(dispatch_table[i], dispatch_table[j]) << i << " " << j;
+            }
+        }
+    }
+}
+
+TEST(analysis_snapshot, file)
+{
+    const auto path = testing::TempDir() + "evmone_analysis_snapshot_test.bin";
+    const auto snapshot = serialize_snapshot({make_entry(test_code, ANALYSIS_FUSION)});
+    ASSERT_TRUE(save_snapshot_file(path.c_str(), snapshot));
+
+    const auto entries = load_snapshot_file(path.c_str());
+    ASSERT_EQ(entries.size(), 1);
+    check_same_analysis(entries[0], test_code, ANALYSIS_FUSION);
+    std::remove(path.c_str());
+
+    EXPECT_TRUE(load_snapshot_file(path.c_str()).empty());
+    EXPECT_FALSE(save_snapshot_file("/nonexistent/dir/snapshot.bin", snapshot));
+}
+
+TEST(analysis_snapshot, cache_import_export)
+{
+    const auto code2 = bytecode{push(1) + push(2) + OP_ADD};
+
+    analysis_cache cache;
+    cache.get(rev, test_code.data(), test_code.size(), ANALYSIS_FUSION);
+    cache.get(rev, code2.data(), code2.size());
+    cache.get(rev, code2.data(), code2.size(), ANALYSIS_LAZY);
+    const auto exported = cache.export_entries();
+    EXPECT_EQ(exported.size(), 3);
+
+    const auto snapshot = serialize_snapshot(exported);
+    auto entries = deserialize_snapshot(snapshot.data(), snapshot.size());
+    EXPECT_EQ(entries.size(), 2);
+
+    analysis_cache warm_cache;
+    EXPECT_EQ(warm_cache.import_entries(entries), 2);
+    EXPECT_EQ(warm_cache.num_entries(), 2);
+
+    // The imported analyses are hits.
+    const auto a1 = warm_cache.get(rev, test_code.data(), test_code.size(), ANALYSIS_FUSION);
+    const auto a2 = warm_cache.get(rev, code2.data(), code2.size());
+    EXPECT_EQ(warm_cache.get_stats().hits, 2);
+    EXPECT_EQ(warm_cache.get_stats().misses, 0);
+    EXPECT_TRUE(a1 == entries[0].analysis || a1 == entries[1].analysis);
+    EXPECT_TRUE(a2 == entries[0].analysis || a2 == entries[1].analysis);
+
+    // The entries already cached are not imported again.
+    EXPECT_EQ(warm_cache.import_entries(entries), 0);
+    EXPECT_EQ(warm_cache.num_entries(), 2);
+
+    analysis_cache disabled_cache{0};
+    EXPECT_EQ(disabled_cache.import_entries(std::move(entries)), 0);
+}
@@ -4,6 +4,7 @@
 
 #include <evmc/instructions.h>
 #include <evmone/analysis.hpp>
+#include <evmone/threaded.hpp>
 #include <gtest/gtest.h>
 #include <test/utils/bytecode.hpp>
 #include <test/utils/utils.hpp>
@@ -148,7 +149,7 @@ TEST(analysis, jumpdests_groups)
     const auto code = 3 * OP_JUMPDEST + push(1) + 3 * OP_JUMPDEST + push(2) + OP_JUMPI;
     auto analysis = evmone::analyze(rev, &code[0], code.size());
 
-    ASSERT_EQ(analysis.instrs.size(), 11);
+    ASSERT_EQ(analysis.instrs.size(), 10);
     EXPECT_EQ(analysis.instrs[0].fn, op_tbl[OP_JUMPDEST].fn);
     EXPECT_EQ(analysis.instrs[1].fn, op_tbl[OP_JUMPDEST].fn);
     EXPECT_EQ(analysis.instrs[2].fn, op_tbl[OP_JUMPDEST].fn);
@@ -156,10 +157,10 @@ TEST(analysis, jumpdests_groups)
     EXPECT_EQ(analysis.instrs[4].fn, op_tbl[OP_JUMPDEST].fn);
     EXPECT_EQ(analysis.instrs[5].fn, op_tbl[OP_JUMPDEST].fn);
     EXPECT_EQ(analysis.instrs[6].fn, op_tbl[OP_JUMPDEST].fn);
-    EXPECT_EQ(analysis.instrs[7].fn, op_tbl[OP_PUSH1].fn);
-    EXPECT_EQ(analysis.instrs[8].fn, op_tbl[OP_JUMPI].fn);
-    EXPECT_EQ(analysis.instrs[9].fn, op_tbl[OPX_BEGINBLOCK].fn);
-    EXPECT_EQ(analysis.instrs[10].fn, op_tbl[OP_STOP].fn);
+    EXPECT_EQ(analysis.instrs[7].fn, op_tbl[OPX_STATIC_JUMPI].fn);
+    EXPECT_EQ(analysis.instrs[7].arg.number, 2);
+    EXPECT_EQ(analysis.instrs[8].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(analysis.instrs[9].fn, op_tbl[OP_STOP].fn);
 
 
     ASSERT_EQ(analysis.jumpdest_offsets.size(), 6);
@@ -176,4 +177,354 @@ TEST(analysis, jumpdests_groups)
     EXPECT_EQ(analysis.jumpdest_targets[4], 5);
     EXPECT_EQ(analysis.jumpdest_offsets[5], 7);
     EXPECT_EQ(analysis.jumpdest_targets[5], 6);
-}
\ No newline at end of file
+}
+
+TEST(analysis, static_jumps)
+{
+    const auto code = push(4) + OP_JUMP + OP_STOP + OP_JUMPDEST + push(0) + push(4) + OP_JUMPI +
+                      push(0xff) + OP_JUMP + push(4) + OP_JUMPDEST + OP_JUMP;
+    const auto analysis = analyze(rev, &code[0], code.size());
+
+    ASSERT_EQ(analysis.instrs.size(), 15);
+    EXPECT_EQ(analysis.instrs[0].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(analysis.instrs[1].fn, op_tbl[OPX_STATIC_JUMP].fn);
+    EXPECT_EQ(analysis.instrs[1].arg.number, 4);
+    EXPECT_EQ(analysis.instrs[2].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(analysis.instrs[3].fn, op_tbl[OP_STOP].fn);
+    EXPECT_EQ(analysis.instrs[4].fn, op_tbl[OP_JUMPDEST].fn);
+    EXPECT_EQ(analysis.instrs[5].fn, op_tbl[OP_PUSH1].fn);
+    EXPECT_EQ(analysis.instrs[6].fn, op_tbl[OPX_STATIC_JUMPI].fn);
+    EXPECT_EQ(analysis.instrs[6].arg.number, 4);
+    EXPECT_EQ(analysis.instrs[7].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(analysis.instrs[8].fn, op_tbl[OPX_STATIC_JUMP].fn);
+    EXPECT_EQ(analysis.instrs[8].arg.number, -1);  // Invalid jump destination.
+
+    // The PUSH and JUMP in different blocks are not combined.
+    EXPECT_EQ(analysis.instrs[9].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(analysis.instrs[10].fn, op_tbl[OP_PUSH1].fn);
+    EXPECT_EQ(analysis.instrs[11].fn, op_tbl[OP_JUMPDEST].fn);
+    EXPECT_EQ(analysis.instrs[12].fn, op_tbl[OP_JUMP].fn);
+    EXPECT_EQ(analysis.instrs[13].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(analysis.instrs[14].fn, op_tbl[OP_STOP].fn);
+}
+
+TEST(analysis, fusion)
+{
+    const auto code = bytecode{OP_JUMPDEST} + push(1) + OP_ADD + OP_DUP2 + OP_SWAP3 + OP_SWAP2 +
+                      OP_POP + push(0x20) + OP_MLOAD + push(std::string(40, 'f')) + OP_AND +
+                      OP_ISZERO + push(0) + OP_JUMPI;
+    const auto analysis = analyze(rev, &code[0], code.size(), ANALYSIS_FUSION);
+
+    ASSERT_EQ(analysis.instrs.size(), 9);
+    EXPECT_EQ(analysis.instrs[0].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(analysis.instrs[1].fn, op_tbl[OPX_PUSH_ADD].fn);
+    EXPECT_EQ(analysis.instrs[1].arg.small_push_value, 1);
+    EXPECT_EQ(analysis.instrs[2].fn, op_tbl[OPX_DUP_SWAP].fn);
+    EXPECT_EQ(analysis.instrs[2].arg.number, 2 | (3 << 8));
+    EXPECT_EQ(analysis.instrs[3].fn, op_tbl[OPX_SWAP_POP].fn);
+    EXPECT_EQ(analysis.instrs[3].arg.number, 2);
+    EXPECT_EQ(analysis.instrs[4].fn, op_tbl[OPX_PUSH_MLOAD].fn);
+    EXPECT_EQ(analysis.instrs[4].arg.small_push_value, 0x20);
+    EXPECT_EQ(analysis.instrs[5].fn, op_tbl[OPX_PUSH_ADDRESS_MASK_AND].fn);
+    EXPECT_EQ(analysis.instrs[6].fn, op_tbl[OPX_ISZERO_STATIC_JUMPI].fn);
+    EXPECT_EQ(analysis.instrs[6].arg.number, 0);
+    EXPECT_EQ(analysis.instrs[7].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(analysis.instrs[8].fn, op_tbl[OP_STOP].fn);
+
+    // The block information is the same as without the fusion.
+    const auto unfused = analyze(rev, &code[0], code.size());
+    ASSERT_EQ(unfused.instrs.size(), 15);
+    EXPECT_EQ(unfused.instrs[1].fn, op_tbl[OP_PUSH1].fn);
+    EXPECT_EQ(unfused.instrs[2].fn, op_tbl[OP_ADD].fn);
+    const auto& block = analysis.instrs[0].arg.block;
+    const auto& unfused_block = unfused.instrs[0].arg.block;
+    EXPECT_EQ(block.gas_cost, unfused_block.gas_cost);
+    EXPECT_EQ(block.stack_req, unfused_block.stack_req);
+    EXPECT_EQ(block.stack_max_growth, unfused_block.stack_max_growth);
+}
+
+TEST(analysis, fusion_limits)
+{
+    // Not fused: across the block boundary, the large PUSH, the mask other than 2^160 - 1.
+    const auto code = push(1) + OP_JUMPDEST + OP_ADD + push("010203040506070809") + OP_ADD +
+                      push(std::string(38, 'f')) + OP_AND;
+    const auto analysis = analyze(rev, &code[0], code.size(), ANALYSIS_FUSION);
+
+    ASSERT_EQ(analysis.instrs.size(), 9);
+    EXPECT_EQ(analysis.instrs[1].fn, op_tbl[OP_PUSH1].fn);
+    EXPECT_EQ(analysis.instrs[2].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(analysis.instrs[3].fn, op_tbl[OP_ADD].fn);
+    EXPECT_EQ(analysis.instrs[4].fn, op_tbl[OP_PUSH9].fn);
+    EXPECT_EQ(analysis.instrs[5].fn, op_tbl[OP_ADD].fn);
+    EXPECT_EQ(analysis.instrs[6].fn, op_tbl[OP_PUSH19].fn);
+    EXPECT_EQ(analysis.instrs[7].fn, op_tbl[OP_AND].fn);
+}
+
+TEST(analysis, fusion_revision)
+{
+    // The SHL and SHR are undefined before Constantinople.
+    const auto code = push(1) + OP_SHL;
+    const auto byzantium = analyze(EVMC_BYZANTIUM, &code[0], code.size(), ANALYSIS_FUSION);
+    ASSERT_EQ(byzantium.instrs.size(), 4);
+    EXPECT_EQ(byzantium.instrs[2].fn, get_op_table(EVMC_BYZANTIUM)[OP_SHL].fn);
+
+    const auto& constantinople_tbl = get_op_table(EVMC_CONSTANTINOPLE);
+    const auto constantinople =
+        analyze(EVMC_CONSTANTINOPLE, &code[0], code.size(), ANALYSIS_FUSION);
+    ASSERT_EQ(constantinople.instrs.size(), 3);
+    EXPECT_EQ(constantinople.instrs[1].fn, constantinople_tbl[OPX_PUSH_SHL].fn);
+}
+
+TEST(analysis, threaded_code_labels)
+{
+    const auto code = push(1) + OP_SHL + OP_JUMPDEST + OP_ADDRESS;
+    const auto analysis = analyze(rev, &code[0], code.size(), ANALYSIS_THREADED_CODE);
+
+    const auto dispatch_table = get_threaded_dispatch_table();
+    if (dispatch_table == nullptr)
+    {
+        EXPECT_EQ(analysis.labels.size(), 0);
+        return;
+    }
+
+    ASSERT_EQ(analysis.instrs.size(), 6);
+    ASSERT_EQ(analysis.labels.size(), analysis.instrs.size());
+    const auto fallback = dispatch_table[op_table_size];
+    EXPECT_EQ(analysis.labels[0], dispatch_table[OPX_BEGINBLOCK]);
+    EXPECT_EQ(analysis.labels[1], dispatch_table[OP_PUSH1]);
+    EXPECT_EQ(analysis.labels[2], fallback);  // The SHL is undefined in Byzantium.
+    EXPECT_EQ(analysis.labels[3], dispatch_table[OPX_BEGINBLOCK]);
+    EXPECT_EQ(analysis.labels[4], fallback);
+    EXPECT_EQ(analysis.labels[5], dispatch_table[OP_STOP]);
+    EXPECT_NE(dispatch_table[OP_SHL], fallback);
+
+    EXPECT_EQ(analyze(rev, &code[0], code.size()).labels.size(), 0);
+}
+
+TEST(analysis, precharge)
+{
+    const auto code = mstore(0x40, 0x80) + sha3(0, 0x20) + push(0x0100) + push(2) + OP_EXP +
+                      push(0x20) + push(0) + push(0x60) + OP_CODECOPY + OP_DUP1 + OP_MLOAD +
+                      push(0) + OP_JUMPDEST + OP_MLOAD;
+    const auto analysis = analyze(rev, &code[0], code.size(), ANALYSIS_PRECHARGE);
+
+    ASSERT_EQ(analysis.instrs.size(), 21);
+    EXPECT_EQ(analysis.instrs[0].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(analysis.instrs[1].fn, op_tbl[OPX_PRECHARGE_MEMORY].fn);
+    EXPECT_EQ(analysis.instrs[1].arg.number, 0x80);
+    EXPECT_EQ(analysis.instrs[4].fn, op_tbl[OPX_PRECHARGED_MSTORE].fn);
+    EXPECT_EQ(analysis.instrs[7].fn, op_tbl[OPX_PRECHARGED_SHA3].fn);
+    EXPECT_EQ(analysis.instrs[10].fn, op_tbl[OPX_PRECHARGED_EXP].fn);
+    EXPECT_EQ(analysis.instrs[14].fn, op_tbl[OPX_PRECHARGED_CODECOPY].fn);
+    EXPECT_EQ(analysis.instrs[15].fn, op_tbl[OP_DUP1].fn);
+    EXPECT_EQ(analysis.instrs[16].fn, op_tbl[OP_MLOAD].fn);  // The offset is unknown.
+    EXPECT_EQ(analysis.instrs[18].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(analysis.instrs[19].fn, op_tbl[OP_MLOAD].fn);  // Pushed in the previous block.
+
+    // The block base gas cost includes the dynamic costs of SHA3, EXP and CODECOPY.
+    const auto unprecharged = analyze(rev, &code[0], code.size());
+    ASSERT_EQ(unprecharged.instrs.size(), 20);
+    EXPECT_EQ(analysis.instrs[0].arg.block.gas_cost,
+        unprecharged.instrs[0].arg.block.gas_cost + 6 + 2 * 50 + 3);
+    EXPECT_EQ(find_jumpdest(analysis, 27), 18);
+}
+
+TEST(analysis, precharge_barrier)
+{
+    // The instructions after MSIZE are not precharged.
+    const auto code = push(0) + OP_MLOAD + OP_MSIZE + push(0x20) + OP_MLOAD + push(0) +
+                      push(0) + push(0) + OP_CALLDATACOPY;
+    const auto analysis =
+        analyze(rev, &code[0], code.size(), ANALYSIS_PRECHARGE | ANALYSIS_CODE_OFFSETS);
+
+    ASSERT_EQ(analysis.instrs.size(), 12);
+    EXPECT_EQ(analysis.instrs[1].fn, op_tbl[OPX_PRECHARGE_MEMORY].fn);
+    EXPECT_EQ(analysis.instrs[1].arg.number, 0x20);
+    EXPECT_EQ(analysis.instrs[3].fn, op_tbl[OPX_PRECHARGED_MLOAD].fn);
+    EXPECT_EQ(analysis.instrs[6].fn, op_tbl[OP_MLOAD].fn);
+    EXPECT_EQ(analysis.instrs[10].fn, op_tbl[OP_CALLDATACOPY].fn);
+
+    // The injected instruction has the offset of the block start.
+    ASSERT_EQ(analysis.code_offsets.size(), analysis.instrs.size());
+    EXPECT_EQ(analysis.code_offsets[1], 0);
+    EXPECT_EQ(analysis.code_offsets[2], 0);
+    EXPECT_EQ(analysis.code_offsets[3], 2);
+}
+
+TEST(analysis, precharge_fusion)
+{
+    // The empty SHA3 touches no memory, so its offset does not have to be known.
+    const auto code = push(0x40) + OP_MLOAD + push(0) + OP_CALLVALUE + OP_SHA3 + push(0) + OP_JUMP;
+    const auto analysis =
+        analyze(rev, &code[0], code.size(), ANALYSIS_PRECHARGE | ANALYSIS_FUSION);
+
+    ASSERT_EQ(analysis.instrs.size(), 9);
+    EXPECT_EQ(analysis.instrs[1].fn, op_tbl[OPX_PRECHARGE_MEMORY].fn);
+    EXPECT_EQ(analysis.instrs[1].arg.number, 0x60);
+    EXPECT_EQ(analysis.instrs[2].fn, op_tbl[OPX_PRECHARGED_PUSH_MLOAD].fn);
+    EXPECT_EQ(analysis.instrs[2].arg.small_push_value, 0x40);
+    EXPECT_EQ(analysis.instrs[5].fn, op_tbl[OPX_PRECHARGED_SHA3].fn);
+    EXPECT_EQ(analysis.instrs[6].fn, op_tbl[OPX_STATIC_JUMP].fn);
+    EXPECT_EQ(analysis.instrs[6].arg.number, -1);
+}
+
+TEST(analysis, elide_checks)
+{
+    // The stack heights are known from the code start to the JUMPDESTs.
+    const auto code = push(7) + push(1) + push(0) + OP_JUMPI + OP_POP + 3 * OP_JUMPDEST +
+                      OP_DUP1 + OP_POP + OP_JUMPDEST + OP_POP;
+    const auto analysis = analyze(rev, &code[0], code.size(), ANALYSIS_ELIDE_CHECKS);
+
+    ASSERT_EQ(analysis.instrs.size(), 14);
+    EXPECT_EQ(analysis.instrs[0].fn, op_tbl[OPX_BEGINBLOCK_GAS].fn);
+    EXPECT_EQ(analysis.instrs[3].fn, op_tbl[OPX_STATIC_JUMPI].fn);
+    EXPECT_EQ(analysis.instrs[4].fn, op_tbl[OPX_BEGINBLOCK_GAS].fn);
+    EXPECT_EQ(analysis.instrs[4].arg.block.gas_cost, 2u);
+    EXPECT_EQ(analysis.instrs[5].fn, op_tbl[OP_POP].fn);
+
+    // The first two JUMPDESTs form the run of empty blocks before the block using the stack.
+    EXPECT_EQ(analysis.instrs[6].fn, op_tbl[OPX_EMPTY_BLOCKS].fn);
+    EXPECT_EQ(analysis.instrs[6].arg.number, 2 | (int64_t{2} << 32));
+    EXPECT_EQ(analysis.instrs[7].fn, op_tbl[OPX_EMPTY_BLOCKS].fn);
+    EXPECT_EQ(analysis.instrs[7].arg.number, 1 | (int64_t{1} << 32));
+    EXPECT_EQ(analysis.instrs[8].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(analysis.instrs[11].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(analysis.instrs[13].fn, op_tbl[OP_STOP].fn);
+    EXPECT_EQ(find_jumpdest(analysis, 8), 6);
+    EXPECT_EQ(find_jumpdest(analysis, 9), 7);
+
+    // The block after JUMPI needing more than the known stack height keeps the checks.
+    const auto underflow = push(1) + push(0) + OP_JUMPI + OP_POP;
+    const auto underflow_analysis =
+        analyze(rev, &underflow[0], underflow.size(), ANALYSIS_ELIDE_CHECKS);
+    ASSERT_EQ(underflow_analysis.instrs.size(), 6);
+    EXPECT_EQ(underflow_analysis.instrs[0].fn, op_tbl[OPX_BEGINBLOCK_GAS].fn);
+    EXPECT_EQ(underflow_analysis.instrs[3].fn, op_tbl[OPX_BEGINBLOCK].fn);
+}
+
+TEST(analysis, elide_checks_static_jumps)
+{
+    // The loop keeps the stack height, known at the JUMPDEST from both of its predecessors.
+    const auto code = push(0) + OP_JUMPDEST + push(1) + OP_ADD + OP_DUP1 + push(2) + OP_JUMPI +
+                      OP_POP;
+    const auto analysis = analyze(rev, &code[0], code.size(), ANALYSIS_ELIDE_CHECKS);
+
+    ASSERT_EQ(analysis.instrs.size(), 10);
+    EXPECT_EQ(analysis.instrs[0].fn, op_tbl[OPX_BEGINBLOCK_GAS].fn);
+    EXPECT_EQ(analysis.instrs[2].fn, op_tbl[OPX_BEGINBLOCK_GAS].fn);
+    EXPECT_EQ(analysis.instrs[6].fn, op_tbl[OPX_STATIC_JUMPI].fn);
+    EXPECT_EQ(analysis.instrs[7].fn, op_tbl[OPX_BEGINBLOCK_GAS].fn);
+    EXPECT_EQ(find_jumpdest(analysis, 2), 2);
+
+    // The dynamic jump may enter the loop with any stack height.
+    const auto dynamic = code + OP_JUMP;
+    const auto dynamic_analysis = analyze(rev, &dynamic[0], dynamic.size(), ANALYSIS_ELIDE_CHECKS);
+    ASSERT_EQ(dynamic_analysis.instrs.size(), 12);
+    EXPECT_EQ(dynamic_analysis.instrs[0].fn, op_tbl[OPX_BEGINBLOCK_GAS].fn);
+    EXPECT_EQ(dynamic_analysis.instrs[2].fn, op_tbl[OPX_BEGINBLOCK].fn);
+    EXPECT_EQ(dynamic_analysis.instrs[7].fn, op_tbl[OPX_BEGINBLOCK].fn);
+}
+
+TEST(analysis, elide_checks_labels)
+{
+    const auto code = 2 * OP_JUMPDEST;
+    const auto analysis =
+        analyze(rev, &code[0], code.size(), ANALYSIS_ELIDE_CHECKS | ANALYSIS_THREADED_CODE);
+
+    const auto dispatch_table = get_threaded_dispatch_table();
+    if (dispatch_table == nullptr)
+        return;
+
+    ASSERT_EQ(analysis.instrs.size(), 3);
+    EXPECT_EQ(analysis.labels[0], dispatch_table[OPX_EMPTY_BLOCKS]);
+    EXPECT_EQ(analysis.labels[1], dispatch_table[OPX_BEGINBLOCK_GAS]);
+    EXPECT_NE(dispatch_table[OPX_EMPTY_BLOCKS], dispatch_table[op_table_size]);
+    EXPECT_NE(dispatch_table[OPX_BEGINBLOCK_GAS], dispatch_table[op_table_size]);
+}
+
+TEST(analysis, jumpdest_map_dense)
+{
+    const auto code = 3 * OP_JUMPDEST + push(1) + 3 * OP_JUMPDEST + push(2) + OP_JUMPI;
+    auto analysis = evmone::analyze(rev, &code[0], code.size());
+
+    ASSERT_EQ(analysis.jumpdest_map.size(), code.size());
+    EXPECT_TRUE(analysis.jumpdest_bitmap.empty());
+    const int expected[] = {0, 1, 2, -1, -1, 4, 5, 6, -1, -1, -1};
+    for (int offset = 0; offset < int(code.size()); ++offset)
+        EXPECT_EQ(find_jumpdest(analysis, offset), expected[offset]) << offset;
+    EXPECT_EQ(find_jumpdest(analysis, int(code.size())), -1);
+    EXPECT_EQ(find_jumpdest(analysis, std::numeric_limits<int>::max()), -1);
+}
+
+TEST(analysis, jumpdest_map_bitmap)
+{
+    // The code too big for the dense jumpdest map.
+    // Jumpdests are placed at the word boundaries of the bitmap.
+    constexpr auto n = int{code_analysis::max_dense_jumpdest_map_code_size};
+    auto code = bytes(size_t{n} + 1, OP_ADDRESS);
+    for (const auto offset : {0, 1, 63, 64, 127, 128, 1000, n - 1, n})
+        code[size_t(offset)] = OP_JUMPDEST;
+    auto analysis = evmone::analyze(rev, &code[0], code.size());
+
+    EXPECT_TRUE(analysis.jumpdest_map.empty());
+    ASSERT_EQ(analysis.jumpdest_bitmap.size(), n / 64 + 1);
+    ASSERT_EQ(analysis.jumpdest_targets.size(), 9);
+    for (size_t i = 0; i < analysis.jumpdest_offsets.size(); ++i)
+    {
+        EXPECT_EQ(find_jumpdest(analysis, analysis.jumpdest_offsets[i]),
+            analysis.jumpdest_targets[i]);
+    }
+    for (const auto offset : {2, 62, 65, 126, 129, 999, 1001, n - 2, n + 1, n + 64})
+        EXPECT_EQ(find_jumpdest(analysis, offset), -1) << offset;
+}
+
+TEST(analysis, arena_layout)
+{
+    static_assert(!std::is_copy_constructible_v<code_analysis>);
+    static_assert(std::is_nothrow_move_constructible_v<code_analysis>);
+
+    const auto code = push(0x0102030405060708) + push("ff00000000000000000000000000000000") +
+                      OP_JUMPDEST + push(1) + OP_JUMPI;
+    const auto analysis =
+        evmone::analyze(rev, &code[0], code.size(), evmone::ANALYSIS_THREADED_CODE);
+
+    ASSERT_EQ(analysis.instrs.size(), 7);
+    if (get_threaded_dispatch_table() != nullptr)
+        EXPECT_EQ(analysis.labels.size(), analysis.instrs.size());
+    ASSERT_EQ(analysis.push_values.size(), 1);
+    ASSERT_EQ(analysis.jumpdest_offsets.size(), 1);
+    ASSERT_EQ(analysis.jumpdest_targets.size(), 1);
+    ASSERT_EQ(analysis.jumpdest_map.size(), code.size());
+    EXPECT_TRUE(analysis.jumpdest_bitmap.empty());
+    EXPECT_TRUE(analysis.jumpdest_rank.empty());
+
+    // The arrays follow each other in the exactly sized arena.
+    const auto arena_begin = analysis.arena.get();
+    const auto arena_end = arena_begin + analysis.arena_size;
+    const auto bytes_begin = [](auto s) { return reinterpret_cast<const uint8_t*>(s.begin()); };
+    const auto bytes_end = [](auto s) { return reinterpret_cast<const uint8_t*>(s.end()); };
+    EXPECT_EQ(bytes_begin(analysis.instrs), arena_begin);
+    EXPECT_LE(bytes_end(analysis.instrs), bytes_begin(analysis.labels));
+    EXPECT_LE(bytes_end(analysis.labels), bytes_begin(analysis.push_values));
+    EXPECT_LE(bytes_end(analysis.push_values), bytes_begin(analysis.jumpdest_offsets));
+    EXPECT_LE(bytes_end(analysis.jumpdest_offsets), bytes_begin(analysis.jumpdest_targets));
+    EXPECT_LE(bytes_end(analysis.jumpdest_targets), bytes_begin(analysis.jumpdest_map));
+    EXPECT_EQ(bytes_end(analysis.jumpdest_map), arena_end);
+
+    // The instructions point to the push values in the arena.
+    EXPECT_EQ(analysis.instrs[2].arg.push_value, &analysis.push_values[0]);
+    EXPECT_EQ(analysis.push_values[0], intx::uint256{0xff} << 128);
+}
+
+TEST(analysis, arena_move)
+{
+    const auto code = push("ff00000000000000000000000000000000") + OP_JUMPDEST;
+    auto analysis = evmone::analyze(rev, &code[0], code.size());
+    const auto instrs = analysis.instrs.data();
+
+    const auto moved = std::move(analysis);
+    EXPECT_EQ(moved.instrs.data(), instrs);
+    EXPECT_EQ(moved.instrs[1].arg.push_value, &moved.push_values[0]);
+    EXPECT_EQ(*moved.instrs[1].arg.push_value, intx::uint256{0xff} << 128);
+    EXPECT_EQ(find_jumpdest(moved, 18), 2);
+}
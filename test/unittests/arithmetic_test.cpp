@@ -0,0 +1,101 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmone/arithmetic.hpp>
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+using namespace evmone;
+using intx::uint256;
+
+namespace
+{
+/// The values around the 64-bit and 128-bit boundaries and random values of various widths.
+std::vector<uint256> make_values()
+{
+    constexpr auto max64 = ~uint64_t{0};
+    std::vector<uint256> values{1, 2, 3, 7, 255, uint256{1} << 63, max64, uint256{max64} + 1,
+        arith::make_u128(max64, max64), uint256{1} << 128, uint256{1} << 255, ~uint256{0},
+        ~uint256{0} - 1};
+
+    std::mt19937_64 rng{5};
+    for (const auto width : {1, 2, 4})
+    {
+        for (int n = 0; n < 8; ++n)
+        {
+            uint256 x;
+            const auto w = intx::as_words(x);
+            for (int i = 0; i < width; ++i)
+                w[i] = rng() >> (n * 7);
+            values.push_back(x);
+        }
+    }
+    return values;
+}
+}  // namespace
+
+TEST(arithmetic, fits_u64)
+{
+    EXPECT_TRUE(arith::fits_u64(0));
+    EXPECT_TRUE(arith::fits_u64(~uint64_t{0}));
+    EXPECT_FALSE(arith::fits_u64(uint256{1} << 64));
+    EXPECT_FALSE(arith::fits_u64(uint256{1} << 255));
+    EXPECT_EQ(arith::low_u64(arith::make_u128(5, 7)), 5);
+    EXPECT_EQ(arith::make_u128(5, 7), (uint256{7} << 64) + 5);
+}
+
+TEST(arithmetic, binary_ops)
+{
+    const auto values = make_values();
+    for (const auto& a : values)
+    {
+        EXPECT_EQ(arith::mul(a, 0), 0);
+        EXPECT_EQ(arith::div(0, a), 0);
+        for (const auto& b : values)
+        {
+            EXPECT_EQ(arith::mul(a, b), a * b);
+            EXPECT_EQ(arith::div(a, b), a / b);
+            EXPECT_EQ(arith::mod(a, b), a % b);
+            EXPECT_EQ(arith::sdiv(a, b), intx::sdivrem(a, b).quot);
+            EXPECT_EQ(arith::smod(a, b), intx::sdivrem(a, b).rem);
+        }
+    }
+}
+
+TEST(arithmetic, modular_ops)
+{
+    const auto values = make_values();
+    for (const auto& x : values)
+    {
+        for (const auto& y : values)
+        {
+            for (const auto& m : {uint256{1}, uint256{3}, uint256{~uint64_t{0}},
+                     uint256{1} << 64, ~uint256{0}})
+            {
+                EXPECT_EQ(arith::addmod(x, y, m), intx::addmod(x, y, m));
+                EXPECT_EQ(arith::mulmod(x, y, m), intx::mulmod(x, y, m));
+            }
+        }
+    }
+}
+
+TEST(arithmetic, exp)
+{
+    const auto values = make_values();
+    for (const auto& base : values)
+    {
+        for (const auto& exponent : {uint256{0}, uint256{1}, uint256{2}, uint256{3},
+                 uint256{63}, uint256{64}, uint256{255}, uint256{256}, uint256{1000},
+                 uint256{1} << 64, ~uint256{0}})
+        {
+            EXPECT_EQ(arith::exp(base, exponent), intx::exp(base, exponent));
+        }
+    }
+
+    EXPECT_EQ(arith::exp(2, 255), uint256{1} << 255);
+    EXPECT_EQ(arith::exp(2, 256), 0);
+    EXPECT_EQ(arith::exp(0, 0), 1);
+    EXPECT_EQ(arith::exp(0, 5), 0);
+}
@@ -0,0 +1,60 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmone/batch_workers.hpp>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <thread>
+
+using namespace evmone;
+
+TEST(batch_workers, run)
+{
+    batch_workers workers;
+    for (size_t num_threads = 0; num_threads <= 4; ++num_threads)
+    {
+        std::mutex mutex;
+        std::set<std::thread::id> ids;
+        workers.run(num_threads, [&]() noexcept {
+            std::lock_guard lock{mutex};
+            ids.insert(std::this_thread::get_id());
+        });
+        EXPECT_EQ(ids.size(), num_threads + 1);
+        EXPECT_EQ(ids.count(std::this_thread::get_id()), 1);
+    }
+}
+
+TEST(batch_workers, threads_reused)
+{
+    batch_workers workers;
+    std::mutex mutex;
+    std::set<std::thread::id> ids;
+    const auto job = [&]() noexcept {
+        std::lock_guard lock{mutex};
+        ids.insert(std::this_thread::get_id());
+    };
+    for (size_t i = 0; i < 100; ++i)
+        workers.run(2, job);
+    EXPECT_EQ(ids.size(), 3);
+}
+
+TEST(batch_workers, concurrent_runs)
+{
+    batch_workers workers;
+    std::atomic<size_t> num_jobs{0};
+    const auto job = [&num_jobs]() noexcept { ++num_jobs; };
+    std::thread other{[&] {
+        for (size_t i = 0; i < 100; ++i)
+            workers.run(3, job);
+    }};
+    for (size_t i = 0; i < 100; ++i)
+        workers.run(2, job);
+    other.join();
+
+    // The run finding the threads busy executes the job only in the calling thread.
+    EXPECT_GE(num_jobs.load(), 200);
+    EXPECT_LE(num_jobs.load(), 100 * 3 + 100 * 4);
+}
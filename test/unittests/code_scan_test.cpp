@@ -0,0 +1,116 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmone/code_scan.hpp>
+#include <gtest/gtest.h>
+#include <test/utils/bytecode.hpp>
+#include <random>
+#include <vector>
+
+using namespace evmone;
+
+namespace
+{
+/// The scan result with the bitmap for comparisons.
+struct scan_result
+{
+    size_t num_jumpdests;
+    size_t num_large_pushes;
+    std::vector<uint64_t> bitmap;
+};
+
+/// The reference implementation processing the code byte by byte.
+scan_result scan_reference(const bytes& code)
+{
+    scan_result r{0, 0, std::vector<uint64_t>((code.size() + 63) / 64)};
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        const auto op = code[i];
+        if (op == OP_JUMPDEST)
+        {
+            r.bitmap[i / 64] |= uint64_t{1} << (i % 64);
+            ++r.num_jumpdests;
+        }
+        else if (op >= OP_PUSH1 && op <= OP_PUSH32)
+        {
+            const auto push_size = size_t(op - OP_PUSH1 + 1);
+            r.num_large_pushes += push_size > 8;
+            i += push_size;
+        }
+    }
+    return r;
+}
+
+scan_result scan(const bytes& code)
+{
+    scan_result r{0, 0, std::vector<uint64_t>((code.size() + 63) / 64, 0xbad)};
+    const auto s = scan_code(code.data(), code.size(), r.bitmap.data());
+    r.num_jumpdests = s.num_jumpdests;
+    r.num_large_pushes = s.num_large_pushes;
+    return r;
+}
+
+void check_scan(const bytes& code)
+{
+    const auto expected = scan_reference(code);
+    const auto r = scan(code);
+    EXPECT_EQ(r.num_jumpdests, expected.num_jumpdests);
+    EXPECT_EQ(r.num_large_pushes, expected.num_large_pushes);
+    EXPECT_EQ(r.bitmap, expected.bitmap);
+}
+}  // namespace
+
+TEST(code_scan, empty)
+{
+    const auto r = scan_code(nullptr, 0, nullptr);
+    EXPECT_EQ(r.num_jumpdests, 0);
+    EXPECT_EQ(r.num_large_pushes, 0);
+}
+
+TEST(code_scan, jumpdests)
+{
+    const auto code = OP_JUMPDEST + push(0x5b) + OP_JUMPDEST + push("5b5b5b5b5b5b5b5b5b5b") +
+                      bytecode{OP_JUMPDEST} + OP_PUSH2;
+    const auto r = scan(code);
+    EXPECT_EQ(r.num_jumpdests, 3);
+    EXPECT_EQ(r.num_large_pushes, 1);
+    ASSERT_EQ(r.bitmap.size(), 1);
+    EXPECT_EQ(r.bitmap[0], (uint64_t{1} << 0) | (uint64_t{1} << 3) | (uint64_t{1} << 15));
+    check_scan(code);
+}
+
+TEST(code_scan, push_across_chunks)
+{
+    // The PUSH32 at every position around the chunk boundaries,
+    // followed by the code of JUMPDESTs.
+    for (size_t pos = 0; pos < 140; ++pos)
+        check_scan(bytecode{bytes(pos, OP_ADD)} + OP_PUSH32 + bytecode{bytes(200, OP_JUMPDEST)});
+
+    // The push data covering whole chunks.
+    auto code = bytecode{};
+    for (int i = 0; i < 20; ++i)
+        code += OP_PUSH32 + bytes(32, OP_JUMPDEST);
+    check_scan(code);
+    EXPECT_EQ(scan(code).num_jumpdests, 0);
+}
+
+TEST(code_scan, truncated_push)
+{
+    for (size_t size = 1; size < 70; ++size)
+        check_scan(bytecode{bytes(size, OP_JUMPDEST)} + OP_PUSH32 +
+                   bytecode{bytes(size, OP_JUMPDEST)});
+}
+
+TEST(code_scan, random_code)
+{
+    std::mt19937_64 rng{7};
+    std::uniform_int_distribution<int> byte_dist{0, 255};
+    for (const auto size : {1, 63, 64, 65, 127, 128, 129, 1000, 4096, 25000})
+    {
+        auto code = bytes(size_t(size), 0);
+        for (auto& b : code)
+            b = static_cast<uint8_t>(byte_dist(rng));
+        check_scan(code);
+    }
+}
@@ -145,4 +145,45 @@ TEST_F(evm_other, jumpdest_with_high_offset)
         execute(code);
         EXPECT_EQ(result.status_code, EVMC_SUCCESS) << "JUMPDEST at " << offset;
     }
-}
\ No newline at end of file
+}
+
+TEST_F(evm_other, nested_executions_are_isolated)
+{
+    /// The host executing the calls in the same VM instance.
+    class nested_host : public evmc::MockedHost
+    {
+        evmc::VM& m_vm;
+        evmc_revision m_rev;
+        bytes m_code;
+
+    public:
+        nested_host(evmc::VM& vm, evmc_revision rev, bytes code)
+          : m_vm{vm}, m_rev{rev}, m_code{std::move(code)}
+        {}
+
+        evmc::result call(const evmc_message& m) noexcept override
+        {
+            return m_vm.execute(*this, m_rev, m, m_code.data(), m_code.size());
+        }
+    };
+
+    // Returns MSIZE + 1 leaving garbage on the stack.
+    const auto inner =
+        push(0xbad) + OP_MSIZE + push(1) + OP_ADD + push(0) + OP_MSTORE + ret(0, 0x20);
+    nested_host nested{vm, rev, inner};
+
+    const auto code = mstore(0x40, push(0xaa)) + call(0).gas(0xffff).output(0, 0x20) + OP_POP +
+                      ret(0, 0x60);
+
+    msg.gas = 1000000;
+
+    // Execute twice to also reuse the execution states released by the first execution.
+    for (int i = 0; i < 2; ++i)
+    {
+        result = vm.execute(nested, rev, msg, code.data(), code.size());
+        ASSERT_EQ(result.status_code, EVMC_SUCCESS);
+        ASSERT_EQ(result.output_size, 0x60);
+        EXPECT_EQ(hex({result.output_data, result.output_size}),
+            std::string(62, '0') + "01" + std::string(64, '0') + std::string(62, '0') + "aa");
+    }
+}
@@ -319,6 +319,116 @@ TEST_F(evm, jump_over_jumpdest)
     EXPECT_GAS_USED(EVMC_SUCCESS, 3 + 8 + 1);
 }
 
+TEST_F(evm, jump_to_constant_invalid_destination)
+{
+    // The invalid constant destination fails only when the jump is taken.
+    execute(jumpi(0xff, 0) + OP_STOP);
+    EXPECT_GAS_USED(EVMC_SUCCESS, 3 + 3 + 10);
+    execute(jumpi(0xff, 1) + OP_STOP);
+    EXPECT_STATUS(EVMC_BAD_JUMP_DESTINATION);
+    execute(jump(0xff) + OP_STOP);
+    EXPECT_STATUS(EVMC_BAD_JUMP_DESTINATION);
+
+    // The destination pointing to the push data or beyond the code.
+    execute(jump(1) + OP_JUMPDEST);
+    EXPECT_STATUS(EVMC_BAD_JUMP_DESTINATION);
+    execute(jump(0xffffffffffffffff) + OP_JUMPDEST);
+    EXPECT_STATUS(EVMC_BAD_JUMP_DESTINATION);
+}
+
+TEST_F(evm, fused_push_binop)
+{
+    // The sequences fused into superinstructions by evmone. The push value is the top operand.
+    execute(push(3) + push(4) + OP_ADD + push(5) + OP_MUL + ret_top());
+    EXPECT_GAS_USED(EVMC_SUCCESS, 32);
+    EXPECT_OUTPUT_INT(35);
+    execute(push(3) + push(2) + OP_SUB + ret_top());
+    EXPECT_OUTPUT_INT(0 - uint256{1});
+    execute(push(0xf0) + push(0x3c) + OP_AND + push(0x01) + OP_OR + ret_top());
+    EXPECT_OUTPUT_INT(0x31);
+    execute(push(5) + push(5) + OP_EQ + ret_top());
+    EXPECT_OUTPUT_INT(1);
+    execute(push(5) + push(2) + OP_LT + ret_top());
+    EXPECT_OUTPUT_INT(1);
+    execute(push(5) + push(2) + OP_GT + ret_top());
+    EXPECT_OUTPUT_INT(0);
+}
+
+TEST_F(evm, fused_push_shift)
+{
+    rev = EVMC_CONSTANTINOPLE;
+    execute(push(1) + push(4) + OP_SHL + ret_top());
+    EXPECT_OUTPUT_INT(16);
+    execute(push(0x100) + push(4) + OP_SHR + ret_top());
+    EXPECT_OUTPUT_INT(0x10);
+    execute(push(1) + push(255) + OP_SHL + push(255) + OP_SHR + ret_top());
+    EXPECT_OUTPUT_INT(1);
+    execute(push(1) + push(256) + OP_SHL + ret_top());
+    EXPECT_OUTPUT_INT(0);
+    execute(push(1) + push(0xffffffff00000000) + OP_SHR + ret_top());
+    EXPECT_OUTPUT_INT(0);
+}
+
+TEST_F(evm, fused_push_mload_mstore)
+{
+    execute(mstore(0x20, 7) + push(0x20) + OP_MLOAD + ret_top());
+    EXPECT_OUTPUT_INT(7);
+    execute(push(9) + push(0x40) + OP_MSTORE + push(0x40) + OP_MLOAD + ret_top());
+    EXPECT_OUTPUT_INT(9);
+    EXPECT_GAS_USED(EVMC_SUCCESS, 4 * 3 + 3 * 3 + 9 + 6);
+
+    // The memory expansion cost is the same.
+    execute(push(0x20) + OP_MLOAD);
+    EXPECT_GAS_USED(EVMC_SUCCESS, 3 + 3 + 2 * 3);
+    execute(100, push(0xffffffffffff) + OP_MLOAD);
+    EXPECT_STATUS(EVMC_OUT_OF_GAS);
+    execute(100, push(1) + push(0xffffffffffff) + OP_MSTORE);
+    EXPECT_STATUS(EVMC_OUT_OF_GAS);
+}
+
+TEST_F(evm, fused_address_mask)
+{
+    execute(push(std::string(64, 'f')) + push(std::string(40, 'f')) + OP_AND + ret_top());
+    EXPECT_OUTPUT_INT((uint256{1} << 160) - 1);
+
+    // Other masks are not fused.
+    execute(push(std::string(64, 'f')) + push("ff" + std::string(38, '0')) + OP_AND + ret_top());
+    EXPECT_OUTPUT_INT(uint256{0xff} << 152);
+}
+
+TEST_F(evm, fused_dup_swap_pop)
+{
+    // [3, 2, 1] -> DUP3 -> [1, 3, 2, 1] -> SWAP2 -> [2, 3, 1, 1].
+    const auto stack = push(1) + push(2) + push(3) + OP_DUP3 + OP_SWAP2;
+    execute(stack + ret_top());
+    EXPECT_OUTPUT_INT(2);
+    execute(stack + OP_POP + OP_POP + ret_top());
+    EXPECT_OUTPUT_INT(1);
+
+    // [2, 3, 1, 1] -> SWAP2 -> [1, 3, 2, 1] -> POP -> [3, 2, 1].
+    execute(stack + OP_SWAP2 + OP_POP + ret_top());
+    EXPECT_OUTPUT_INT(3);
+    execute(stack + OP_SWAP2 + OP_POP + OP_POP + ret_top());
+    EXPECT_OUTPUT_INT(2);
+    execute(stack + OP_SWAP2 + OP_POP + OP_POP + OP_POP + ret_top());
+    EXPECT_OUTPUT_INT(1);
+    execute(stack + OP_SWAP2 + OP_POP);
+    EXPECT_GAS_USED(EVMC_SUCCESS, 6 * 3 + 2);
+}
+
+TEST_F(evm, fused_iszero_jumpi)
+{
+    const auto code = [](uint64_t x) {
+        return push(x) + OP_ISZERO + push(7) + OP_JUMPI + OP_INVALID + OP_JUMPDEST;
+    };
+    execute(code(0));
+    EXPECT_GAS_USED(EVMC_SUCCESS, 3 + 3 + 3 + 10 + 1);
+    execute(code(1));
+    EXPECT_STATUS(EVMC_INVALID_INSTRUCTION);
+    execute(push(0) + OP_ISZERO + push(0xff) + OP_JUMPI);
+    EXPECT_STATUS(EVMC_BAD_JUMP_DESTINATION);
+}
+
 TEST_F(evm, pc)
 {
     const auto code = OP_CALLDATASIZE + push(9) + OP_JUMPI + push(12) + OP_PC + OP_SWAP1 + OP_JUMP +
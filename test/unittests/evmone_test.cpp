@@ -3,8 +3,15 @@
 // Licensed under the Apache License, Version 2.0.
 
 #include <evmc/evmc.hpp>
+#include <evmc/mocked_host.hpp>
+#include <evmone/analysis_pool.hpp>
 #include <evmone/evmone.h>
+#include <evmone/execution.hpp>
+#include <evmone/vm.hpp>
 #include <gtest/gtest.h>
+#include <test/utils/bytecode.hpp>
+#include <cstdio>
+#include <vector>
 
 TEST(evmone, info)
 {
@@ -20,3 +27,367 @@ TEST(evmone, capabilities)
     EXPECT_EQ(vm->get_capabilities(vm), evmc_capabilities_flagset{EVMC_CAPABILITY_EVM1});
     vm->destroy(vm);
 }
+
+TEST(evmone, set_option_invalid)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    EXPECT_EQ(vm.set_option("", ""), EVMC_SET_OPTION_INVALID_NAME);
+    EXPECT_EQ(vm.set_option("o", ""), EVMC_SET_OPTION_INVALID_NAME);
+}
+
+TEST(evmone, set_option_analysis_cache_size)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    EXPECT_EQ(vm.set_option("analysis_cache_size", "0"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("analysis_cache_size", "128"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("analysis_cache_size", ""), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("analysis_cache_size", "-1"), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("analysis_cache_size", "1M"), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("analysis_cache_size", "99999999999999999999999"),
+        EVMC_SET_OPTION_INVALID_VALUE);
+}
+
+TEST(evmone, set_option_fusion)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    EXPECT_EQ(vm.set_option("fusion", "off"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("fusion", "on"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("fusion", ""), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("fusion", "1"), EVMC_SET_OPTION_INVALID_VALUE);
+}
+
+TEST(evmone, set_option_precharge)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    EXPECT_EQ(vm.set_option("precharge", "off"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("precharge", "on"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("precharge", ""), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("precharge", "1"), EVMC_SET_OPTION_INVALID_VALUE);
+}
+
+TEST(evmone, set_option_jit)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    EXPECT_EQ(vm.set_option("jit", "on"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("jit", "0"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("jit", "1000"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("jit", "off"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("jit", ""), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("jit", "-1"), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("jit", "4294967295"), EVMC_SET_OPTION_INVALID_VALUE);
+}
+
+TEST(evmone, set_option_dispatch)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    EXPECT_EQ(vm.set_option("dispatch", "call"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("dispatch", "threaded"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("dispatch", ""), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("dispatch", "jit"), EVMC_SET_OPTION_INVALID_VALUE);
+}
+
+TEST(evmone, set_option_analysis)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    EXPECT_EQ(vm.set_option("analysis", "lazy"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("analysis", "full"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("analysis", ""), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("analysis", "eager"), EVMC_SET_OPTION_INVALID_VALUE);
+}
+
+TEST(evmone, set_option_create_analysis)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    EXPECT_EQ(vm.set_option("create_analysis", "sync"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("create_analysis", "async"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("create_analysis", "off"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("create_analysis", ""), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("create_analysis", "on"), EVMC_SET_OPTION_INVALID_VALUE);
+}
+
+TEST(evmone, set_option_analysis_threads)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    EXPECT_EQ(vm.set_option("analysis_threads", "1"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("analysis_threads", "8"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("analysis_threads", "0"), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("analysis_threads", ""), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("analysis_threads", "65"), EVMC_SET_OPTION_INVALID_VALUE);
+}
+
+TEST(evmone, prefetch_analysis)
+{
+    const auto code = bytecode{push(1) + push(2) + OP_ADD + ret_top()};
+    evmc::MockedHost host;
+    evmc_message msg{};
+    msg.gas = 100000;
+
+    auto vm = evmc::VM{evmc_create_evmone()};
+    auto& evmone_vm = *static_cast<evmone::VM*>(vm.get_raw_pointer());
+    EXPECT_TRUE(evmone::prefetch_analysis(vm.get_raw_pointer(), &evmc::MockedHost::get_interface(),
+        EVMC_ISTANBUL, code.data(), code.size(), 1));
+    evmone_vm.pool.wait();
+    EXPECT_EQ(evmone_vm.cache.num_entries(), 1);
+
+    const auto r = vm.execute(host, EVMC_ISTANBUL, msg, code.data(), code.size());
+    ASSERT_EQ(r.status_code, EVMC_SUCCESS);
+    EXPECT_EQ(evmone_vm.cache.get_stats().hits, 1);
+    EXPECT_EQ(evmone_vm.cache.get_stats().misses, 1);
+
+    const auto stats = evmone::get_analysis_pool_stats(vm.get_raw_pointer());
+    EXPECT_EQ(stats.submitted, 1);
+    EXPECT_EQ(stats.completed, 1);
+    EXPECT_EQ(stats.queue_depth, 0);
+
+    // Not submitted with the cache disabled.
+    ASSERT_EQ(vm.set_option("analysis_cache_size", "0"), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_FALSE(evmone::prefetch_analysis(
+        vm.get_raw_pointer(), nullptr, EVMC_ISTANBUL, code.data(), code.size()));
+}
+
+TEST(evmone, create_analysis)
+{
+    // The init code returning the runtime code.
+    const auto runtime_code = bytecode{push(7) + ret_top()};
+    const auto init_code = mstore(0, push(runtime_code)) +
+                           ret(32 - runtime_code.size(), runtime_code.size());
+
+    evmc::MockedHost host;
+    evmc_message create_msg{};
+    create_msg.kind = EVMC_CREATE;
+    create_msg.gas = 100000;
+    evmc_message call_msg{};
+    call_msg.gas = 100000;
+
+    for (const auto mode : {"off", "sync", "async"})
+    {
+        auto vm = evmc::VM{evmc_create_evmone()};
+        auto& evmone_vm = *static_cast<evmone::VM*>(vm.get_raw_pointer());
+        const auto& cache = evmone_vm.cache;
+        ASSERT_EQ(vm.set_option("create_analysis", mode), EVMC_SET_OPTION_SUCCESS);
+
+        const auto r =
+            vm.execute(host, EVMC_ISTANBUL, create_msg, init_code.data(), init_code.size());
+        ASSERT_EQ(r.status_code, EVMC_SUCCESS);
+        ASSERT_EQ(bytes_view(r.output_data, r.output_size), runtime_code);
+        evmone_vm.pool.wait();
+
+        const auto pre_analyzed = evmone_vm.create_analysis != evmone::create_analysis_mode::off;
+        EXPECT_EQ(cache.num_entries(), pre_analyzed ? 2 : 1) << mode;
+
+        vm.execute(host, EVMC_ISTANBUL, call_msg, runtime_code.data(), runtime_code.size());
+        EXPECT_EQ(cache.get_stats().misses, 2) << mode;
+        EXPECT_EQ(cache.get_stats().hits, pre_analyzed ? 1 : 0) << mode;
+
+        // The failed create deploys nothing.
+        const auto revert_code = bytecode{push(0) + push(0) + OP_REVERT};
+        vm.execute(host, EVMC_ISTANBUL, create_msg, revert_code.data(), revert_code.size());
+        evmone_vm.pool.wait();
+        EXPECT_EQ(cache.num_entries(), 3) << mode;
+    }
+}
+
+TEST(evmone, set_option_analysis_cache_save_load)
+{
+    const auto code = push(1) + push(2) + OP_ADD + ret_top();
+    const auto path = testing::TempDir() + "evmone_test_analysis_cache.bin";
+
+    evmc::MockedHost host;
+    evmc_message msg{};
+    msg.gas = 100000;
+
+    auto vm = evmc::VM{evmc_create_evmone()};
+    const auto expected = vm.execute(host, EVMC_ISTANBUL, msg, code.data(), code.size());
+    ASSERT_EQ(vm.set_option("analysis_cache_save", path.c_str()), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("analysis_cache_save", ""), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("analysis_cache_save", "/nonexistent/dir/cache.bin"),
+        EVMC_SET_OPTION_INVALID_VALUE);
+
+    auto warm_vm = evmc::VM{evmc_create_evmone()};
+    ASSERT_EQ(warm_vm.set_option("analysis_cache_load", path.c_str()), EVMC_SET_OPTION_SUCCESS);
+    const auto r = warm_vm.execute(host, EVMC_ISTANBUL, msg, code.data(), code.size());
+    EXPECT_EQ(r.status_code, expected.status_code);
+    EXPECT_EQ(r.gas_left, expected.gas_left);
+    EXPECT_EQ(bytes_view(r.output_data, r.output_size),
+        bytes_view(expected.output_data, expected.output_size));
+    std::remove(path.c_str());
+
+    EXPECT_EQ(warm_vm.set_option("analysis_cache_load", path.c_str()),
+        EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(warm_vm.set_option("analysis_cache_load", ""), EVMC_SET_OPTION_INVALID_VALUE);
+}
+
+TEST(evmone, execute_batch)
+{
+    // Returns the sum of the input number and the storage value,
+    // reverts for the input number 0.
+    const auto code = calldataload(0) + OP_DUP1 + push(12) + OP_JUMPI + push(0) + push(0) +
+                      OP_REVERT + OP_JUMPDEST + push(0) + OP_SLOAD + OP_ADD + ret_top();
+
+    constexpr size_t count = 100;
+    std::vector<evmc::MockedHost> hosts(count);
+    std::vector<evmone::batch_host> batch_hosts;
+    std::vector<evmc::bytes32> inputs(count);
+    std::vector<evmc_message> msgs(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        hosts[i].accounts[{}].storage[{}].value.bytes[31] = 1;
+        batch_hosts.push_back({&evmc::MockedHost::get_interface(), hosts[i].to_context()});
+        inputs[i].bytes[31] = static_cast<uint8_t>(i);
+        msgs[i].gas = static_cast<int64_t>(100000 + i);
+        msgs[i].input_data = inputs[i].bytes;
+        msgs[i].input_size = sizeof(inputs[i]);
+    }
+
+    auto vm = evmc::VM{evmc_create_evmone()};
+    for (const auto num_threads : {size_t{1}, size_t{4}})
+    {
+        std::vector<evmc_result> results(count);
+        evmone::execute_batch(vm.get_raw_pointer(), EVMC_ISTANBUL, code.data(), code.size(),
+            msgs.data(), batch_hosts.data(), results.data(), count, num_threads);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const auto batch_result = evmc::result{results[i]};
+            const auto expected =
+                vm.execute(hosts[i], EVMC_ISTANBUL, msgs[i], code.data(), code.size());
+            EXPECT_EQ(batch_result.status_code, i == 0 ? EVMC_REVERT : EVMC_SUCCESS);
+            EXPECT_EQ(batch_result.status_code, expected.status_code);
+            EXPECT_EQ(batch_result.gas_left, expected.gas_left);
+            EXPECT_EQ(bytes_view(batch_result.output_data, batch_result.output_size),
+                bytes_view(expected.output_data, expected.output_size));
+            if (i != 0)
+            {
+                ASSERT_EQ(batch_result.output_size, 32);
+                EXPECT_EQ(batch_result.output_data[31], i + 1);
+            }
+        }
+    }
+
+    evmone::execute_batch(vm.get_raw_pointer(), EVMC_ISTANBUL, code.data(), code.size(), nullptr,
+        nullptr, nullptr, 0, 4);
+}
+
+TEST(evmone, dispatch_modes)
+{
+    // The loop summing numbers 1..100 (starting with the empty blocks) ending with
+    // the memory expansion, hashing and the gas check.
+    const auto code = push(0) + push(100) + 3 * OP_JUMPDEST + OP_DUP1 + OP_SWAP2 + OP_ADD +
+                      OP_SWAP1 + push(1) + OP_SWAP1 + OP_SUB + OP_DUP1 + push(4) + OP_JUMPI +
+                      OP_POP + push(0x40) + OP_MSTORE + sha3(0, 0x80) + OP_POP + OP_GAS + push(0) +
+                      OP_MSTORE + ret(0, 0x60);
+
+    evmc::MockedHost host;
+    evmc_message msg{};
+    msg.gas = 100000;
+
+    std::vector<evmc::result> results;
+    for (const auto analysis : {"full", "lazy"})
+    {
+        for (const auto dispatch : {"call", "threaded"})
+        {
+            for (const auto fusion : {"off", "on"})
+            {
+                for (const auto precharge : {"off", "on"})
+                {
+                    for (const auto jit : {"off", "0", "1"})
+                    {
+                        auto vm = evmc::VM{evmc_create_evmone()};
+                        ASSERT_EQ(vm.set_option("analysis", analysis), EVMC_SET_OPTION_SUCCESS);
+                        ASSERT_EQ(vm.set_option("dispatch", dispatch), EVMC_SET_OPTION_SUCCESS);
+                        ASSERT_EQ(vm.set_option("fusion", fusion), EVMC_SET_OPTION_SUCCESS);
+                        ASSERT_EQ(vm.set_option("precharge", precharge), EVMC_SET_OPTION_SUCCESS);
+                        ASSERT_EQ(vm.set_option("jit", jit), EVMC_SET_OPTION_SUCCESS);
+
+                        // With the threshold 1 the second execution requests the compilation.
+                        for (int i = 0; i < 2; ++i)
+                        {
+                            results.emplace_back(
+                                vm.execute(host, EVMC_ISTANBUL, msg, code.data(), code.size()));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    const auto& expected = results[0];
+    ASSERT_EQ(expected.status_code, EVMC_SUCCESS);
+    ASSERT_EQ(expected.output_size, 0x60);
+    EXPECT_EQ(expected.output_data[0x5f], 5050 % 256);
+    EXPECT_EQ(expected.output_data[0x5e], 5050 / 256);
+    for (const auto& r : results)
+    {
+        EXPECT_EQ(r.status_code, expected.status_code);
+        EXPECT_EQ(r.gas_left, expected.gas_left);
+        EXPECT_EQ(bytes_view(r.output_data, r.output_size),
+            bytes_view(expected.output_data, expected.output_size));
+    }
+}
+
+TEST(evmone, result_output_not_shared)
+{
+    // The outputs stay valid while the following executions reuse the states.
+    auto vm = evmc::VM{evmc_create_evmone()};
+    evmc::MockedHost host;
+    evmc_message msg{};
+    msg.gas = 100000;
+
+    std::vector<evmc::result> results;
+    for (uint8_t i = 1; i <= 4; ++i)
+    {
+        const auto code = mstore8(31, i) + ret(0, 32);
+        results.emplace_back(vm.execute(host, EVMC_ISTANBUL, msg, code.data(), code.size()));
+    }
+
+    for (uint8_t i = 1; i <= 4; ++i)
+    {
+        const auto& r = results[i - 1u];
+        ASSERT_EQ(r.status_code, EVMC_SUCCESS);
+        ASSERT_EQ(r.output_size, 32);
+        EXPECT_EQ(r.output_data[31], i);
+    }
+}
+
+TEST(evmone, return_data_nested)
+{
+    /// The host executing the calls with evmone.
+    class recursive_host : public evmc::MockedHost
+    {
+    public:
+        evmc::VM* vm = nullptr;
+
+        evmc::result call(const evmc_message& msg) noexcept override
+        {
+            const auto& code = accounts[msg.destination].code;
+            return vm->execute(*this, EVMC_ISTANBUL, msg, code.data(), code.size());
+        }
+    };
+
+    auto vm = evmc::VM{evmc_create_evmone()};
+    recursive_host host;
+    host.vm = &vm;
+
+    // The callee returns 64 bytes: its input and the byte 0xee.
+    const auto callee_address = evmc::address{{0xca}};
+    const auto callee = bytecode{} + OP_CALLDATASIZE + push(0) + push(0) + OP_CALLDATACOPY +
+                        mstore8(63, 0xee) + ret(0, 64);
+    host.accounts[callee_address].code = {callee.data(), callee.size()};
+
+    // Calls the callee twice, returns the return data of the second call and its size.
+    const bytecode call_callee =
+        call(push({callee_address.bytes, sizeof(callee_address)})).gas(50000).input(0, 1);
+    const auto caller = mstore8(0, 0xaa) + call_callee + OP_POP + mstore8(0, 0xbb) + call_callee +
+                        OP_POP + push(64) + push(0) + push(0) + OP_RETURNDATACOPY +
+                        OP_RETURNDATASIZE + push(64) + OP_MSTORE + ret(0, 96);
+
+    evmc_message msg{};
+    msg.gas = 200000;
+    const auto result = vm.execute(host, EVMC_ISTANBUL, msg, caller.data(), caller.size());
+    ASSERT_EQ(result.status_code, EVMC_SUCCESS);
+    ASSERT_EQ(result.output_size, 96);
+    EXPECT_EQ(result.output_data[0], 0xbb);
+    EXPECT_EQ(result.output_data[1], 0);
+    EXPECT_EQ(result.output_data[63], 0xee);
+    EXPECT_EQ(result.output_data[95], 64);
+}
@@ -0,0 +1,289 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmc/mocked_host.hpp>
+#include <evmone/analysis_pool.hpp>
+#include <evmone/jit.hpp>
+#include <gtest/gtest.h>
+#include <test/utils/bytecode.hpp>
+#include <test/utils/utils.hpp>
+
+using namespace evmone;
+
+namespace
+{
+constexpr auto rev = EVMC_ISTANBUL;
+
+struct execution_result
+{
+    evmc_status_code status;
+    int64_t gas_left;
+    bytes output;
+};
+
+/// Executes the code with the interpreter or the JIT compiled code.
+execution_result execute(
+    const bytecode& code, uint32_t flags, bool jit, int64_t gas = 1000000, bytes_view input = {})
+{
+    evmc::MockedHost host;
+    evmc_message msg{};
+    msg.gas = gas;
+    msg.input_data = input.data();
+    msg.input_size = input.size();
+
+    const auto analysis = analyze(rev, code.data(), code.size(), flags);
+    const auto state = std::make_unique<execution_state>();
+    state->reset(rev, msg, host.get_interface(), host.to_context(), code.data(), code.size());
+    state->analysis = &analysis;
+
+    if (jit)
+    {
+        const auto native = jit_code::compile(analysis, *state);
+        EXPECT_NE(native, nullptr);
+        if (native == nullptr)
+            return {};
+        native->execute(*state);
+    }
+    else
+    {
+        const auto* instr = &analysis.instrs[0];
+        while (instr != nullptr)
+            instr = instr->fn(instr, *state);
+    }
+
+    const auto gas_left =
+        (state->status == EVMC_SUCCESS || state->status == EVMC_REVERT) ? state->gas_left : 0;
+    return {state->status, gas_left,
+        bytes{&state->memory[state->output_offset], state->output_size}};
+}
+
+/// Checks the JIT compiled code has the same result as the interpreter
+/// with all the analysis modes changing the instructions.
+void expect_same_result(const bytecode& code, int64_t gas = 1000000, bytes_view input = {})
+{
+    for (const auto flags : {0u, uint32_t{ANALYSIS_FUSION},
+             uint32_t{ANALYSIS_FUSION | ANALYSIS_PRECHARGE | ANALYSIS_ELIDE_CHECKS}})
+    {
+        const auto expected = execute(code, flags, false, gas, input);
+        const auto r = execute(code, flags, true, gas, input);
+        EXPECT_EQ(r.status, expected.status) << "flags: " << flags;
+        EXPECT_EQ(r.gas_left, expected.gas_left) << "flags: " << flags;
+        EXPECT_EQ(hex(r.output), hex(expected.output)) << "flags: " << flags;
+    }
+}
+
+const auto max = push("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+const auto high = push("8000000000000000000000000000000000000000000000000000000000000000");
+const auto mixed = push("00000000000000010000000000000000ffffffffffffffff0000000000000001");
+}  // namespace
+
+TEST(jit, not_available)
+{
+    if (is_jit_available())
+        return;
+
+    const auto code = bytecode{OP_STOP};
+    const auto analysis = analyze(rev, code.data(), code.size());
+    const auto state = std::make_unique<execution_state>();
+    EXPECT_EQ(jit_code::compile(analysis, *state), nullptr);
+}
+
+TEST(jit, not_compiled_lazy)
+{
+    const auto code = bytecode{OP_STOP};
+    const auto analysis = analyze(rev, code.data(), code.size(), ANALYSIS_LAZY);
+    const auto state = std::make_unique<execution_state>();
+    EXPECT_EQ(jit_code::compile(analysis, *state), nullptr);
+}
+
+TEST(jit, arithmetic)
+{
+    if (!is_jit_available())
+        return;
+
+    const bytecode operands[][2] = {{max, push(1)}, {push(1), max}, {high, mixed}, {mixed, high},
+        {mixed, mixed}, {push(0), max}};
+
+    for (const auto& [a, b] : operands)
+    {
+        auto code = bytecode{};
+        auto offset = 0;
+        for (const auto op : {OP_ADD, OP_SUB, OP_LT, OP_GT, OP_EQ, OP_AND, OP_OR, OP_XOR, OP_MUL})
+        {
+            code += b + a + op + push(offset) + OP_MSTORE;
+            offset += 32;
+        }
+        for (const auto op : {OP_ISZERO, OP_NOT})
+        {
+            code += a + op + push(offset) + OP_MSTORE;
+            offset += 32;
+        }
+        code += ret(0, offset);
+        expect_same_result(code);
+    }
+}
+
+TEST(jit, fused)
+{
+    if (!is_jit_available())
+        return;
+
+    for (const auto& x : {max, mixed, push(0)})
+    {
+        const auto code = x + push(0xfffffffe) + OP_ADD + push(0x80) + OP_AND + x +
+                          push(0xffffffffff) + OP_OR +
+                          push("ffffffffffffffffffffffffffffffffffffffff") + OP_AND + x + push(5) +
+                          OP_SUB + push(3) + OP_DUP2 + OP_SWAP3 + OP_POP + OP_SWAP1 + OP_POP +
+                          push(0) + OP_MSTORE + push(0x20) + OP_MSTORE + push(0x40) + OP_MSTORE +
+                          ret(0, 0x60);
+        expect_same_result(code);
+    }
+}
+
+TEST(jit, stack)
+{
+    if (!is_jit_available())
+        return;
+
+    auto code = bytecode{};
+    for (uint64_t i = 1; i <= 16; ++i)
+        code += push(i * 0x0101010101010101);
+    code += max + mixed;
+    for (int i = 0; i < 16; ++i)
+    {
+        code += bytecode{static_cast<evmc_opcode>(OP_DUP1 + i)} +
+                bytecode{static_cast<evmc_opcode>(OP_SWAP1 + (15 - i))} + OP_POP;
+    }
+    for (int i = 0; i < 16; ++i)
+        code += bytecode{static_cast<evmc_opcode>(OP_SWAP1 + i)};
+    for (int i = 0; i < 8; ++i)
+        code += push(i * 32) + OP_MSTORE;
+    code += ret(0, 8 * 32);
+    expect_same_result(code);
+}
+
+TEST(jit, loops_and_jumps)
+{
+    if (!is_jit_available())
+        return;
+
+    // The loop summing 1..100 with the static jumps, then the dynamic jump to the destination
+    // from the call data.
+    const auto code = push(0) + push(100) + OP_JUMPDEST + OP_JUMPDEST + OP_DUP1 + OP_SWAP2 +
+                      OP_ADD + OP_SWAP1 + push(1) + OP_SWAP1 + OP_SUB + OP_DUP1 + OP_ISZERO +
+                      push(26) + OP_JUMPI + push(4) + OP_JUMP + OP_INVALID + 3 * OP_INVALID +
+                      OP_JUMPDEST + OP_POP + calldataload(0) + OP_JUMP + OP_JUMPDEST + push(0) +
+                      OP_MSTORE + ret(0, 0x20) + OP_JUMPDEST + OP_GAS + push(0) + OP_MSTORE +
+                      ret(0, 0x20);
+
+    for (const auto dest : {uint8_t{32}, uint8_t{41}, uint8_t{37}, uint8_t{200}})
+    {
+        bytes input(32, 0);
+        input[31] = dest;
+        expect_same_result(code, 1000000, input);
+    }
+}
+
+TEST(jit, failures)
+{
+    if (!is_jit_available())
+        return;
+
+    expect_same_result(push(1) + push(2) + OP_ADD + OP_POP, 8);
+    expect_same_result(push(1) + push(2) + OP_ADD + OP_POP, 7);
+    expect_same_result(push(1) + OP_ADD);
+    expect_same_result(OP_JUMPDEST + OP_POP);
+    expect_same_result(OP_JUMPDEST + 1025 * push(1));
+    expect_same_result(push(1) + OP_JUMPDEST + OP_DUP1 + push(2) + OP_JUMP);
+    expect_same_result(push(1) + push(1) + OP_JUMP);
+    expect_same_result(push(1) + push(1) + OP_JUMPI);
+    expect_same_result(push(3) + calldataload(0) + OP_JUMP);
+    expect_same_result(push(1) + OP_INVALID);
+    expect_same_result(mstore(0, 1) + push(0) + push(0x20) + OP_REVERT);
+    expect_same_result(OP_JUMPDEST + OP_JUMPDEST + OP_JUMPDEST + OP_STOP, 2);
+}
+
+TEST(jit, instruction_functions)
+{
+    if (!is_jit_available())
+        return;
+
+    // The instructions calling the host and observing the gas left.
+    const auto code = sstore(1, 7) + sstore(2, sload(1)) + sha3(0, 0x40) + push(0) + OP_MSTORE +
+                      push(1) + push(0) + push(0x20) + OP_LOG1 + OP_GAS + OP_MSIZE + OP_PC +
+                      push(0x20) + OP_MSTORE + push(0x40) + OP_MSTORE + push(0x60) + OP_MSTORE +
+                      ret(0, 0x80);
+    expect_same_result(code);
+    expect_same_result(code, 30000);
+}
+
+TEST(jit_tier, threshold)
+{
+    const auto code = push(1) + push(2) + OP_ADD + ret_top();
+    const auto analysis = analyze(rev, code.data(), code.size(), ANALYSIS_JIT);
+    ASSERT_NE(analysis.jit, nullptr);
+    auto& tier = *analysis.jit;
+
+    EXPECT_FALSE(tier.count(2));
+    EXPECT_FALSE(tier.count(2));
+    EXPECT_EQ(tier.num_executions(), 2);
+    EXPECT_TRUE(tier.count(2));
+    EXPECT_FALSE(tier.count(2));
+    EXPECT_EQ(tier.num_executions(), 4);
+
+    // The cancelled request is repeated by the next execution.
+    tier.cancel(2);
+    EXPECT_TRUE(tier.count(2));
+
+    // The code is interpreted until the compiled code is published.
+    EXPECT_EQ(tier.code(), nullptr);
+    EXPECT_EQ(tier.memory_size(), 0);
+    tier.compile(analysis);
+    const auto native = tier.code();
+    if (!is_jit_available())
+    {
+        EXPECT_EQ(native, nullptr);
+        return;
+    }
+    ASSERT_NE(native, nullptr);
+    EXPECT_GT(native->size(), 0);
+    EXPECT_GT(tier.memory_size(), native->size());
+
+    // The repeated compilation keeps the published code.
+    tier.compile(analysis);
+    EXPECT_EQ(tier.code(), native);
+}
+
+TEST(jit_tier, background_compilation)
+{
+    const auto code = push(1) + push(2) + OP_ADD + ret_top();
+    analysis_cache cache;
+    analysis_pool pool{cache};
+    const auto analysis = cache.get(rev, code.data(), code.size(), ANALYSIS_JIT);
+    const auto inserted_size = cache.size();
+
+    ASSERT_TRUE(pool.submit_jit(analysis, 0));
+    pool.wait();
+    EXPECT_EQ(pool.get_stats().completed, 1);
+    if (!is_jit_available())
+    {
+        EXPECT_EQ(analysis->jit->code(), nullptr);
+        return;
+    }
+    ASSERT_NE(analysis->jit->code(), nullptr);
+
+    // The compiled code is charged to the cache by the following hit.
+    EXPECT_EQ(cache.get(rev, code.data(), code.size(), ANALYSIS_JIT), analysis);
+    EXPECT_EQ(cache.size(), inserted_size + analysis->jit->memory_size());
+}
+
+TEST(jit_tier, not_enabled)
+{
+    const auto code = bytecode{OP_STOP};
+    const auto analysis = analyze(rev, code.data(), code.size());
+    EXPECT_EQ(analysis.jit, nullptr);
+
+    const auto lazy = analyze(rev, code.data(), code.size(), ANALYSIS_LAZY | ANALYSIS_JIT);
+    EXPECT_EQ(lazy.jit, nullptr);
+}
@@ -0,0 +1,83 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmone/keccak.hpp>
+#include <gtest/gtest.h>
+#include <test/utils/utils.hpp>
+
+using namespace evmone;
+
+namespace
+{
+std::string hex(const bytes32& h)
+{
+    return ::hex({h.data(), h.size()});
+}
+
+/// The bytes 0x00, 0x01, 0x02, ...
+bytes make_input(size_t size)
+{
+    bytes input(size, 0);
+    for (size_t i = 0; i < size; ++i)
+        input[i] = static_cast<uint8_t>(i);
+    return input;
+}
+}  // namespace
+
+TEST(keccak, keccakf1600)
+{
+    uint64_t state[25]{};
+    keccakf1600(state);
+    EXPECT_EQ(state[0], 0xf1258f7940e1dde7);
+    EXPECT_EQ(state[24], 0xeaf1ff7b5ceca249);
+}
+
+TEST(keccak, keccak256)
+{
+    const uint8_t zeros[64]{};
+    EXPECT_EQ(hex(keccak256(nullptr, 0)),
+        "c5d2460186f7233c927e7db2dcc703c0e500b653ca82273b7bfad8045d85a470");
+    EXPECT_EQ(hex(keccak256(zeros, 32)),
+        "290decd9548b62a8d60345a988386fc84ba6bc95484008f6362f93160ef3e563");
+    EXPECT_EQ(hex(keccak256(zeros, 64)),
+        "ad3228b676f7d3cd4284a5443f17f1962b36e491b30a40b2405849e597ba5fb5");
+
+    const auto input = make_input(137);
+    EXPECT_EQ(hex(keccak256(input.data(), 32)),
+        "8ae1aa597fa146ebd3aa2ceddf360668dea5e526567e92b0321816a4e895bd2d");
+    EXPECT_EQ(hex(keccak256(input.data(), 64)),
+        "002030bde3d4cf89919649775cd71875c4d0ab1708a380e03fefc3a28aa24831");
+    EXPECT_EQ(hex(keccak256(input.data(), 65)),
+        "64578d7b8ae53c452c57b27375f3827854a7ead6448dc566d77a6673701f50d3");
+    EXPECT_EQ(hex(keccak256(input.data(), 136)),
+        "7ce759f1ab7f9ce437719970c26b0a66ff11fe3e38e17df89cf5d29c7d7f807e");
+    EXPECT_EQ(hex(keccak256(input.data(), 137)),
+        "ac73d4fae68b8453f764007c1a20ce95994187861f0c3227a3a8e99a73a3b1db");
+}
+
+TEST(keccak, memo)
+{
+    const auto input = make_input(200);
+    keccak_memo memo;
+    for (int repeat = 0; repeat < 3; ++repeat)
+    {
+        for (size_t offset = 0; offset < 100; ++offset)
+        {
+            for (const auto size : {size_t{0}, size_t{1}, size_t{32}, size_t{64}, size_t{100}})
+            {
+                EXPECT_EQ(memo.hash(&input[offset], size), keccak256(&input[offset], size))
+                    << offset << " " << size;
+            }
+        }
+    }
+
+    // The 32-byte input and the 64-byte one with the same prefix and zeros are different.
+    const uint8_t zeros[64]{};
+    EXPECT_EQ(hex(memo.hash(zeros, 32)), hex(keccak256(zeros, 32)));
+    EXPECT_EQ(hex(memo.hash(zeros, 64)), hex(keccak256(zeros, 64)));
+    EXPECT_EQ(hex(memo.hash(zeros, 32)), hex(keccak256(zeros, 32)));
+
+    memo.clear();
+    EXPECT_EQ(memo.hash(&input[7], 64), keccak256(&input[7], 64));
+}
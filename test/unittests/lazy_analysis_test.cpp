@@ -0,0 +1,126 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmone/lazy_analysis.hpp>
+#include <gtest/gtest.h>
+#include <test/utils/bytecode.hpp>
+#include <algorithm>
+#include <thread>
+
+using namespace evmone;
+
+constexpr auto rev = EVMC_ISTANBUL;
+
+TEST(lazy_analysis, nothing_analyzed_upfront)
+{
+    const auto code = push(9) + OP_JUMP + OP_JUMPDEST + push(1) + OP_POP + OP_STOP + OP_INVALID +
+                      OP_JUMPDEST + OP_STOP;
+    const auto analysis = analyze(rev, code.data(), code.size(), ANALYSIS_LAZY);
+    EXPECT_TRUE(analysis.instrs.empty());
+    EXPECT_TRUE(analysis.jumpdest_offsets.empty());
+    ASSERT_NE(analysis.lazy, nullptr);
+
+    auto& lazy = *analysis.lazy;
+    EXPECT_EQ(lazy.num_segments(), 0);
+    EXPECT_FALSE(lazy.is_analyzed(3));
+    EXPECT_FALSE(lazy.is_analyzed(9));
+}
+
+TEST(lazy_analysis, segments)
+{
+    const auto code = push(9) + OP_JUMP + OP_JUMPDEST + push(1) + OP_POP + OP_STOP + OP_INVALID +
+                      OP_JUMPDEST + OP_STOP;
+    const auto analysis = analyze(rev, code.data(), code.size(), ANALYSIS_LAZY);
+    auto& lazy = *analysis.lazy;
+
+    // The first segment ends with the JUMP: BEGINBLOCK, STATIC_JUMP.
+    const auto start = lazy.start();
+    ASSERT_NE(start, nullptr);
+    EXPECT_EQ(lazy.start(), start);
+    EXPECT_EQ(lazy.num_segments(), 1);
+    EXPECT_EQ(lazy.num_instructions(), 2);
+    EXPECT_FALSE(lazy.is_analyzed(3));
+    EXPECT_FALSE(lazy.is_analyzed(9));
+
+    const auto jumpdest = lazy.jumpdest(9);
+    ASSERT_NE(jumpdest, nullptr);
+    EXPECT_EQ(lazy.jumpdest(9), jumpdest);
+    EXPECT_TRUE(lazy.is_analyzed(9));
+    EXPECT_FALSE(lazy.is_analyzed(3));
+    EXPECT_EQ(lazy.num_segments(), 2);
+
+    // The invalid jump destinations.
+    EXPECT_EQ(lazy.jumpdest(0), nullptr);
+    EXPECT_EQ(lazy.jumpdest(4), nullptr);
+    EXPECT_EQ(lazy.jumpdest(code.size()), nullptr);
+    EXPECT_EQ(lazy.jumpdest(1000), nullptr);
+    EXPECT_EQ(lazy.num_segments(), 2);
+}
+
+TEST(lazy_analysis, continue_in_analyzed_segment)
+{
+    const auto code = OP_JUMPDEST + push(0) + OP_POP + OP_JUMPDEST + OP_STOP;
+    const auto analysis = analyze(rev, code.data(), code.size(), ANALYSIS_LAZY);
+    auto& lazy = *analysis.lazy;
+
+    // The segment: BEGINBLOCK, STOP.
+    ASSERT_NE(lazy.jumpdest(4), nullptr);
+    EXPECT_EQ(lazy.num_instructions(), 2);
+
+    // The segment: BEGINBLOCK, PUSH1, POP, continue at 4.
+    const auto start = lazy.start();
+    EXPECT_EQ(lazy.jumpdest(0), start);
+    EXPECT_EQ(lazy.num_segments(), 2);
+    EXPECT_EQ(lazy.num_instructions(), 6);
+}
+
+TEST(lazy_analysis, jumpdests_in_segment)
+{
+    // All JUMPDESTs are reachable from the start without jumps.
+    const auto code = OP_JUMPDEST + push(0) + OP_POP + OP_JUMPDEST + push(1) + OP_JUMPI +
+                      OP_JUMPDEST + OP_STOP;
+    const auto analysis = analyze(rev, code.data(), code.size(), ANALYSIS_LAZY);
+    auto& lazy = *analysis.lazy;
+
+    const auto start = lazy.start();
+    EXPECT_EQ(lazy.num_segments(), 1);
+    EXPECT_EQ(lazy.jumpdest(0), start);
+    EXPECT_TRUE(lazy.is_analyzed(4));
+    EXPECT_TRUE(lazy.is_analyzed(8));
+    EXPECT_NE(lazy.jumpdest(8), nullptr);
+    EXPECT_EQ(lazy.num_segments(), 1);
+}
+
+TEST(lazy_analysis, concurrent_entries)
+{
+    auto code = bytecode{};
+    for (int i = 0; i < 200; ++i)
+        code += OP_JUMPDEST + push(0) + OP_POP + OP_STOP;
+    const auto analysis = analyze(rev, code.data(), code.size(), ANALYSIS_LAZY);
+    auto& lazy = *analysis.lazy;
+
+    constexpr size_t num_threads = 4;
+    std::vector<std::vector<const instruction*>> results(num_threads);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&lazy, &code, &result = results[t], t] {
+            for (size_t i = 0; i < code.size(); i += 5)
+            {
+                // The threads go through the JUMPDESTs in different orders.
+                const auto offset = (t % 2 == 0) ? i : code.size() - 5 - i;
+                result.push_back(lazy.jumpdest(offset));
+            }
+            if (t % 2 != 0)
+                std::reverse(result.begin(), result.end());
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    EXPECT_EQ(lazy.num_segments(), 200);
+    for (const auto& r : results)
+        EXPECT_EQ(r, results[0]);
+    EXPECT_EQ(std::count(results[0].begin(), results[0].end(), nullptr), 0);
+}
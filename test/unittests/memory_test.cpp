@@ -0,0 +1,144 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmone/analysis.hpp>
+#include <evmone/memory_ops.hpp>
+#include <gtest/gtest.h>
+#include <algorithm>
+
+using namespace evmone;
+
+namespace
+{
+bool is_zero(evm_memory& m, size_t begin, size_t end)
+{
+    for (auto i = begin; i < end; ++i)
+    {
+        if (m[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+void fill(evm_memory& m, uint8_t value)
+{
+    for (size_t i = 0; i < m.size(); ++i)
+        m[i] = value;
+}
+}  // namespace
+
+TEST(memory, initial)
+{
+    evm_memory m;
+    EXPECT_EQ(m.size(), 0);
+}
+
+TEST(memory, grow)
+{
+    evm_memory m;
+    const auto reserved = m.is_reserved();
+
+    ASSERT_TRUE(m.resize(32));
+    EXPECT_EQ(m.size(), 32);
+    EXPECT_TRUE(is_zero(m, 0, 32));
+    fill(m, 0xfe);
+
+    ASSERT_TRUE(m.resize(1024 * 1024 + 32));
+    EXPECT_EQ(m.size(), 1024 * 1024 + 32);
+    EXPECT_EQ(m[31], 0xfe);
+    EXPECT_TRUE(is_zero(m, 32, m.size()));
+    EXPECT_EQ(m.is_reserved(), reserved);
+}
+
+TEST(memory, grow_beyond_reserved)
+{
+    evm_memory m;
+    ASSERT_TRUE(m.resize(64));
+    fill(m, 0xaa);
+
+    constexpr auto big_size = evm_memory::reserved_size + 4096;
+    ASSERT_TRUE(m.resize(big_size));
+    EXPECT_FALSE(m.is_reserved());
+    EXPECT_EQ(m[0], 0xaa);
+    EXPECT_EQ(m[63], 0xaa);
+    EXPECT_EQ(m[64], 0);
+    EXPECT_EQ(m[big_size - 1], 0);
+
+    m[big_size - 1] = 1;
+    m.clear();
+    EXPECT_EQ(m.size(), 0);
+
+    // The memory is zeroed after clear() in any mode.
+    ASSERT_TRUE(m.resize(128));
+    EXPECT_TRUE(is_zero(m, 0, 128));
+}
+
+TEST(memory, clear)
+{
+    for (const auto size : {size_t{32}, size_t{64 * 1024}, size_t{4 * 1024 * 1024}})
+    {
+        evm_memory m;
+        const auto reserved = m.is_reserved();
+        ASSERT_TRUE(m.resize(size));
+        fill(m, 0xff);
+        m.clear();
+        EXPECT_EQ(m.size(), 0);
+        EXPECT_EQ(m.is_reserved(), reserved);
+
+        // Grow more than before to also check the space beyond the previous size.
+        ASSERT_TRUE(m.resize(2 * size));
+        EXPECT_TRUE(is_zero(m, 0, 2 * size)) << size;
+    }
+}
+
+TEST(memory, copy_padded)
+{
+    uint8_t data[64];
+    for (size_t i = 0; i < sizeof(data); ++i)
+        data[i] = static_cast<uint8_t>(i + 1);
+
+    for (size_t size = 0; size <= 64; ++size)
+    {
+        for (size_t data_size = 0; data_size <= size; ++data_size)
+        {
+            uint8_t dirty[66];
+            std::fill(std::begin(dirty), std::end(dirty), 0xee);
+            copy_padded(&dirty[1], size, data, data_size, size);
+            EXPECT_EQ(dirty[0], 0xee);
+            EXPECT_TRUE(std::equal(data, data + data_size, &dirty[1]));
+            EXPECT_TRUE(std::all_of(&dirty[1 + data_size], &dirty[1 + size],
+                [](uint8_t x) { return x == 0; }));
+            EXPECT_EQ(dirty[1 + size], 0xee) << size << " " << data_size;
+        }
+    }
+
+    // The part beyond the dirty size is not filled.
+    uint8_t m[64];
+    std::fill(std::begin(m), std::end(m), 0xee);
+    copy_padded(m, 64, data, 8, 40);
+    EXPECT_EQ(m[7], 8);
+    EXPECT_EQ(m[8], 0);
+    EXPECT_EQ(m[39], 0);
+    EXPECT_EQ(m[40], 0xee);
+
+    EXPECT_EQ(dirty_size(32, 64), 32);
+    EXPECT_EQ(dirty_size(64, 64), 0);
+    EXPECT_EQ(dirty_size(96, 64), 0);
+}
+
+TEST(memory, load_store_word)
+{
+    uint8_t bytes[33];
+    for (size_t i = 0; i < sizeof(bytes); ++i)
+        bytes[i] = static_cast<uint8_t>(0xa0 + i);
+
+    // Unaligned.
+    const auto x = load_word(&bytes[1]);
+    EXPECT_EQ(x, intx::be::unsafe::load<intx::uint256>(&bytes[1]));
+
+    uint8_t out[33]{};
+    store_word(&out[1], x);
+    EXPECT_EQ(out[0], 0);
+    EXPECT_TRUE(std::equal(&bytes[1], &bytes[33], &out[1]));
+}
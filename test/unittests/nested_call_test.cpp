@@ -0,0 +1,194 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmc/mocked_host.hpp>
+#include <evmone/evmone.h>
+#include <evmone/nested_call.hpp>
+#include <gtest/gtest.h>
+#include <test/utils/bytecode.hpp>
+#include <vector>
+
+using namespace evmone;
+
+namespace
+{
+constexpr auto rev = EVMC_ISTANBUL;
+
+evmc::address make_address(uint8_t n) noexcept
+{
+    evmc::address address;
+    address.bytes[19] = n;
+    return address;
+}
+
+/// The host executing the code of its accounts with the VM.
+class executing_host : public evmc::MockedHost
+{
+public:
+    evmc::VM* vm = nullptr;
+    size_t num_host_calls = 0;
+
+    evmc::result call(const evmc_message& msg) noexcept override
+    {
+        ++num_host_calls;
+        const auto it = accounts.find(msg.destination);
+        if (it == accounts.end())
+            return evmc::result{EVMC_SUCCESS, msg.gas, nullptr, 0};
+        return vm->execute(*this, rev, msg, it->second.code.data(), it->second.code.size());
+    }
+};
+
+/// The host of the current test and the calls begun and ended by the nested call callbacks.
+executing_host* current_host = nullptr;
+std::vector<evmc_message> begun_calls;
+std::vector<evmc_status_code> ended_calls;
+
+bool begin_call(evmc_host_context* context, evmc_message* msg, const uint8_t** code,
+    size_t* code_size) noexcept
+{
+    EXPECT_EQ(context, current_host->to_context());
+    const auto it = current_host->accounts.find(msg->destination);
+    if (it == current_host->accounts.end())
+        return false;
+
+    begun_calls.push_back(*msg);
+    *code = it->second.code.data();
+    *code_size = it->second.code.size();
+    return true;
+}
+
+void end_call(evmc_host_context* context, const evmc_message*, evmc_result* result) noexcept
+{
+    EXPECT_EQ(context, current_host->to_context());
+    ended_calls.push_back(result->status_code);
+}
+
+constexpr nested_call_interface nested_calls{begin_call, end_call};
+
+/// Returns 7.
+const auto callee_c = bytecode{push(7) + ret_top()};
+
+/// Calls C and returns its output incremented.
+const auto callee_b = bytecode{call(0xcc).gas(0xffff).output(0, 0x20) + OP_POP + push(0) +
+                               OP_MLOAD + push(1) + OP_ADD + ret_top()};
+
+/// Calls B and then C, returns the outputs of both and the size of the return data of C.
+const auto caller_a =
+    bytecode{call(0xbb).gas(0xffffff).output(0, 0x20) + OP_POP +
+             call(0xcc).gas(0xffff).output(0x20, 0x20) + OP_POP + OP_RETURNDATASIZE + push(0x40) +
+             OP_MSTORE + ret(0, 0x60)};
+
+class nested_call : public testing::Test
+{
+protected:
+    evmc::VM vm{evmc_create_evmone()};
+    executing_host host;
+    evmc_message msg{};
+
+    void SetUp() override
+    {
+        host.vm = &vm;
+        host.accounts[make_address(0xbb)].code = callee_b;
+        host.accounts[make_address(0xcc)].code = callee_c;
+        msg.gas = 1000000;
+        current_host = &host;
+        begun_calls.clear();
+        ended_calls.clear();
+    }
+};
+}  // namespace
+
+TEST_F(nested_call, same_result_as_host_calls)
+{
+    const auto expected = vm.execute(host, rev, msg, caller_a.data(), caller_a.size());
+    ASSERT_EQ(expected.status_code, EVMC_SUCCESS);
+    ASSERT_EQ(expected.output_size, 0x60);
+    EXPECT_EQ(expected.output_data[0x1f], 8);
+    EXPECT_EQ(expected.output_data[0x3f], 7);
+    EXPECT_EQ(expected.output_data[0x5f], 0x20);
+    EXPECT_EQ(host.num_host_calls, 3);
+
+    set_host_nested_calls(vm.get_raw_pointer(), &executing_host::get_interface(), &nested_calls);
+    host.num_host_calls = 0;
+    const auto result = vm.execute(host, rev, msg, caller_a.data(), caller_a.size());
+    ASSERT_EQ(result.status_code, EVMC_SUCCESS);
+    EXPECT_EQ(result.gas_left, expected.gas_left);
+    EXPECT_EQ(bytes(result.output_data, result.output_size),
+        bytes(expected.output_data, expected.output_size));
+    EXPECT_EQ(host.num_host_calls, 0);
+
+    // B and then C in the depth 1 frame reused, C called by B in the depth 2.
+    ASSERT_EQ(begun_calls.size(), 3);
+    EXPECT_EQ(begun_calls[0].destination, make_address(0xbb));
+    EXPECT_EQ(begun_calls[0].depth, 1);
+    EXPECT_EQ(begun_calls[1].destination, make_address(0xcc));
+    EXPECT_EQ(begun_calls[1].depth, 2);
+    EXPECT_EQ(begun_calls[2].destination, make_address(0xcc));
+    EXPECT_EQ(begun_calls[2].depth, 1);
+    EXPECT_EQ(ended_calls, (std::vector<evmc_status_code>(3, EVMC_SUCCESS)));
+
+    // Disabled again.
+    set_host_nested_calls(vm.get_raw_pointer(), &executing_host::get_interface(), nullptr);
+    begun_calls.clear();
+    vm.execute(host, rev, msg, caller_a.data(), caller_a.size());
+    EXPECT_EQ(host.num_host_calls, 3);
+    EXPECT_TRUE(begun_calls.empty());
+}
+
+TEST_F(nested_call, declined_by_host)
+{
+    // The call of the account without the code is passed to the host.
+    const auto code = bytecode{call(0xdd).gas(0xffff) + ret_top()};
+    set_host_nested_calls(vm.get_raw_pointer(), &executing_host::get_interface(), &nested_calls);
+    const auto result = vm.execute(host, rev, msg, code.data(), code.size());
+    ASSERT_EQ(result.status_code, EVMC_SUCCESS);
+    ASSERT_EQ(result.output_size, 0x20);
+    EXPECT_EQ(result.output_data[0x1f], 1);
+    EXPECT_EQ(host.num_host_calls, 1);
+    EXPECT_TRUE(begun_calls.empty());
+    EXPECT_TRUE(ended_calls.empty());
+}
+
+TEST_F(nested_call, failure_and_other_host)
+{
+    // The failed callee has its result ended by the host.
+    host.accounts[make_address(0xcc)].code = bytecode{OP_INVALID};
+    set_host_nested_calls(vm.get_raw_pointer(), &executing_host::get_interface(), &nested_calls);
+    const auto code = bytecode{call(0xcc).gas(0xffff) + ret_top()};
+    const auto result = vm.execute(host, rev, msg, code.data(), code.size());
+    ASSERT_EQ(result.status_code, EVMC_SUCCESS);
+    EXPECT_EQ(result.output_data[0x1f], 0);
+    EXPECT_EQ(ended_calls, (std::vector<evmc_status_code>{EVMC_INVALID_INSTRUCTION}));
+
+    // Not used for the executions with other hosts.
+    const evmc_host_interface other_interface{};
+    set_host_nested_calls(vm.get_raw_pointer(), &other_interface, &nested_calls);
+    begun_calls.clear();
+    vm.execute(host, rev, msg, code.data(), code.size());
+    EXPECT_EQ(host.num_host_calls, 1);
+    EXPECT_TRUE(begun_calls.empty());
+}
+
+TEST_F(nested_call, deep_calls_repeated)
+{
+    // Calls itself with all the gas left and returns the depth reached below it plus 1.
+    const auto callee_d = bytecode{call(0xdd).gas(OP_GAS).output(0, 0x20) + OP_POP + push(0) +
+                                   OP_MLOAD + push(1) + OP_ADD + ret_top()};
+    host.accounts[make_address(0xdd)].code = callee_d;
+    set_host_nested_calls(vm.get_raw_pointer(), &executing_host::get_interface(), &nested_calls);
+
+    // The frames deeper than the retained ones are destroyed after the first execution.
+    const auto code = bytecode{call(0xdd).gas(OP_GAS).output(0, 0x20) + ret(0, 0x20)};
+    const auto first = vm.execute(host, rev, msg, code.data(), code.size());
+    ASSERT_EQ(first.status_code, EVMC_SUCCESS);
+    ASSERT_EQ(first.output_size, 0x20);
+    EXPECT_GT(first.output_data[0x1f] + (first.output_data[0x1e] << 8), 16);
+
+    const auto second = vm.execute(host, rev, msg, code.data(), code.size());
+    ASSERT_EQ(second.status_code, EVMC_SUCCESS);
+    EXPECT_EQ(second.gas_left, first.gas_left);
+    EXPECT_EQ(bytes(second.output_data, second.output_size),
+        bytes(first.output_data, first.output_size));
+    EXPECT_EQ(host.num_host_calls, 0);
+}
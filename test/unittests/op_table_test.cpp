@@ -15,7 +15,8 @@ TEST(op_table, compare_with_evmc_instruction_tables)
         const auto& evmone_tbl = evmone::get_op_table(rev);
         const auto* evmc_tbl = evmc_get_instruction_metrics_table(rev);
 
-        for (size_t i = 0; i < evmone_tbl.size(); ++i)
+        // Compare only the EVM opcodes, the evmone intrinsic opcodes are placed after them.
+        for (size_t i = 0; i < 256; ++i)
         {
             const auto& metrics = evmone_tbl[i];
             const auto& ref_metrics = evmc_tbl[i];
@@ -33,3 +34,22 @@ TEST(op_table, compare_with_evmc_instruction_tables)
         }
     }
 }
+
+TEST(op_table, revision_specialized_instructions)
+{
+    const auto& tangerine_whistle = evmone::get_op_table(EVMC_TANGERINE_WHISTLE);
+    const auto& spurious_dragon = evmone::get_op_table(EVMC_SPURIOUS_DRAGON);
+    const auto& constantinople = evmone::get_op_table(EVMC_CONSTANTINOPLE);
+    const auto& petersburg = evmone::get_op_table(EVMC_PETERSBURG);
+
+    // The instructions with the revision dependent semantics are instantiated per revision
+    // even if the revisions do not differ in the base gas costs.
+    EXPECT_NE(tangerine_whistle[OP_EXP].fn, spurious_dragon[OP_EXP].fn);
+    EXPECT_NE(tangerine_whistle[OP_CALL].fn, spurious_dragon[OP_CALL].fn);
+    EXPECT_NE(tangerine_whistle[OP_SELFDESTRUCT].fn, spurious_dragon[OP_SELFDESTRUCT].fn);
+    EXPECT_NE(constantinople[OP_SSTORE].fn, petersburg[OP_SSTORE].fn);
+
+    // The other instructions are shared by all revisions.
+    EXPECT_EQ(tangerine_whistle[OP_ADD].fn, petersburg[OP_ADD].fn);
+    EXPECT_EQ(spurious_dragon[OP_SLOAD].fn, constantinople[OP_SLOAD].fn);
+}
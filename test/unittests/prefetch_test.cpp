@@ -0,0 +1,230 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmc/mocked_host.hpp>
+#include <evmone/analysis.hpp>
+#include <evmone/evmone.h>
+#include <evmone/execution.hpp>
+#include <evmone/prefetch.hpp>
+#include <evmone/threaded.hpp>
+#include <gtest/gtest.h>
+#include <test/utils/bytecode.hpp>
+#include <vector>
+
+using namespace evmone;
+
+namespace
+{
+constexpr auto rev = EVMC_ISTANBUL;
+
+evmc::bytes32 make_key(uint8_t n) noexcept
+{
+    evmc::bytes32 key;
+    key.bytes[31] = n;
+    return key;
+}
+
+evmc::address make_address(uint8_t n) noexcept
+{
+    evmc::address address;
+    address.bytes[19] = n;
+    return address;
+}
+
+/// The calls of the prefetch callback.
+struct prefetch_call
+{
+    evmc_host_context* context;
+    evmc::address account;
+    std::vector<evmc::bytes32> keys;
+    std::vector<evmc::address> addresses;
+};
+
+std::vector<prefetch_call> prefetch_calls;
+
+void record_prefetch(evmc_host_context* context, const evmc_address* account,
+    const evmc_bytes32* keys, size_t num_keys, const evmc_address* addresses,
+    size_t num_addresses) noexcept
+{
+    prefetch_calls.push_back({context, *account, {keys, keys + num_keys},
+        {addresses, addresses + num_addresses}});
+}
+
+/// Loads the storage at keys 1, 2 (twice) and 3 (in the second block) and returns the sum.
+const auto sum_code = bytecode{sload(1) + sload(2) + OP_ADD + sload(2) + OP_ADD + OP_JUMPDEST +
+                               sload(3) + OP_ADD + ret_top()};
+}  // namespace
+
+TEST(prefetch, analysis)
+{
+    const auto address = make_address(0xaa);
+    const auto code = sload(1) + sload(1) + OP_CALLER + OP_SLOAD + sstore(2, 3) +
+                      push({address.bytes, sizeof(address)}) + OP_BALANCE +
+                      call(push(0xbb)).gas(OP_GAS) + call(push(0xcc)).gas(1) + OP_JUMPDEST +
+                      push(0xdd) + OP_EXTCODEHASH + push(4) + push(4) + OP_SSTORE;
+
+    const auto plain = analyze(rev, code.data(), code.size(), ANALYSIS_FUSION);
+    EXPECT_TRUE(plain.prefetch_blocks.empty());
+    EXPECT_TRUE(plain.prefetch_keys.empty());
+    EXPECT_TRUE(plain.prefetch_addresses.empty());
+
+    const auto analysis =
+        analyze(rev, code.data(), code.size(), ANALYSIS_FUSION | ANALYSIS_PREFETCH_HINTS);
+    ASSERT_EQ(analysis.prefetch_blocks.size(), 2);
+    EXPECT_EQ(std::vector<evmc::bytes32>(
+                  analysis.prefetch_keys.begin(), analysis.prefetch_keys.end()),
+        (std::vector<evmc::bytes32>{make_key(1), make_key(2), make_key(4)}));
+    EXPECT_EQ(std::vector<evmc::address>(
+                  analysis.prefetch_addresses.begin(), analysis.prefetch_addresses.end()),
+        (std::vector<evmc::address>{address, make_address(0xbb), make_address(0xdd)}));
+
+    const auto& first = analysis.prefetch_blocks[0];
+    EXPECT_EQ(first.block_index, 0);
+    EXPECT_EQ(first.keys_offset, 0);
+    EXPECT_EQ(first.num_keys, 2);
+    EXPECT_EQ(first.addresses_offset, 0);
+    EXPECT_EQ(first.num_addresses, 2);
+
+    const auto& second = analysis.prefetch_blocks[1];
+    EXPECT_EQ(second.keys_offset, 2);
+    EXPECT_EQ(second.num_keys, 1);
+    EXPECT_EQ(second.addresses_offset, 2);
+    EXPECT_EQ(second.num_addresses, 1);
+
+    // Only the BEGINBLOCKs of these blocks are replaced, the instructions are the same.
+    ASSERT_EQ(analysis.instrs.size(), plain.instrs.size());
+    const auto beginblock_fn = get_op_table(rev)[OPX_BEGINBLOCK].fn;
+    for (size_t i = 0; i < analysis.instrs.size(); ++i)
+    {
+        if (i == first.block_index || i == second.block_index)
+        {
+            EXPECT_EQ(plain.instrs[i].fn, beginblock_fn);
+            EXPECT_EQ(analysis.instrs[i].fn, opx_beginblock_prefetch);
+        }
+        else
+            EXPECT_EQ(analysis.instrs[i].fn, plain.instrs[i].fn);
+    }
+}
+
+TEST(prefetch, analysis_labels)
+{
+    const auto code = sload(1) + OP_JUMPDEST + OP_PC + OP_SLOAD;
+    const auto analysis =
+        analyze(rev, code.data(), code.size(), ANALYSIS_THREADED_CODE | ANALYSIS_PREFETCH_HINTS);
+    const auto dispatch_table = get_threaded_dispatch_table();
+    if (dispatch_table == nullptr)
+        return;
+
+    ASSERT_EQ(analysis.prefetch_blocks.size(), 1);
+    ASSERT_EQ(analysis.labels.size(), analysis.instrs.size());
+    EXPECT_EQ(analysis.labels[0], dispatch_table[op_table_size]);
+    EXPECT_EQ(analysis.labels[3], dispatch_table[OPX_BEGINBLOCK]);
+}
+
+TEST(prefetch, execution)
+{
+    const uint8_t contract = 0x0c;
+    evmc::MockedHost host;
+    auto& storage = host.accounts[make_address(contract)].storage;
+    storage[make_key(1)].value = make_key(1);
+    storage[make_key(2)].value = make_key(2);
+    storage[make_key(3)].value = make_key(4);
+
+    evmc_message msg{};
+    msg.gas = 10000;
+    msg.destination = make_address(contract);
+
+    for (const auto dispatch : {"call", "threaded"})
+    {
+        for (const auto fusion : {"off", "on"})
+        {
+            auto vm = evmc::VM{evmc_create_evmone()};
+            ASSERT_EQ(vm.set_option("dispatch", dispatch), EVMC_SET_OPTION_SUCCESS);
+            ASSERT_EQ(vm.set_option("fusion", fusion), EVMC_SET_OPTION_SUCCESS);
+
+            // No calls for the host not registered.
+            prefetch_calls.clear();
+            const auto expected = vm.execute(host, rev, msg, sum_code.data(), sum_code.size());
+            ASSERT_EQ(expected.status_code, EVMC_SUCCESS);
+            ASSERT_EQ(expected.output_size, 32);
+            EXPECT_EQ(expected.output_data[31], 9);
+            EXPECT_TRUE(prefetch_calls.empty());
+
+            set_host_prefetch(
+                vm.get_raw_pointer(), &evmc::MockedHost::get_interface(), record_prefetch);
+            const auto result = vm.execute(host, rev, msg, sum_code.data(), sum_code.size());
+            ASSERT_EQ(result.status_code, EVMC_SUCCESS);
+            EXPECT_EQ(result.gas_left, expected.gas_left);
+            ASSERT_EQ(result.output_size, 32);
+            EXPECT_EQ(result.output_data[31], 9);
+
+            ASSERT_EQ(prefetch_calls.size(), 2) << dispatch << " " << fusion;
+            EXPECT_EQ(prefetch_calls[0].context, host.to_context());
+            EXPECT_EQ(prefetch_calls[0].account, make_address(contract));
+            EXPECT_EQ(prefetch_calls[0].keys,
+                (std::vector<evmc::bytes32>{make_key(1), make_key(2)}));
+            EXPECT_TRUE(prefetch_calls[0].addresses.empty());
+            EXPECT_EQ(prefetch_calls[1].keys, (std::vector<evmc::bytes32>{make_key(3)}));
+
+            // Disabled again.
+            set_host_prefetch(vm.get_raw_pointer(), &evmc::MockedHost::get_interface(), nullptr);
+            prefetch_calls.clear();
+            vm.execute(host, rev, msg, sum_code.data(), sum_code.size());
+            EXPECT_TRUE(prefetch_calls.empty());
+        }
+    }
+}
+
+TEST(prefetch, execution_other_host)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    const evmc_host_interface other_interface{};
+    set_host_prefetch(vm.get_raw_pointer(), &other_interface, record_prefetch);
+
+    evmc::MockedHost host;
+    evmc_message msg{};
+    msg.gas = 10000;
+    prefetch_calls.clear();
+    const auto result = vm.execute(host, rev, msg, sum_code.data(), sum_code.size());
+    EXPECT_EQ(result.status_code, EVMC_SUCCESS);
+    EXPECT_TRUE(prefetch_calls.empty());
+}
+
+TEST(prefetch, execution_out_of_gas)
+{
+    // The hints of the block are not passed if the block cannot be executed.
+    auto vm = evmc::VM{evmc_create_evmone()};
+    set_host_prefetch(vm.get_raw_pointer(), &evmc::MockedHost::get_interface(), record_prefetch);
+
+    evmc::MockedHost host;
+    evmc_message msg{};
+    msg.gas = 2500;
+    prefetch_calls.clear();
+    const auto result = vm.execute(host, rev, msg, sum_code.data(), sum_code.size());
+    EXPECT_EQ(result.status_code, EVMC_OUT_OF_GAS);
+    ASSERT_EQ(prefetch_calls.size(), 1);
+    EXPECT_EQ(prefetch_calls[0].keys.size(), 2);
+}
+
+TEST(prefetch, execute_batch)
+{
+    constexpr size_t count = 4;
+    evmc::MockedHost host;
+    const std::vector<batch_host> hosts(
+        count, {&evmc::MockedHost::get_interface(), host.to_context()});
+    evmc_message msg{};
+    msg.gas = 10000;
+    const std::vector<evmc_message> msgs(count, msg);
+
+    auto vm = evmc::VM{evmc_create_evmone()};
+    set_host_prefetch(vm.get_raw_pointer(), &evmc::MockedHost::get_interface(), record_prefetch);
+
+    prefetch_calls.clear();
+    std::vector<evmc_result> results(count);
+    execute_batch(vm.get_raw_pointer(), rev, sum_code.data(), sum_code.size(), msgs.data(),
+        hosts.data(), results.data(), count);
+    for (auto& result : results)
+        EXPECT_EQ(evmc::result{result}.status_code, EVMC_SUCCESS);
+    EXPECT_EQ(prefetch_calls.size(), count * 2);
+}
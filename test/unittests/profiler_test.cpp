@@ -0,0 +1,180 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmc/mocked_host.hpp>
+#include <evmone/analysis_cache.hpp>
+#include <evmone/evmone.h>
+#include <evmone/profiler.hpp>
+#include <evmone/vm.hpp>
+#include <gtest/gtest.h>
+#include <test/utils/bytecode.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+using namespace evmone;
+
+namespace
+{
+constexpr auto rev = EVMC_ISTANBUL;
+
+/// The loop summing numbers 1..10. The blocks start at the offsets 0, 4 and 17.
+const auto loop_code = bytecode{push(0) + push(10) + OP_JUMPDEST + OP_DUP1 + OP_SWAP2 + OP_ADD +
+                                OP_SWAP1 + push(1) + OP_SWAP1 + OP_SUB + OP_DUP1 + push(4) +
+                                OP_JUMPI + ret_top()};
+
+size_t count_beginblocks(const code_analysis& analysis)
+{
+    const auto beginblock_fn = get_op_table(rev)[OPX_BEGINBLOCK].fn;
+    return static_cast<size_t>(std::count_if(analysis.instrs.begin(), analysis.instrs.end(),
+        [beginblock_fn](const instruction& instr) { return instr.fn == beginblock_fn; }));
+}
+}  // namespace
+
+TEST(profiler, opcode_name)
+{
+    EXPECT_EQ(opcode_name(OP_ADD), "ADD");
+    EXPECT_EQ(opcode_name(OP_PUSH32), "PUSH32");
+    EXPECT_EQ(opcode_name(OPX_BEGINBLOCK), "BEGINBLOCK");
+    EXPECT_EQ(opcode_name(OPX_STATIC_JUMP), "STATIC_JUMP");
+    EXPECT_EQ(opcode_name(OPX_ISZERO_STATIC_JUMPI), "ISZERO_STATIC_JUMPI");
+    EXPECT_EQ(opcode_name(0x0c), "UNDEFINED");
+    EXPECT_EQ(opcode_name(-1), "UNDEFINED");
+}
+
+TEST(profiler, find_block_offsets)
+{
+    EXPECT_EQ(find_block_offsets(loop_code.data(), loop_code.size()),
+        (std::vector<int32_t>{0, 4, 17, static_cast<int32_t>(loop_code.size())}));
+    EXPECT_EQ(find_block_offsets(nullptr, 0), (std::vector<int32_t>{0}));
+
+    // The number of blocks must match the analysis, also for random code.
+    std::mt19937_64 rng{3};
+    std::uniform_int_distribution<int> byte_dist{0, 255};
+    for (const auto size : {1, 2, 10, 100, 1000, 10000})
+    {
+        auto code = bytes(size_t(size), 0);
+        for (auto& b : code)
+            b = static_cast<uint8_t>(byte_dist(rng));
+
+        for (const auto flags : {0u, uint32_t{ANALYSIS_FUSION}})
+        {
+            const auto analysis = analyze(rev, code.data(), code.size(), flags);
+            EXPECT_EQ(find_block_offsets(code.data(), code.size()).size(),
+                count_beginblocks(analysis))
+                << size;
+        }
+    }
+}
+
+TEST(profiler, add)
+{
+    const auto analysis = analyze(rev, loop_code.data(), loop_code.size(), 0);
+    std::vector<profile_counters> counters(analysis.instrs.size());
+    for (size_t i = 0; i < counters.size(); ++i)
+        counters[i] = {i, 10 * i, static_cast<int64_t>(100 * i)};
+
+    profiler p;
+    p.add(rev, loop_code.data(), loop_code.size(), analysis, counters.data());
+    p.add(rev, loop_code.data(), loop_code.size(), analysis, counters.data());
+
+    // The BEGINBLOCKs are the instructions 0, 3, 13 and 19.
+    const auto opcodes = p.opcodes();
+    ASSERT_EQ(opcodes.count(OPX_BEGINBLOCK), 1);
+    EXPECT_EQ(opcodes.at(OPX_BEGINBLOCK).executions, 2 * (0 + 3 + 13 + 19));
+    ASSERT_EQ(opcodes.count(OP_ADD), 1);
+    EXPECT_EQ(opcodes.at(OP_ADD).executions, 2 * 6);
+    EXPECT_EQ(opcodes.at(OP_ADD).cycles, 2 * 60);
+    EXPECT_EQ(opcodes.at(OP_ADD).gas, 2 * 600);
+
+    const auto hash = hash_code(loop_code.data(), loop_code.size());
+    const auto blocks = p.blocks();
+    ASSERT_EQ(blocks.size(), 4);
+    EXPECT_EQ(blocks.begin()->first.code_hash, hash);
+    EXPECT_EQ(blocks.begin()->first.offset, 0);
+    EXPECT_EQ(blocks.at({hash, 0}).executions, 0);
+    EXPECT_EQ(blocks.at({hash, 4}).executions, 2 * 3);
+    EXPECT_EQ(blocks.at({hash, 17}).executions, 2 * 13);
+
+    p.reset();
+    EXPECT_TRUE(p.opcodes().empty());
+    EXPECT_TRUE(p.blocks().empty());
+}
+
+TEST(profiler, export)
+{
+    const auto code = bytecode{push(1) + push(2) + OP_ADD + OP_STOP};
+    const auto analysis = analyze(rev, code.data(), code.size(), 0);
+    ASSERT_EQ(analysis.instrs.size(), 7);
+    const std::vector<profile_counters> counters{
+        {1, 10, 3}, {1, 20, 0}, {1, 30, 0}, {1, 40, 0}, {1, 50, 0}, {0, 0, 0}, {0, 0, 0}};
+
+    profiler p;
+    EXPECT_EQ(p.to_json(), "{\n  \"opcodes\": [\n  ],\n  \"blocks\": [\n  ]\n}\n");
+    EXPECT_EQ(p.to_folded(), "");
+
+    p.add(rev, code.data(), code.size(), analysis, counters.data());
+    const auto hash = hash_code(code.data(), code.size());
+    char hash_hex[17];
+    std::snprintf(hash_hex, sizeof(hash_hex), "%016llx", static_cast<unsigned long long>(hash));
+    const auto code_hash = std::string{hash_hex};
+
+    EXPECT_EQ(p.to_json(),
+        "{\n"
+        "  \"opcodes\": [\n"
+        "    {\"opcode\": \"STOP\", \"executions\": 1, \"cycles\": 50, \"gas\": 0},\n"
+        "    {\"opcode\": \"ADD\", \"executions\": 1, \"cycles\": 40, \"gas\": 0},\n"
+        "    {\"opcode\": \"BEGINBLOCK\", \"executions\": 1, \"cycles\": 10, \"gas\": 3},\n"
+        "    {\"opcode\": \"PUSH1\", \"executions\": 2, \"cycles\": 50, \"gas\": 0}\n"
+        "  ],\n"
+        "  \"blocks\": [\n"
+        "    {\"code_hash\": \"" +
+            code_hash +
+            "\", \"offset\": 0, \"executions\": 1, \"cycles\": 150, \"gas\": 3}\n"
+            "  ]\n"
+            "}\n");
+
+    EXPECT_EQ(p.to_folded(), "code_" + code_hash + ";block_0;STOP 50\n" + "code_" + code_hash +
+                                 ";block_0;ADD 40\n" + "code_" + code_hash +
+                                 ";block_0;BEGINBLOCK 10\n" + "code_" + code_hash +
+                                 ";block_0;PUSH1 50\n");
+}
+
+#if EVMONE_PROFILING
+TEST(profiler, execution)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    auto& profile = static_cast<VM*>(vm.get_raw_pointer())->profile;
+
+    evmc::MockedHost host;
+    evmc_message msg{};
+    msg.gas = 100000;
+    const auto r = vm.execute(host, rev, msg, loop_code.data(), loop_code.size());
+    ASSERT_EQ(r.status_code, EVMC_SUCCESS);
+
+    const auto hash = hash_code(loop_code.data(), loop_code.size());
+    const auto blocks = profile.blocks();
+    EXPECT_EQ(blocks.at({hash, 0}).executions, 1);
+    EXPECT_EQ(blocks.at({hash, 4}).executions, 10);
+    EXPECT_EQ(blocks.at({hash, 17}).executions, 1);
+
+    // All the gas used is reported.
+    int64_t total_gas = 0;
+    for (const auto& [block, c] : blocks)
+        total_gas += c.gas;
+    EXPECT_EQ(total_gas, msg.gas - r.gas_left);
+
+    const auto opcodes = profile.opcodes();
+    EXPECT_EQ(opcodes.at(OPX_BEGINBLOCK).executions, 12);
+    EXPECT_EQ(opcodes.at(OP_RETURN).executions, 1);
+
+    const auto path = testing::TempDir() + "evmone_profile.json";
+    EXPECT_EQ(vm.set_option("profile_json", path.c_str()), EVMC_SET_OPTION_SUCCESS);
+    EXPECT_EQ(vm.set_option("profile_folded", path.c_str()), EVMC_SET_OPTION_SUCCESS);
+    std::remove(path.c_str());
+    EXPECT_EQ(vm.set_option("profile_json", ""), EVMC_SET_OPTION_INVALID_VALUE);
+    EXPECT_EQ(vm.set_option("profile_folded", "/nonexistent/dir/profile.txt"),
+        EVMC_SET_OPTION_INVALID_VALUE);
+}
+#endif
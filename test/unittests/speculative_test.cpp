@@ -0,0 +1,366 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmc/mocked_host.hpp>
+#include <evmone/evmone.h>
+#include <evmone/speculative.hpp>
+#include <gtest/gtest.h>
+#include <test/utils/bytecode.hpp>
+#include <iterator>
+#include <mutex>
+
+using namespace evmone;
+
+namespace
+{
+constexpr auto rev = EVMC_ISTANBUL;
+
+evmc::bytes32 make_key(uint8_t n) noexcept
+{
+    evmc::bytes32 key;
+    key.bytes[31] = n;
+    return key;
+}
+
+evmc::address make_address(uint8_t n) noexcept
+{
+    evmc::address address;
+    address.bytes[19] = n;
+    return address;
+}
+
+state_location storage(uint8_t account, uint8_t key) noexcept
+{
+    return {make_address(account), make_key(key), location_kind::storage};
+}
+
+state_location balance(uint8_t account) noexcept
+{
+    return {make_address(account), {}, location_kind::balance};
+}
+
+evmc_message make_message(uint8_t destination) noexcept
+{
+    evmc_message msg{};
+    msg.gas = 1000000;
+    msg.sender = make_address(0x5e);
+    msg.destination = make_address(destination);
+    return msg;
+}
+
+/// Increments the storage at the key 0.
+const auto counter_code = bytecode{sstore(0, add(sload(0), 1))};
+
+/// The MockedHost allowing the concurrent reads.
+class locked_host : public evmc::Host
+{
+    mutable std::mutex m_mutex;
+
+public:
+    evmc::MockedHost host;
+
+    bool account_exists(const evmc::address& addr) const noexcept override
+    {
+        std::lock_guard lock{m_mutex};
+        return host.account_exists(addr);
+    }
+
+    evmc::bytes32 get_storage(
+        const evmc::address& addr, const evmc::bytes32& key) const noexcept override
+    {
+        std::lock_guard lock{m_mutex};
+        return host.get_storage(addr, key);
+    }
+
+    evmc_storage_status set_storage(const evmc::address& addr, const evmc::bytes32& key,
+        const evmc::bytes32& value) noexcept override
+    {
+        std::lock_guard lock{m_mutex};
+        return host.set_storage(addr, key, value);
+    }
+
+    evmc::uint256be get_balance(const evmc::address& addr) const noexcept override
+    {
+        std::lock_guard lock{m_mutex};
+        return host.get_balance(addr);
+    }
+
+    size_t get_code_size(const evmc::address& addr) const noexcept override
+    {
+        std::lock_guard lock{m_mutex};
+        return host.get_code_size(addr);
+    }
+
+    evmc::bytes32 get_code_hash(const evmc::address& addr) const noexcept override
+    {
+        std::lock_guard lock{m_mutex};
+        return host.get_code_hash(addr);
+    }
+
+    size_t copy_code(const evmc::address& addr, size_t code_offset, uint8_t* buffer_data,
+        size_t buffer_size) const noexcept override
+    {
+        std::lock_guard lock{m_mutex};
+        return host.copy_code(addr, code_offset, buffer_data, buffer_size);
+    }
+
+    void selfdestruct(const evmc::address& addr, const evmc::address& beneficiary) noexcept override
+    {
+        std::lock_guard lock{m_mutex};
+        host.selfdestruct(addr, beneficiary);
+    }
+
+    evmc::result call(const evmc_message& msg) noexcept override
+    {
+        std::lock_guard lock{m_mutex};
+        return host.call(msg);
+    }
+
+    evmc_tx_context get_tx_context() const noexcept override
+    {
+        std::lock_guard lock{m_mutex};
+        return host.get_tx_context();
+    }
+
+    evmc::bytes32 get_block_hash(int64_t block_number) const noexcept override
+    {
+        std::lock_guard lock{m_mutex};
+        return host.get_block_hash(block_number);
+    }
+
+    void emit_log(const evmc::address& addr, const uint8_t* data, size_t data_size,
+        const evmc::bytes32 topics[], size_t num_topics) noexcept override
+    {
+        std::lock_guard lock{m_mutex};
+        host.emit_log(addr, data, data_size, topics, num_topics);
+    }
+};
+}  // namespace
+
+TEST(speculative, mv_memory)
+{
+    mv_memory memory{4};
+    const auto location = storage(0x0c, 1);
+    version ver;
+    evmc::bytes32 value;
+    EXPECT_FALSE(memory.read(location, 5, ver, value));
+
+    memory.write(location, {1, 1}, make_key(10));
+    memory.write(location, {3, 2}, make_key(30));
+    EXPECT_FALSE(memory.read(location, 0, ver, value));
+    EXPECT_FALSE(memory.read(location, 1, ver, value));
+    ASSERT_TRUE(memory.read(location, 3, ver, value));
+    EXPECT_EQ(ver, (version{1, 1}));
+    EXPECT_EQ(value, make_key(10));
+    ASSERT_TRUE(memory.read(location, 4, ver, value));
+    EXPECT_EQ(ver, (version{3, 2}));
+    EXPECT_EQ(value, make_key(30));
+
+    memory.erase(location, 3);
+    ASSERT_TRUE(memory.read(location, 4, ver, value));
+    EXPECT_EQ(ver, (version{1, 1}));
+    EXPECT_FALSE(memory.read(storage(0x0c, 2), 4, ver, value));
+}
+
+TEST(speculative, reads_and_writes)
+{
+    evmc::MockedHost host;
+    auto& storage_0c = host.accounts[make_address(0x0c)].storage;
+    storage_0c[make_key(1)].value = make_key(10);
+    storage_0c[make_key(2)].value = make_key(20);
+    const auto code = sstore(1, add(sload(1), 1)) + sload(2) + OP_POP + sload(1) + OP_POP;
+    host.accounts[make_address(0x0c)].code = {code.data(), code.size()};
+
+    auto vm = evmc::VM{evmc_create_evmone()};
+    mv_memory memory;
+    speculative_host tx{
+        vm.get_raw_pointer(), rev, evmc::MockedHost::get_interface(), host.to_context(), memory, 1};
+    const auto result = tx.execute(make_message(0x0c));
+    EXPECT_EQ(result.status_code, EVMC_SUCCESS);
+    EXPECT_EQ(tx.incarnation(), 1);
+    EXPECT_FALSE(tx.is_unsupported());
+
+    // The reads are recorded with the values at the transaction start.
+    EXPECT_EQ(tx.reads().size(), 3);  // Including the selfdestruct marker.
+    ASSERT_EQ(tx.reads().count(storage(0x0c, 1)), 1);
+    EXPECT_EQ(tx.reads().at(storage(0x0c, 1)).value, make_key(10));
+    EXPECT_EQ(tx.reads().at(storage(0x0c, 1)).ver, version{});
+    EXPECT_EQ(tx.reads().at(storage(0x0c, 2)).value, make_key(20));
+
+    // The writes are buffered.
+    ASSERT_EQ(tx.writes().size(), 1);
+    EXPECT_EQ(tx.writes().at(storage(0x0c, 1)), make_key(11));
+    EXPECT_EQ(storage_0c[make_key(1)].value, make_key(10));
+
+    tx.publish();
+    version ver;
+    evmc::bytes32 value;
+    EXPECT_FALSE(memory.read(storage(0x0c, 1), 1, ver, value));
+    ASSERT_TRUE(memory.read(storage(0x0c, 1), 2, ver, value));
+    EXPECT_EQ(ver, (version{1, 1}));
+    EXPECT_EQ(value, make_key(11));
+
+    // The write of the preceding transaction invalidates the read.
+    EXPECT_TRUE(tx.validate());
+    memory.write(storage(0x0c, 2), {0, 1}, make_key(21));
+    EXPECT_FALSE(tx.validate());
+
+    // The re-execution reads the new value.
+    tx.execute(make_message(0x0c));
+    EXPECT_EQ(tx.incarnation(), 2);
+    EXPECT_EQ(tx.reads().at(storage(0x0c, 2)).value, make_key(21));
+    EXPECT_EQ(tx.reads().at(storage(0x0c, 2)).ver, (version{0, 1}));
+    EXPECT_TRUE(tx.validate());
+}
+
+TEST(speculative, storage_status)
+{
+    evmc::MockedHost host;
+    host.accounts[make_address(0x0c)].storage[make_key(2)].value = make_key(5);
+    mv_memory memory;
+    speculative_host tx{
+        nullptr, rev, evmc::MockedHost::get_interface(), host.to_context(), memory, 0};
+
+    const auto addr = make_address(0x0c);
+    EXPECT_EQ(tx.set_storage(addr, make_key(1), make_key(1)), EVMC_STORAGE_ADDED);
+    EXPECT_EQ(tx.set_storage(addr, make_key(1), make_key(2)), EVMC_STORAGE_MODIFIED_AGAIN);
+    EXPECT_EQ(tx.set_storage(addr, make_key(1), make_key(2)), EVMC_STORAGE_UNCHANGED);
+    EXPECT_EQ(tx.set_storage(addr, make_key(2), make_key(5)), EVMC_STORAGE_UNCHANGED);
+    EXPECT_EQ(tx.set_storage(addr, make_key(2), {}), EVMC_STORAGE_DELETED);
+    EXPECT_EQ(tx.set_storage(addr, make_key(3), {}), EVMC_STORAGE_UNCHANGED);
+    EXPECT_EQ(tx.get_storage(addr, make_key(1)), make_key(2));
+    EXPECT_EQ(host.accounts[addr].storage.count(make_key(1)), 0);
+}
+
+TEST(speculative, nested_calls)
+{
+    evmc::MockedHost host;
+    host.accounts[make_address(0x0a)].set_balance(100);
+
+    // The 0x0b stores and reverts, 0x0d stores to the storage of the caller.
+    const auto code_a = sstore(1, 1) + call(0x0b).gas(50000).value(10) + OP_POP +
+                        call(0x0c).gas(50000).value(20) + OP_POP +
+                        delegatecall(0x0d).gas(50000) + OP_POP;
+    const auto code_b = sstore(1, 2) + push(0) + push(0) + OP_REVERT;
+    const auto code_d = sstore(2, OP_CALLER);
+    host.accounts[make_address(0x0a)].code = {code_a.data(), code_a.size()};
+    host.accounts[make_address(0x0b)].code = {code_b.data(), code_b.size()};
+    host.accounts[make_address(0x0d)].code = {code_d.data(), code_d.size()};
+
+    auto vm = evmc::VM{evmc_create_evmone()};
+    mv_memory memory;
+    speculative_host tx{
+        vm.get_raw_pointer(), rev, evmc::MockedHost::get_interface(), host.to_context(), memory, 0};
+    const auto result = tx.execute(make_message(0x0a));
+    EXPECT_EQ(result.status_code, EVMC_SUCCESS);
+
+    const std::map<state_location, evmc::bytes32> expected{
+        {storage(0x0a, 1), make_key(1)},
+        {storage(0x0a, 2), make_key(0x5e)},
+        {balance(0x0a), make_key(80)},
+        {balance(0x0c), make_key(20)},
+    };
+    EXPECT_EQ(tx.writes(), expected);
+    EXPECT_TRUE(host.recorded_calls.empty());
+}
+
+TEST(speculative, logs_and_selfdestruct)
+{
+    evmc::MockedHost host;
+    host.accounts[make_address(0x0a)].set_balance(7);
+    const auto code_a = mstore(0, 0xff) + push(0xaa) + push(32) + push(0) + OP_LOG1 + push(0xbb) +
+                        OP_SELFDESTRUCT;
+    host.accounts[make_address(0x0a)].code = {code_a.data(), code_a.size()};
+
+    // Reads the code size of the selfdestructed account and the beneficiary balance.
+    const auto code_c = sstore(1, bytecode{push(0x0a)} + OP_EXTCODESIZE) +
+                        sstore(2, bytecode{push(0xbb)} + OP_BALANCE);
+    host.accounts[make_address(0x0c)].code = {code_c.data(), code_c.size()};
+
+    auto vm = evmc::VM{evmc_create_evmone()};
+    const evmc_message msgs[]{make_message(0x0a), make_message(0x0c)};
+    const auto execution = execute_parallel(vm.get_raw_pointer(), rev,
+        evmc::MockedHost::get_interface(), host.to_context(), msgs, std::size(msgs));
+    ASSERT_EQ(execution.num_completed, 2);
+
+    const auto& tx_a = *execution.transactions[0];
+    ASSERT_EQ(tx_a.logs().size(), 1);
+    EXPECT_EQ(tx_a.logs()[0].address, make_address(0x0a));
+    EXPECT_EQ(tx_a.logs()[0].data.size(), 32);
+    EXPECT_EQ(tx_a.logs()[0].data[31], 0xff);
+    EXPECT_EQ(tx_a.logs()[0].topics, (std::vector<evmc::bytes32>{make_key(0xaa)}));
+    ASSERT_EQ(tx_a.selfdestructs().size(), 1);
+    EXPECT_EQ(tx_a.selfdestructs()[0].beneficiary, make_address(0xbb));
+    EXPECT_EQ(tx_a.writes().at(balance(0x0a)), evmc::bytes32{});
+    EXPECT_EQ(tx_a.writes().at(balance(0xbb)), make_key(7));
+    EXPECT_TRUE(host.recorded_logs.empty());
+    EXPECT_TRUE(host.recorded_selfdestructs.empty());
+
+    const auto& tx_c = *execution.transactions[1];
+    EXPECT_EQ(tx_c.writes().count(storage(0x0c, 1)), 0);
+    EXPECT_EQ(tx_c.writes().at(storage(0x0c, 2)), make_key(7));
+}
+
+TEST(speculative, execute_parallel)
+{
+    constexpr size_t count = 32;
+    locked_host base;
+    base.host.accounts[make_address(0x0c)].code = {counter_code.data(), counter_code.size()};
+    base.host.accounts[make_address(0x0c)].storage[make_key(0)].value = make_key(100);
+
+    // The odd transactions increment the shared counter, the even ones their own.
+    std::vector<evmc_message> msgs;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto own = static_cast<uint8_t>(0x10 + i);
+        base.host.accounts[make_address(own)].code = {counter_code.data(), counter_code.size()};
+        msgs.push_back(make_message(i % 2 == 1 ? 0x0c : own));
+    }
+
+    auto vm = evmc::VM{evmc_create_evmone()};
+    for (const auto num_threads : {size_t{1}, size_t{4}})
+    {
+        const auto execution = execute_parallel(vm.get_raw_pointer(), rev, base.get_interface(),
+            base.to_context(), msgs.data(), count, num_threads);
+        ASSERT_EQ(execution.num_completed, count);
+        EXPECT_GE(execution.num_executions, count);
+        if (num_threads == 1)
+            EXPECT_EQ(execution.num_executions, count);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const auto& tx = *execution.transactions[i];
+            EXPECT_EQ(execution.results[i].status_code, EVMC_SUCCESS);
+            ASSERT_EQ(tx.writes().size(), 1);
+            const auto& [location, value] = *tx.writes().begin();
+            EXPECT_EQ(location.address, msgs[i].destination);
+            const auto expected = i % 2 == 1 ? 100 + (i + 1) / 2 : 1;
+            EXPECT_EQ(value, make_key(static_cast<uint8_t>(expected))) << i;
+        }
+    }
+    EXPECT_EQ(base.host.accounts[make_address(0x0c)].storage[make_key(0)].value, make_key(100));
+}
+
+TEST(speculative, execute_parallel_unsupported)
+{
+    evmc::MockedHost host;
+    const auto create_code = push(0) + push(0) + push(0) + OP_CREATE;
+    host.accounts[make_address(0x0c)].code = {counter_code.data(), counter_code.size()};
+    host.accounts[make_address(0x0d)].code = {create_code.data(), create_code.size()};
+
+    auto vm = evmc::VM{evmc_create_evmone()};
+    const evmc_message msgs[]{make_message(0x0c), make_message(0x0d), make_message(0x0c)};
+    const auto execution = execute_parallel(vm.get_raw_pointer(), rev,
+        evmc::MockedHost::get_interface(), host.to_context(), msgs, std::size(msgs));
+    EXPECT_EQ(execution.num_completed, 1);
+    EXPECT_FALSE(execution.transactions[0]->is_unsupported());
+    EXPECT_TRUE(execution.transactions[1]->is_unsupported());
+
+    // The precompiles.
+    const evmc_message precompile_msgs[]{make_message(0x01)};
+    EXPECT_EQ(execute_parallel(vm.get_raw_pointer(), rev, evmc::MockedHost::get_interface(),
+                  host.to_context(), precompile_msgs, 1)
+                  .num_completed,
+        0);
+}
@@ -0,0 +1,281 @@
+// evmone: Fast Ethereum Virtual Machine implementation
+// Copyright 2020 The evmone Authors.
+// Licensed under the Apache License, Version 2.0.
+
+#include <evmc/mocked_host.hpp>
+#include <evmone/analysis.hpp>
+#include <evmone/evmone.h>
+#include <evmone/execution.hpp>
+#include <evmone/tracing.hpp>
+#include <gtest/gtest.h>
+#include <test/utils/bytecode.hpp>
+#include <cstring>
+#include <vector>
+
+using namespace evmone;
+
+namespace
+{
+constexpr auto rev = EVMC_ISTANBUL;
+
+/// The loop summing numbers 1..10.
+const auto loop_code = bytecode{push(0) + push(10) + OP_JUMPDEST + OP_DUP1 + OP_SWAP2 + OP_ADD +
+                                OP_SWAP1 + push(1) + OP_SWAP1 + OP_SUB + OP_DUP1 + push(4) +
+                                OP_JUMPI + ret_top()};
+
+std::vector<trace_step> decode_steps(const uint8_t* data, size_t size)
+{
+    std::vector<trace_step> steps;
+    for (size_t pos = 0; pos < size;)
+    {
+        auto& step = steps.emplace_back();
+        std::memcpy(&step, &data[pos], sizeof(step));
+        pos += sizeof(step) + size_t{step.num_stack_items} * 32;
+    }
+    return steps;
+}
+
+void append_to_vector(void* context, const uint8_t* data, size_t size) noexcept
+{
+    auto& v = *static_cast<std::vector<uint8_t>*>(context);
+    v.insert(v.end(), data, data + size);
+}
+
+struct traced_execution
+{
+    evmc::result result;
+    std::string json;
+    std::vector<trace_step> steps;
+};
+
+traced_execution execute_traced(const bytes& code, int64_t gas = 100)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    uint8_t buffer[4096];
+    std::vector<uint8_t> trace;
+    tracer t{buffer, sizeof(buffer), append_to_vector, &trace};
+    set_tracer(vm.get_raw_pointer(), &t);
+
+    evmc::MockedHost host;
+    evmc_message msg{};
+    msg.gas = gas;
+    auto result = vm.execute(host, rev, msg, code.data(), code.size());
+    t.flush();
+    return {std::move(result), format_trace_json(trace.data(), trace.size()),
+        decode_steps(trace.data(), trace.size())};
+}
+}  // namespace
+
+TEST(tracing, analysis_code_offsets)
+{
+    const auto code = push(1) + push(2) + OP_ADD + OP_JUMPDEST + push(7) + OP_JUMP + OP_JUMPDEST;
+    EXPECT_TRUE(analyze(rev, code.data(), code.size(), 0).code_offsets.empty());
+
+    const auto analysis = analyze(rev, code.data(), code.size(), ANALYSIS_CODE_OFFSETS);
+    ASSERT_EQ(analysis.code_offsets.size(), analysis.instrs.size());
+
+    // The static jump replaces the PUSH and keeps its offset.
+    EXPECT_EQ(std::vector<int32_t>(analysis.code_offsets.begin(), analysis.code_offsets.end()),
+        (std::vector<int32_t>{0, 0, 2, 4, 5, 6, 9, 10}));
+
+    const auto fused =
+        analyze(rev, code.data(), code.size(), ANALYSIS_FUSION | ANALYSIS_CODE_OFFSETS);
+    ASSERT_EQ(fused.code_offsets.size(), fused.instrs.size());
+    EXPECT_EQ(fused.code_offsets[1], 0);
+    EXPECT_EQ(fused.code_offsets[fused.code_offsets.size() - 1], static_cast<int32_t>(code.size()));
+}
+
+TEST(tracing, tracer_buffer)
+{
+    evm_stack stack;
+    stack.push(1);
+    stack.push(2);
+
+    // The buffer fits 2 records with 2 stack items.
+    uint8_t buffer[2 * (sizeof(trace_step) + 2 * 32)];
+    tracer t{buffer, sizeof(buffer), nullptr, nullptr, 2};
+    const auto id0 = t.step(0, OP_ADD, 1, 100, 3, 0, stack);
+    const auto id1 = t.step(1, OP_ADD, 1, 97, 3, 0, stack);
+    t.step(2, OP_ADD, 1, 94, 3, 0, stack);
+    EXPECT_EQ(t.num_steps(), 2);
+    EXPECT_EQ(t.num_dropped(), 1);
+    EXPECT_EQ(t.size(), sizeof(buffer));
+
+    t.set_gas_cost(id1, 10);
+    const auto steps = decode_steps(t.data(), t.size());
+    ASSERT_EQ(steps.size(), 2);
+    EXPECT_EQ(steps[0].gas_cost, 3);
+    EXPECT_EQ(steps[1].gas_cost, 10);
+    EXPECT_EQ(steps[1].pc, 1);
+    EXPECT_EQ(steps[1].stack_size, 2);
+    EXPECT_EQ(steps[1].num_stack_items, 2);
+
+    // With the flush function, the records are flushed and the buffer is reused.
+    std::vector<uint8_t> flushed;
+    tracer ft{buffer, sizeof(buffer), append_to_vector, &flushed, 1};
+    for (uint32_t pc = 0; pc < 10; ++pc)
+        ft.step(pc, OP_ADD, 1, 100, 3, 0, stack);
+    ft.set_gas_cost(id0, 7);  // Already flushed.
+    ft.flush();
+    EXPECT_EQ(ft.size(), 0);
+    EXPECT_EQ(ft.num_steps(), 10);
+    EXPECT_EQ(ft.num_dropped(), 0);
+    const auto flushed_steps = decode_steps(flushed.data(), flushed.size());
+    ASSERT_EQ(flushed_steps.size(), 10);
+    for (uint32_t pc = 0; pc < 10; ++pc)
+    {
+        EXPECT_EQ(flushed_steps[pc].pc, pc);
+        EXPECT_EQ(flushed_steps[pc].gas_cost, 3);
+        EXPECT_EQ(flushed_steps[pc].num_stack_items, 1);
+    }
+
+    // The record not fitting the buffer at all is dropped.
+    uint8_t small_buffer[sizeof(trace_step)];
+    tracer st{small_buffer, sizeof(small_buffer), append_to_vector, &flushed, 1};
+    st.step(0, OP_ADD, 1, 100, 3, 0, stack);
+    EXPECT_EQ(st.num_dropped(), 1);
+}
+
+TEST(tracing, format_trace_json)
+{
+    evm_stack stack;
+    stack.push(1);
+    stack.push(intx::uint256{0xff} << 128);
+
+    uint8_t buffer[1024];
+    tracer t{buffer, sizeof(buffer)};
+    t.step(7, OP_ADD, 2, 0x64, 3, 32, stack);
+    t.step(8, OP_STOP, 2, 0x61, 0, 32, stack);
+    const auto json = format_trace_json(t.data(), t.size());
+    EXPECT_EQ(json,
+        "{\"pc\":7,\"op\":1,\"gas\":\"0x64\",\"gasCost\":\"0x3\",\"memSize\":32,"
+        "\"stack\":[\"0x1\",\"0xff00000000000000000000000000000000\"],\"depth\":2,"
+        "\"opName\":\"ADD\"}\n"
+        "{\"pc\":8,\"op\":0,\"gas\":\"0x61\",\"gasCost\":\"0x0\",\"memSize\":32,"
+        "\"stack\":[\"0x1\",\"0xff00000000000000000000000000000000\"],\"depth\":2,"
+        "\"opName\":\"STOP\"}\n");
+
+    // The incomplete record is ignored.
+    EXPECT_EQ(format_trace_json(t.data(), t.size() - 1), json.substr(0, json.find('\n') + 1));
+    EXPECT_EQ(format_trace_json(nullptr, 0), "");
+}
+
+TEST(tracing, execution)
+{
+    const auto r = execute_traced(push(1) + push(2) + OP_ADD);
+    EXPECT_EQ(r.result.status_code, EVMC_SUCCESS);
+    EXPECT_EQ(r.json,
+        "{\"pc\":0,\"op\":96,\"gas\":\"0x64\",\"gasCost\":\"0x3\",\"memSize\":0,"
+        "\"stack\":[],\"depth\":1,\"opName\":\"PUSH1\"}\n"
+        "{\"pc\":2,\"op\":96,\"gas\":\"0x61\",\"gasCost\":\"0x3\",\"memSize\":0,"
+        "\"stack\":[\"0x1\"],\"depth\":1,\"opName\":\"PUSH1\"}\n"
+        "{\"pc\":4,\"op\":1,\"gas\":\"0x5e\",\"gasCost\":\"0x3\",\"memSize\":0,"
+        "\"stack\":[\"0x1\",\"0x2\"],\"depth\":1,\"opName\":\"ADD\"}\n"
+        "{\"pc\":5,\"op\":0,\"gas\":\"0x5b\",\"gasCost\":\"0x0\",\"memSize\":0,"
+        "\"stack\":[\"0x3\"],\"depth\":1,\"opName\":\"STOP\"}\n");
+}
+
+TEST(tracing, execution_static_jump)
+{
+    // The static jump is reported as the PUSH and the JUMP with the destination on the stack.
+    const auto r = execute_traced(push(4) + OP_JUMP + OP_INVALID + OP_JUMPDEST + OP_STOP);
+    EXPECT_EQ(r.result.status_code, EVMC_SUCCESS);
+    EXPECT_EQ(r.json,
+        "{\"pc\":0,\"op\":96,\"gas\":\"0x64\",\"gasCost\":\"0x3\",\"memSize\":0,"
+        "\"stack\":[],\"depth\":1,\"opName\":\"PUSH1\"}\n"
+        "{\"pc\":2,\"op\":86,\"gas\":\"0x61\",\"gasCost\":\"0x8\",\"memSize\":0,"
+        "\"stack\":[\"0x4\"],\"depth\":1,\"opName\":\"JUMP\"}\n"
+        "{\"pc\":4,\"op\":91,\"gas\":\"0x59\",\"gasCost\":\"0x1\",\"memSize\":0,"
+        "\"stack\":[],\"depth\":1,\"opName\":\"JUMPDEST\"}\n"
+        "{\"pc\":5,\"op\":0,\"gas\":\"0x58\",\"gasCost\":\"0x0\",\"memSize\":0,"
+        "\"stack\":[],\"depth\":1,\"opName\":\"STOP\"}\n");
+}
+
+TEST(tracing, execution_memory)
+{
+    const auto r = execute_traced(push(1) + push(0) + OP_MSTORE8 + OP_MSIZE);
+    EXPECT_EQ(r.result.status_code, EVMC_SUCCESS);
+    ASSERT_EQ(r.steps.size(), 5);
+    EXPECT_EQ(r.steps[2].opcode, OP_MSTORE8);
+    EXPECT_EQ(r.steps[2].gas_cost, 3 + 3);
+    EXPECT_EQ(r.steps[2].memory_size, 0);
+    EXPECT_EQ(r.steps[3].opcode, OP_MSIZE);
+    EXPECT_EQ(r.steps[3].memory_size, 32);
+}
+
+TEST(tracing, execution_same_result)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    evmc::MockedHost host;
+    evmc_message msg{};
+    msg.gas = 100000;
+    const auto expected = vm.execute(host, rev, msg, loop_code.data(), loop_code.size());
+    ASSERT_EQ(expected.status_code, EVMC_SUCCESS);
+
+    const auto r = execute_traced(loop_code, msg.gas);
+    EXPECT_EQ(r.result.status_code, expected.status_code);
+    EXPECT_EQ(r.result.gas_left, expected.gas_left);
+    EXPECT_EQ(bytes_view(r.result.output_data, r.result.output_size),
+        bytes_view(expected.output_data, expected.output_size));
+
+    // 2 PUSHes, 10 loop iterations of 11 instructions and 5 instructions in the return.
+    ASSERT_EQ(r.steps.size(), 2 + 10 * 11 + 5);
+    EXPECT_EQ(r.steps.front().gas, msg.gas);
+    EXPECT_EQ(r.steps.back().opcode, OP_RETURN);
+    EXPECT_EQ(r.steps.back().gas - r.steps.back().gas_cost, expected.gas_left);
+
+    // The gas left before each step is the gas left before the previous one minus its cost.
+    for (size_t i = 1; i < r.steps.size(); ++i)
+        EXPECT_EQ(r.steps[i].gas, r.steps[i - 1].gas - r.steps[i - 1].gas_cost) << i;
+}
+
+TEST(tracing, execution_out_of_gas)
+{
+    // The block of the loop body fails the gas check, its steps are not reported.
+    const auto r = execute_traced(loop_code, 30);
+    EXPECT_EQ(r.result.status_code, EVMC_OUT_OF_GAS);
+    EXPECT_EQ(r.result.gas_left, 0);
+    ASSERT_FALSE(r.steps.empty());
+    EXPECT_EQ(r.steps.front().pc, 0);
+}
+
+TEST(tracing, detach)
+{
+    auto vm = evmc::VM{evmc_create_evmone()};
+    uint8_t buffer[4096];
+    tracer t{buffer, sizeof(buffer)};
+    set_tracer(vm.get_raw_pointer(), &t);
+    set_tracer(vm.get_raw_pointer(), nullptr);
+
+    evmc::MockedHost host;
+    evmc_message msg{};
+    msg.gas = 100000;
+    const auto r = vm.execute(host, rev, msg, loop_code.data(), loop_code.size());
+    EXPECT_EQ(r.status_code, EVMC_SUCCESS);
+    EXPECT_EQ(t.num_steps(), 0);
+}
+
+TEST(tracing, execute_batch)
+{
+    const auto code = push(1) + push(2) + OP_ADD;
+    constexpr size_t count = 10;
+    evmc::MockedHost host;
+    const std::vector<batch_host> hosts(
+        count, {&evmc::MockedHost::get_interface(), host.to_context()});
+    evmc_message msg{};
+    msg.gas = 100;
+    const std::vector<evmc_message> msgs(count, msg);
+
+    auto vm = evmc::VM{evmc_create_evmone()};
+    uint8_t buffer[4096];
+    tracer t{buffer, sizeof(buffer)};
+    set_tracer(vm.get_raw_pointer(), &t);
+
+    // The traced batch is executed by single thread.
+    std::vector<evmc_result> results(count);
+    execute_batch(vm.get_raw_pointer(), rev, code.data(), code.size(), msgs.data(), hosts.data(),
+        results.data(), count, 4);
+    for (auto& result : results)
+        EXPECT_EQ(evmc::result{result}.status_code, EVMC_SUCCESS);
+    EXPECT_EQ(t.num_steps(), count * 4);
+}
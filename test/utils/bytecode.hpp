@@ -6,6 +6,7 @@
 #include <evmc/instructions.h>
 #include <test/utils/utils.hpp>
 #include <algorithm>
+#include <stdexcept>
 
 struct bytecode;
 